@@ -1,42 +1,246 @@
 #pragma once
 
-#include <utility>
 #include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#include <cstdint>
+#include <new>
+#include <stdexcept>
+#include <vector>
+#include <cassert>
 #include <set>
 #include <map>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <list>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <bitset>
 
-template<typename T_Key>
-class KeyInternal;
+/**
+ * Optional hot-path instrumentation.
+ *
+ * Compile with SUFFIX_TREE_INSTRUMENTATION defined to count the inner steps of put and search
+ * and to record their latencies. Without it, every macro below expands to nothing.
+ *
+ * Counters are kept per thread, see suffix_tree_counters().
+ */
 
-template<typename T_Key, typename T_Mapped>
-class SuffixEdge;
+#ifdef SUFFIX_TREE_INSTRUMENTATION
 
-template<typename T_Key, typename T_Mapped>
-class SuffixNode;
+#include <chrono>
+#include <cstdint>
+#include <ostream>
 
-template<typename T_String, typename T_Mapped>
-class SuffixTree;
+/**
+ * Latency histogram with power-of-two nanosecond buckets: bucket i holds samples in [2^i, 2^(i+1)).
+ */
+class SuffixTreeLatencyHistogram {
+public:
+    static constexpr int bucket_count = 48;
+
+private:
+    std::uint64_t buckets_[bucket_count] = {};
+    std::uint64_t count_ = 0;
+    std::uint64_t total_ns_ = 0;
+    std::uint64_t max_ns_ = 0;
+
+public:
+    void record(std::uint64_t ns) {
+        int bucket = 0;
+        for (auto v = ns; v > 1 && bucket < bucket_count - 1; v >>= 1) bucket++;
+
+        buckets_[bucket]++;
+        count_++;
+        total_ns_ += ns;
+        if (ns > max_ns_) max_ns_ = ns;
+    }
+
+    std::uint64_t count() const { return count_; }
+
+    std::uint64_t total_ns() const { return total_ns_; }
+
+    std::uint64_t max_ns() const { return max_ns_; }
+
+    double mean_ns() const { return count_ ? (double) total_ns_ / (double) count_ : 0; }
+
+    /**
+     * Returns the upper bound of the bucket containing the p-th percentile (0 <= p <= 100).
+     */
+    std::uint64_t percentile_ns(double p) const {
+        if (!count_) return 0;
+
+        auto rank = (std::uint64_t) ((double) count_ * p / 100.0);
+        if (rank >= count_) rank = count_ - 1;
+
+        std::uint64_t seen = 0;
+        for (int i = 0; i < bucket_count; i++) {
+            seen += buckets_[i];
+            if (seen > rank) return std::uint64_t(1) << (i + 1);
+        }
+        return max_ns_;
+    }
+
+    void reset() { *this = SuffixTreeLatencyHistogram(); }
+
+    void print(std::ostream &os) const {
+        os << "count=" << count_ << " mean=" << mean_ns() << "ns p50<=" << percentile_ns(50)
+           << "ns p99<=" << percentile_ns(99) << "ns max=" << max_ns_ << "ns";
+    }
+};
+
+struct SuffixTreeCounters {
+    /// Edges skipped by canonize
+    std::uint64_t canonize_iterations = 0;
+    /// Outcomes of one extension step of put: suffix already present, edge split, new leaf under a node
+    std::uint64_t extension_found = 0;
+    std::uint64_t extension_split = 0;
+    std::uint64_t extension_new_leaf = 0;
+    /// Leading key elements of put already in the tree, read in one descent instead of by extension steps
+    std::uint64_t contained_prefix_elements = 0;
+    /// Implicit suffixes given the value at the end of put, walking the suffix chain
+    std::uint64_t suffix_chain_steps = 0;
+    /// Child lookups, and how many of them found no edge
+    std::uint64_t get_edge_lookups = 0;
+    std::uint64_t get_edge_misses = 0;
+    /// Label elements compared by search_node
+    std::uint64_t search_label_compares = 0;
+    /// Searches answered by the q-gram table, see enable_short_queries
+    std::uint64_t short_query_hits = 0;
+
+    SuffixTreeLatencyHistogram put_latency;
+    SuffixTreeLatencyHistogram search_latency;
+
+    void reset() { *this = SuffixTreeCounters(); }
+
+    void print(std::ostream &os) const {
+        os << "canonize_iterations " << canonize_iterations << '\n'
+           << "extension_found " << extension_found << '\n'
+           << "extension_split " << extension_split << '\n'
+           << "extension_new_leaf " << extension_new_leaf << '\n'
+           << "contained_prefix_elements " << contained_prefix_elements << '\n'
+           << "suffix_chain_steps " << suffix_chain_steps << '\n'
+           << "get_edge_lookups " << get_edge_lookups << '\n'
+           << "get_edge_misses " << get_edge_misses << '\n'
+           << "search_label_compares " << search_label_compares << '\n'
+           << "short_query_hits " << short_query_hits << '\n'
+           << "put_latency ";
+        put_latency.print(os);
+        os << "\nsearch_latency ";
+        search_latency.print(os);
+        os << '\n';
+    }
+};
+
+/**
+ * Counters of the calling thread.
+ */
+inline SuffixTreeCounters &suffix_tree_counters() {
+    static thread_local SuffixTreeCounters counters;
+    return counters;
+}
+
+/**
+ * Records the lifetime of the enclosing scope into a histogram.
+ */
+class SuffixTreeScopedTimer {
+    using clock = std::chrono::steady_clock;
+
+    SuffixTreeLatencyHistogram &histogram_;
+    clock::time_point start_;
+
+public:
+    explicit SuffixTreeScopedTimer(SuffixTreeLatencyHistogram &histogram)
+            : histogram_(histogram), start_(clock::now()) {}
+
+    SuffixTreeScopedTimer(const SuffixTreeScopedTimer &) = delete;
+
+    SuffixTreeScopedTimer &operator=(const SuffixTreeScopedTimer &) = delete;
+
+    ~SuffixTreeScopedTimer() {
+        histogram_.record((std::uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+                clock::now() - start_).count());
+    }
+};
+
+#define SUFFIX_TREE_COUNT(field) (++suffix_tree_counters().field)
+#define SUFFIX_TREE_COUNT_N(field, n) (suffix_tree_counters().field += (n))
+#define SUFFIX_TREE_TIMED_SCOPE(histogram) \
+    SuffixTreeScopedTimer suffix_tree_scoped_timer_(suffix_tree_counters().histogram)
+
+#else
+
+#define SUFFIX_TREE_COUNT(field) ((void) 0)
+#define SUFFIX_TREE_COUNT_N(field, n) ((void) 0)
+#define SUFFIX_TREE_TIMED_SCOPE(histogram) ((void) 0)
+
+#endif
+
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
+#if __cplusplus >= 202002L && defined(__has_include)
+#if __has_include(<span>)
+#include <span>
+#endif
+#endif
+
+/**
+ * Whether T_Key is a view over elements stored elsewhere, rather than a container owning them.
+ * A view is cheap to copy and owns nothing, so SuffixTree::put stores it as is even when given a temporary.
+ *
+ * Specialize it for other view types.
+ */
+template<typename T_Key>
+struct is_key_view : std::false_type {};
+
+#if __cplusplus >= 201703L
+template<typename T_Char, typename T_Traits>
+struct is_key_view<std::basic_string_view<T_Char, T_Traits>> : std::true_type {};
+#endif
+#if defined(__cpp_lib_span)
+template<typename T_Element, std::size_t Extent>
+struct is_key_view<std::span<T_Element, Extent>> : std::true_type {};
+#endif
 
+/**
+ * A range of a key, as a pair of iterators.
+ *
+ * T_Key only has to be iterable with std::begin and std::end, so that besides containers, views such as
+ * std::string_view and std::span can be used as keys.
+ */
 template<typename T_Key>
 class KeyInternal {
+public:
+    using const_iterator = decltype(std::begin(std::declval<const T_Key &>()));
+    using value_type = typename std::iterator_traits<const_iterator>::value_type;
+    using size_type = std::size_t;
+
 private:
     /// Start and end (1 past last position) of a substring
-    using const_iterator = typename T_Key::const_iterator;
-
     const_iterator begin_;
     const_iterator end_;
+    /// Number of elements in [begin_, end_), cached so that no operation has to walk the range to measure it
+    size_type size_ = 0;
 
 public:
-    using value_type = typename T_Key::value_type;
-    using size_type = typename T_Key::size_type;
-
     KeyInternal() = default;
 
     KeyInternal(const T_Key &key)
-            : begin_(std::begin(key)), end_(std::end(key)) {}
+            : begin_(std::begin(key)), end_(std::end(key)), size_(std::distance(begin_, end_)) {}
 
     KeyInternal(const const_iterator &begin, const const_iterator &end)
-            : begin_(begin), end_(end) {}
+            : begin_(begin), end_(end), size_(std::distance(begin, end)) {}
+
+    KeyInternal(const const_iterator &begin, const const_iterator &end, size_type size)
+            : begin_(begin), end_(end), size_(size) {}
 
     KeyInternal(const KeyInternal &src) = default;
 
@@ -58,579 +262,4283 @@ public:
 
     inline const_iterator end() const { return end_; }
 
-    inline const_iterator iter_at(int idx) const { return std::next(this->begin(), idx); }
+    inline const_iterator iter_at(size_type idx) const { return std::next(this->begin(), idx); }
 
-    inline value_type at(int idx) const { return *std::next(this->begin(), idx); }
+    inline value_type at(size_type idx) const { return *std::next(this->begin(), idx); }
 
     [[nodiscard]] inline size_type size(size_type from_idx = 0) const {
-        const auto begin = std::next(this->begin(), from_idx);
-        const auto end = this->end();
-        auto size = std::distance(begin, end);
-
-        return size < 0 ? 0 : size;
+        return from_idx < size_ ? size_ - from_idx : 0;
     }
 
     [[nodiscard]] inline bool empty() const {
-        return std::distance(this->begin(), this->end()) <= 0;
+        return size_ == 0;
     }
 
     inline KeyInternal substr(size_type from_idx) const {
-        const auto start_used = std::next(this->begin(), from_idx);
-        const auto key_end = this->end();
-        auto result = KeyInternal(std::distance(start_used, key_end) > 0 ? start_used : key_end,
-                                  key_end);
+        if (from_idx >= size_)
+            return KeyInternal(end_, end_, 0);
 
-        return result;
+        return KeyInternal(std::next(this->begin(), from_idx), end_, size_ - from_idx);
     }
 
     inline KeyInternal substr(size_type from_idx, size_type len) const {
-        const auto start_used = std::next(this->begin(), from_idx);
-        const auto end_used = std::next(start_used, len);
-        const auto key_end = this->end();
-        auto result = KeyInternal(std::distance(start_used, key_end) > 0 ? start_used : key_end,
-                                  std::distance(end_used, key_end) > 0 ? end_used : key_end);
+        if (from_idx >= size_)
+            return KeyInternal(end_, end_, 0);
+        if (len >= size_ - from_idx)
+            return substr(from_idx);
 
-        return result;
+        const auto start_used = std::next(this->begin(), from_idx);
+        return KeyInternal(start_used, std::next(start_used, len), len);
     }
 
     bool has_prefix(const KeyInternal &prefix, size_type str_begin_idx = 0, size_type prefix_begin_idx = 0) const {
-        if (this->size() < prefix.size()) return false;
+        if (this->size(str_begin_idx) < prefix.size(prefix_begin_idx)) return false;
 
-        const auto prefix_begin = std::next(prefix.begin(), prefix_begin_idx);
         const auto prefix_end = prefix.end();
 
-        auto pit = prefix_begin;
-        {
-            for (auto it = std::next(this->begin(), str_begin_idx);
-                 it != this->end() && pit != prefix_end; it++, pit++) {
-                auto e = *it;
-                auto pe = *pit;
-                if (e < pe || pe < e) break;
-            }
+        auto pit = std::next(prefix.begin(), prefix_begin_idx);
+        for (auto it = std::next(this->begin(), str_begin_idx); pit != prefix_end; it++, pit++) {
+            auto &e = *it;
+            auto &pe = *pit;
+            if (e < pe || pe < e) break;
         }
 
         return pit == prefix_end;
     }
 
     [[nodiscard]] T_Key debug(size_type pos = 0) const {
-        const auto key_start = std::next(this->begin(), pos);
-        const auto key_end = this->end();
-        if (std::distance(key_start, key_end) <= 0) {
+        if (pos >= size_) {
             return {};
         }
 
-        return T_Key(key_start, key_end);
+        return T_Key(std::next(this->begin(), pos), this->end());
     }
 };
 
-template<typename T_Key>
-static KeyInternal<T_Key> safe_cut_last_char(const KeyInternal<T_Key> &s) {
-    if (s.empty())
-        return s;
-    return s.substr(0, s.size() - 1);
-}
+/**
+ * Handle of an element of an Arena, its index.
+ *
+ * 32 bits hold trees of up to 4 billion nodes at half the size of a pointer; define
+ * SUFFIX_TREE_64BIT_HANDLES before including the tree to lift that limit.
+ */
+#ifdef SUFFIX_TREE_64BIT_HANDLES
+using ArenaHandle = std::uint64_t;
+#else
+using ArenaHandle = std::uint32_t;
+#endif
 
-template<typename T_Key, typename T_Mapped>
-class SuffixEdge {
+/// Handle of no element
+constexpr ArenaHandle null_handle = ArenaHandle(-1);
+
+/**
+ * Storage for the nodes of a tree, which refer to each other by handle instead of by pointer.
+ *
+ * Elements are allocated in chunks of a thousand instead of one by one, and never move: references to them
+ * stay valid as more are added. Handles are positions, not addresses, so they also stay valid when the contents
+ * of two arenas are swapped.
+ */
+template<typename T>
+class Arena {
 public:
-    using key_type = T_Key;
-    using mapped_type = T_Mapped;
+    using handle_type = ArenaHandle;
+    using size_type = std::size_t;
 
 private:
-    using node_type = SuffixNode<key_type, mapped_type>;
+    enum : size_type { chunk_bits = 10, chunk_size = size_type(1) << chunk_bits };
 
-    node_type *dest_ = nullptr;
+    std::vector<T *> chunks_;
+    size_type size_ = 0;
 
 public:
-    key_type label;
+    Arena() = default;
+
+    Arena(const Arena &) = delete;
+
+    Arena &operator=(const Arena &) = delete;
+
+    ~Arena() { clear(); }
 
-    SuffixEdge() = default;
+    /**
+     * Constructs an element from <tt>args</tt> at the end of the arena and returns its handle.
+     * Throws std::length_error if every handle is taken (see SUFFIX_TREE_64BIT_HANDLES).
+     */
+    template<typename... Args>
+    handle_type emplace_back(Args &&... args) {
+        if (size_ >= (size_type) null_handle)
+            throw std::length_error("Arena: out of handles, define SUFFIX_TREE_64BIT_HANDLES");
+        if (size_ == capacity())
+            chunks_.push_back(static_cast<T *>(::operator new(chunk_size * sizeof(T))));
+
+        new(chunks_[size_ >> chunk_bits] + (size_ & (chunk_size - 1))) T(std::forward<Args>(args)...);
+        return (handle_type) size_++;
+    }
+
+    T &operator[](handle_type handle) { return chunks_[handle >> chunk_bits][handle & (chunk_size - 1)]; }
+
+    const T &operator[](handle_type handle) const { return chunks_[handle >> chunk_bits][handle & (chunk_size - 1)]; }
+
+    size_type size() const { return size_; }
+
+    /**
+     * Number of elements the arena holds without allocating.
+     */
+    size_type capacity() const { return chunks_.size() * chunk_size; }
+
+    /**
+     * Allocates storage for at least <tt>count</tt> elements up front.
+     * Throws std::length_error if there are fewer handles than that (see SUFFIX_TREE_64BIT_HANDLES).
+     */
+    void reserve(size_type count) {
+        if (count > (size_type) null_handle)
+            throw std::length_error("Arena: out of handles, define SUFFIX_TREE_64BIT_HANDLES");
+        chunks_.reserve((count + chunk_size - 1) >> chunk_bits);
+        while (capacity() < count)
+            chunks_.push_back(static_cast<T *>(::operator new(chunk_size * sizeof(T))));
+    }
 
-    SuffixEdge(const key_type label, node_type *dest) : label{label}, dest_{dest} {}
+    /**
+     * Destroys all the elements but keeps their storage for the next ones.
+     */
+    void reset() {
+        for (size_type i = 0; i < size_; i++) (*this)[(handle_type) i].~T();
+        size_ = 0;
+    }
 
-    void set_dest(node_type *node) { dest_ = node; }
+    /**
+     * Destroys all the elements and frees their storage.
+     */
+    void clear() {
+        reset();
+        for (auto chunk: chunks_) ::operator delete(chunk);
+        chunks_.clear();
+    }
 
-    node_type const *dest() const { return dest_; }
+    void swap(Arena &other) {
+        chunks_.swap(other.chunks_);
+        std::swap(size_, other.size_);
+    }
 
-    node_type *dest() { return dest_; }
+    size_type memory_bytes() const { return chunks_.size() * chunk_size * sizeof(T) + chunks_.capacity() * sizeof(T *); }
 };
 
-template<typename T_Key, typename T_Mapped>
-class SuffixNode {
-    template<typename T1, typename T2> friend
-    class SuffixTree;
+/**
+ * Sets of values held by the nodes of a SuffixTree, chosen with its T_ValueSetPolicy parameter.
+ *
+ * A policy is a struct with a member alias template <tt>set_type<T></tt>. The set type must be default
+ * constructible and provide:
+ * - <tt>bool insert(const T &)</tt>, returning whether the value was not in the set yet;
+ * - <tt>insert(first, last)</tt>, adding a range of values in increasing order;
+ * - <tt>begin()</tt>, <tt>end()</tt>, iterating over the values in increasing order;
+ * - <tt>size()</tt> and <tt>empty()</tt>.
+ */
 
+/**
+ * std::set with the value set interface.
+ */
+template<typename T>
+class StdValueSet : public std::set<T> {
 public:
-    using key_type = T_Key;
-    using mapped_type = T_Mapped;
+    using std::set<T>::insert;
 
-private:
-    using element_type = typename key_type::value_type;
-    using edge_type = SuffixEdge<key_type, mapped_type>;
+    bool insert(const T &value) { return std::set<T>::insert(value).second; }
+};
 
-    SuffixNode *suffix_;
+/**
+ * A set kept as a sorted array, stored inline for up to N values and on the heap beyond that.
+ *
+ * Most nodes of a suffix tree are leaves holding a single value, which then costs no allocation at all.
+ * Values put in increasing order (the usual case, see SuffixTree::put) are appended in constant time.
+ */
+template<typename T, std::size_t N>
+class InlineValueSet {
+    static_assert(N > 0, "use SortedVectorValueSet for no inline storage");
 
-    std::set<mapped_type> data_;
-    std::map<element_type, edge_type *> edges_;
+    std::uint32_t size_ = 0;
+    std::uint32_t capacity_ = N;
 
-    void get_data(std::set<mapped_type> &set, int count) const {
-        for (auto &num: data_) {
-            set.insert(num);
-            if (set.size() == count)
+    union {
+        alignas(T) unsigned char inline_[N * sizeof(T)];
+        T *heap_;
+    };
 
-                break;
-        }
+    bool spilled() const { return capacity_ > N; }
 
-        if (set.size() != count) {
-            for (std::pair<element_type, edge_type *> p: edges_) {
-                edge_type const *e = p.second;
-                e->dest()->get_data(set, count);
-                if (set.size() == count)
+    T *data() { return spilled() ? heap_ : reinterpret_cast<T *>(inline_); }
 
-                    break;
-            }
-        }
+    const T *data() const { return spilled() ? heap_ : reinterpret_cast<const T *>(inline_); }
+
+    void destroy() {
+        auto values = data();
+        for (std::uint32_t i = 0; i < size_; i++) values[i].~T();
+        if (spilled())
+            ::operator delete(heap_);
     }
 
-    bool add_index(const mapped_type &idx) {
-        if (data_.find(idx) != data_.end())
-            return false;
+    /**
+     * Moves the values to a heap array of <tt>capacity</tt> slots.
+     */
+    void grow(std::size_t capacity) {
+        assert(capacity < UINT32_MAX);
+        auto grown = static_cast<T *>(::operator new(capacity * sizeof(T)));
+        auto values = data();
+        for (std::uint32_t i = 0; i < size_; i++) {
+            new(grown + i) T(std::move(values[i]));
+            values[i].~T();
+        }
 
-        data_.insert(idx);
-        return true;
+        if (spilled())
+            ::operator delete(heap_);
+        heap_ = grown;
+        capacity_ = (std::uint32_t) capacity;
     }
 
 public:
-    SuffixNode() : suffix_{nullptr} {}
+    using const_iterator = const T *;
 
-    [[nodiscard]] std::set<mapped_type> get_data() const {
-        return get_data(-1);
-    }
+    InlineValueSet() {}
 
-    [[nodiscard]] std::set<mapped_type> get_data(int count) const {
-        std::set<mapped_type> set;
-        get_data(set, count);
+    InlineValueSet(const InlineValueSet &) = delete;
 
-        return set;
-    }
+    InlineValueSet &operator=(const InlineValueSet &) = delete;
 
-    bool add_ref(const mapped_type &idx) {
-        if (!add_index(idx))
+    ~InlineValueSet() { destroy(); }
+
+    bool insert(const T &value) {
+        auto values = data();
+        auto pos = std::lower_bound(values, values + size_, value);
+        if (pos != values + size_ && !(value < *pos))
             return false;
 
-        for (auto iter = this->suffix_; iter != nullptr && iter->add_ref(idx); iter = iter->suffix_);
+        if (size_ == capacity_) {
+            const auto offset = pos - values;
+            grow(2 * (std::size_t) capacity_);
+            values = data();
+            pos = values + offset;
+        }
 
+        auto end = values + size_;
+        if (pos == end)
+            new(end) T(value);
+        else {
+            new(end) T(std::move(end[-1]));
+            std::move_backward(pos, end - 1, end);
+            *pos = value;
+        }
+        size_++;
         return true;
     }
 
-    void add_edge(const element_type &c, edge_type *e) { edges_[c] = e; }
+    template<typename Iterator>
+    void insert(Iterator first, Iterator last) {
+        std::vector<T> added(first, last);
+        if (added.empty())
+            return;
 
-    edge_type const *get_edge(const element_type &c) const {
-        return edges_.find(c) != edges_.end() ? edges_.at(c) : nullptr;
-    }
+        // union of two sorted ranges, then moved back in place
+        std::vector<T> merged;
+        merged.reserve(size_ + added.size());
+        std::set_union(begin(), end(), added.begin(), added.end(), std::back_inserter(merged));
 
-    edge_type *get_edge(const element_type &c) {
-        return edges_.find(c) != edges_.end() ? edges_.at(c) : nullptr;
+        destroy();
+        size_ = 0;
+        capacity_ = N;
+        if (merged.size() > N)
+            grow(merged.size());
+
+        auto values = data();
+        for (auto &value: merged)
+            new(values + size_++) T(std::move(value));
     }
 
-    SuffixNode const *get_suffix() const { return this->suffix_; }
+    const_iterator begin() const { return data(); }
+
+    const_iterator end() const { return data() + size_; }
 
-    SuffixNode *get_suffix() { return this->suffix_; }
+    std::size_t size() const { return size_; }
 
-    void set_suffix(SuffixNode *suffix) { this->suffix_ = suffix; }
+    bool empty() const { return size_ == 0; }
 };
 
 /**
- * A Generalized Suffix Tree, based on the Ukkonen's paper "On-line construction of suffix trees"
- * http://www.cs.helsinki.fi/u/ukkonen/SuffixT1withFigs.pdf
- *
- * Allows for fast storage and fast(er) retrieval by creating a tree-based index out of a set of strings.
- * Unlike common suffix trees, which are generally used to build an index out of one (very) long string,
- * a Generalized Suffix Tree can be used to build an index over many strings.
- *
- * Its main operations are put and search:
- * Put adds the given key to the index, allowing for later retrieval of the given value.
- * Search can be used to retrieve the set of all the values that were put in the index with keys that contain a given input.
- *
- * In particular, after put(K, V), search(H) will return a set containing V for any string H that is substring of K.
- *
- * The overall complexity of the retrieval operation (search) is O(m) where m is the length of the string to search within the index.
- *
- * Although the implementation is based on the original design by Ukkonen, there are a few aspects where it differs significantly.
- *
- * The tree is composed of a set of nodes and labeled edges. The labels on the edges can have any length as long as it's greater than 0.
- * The only constraint is that no two edges going out from the same node will start with the same character.
- *
- * Because of this, a given (startNode, stringSuffix) pair can denote a unique path within the tree, and it is the path (if any) that can be
- * composed by sequentially traversing all the edges (e1, e2, ...) starting from startNode such that (e1.label + e2.label + ...) is equal
- * to the stringSuffix.
- * See the search method for details.
- *
- * The union of all the edge labels from the root to a given leaf node denotes the set of the strings explicitly contained within the GST.
- * In addition to those strings, there are a set of different strings that are implicitly contained within the GST, and it is composed of
- * the strings built by concatenating e1.label + e2.label + ... + $end, where e1, e2, ... is a proper path and $end is prefix of any of
- * the labels of the edges starting from the last node of the path.
- *
- * This kind of "implicit path" is important in the testAndSplit method.
- *
+ * A set kept as a sorted std::vector.
  */
-template<typename T_String, typename T_Mapped>
-class SuffixTree {
-public:
-    using key_type = KeyInternal<T_String>;
-    using mapped_type = T_Mapped;
-    using value_type = std::pair<key_type, mapped_type>;
-    using size_type = std::size_t;
+template<typename T>
+class SortedVectorValueSet {
+    std::vector<T> values_;
 
-private:
-    using element_type = typename key_type::value_type;
-    using node_type = SuffixNode<key_type, mapped_type>;
-    using edge_type = SuffixEdge<key_type, mapped_type>;
+public:
+    using const_iterator = typename std::vector<T>::const_iterator;
 
-    std::vector<node_type *> all_nodes;
-    std::vector<edge_type *> all_edges;
-    /**
-     * The root of the suffix tree
-     */
-    node_type *root;
-    /**
-     * The last leaf that was added during the update operation
-     */
-    node_type *active_leaf;
+    bool insert(const T &value) {
+        auto pos = std::lower_bound(values_.begin(), values_.end(), value);
+        if (pos != values_.end() && !(value < *pos))
+            return false;
 
-    node_type *make_node() {
-        all_nodes.push_back(new node_type);
-        return all_nodes.back();
+        values_.insert(pos, value);
+        return true;
     }
 
-    edge_type *make_edge(const key_type &label, node_type *dest) {
-        all_edges.push_back(new edge_type(label, dest));
-        return all_edges.back();
+    template<typename Iterator>
+    void insert(Iterator first, Iterator last) {
+        std::vector<T> merged;
+        std::set_union(values_.begin(), values_.end(), first, last, std::back_inserter(merged));
+        merged.shrink_to_fit();
+        values_.swap(merged);
     }
 
-    /**
-     * Returns the tree node (if present) that corresponds to the given string.
-     */
-    node_type const *search_node(const T_String &word) const {
-        /*
-         * Verifies if exists a path from the root to a node such that the concatenation
-         * of all the labels on the path is a super string of the given word.
-         * If such a path is found, the last node on it is returned.
-         */
-        auto node = root;
+    const_iterator begin() const { return values_.begin(); }
 
-        for (auto it = word.begin(); it != word.end(); it++) {
-            // follow the edge corresponding to this char
-            auto edge = node->get_edge(*it);
-
-            if (edge) {
-                for (auto iw = it, il = edge->label.begin(); iw != word.end() && il != edge->label.end(); iw++, il++)
-                    // *iw != *il
-                    if (*iw < *il || *il < *iw)
-                        // the label on the edge does not correspond to the one in the string to search
-                        return nullptr;
-
-                if (edge->label.size() < std::distance(it, word.end())) {
-                    // advance to next node
-                    node = edge->dest();
-                    it = std::next(it, edge->label.size() - 1);
-                } else
-                    // there is no edge starting with this char
-                    return edge->dest();
-            } else
-                return nullptr;
-        }
+    const_iterator end() const { return values_.end(); }
 
-        return nullptr;
-    }
+    std::size_t size() const { return values_.size(); }
+
+    bool empty() const { return values_.empty(); }
+};
+
+/**
+ * A set of non-negative integers, kept as a sorted array while it is sparse and as a bit vector once it is dense.
+ *
+ * The bit vector only spans the words from the smallest value to the largest one, and a set switches to it once
+ * that takes no more room than the array, at least one value in 64 consecutive ids. So a node never costs more
+ * than one 64-bit word per value, and a node holding many dense integral ids takes one bit per id in its range.
+ * Every set takes 40 bytes in its node; a single value (all leaves) is held there, without an allocation.
+ */
+template<typename T>
+class BitsetValueSet {
+    static_assert(std::is_integral<T>::value, "BitsetValueSet holds integral values only");
+
+    enum : std::size_t { sparse = std::size_t(-1) };
 
     /**
-     * Return a (Node, string) (n, remainder) pair such that n is a farthest descendant of
-     * input_node (the input node) that can be reached by following a path of edges denoting
-     * a prefix of input and remainder will be string that must be
-     * appended to the concatenation of labels from input_node to n to get input.
+     * The sorted values while base_ is sparse, else the bits of the values from base_ * 64 on.
+     * A single value is held in base_ instead, with no words.
      */
-    std::pair<node_type *, key_type>
-    canonize(node_type *input_node, key_type input) {
-        if (!input.empty()) {
-            auto edge = input_node->get_edge(*input.begin());
+    std::vector<std::uint64_t> words_;
+    std::size_t base_ = sparse;
+    std::size_t size_ = 0;
 
-            // descend the tree as long as a proper label is found
-            while (edge && input.has_prefix(edge->label)) {
-                input = input.substr(edge->label.size());
-                input_node = edge->dest();
-                if (!input.empty())
-                    edge = input_node->get_edge(*input.begin());
-            }
-        }
+    bool single() const { return size_ == 1; }
 
-        return std::make_pair(input_node, std::move(input));
-    }
+    bool dense() const { return size_ > 1 && base_ != sparse; }
 
     /**
-     * Tests whether the string part + t is contained in the subtree that has input_node as root.
-     * If that's not the case, and there exists a path of edges e1, e2, ... such that
-     *     e1.label + e2.label + ... + $end = part
-     * and there is an edge g such that
-     *     g.label = part + rest
-     *
-     * Then g will be split in two different edges, one having $end as label, and the other one
-     * having rest as label.
-     *
-     * @param input_node starting node
-     * @param part the string to search
-     * @param t the following character
-     * @param remainder the remainder of the string to add to the index
-     * @param value the value to add to the index
-     * @return a pair containing:
-     *                  true/false depending on whether (part + t) is contained in the subtree starting in input_node
-     *                  the last node that can be reached by following the path denoted by part starting from input_node
-     *
+     * Turns the array into a bit vector if that takes no more words.
      */
-    std::pair<bool, node_type *>
-    test_and_split(node_type *input_node,
-                   const key_type &part,
-                   const element_type &t,
-                   const key_type &remainder,
-                   mapped_type value) {
-        // descend the tree as far as possible
-        node_type *node;
-        key_type str;
-        {
-            auto p = canonize(input_node, part);
-            node = p.first;
-            str = p.second;
-        }
+    void densify() {
+        const auto first = words_.front() / 64, last = words_.back() / 64;
+        if (last - first + 1 > words_.size())
+            return;
 
-        std::pair<bool, node_type *> re;
+        std::vector<std::uint64_t> bits(last - first + 1, 0);
+        for (auto value: words_)
+            bits[value / 64 - first] |= std::uint64_t(1) << (value % 64);
+        words_.swap(bits);
+        base_ = (std::size_t) first;
+    }
 
-        if (!str.empty()) {
-            auto edge = node->get_edge(*str.begin());
-            auto &label = edge->label;
+public:
+    class const_iterator {
+        const BitsetValueSet *set_;
+        /// index in the array, or bit from base_ * 64 in the bit vector
+        std::size_t pos_;
 
-            // must see whether "str" is substring of the label of an edge
-            if (label.size() > str.size() &&
-                // label[str.size()] == t
-                // Strictly use operator < as label[str.size()] and t might be custom objects.
-                !(*(label.iter_at(str.size())) < t) &&
-                !(t < *(label.iter_at(str.size()))))
+        void skip_zeros() {
+            if (!set_->dense())
+                return;
 
-                re = std::make_pair(true, node);
-            else {
-                // need to split the edge
-                assert(label.has_prefix(str));
-                label = label.substr(str.size());
+            const auto &words = set_->words_;
+            const auto bits = words.size() * 64;
+            while (pos_ < bits) {
+                const auto word = words[pos_ / 64] >> (pos_ % 64);
+                if (word & 1)
+                    return;
+                // jump to the next word when the rest of this one is empty
+                pos_ = word ? pos_ + 1 : (pos_ / 64 + 1) * 64;
+            }
+        }
 
-                // build a new node
-                auto new_node = make_node();
-                // build a new edge
-                auto new_edge = make_edge(str, new_node);
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const T *;
+        using reference = T;
 
-                // link node -> new_node
-                new_node->add_edge(*label.begin(), edge);
-                node->add_edge(*str.begin(), new_edge);
+        const_iterator(const BitsetValueSet *set, std::size_t pos) : set_(set), pos_(pos) {
+            skip_zeros();
+        }
 
-                re = std::make_pair(false, new_node);
-            }
-        } else {
-            auto edge = node->get_edge(t);
-            if (edge) {
-                if (remainder == edge->label) {
-                    // update payload of destination node
-                    edge->dest()->add_ref(value);
-
-                    re = std::make_pair(true, node);
-                } else if (remainder.has_prefix(edge->label)) {
-
-                    re = std::make_pair(true, node);
-                } else if (edge->label.has_prefix(remainder)) {
-                    // need to split as above
-                    auto new_node = make_node();
-                    new_node->add_ref(value);
-
-                    auto new_edge = make_edge(remainder, new_node);
-                    edge->label = edge->label.substr(remainder.size());
-                    new_node->add_edge(*edge->label.begin(), edge);
-                    node->add_edge(t, new_edge);
-
-                    re = std::make_pair(false, node);
-                } else {
-                    // they are different words. No prefix. but they may still share some common substr
-                    re = std::make_pair(true, node);
-                }
-            } else {
-                // if there is no t-transition from node
-                re = std::make_pair(false, node);
-            }
+        T operator*() const {
+            if (set_->single())
+                return (T) set_->base_;
+            return (T) (set_->dense() ? set_->base_ * 64 + pos_ : set_->words_[pos_]);
         }
 
-        return re;
-    }
+        const_iterator &operator++() {
+            pos_++;
+            skip_zeros();
+            return *this;
+        }
 
-    /**
-     * Updates the tree starting from input_node and by adding part.
-     *
-     * Returns a reference (Node, string) pair for the string that has been added so far.
-     * This means:
-     * - the Node will be the Node that can be reached by the longest path string (S1)
-     *   that can be obtained by concatenating consecutive edges in the tree and
-     *   that is a substring of the string added so far to the tree.
-     * - the string will be the remainder that must be added to S1 to get the string
-     *   added so far.
-     *
-     * @param input_node the node to start from
-     * @param part the string to add to the tree
-     * @param rest the rest of the string
-     * @param value the value to add to the index
-     */
-    std::pair<node_type *, key_type>
-    update(node_type *input_node, const key_type &part, const element_type &new_char,
-           const key_type &rest, mapped_type value) {
-        auto tmp_part = part;
-        auto input = input_node;
-
-        bool endpoint;
-        node_type *node;
-        {
-            auto p = test_and_split(input,
-                                    part.substr(0, part.size() - 1),
-                                    new_char,
-                                    rest,
-                                    value);
-            endpoint = p.first;
-            node = p.second;
-        }
-
-        auto old_root = root;
-
-        while (!endpoint) {
-            node_type *leaf;
-            auto tmp_edge = node->get_edge(new_char);
-            if (tmp_edge)
-                // such a node is already present. This is one of the main differences from Ukkonen's case:
-                // the tree can contain deeper nodes at this stage because different strings were added by previous iterations.
-                leaf = tmp_edge->dest();
-            else {
-                // must build a new leaf
-                leaf = make_node();
-                leaf->add_ref(value);
-                node->add_edge(new_char, make_edge(rest, leaf));
-            }
+        const_iterator operator++(int) {
+            auto old = *this;
+            ++*this;
+            return old;
+        }
 
-            // update suffix link for newly created leaf
-            if (active_leaf != root)
-                active_leaf->set_suffix(leaf);
-            active_leaf = leaf;
+        bool operator==(const const_iterator &other) const { return pos_ == other.pos_; }
 
-            if (old_root != root)
-                old_root->set_suffix(node);
-            old_root = node;
+        bool operator!=(const const_iterator &other) const { return pos_ != other.pos_; }
+    };
 
-            if (!input->get_suffix()) { // root node
-                assert(root == input);
-                // this is a special case to handle what is referred to as node _|_ on the paper
-                tmp_part = tmp_part.substr(1);
-            } else {
-                key_type str;
-                {
-                    auto p = canonize(input->get_suffix(),
-                                      safe_cut_last_char(tmp_part));
-                    input = p.first;
-                    str = p.second;
-                }
-                tmp_part = {str.begin(), ++str.end()};
-            }
+    bool insert(const T &value) {
+        assert(value >= 0);
+        const auto i = (std::size_t) value;
 
-            {
-                auto p = test_and_split(input,
-                                        safe_cut_last_char(tmp_part),
-                                        new_char,
-                                        rest,
-                                        value);
-                endpoint = p.first;
-                node = p.second;
-            }
+        if (size_ == 0) {
+            base_ = i;
+            size_ = 1;
+            return true;
+        }
+        if (single()) {
+            if (base_ == i)
+                return false;
+            words_.push_back(base_);
+            base_ = sparse;
         }
 
-        if (old_root != root)
-            old_root->set_suffix(node);
+        if (!dense()) {
+            auto pos = std::lower_bound(words_.begin(), words_.end(), (std::uint64_t) i);
+            if (pos != words_.end() && *pos == i)
+                return false;
 
-        return std::make_pair(input, tmp_part);
-    }
+            words_.insert(pos, (std::uint64_t) i);
+            size_++;
+            densify();
+            return true;
+        }
 
-public:
-    SuffixTree() {
-        root = make_node();
-        active_leaf = root;
-    }
+        // widen the bit vector to the word of the value
+        if (i / 64 < base_) {
+            words_.insert(words_.begin(), base_ - i / 64, 0);
+            base_ = i / 64;
+        } else if (i / 64 - base_ >= words_.size())
+            words_.resize(i / 64 - base_ + 1, 0);
+
+        auto &word = words_[i / 64 - base_];
+        const auto bit = std::uint64_t(1) << (i % 64);
+        if (word & bit)
+            return false;
+
+        word |= bit;
+        size_++;
+        return true;
+    }
+
+    template<typename Iterator>
+    void insert(Iterator first, Iterator last) {
+        for (; first != last; ++first)
+            insert(*first);
+    }
+
+    const_iterator begin() const { return const_iterator(this, 0); }
+
+    const_iterator end() const {
+        return const_iterator(this, single() ? 1 : dense() ? words_.size() * 64 : words_.size());
+    }
+
+    std::size_t size() const { return size_; }
+
+    bool empty() const { return size_ == 0; }
+};
+
+/// Values in a std::set, as before value set policies existed
+struct StdSetValues {
+    template<typename T> using set_type = StdValueSet<T>;
+};
+
+/// Up to N values inline in the node, the default
+template<std::size_t N = 2>
+struct InlineValues {
+    template<typename T> using set_type = InlineValueSet<T, N>;
+};
+
+struct SortedVectorValues {
+    template<typename T> using set_type = SortedVectorValueSet<T>;
+};
+
+/// For non-negative integral values only
+struct BitsetValues {
+    template<typename T> using set_type = BitsetValueSet<T>;
+};
+
+/**
+ * Dense integer code of an element in an Alphabet.
+ */
+enum class Symbol : std::uint32_t {};
+
+/**
+ * A symbol table mapping every distinct element to a dense code, in order of first appearance.
+ *
+ * Elements only need operator<, and are compared once per element when a key is encoded instead of at every
+ * step of the tree construction and search.
+ */
+template<typename T_Element>
+class Alphabet {
+public:
+    using element_type = T_Element;
+    using size_type = std::size_t;
+
+private:
+    std::map<element_type, Symbol> codes_;
+    /// elements_[code]: the element encoded as code
+    std::vector<element_type> elements_;
+
+public:
+    size_type size() const { return elements_.size(); }
+
+    /**
+     * Returns the code of <tt>element</tt>, adding it to the alphabet if it isn't there yet.
+     */
+    Symbol encode(const element_type &element) {
+        auto it = codes_.lower_bound(element);
+        if (it != codes_.end() && !(element < it->first))
+            return it->second;
+
+        assert(elements_.size() < UINT32_MAX);
+        const auto code = (Symbol) elements_.size();
+        codes_.emplace_hint(it, element, code);
+        elements_.push_back(element);
+        return code;
+    }
+
+    /**
+     * Sets <tt>code</tt> to the code of <tt>element</tt>, returns false if it isn't in the alphabet.
+     */
+    bool find(const element_type &element, Symbol &code) const {
+        auto it = codes_.find(element);
+        if (it == codes_.end())
+            return false;
+
+        code = it->second;
+        return true;
+    }
+
+    const element_type &decode(Symbol code) const { return elements_[(size_type) code]; }
+};
+
+/**
+ * The children of a node as an array of (first element of their label, child) pairs sorted by element.
+ *
+ * Has the subset of the std::map interface that SuffixNode uses. Lookups are a binary search over a few
+ * contiguous pairs, and a node costs one allocation for all its children instead of one per child,
+ * which pays off when elements are small and cheap to compare.
+ */
+template<typename T_Element, typename T_Edge>
+class EdgeArray {
+public:
+    using value_type = std::pair<T_Element, T_Edge>;
+    using iterator = typename std::vector<value_type>::iterator;
+    using const_iterator = typename std::vector<value_type>::const_iterator;
+    using reverse_iterator = typename std::vector<value_type>::reverse_iterator;
+    using const_reverse_iterator = typename std::vector<value_type>::const_reverse_iterator;
+
+private:
+    std::vector<value_type> edges_;
+
+    static bool before(const value_type &edge, const T_Element &c) { return edge.first < c; }
+
+public:
+    iterator find(const T_Element &c) {
+        auto it = std::lower_bound(edges_.begin(), edges_.end(), c, before);
+        return it != edges_.end() && !(c < it->first) ? it : edges_.end();
+    }
+
+    const_iterator find(const T_Element &c) const {
+        auto it = std::lower_bound(edges_.begin(), edges_.end(), c, before);
+        return it != edges_.end() && !(c < it->first) ? it : edges_.end();
+    }
+
+    T_Edge &operator[](const T_Element &c) {
+        auto it = std::lower_bound(edges_.begin(), edges_.end(), c, before);
+        if (it == edges_.end() || c < it->first)
+            it = edges_.insert(it, value_type(c, T_Edge()));
+        return it->second;
+    }
+
+    iterator begin() { return edges_.begin(); }
+
+    iterator end() { return edges_.end(); }
+
+    const_iterator begin() const { return edges_.begin(); }
+
+    const_iterator end() const { return edges_.end(); }
+
+    reverse_iterator rbegin() { return edges_.rbegin(); }
+
+    reverse_iterator rend() { return edges_.rend(); }
+
+    const_reverse_iterator rbegin() const { return edges_.rbegin(); }
+
+    const_reverse_iterator rend() const { return edges_.rend(); }
+
+    std::size_t size() const { return edges_.size(); }
+
+    bool empty() const { return edges_.empty(); }
+};
+
+/**
+ * The container SuffixNode keeps its children in, by the first element of their label: a std::map in general,
+ * an EdgeArray for the dense codes of an Alphabet.
+ *
+ * Specialize it for other element types.
+ */
+template<typename T_Element, typename T_Edge>
+struct edge_table {
+    using type = std::map<T_Element, T_Edge>;
+};
+
+template<typename T_Edge>
+struct edge_table<Symbol, T_Edge> {
+    using type = EdgeArray<Symbol, T_Edge>;
+};
+
+#if defined(__GNUC__) || defined(__clang__)
+#define SUFFIX_TREE_PREFETCH(address) __builtin_prefetch(address)
+#else
+#define SUFFIX_TREE_PREFETCH(address) ((void) 0)
+#endif
+
+/**
+ * A node of a SuffixTree, holding the label of the edge that leads to it from its parent: every node but the root
+ * has exactly one incoming edge, so the edge needs no object of its own, and following it is reading the child.
+ *
+ * T_Values is the set type holding the values of the node, see ValueSet.h.
+ */
+template<typename T_Key, typename T_Mapped, typename T_Values>
+class SuffixNode {
+    template<typename T1, typename T2, typename T3> friend
+    class SuffixTree;
+
+    template<typename T1, typename T2, typename T3> friend
+    class CompactLayout;
+
+public:
+    using key_type = T_Key;
+    using mapped_type = T_Mapped;
+
+private:
+    using element_type = typename key_type::value_type;
+    using handle_type = ArenaHandle;
+
+    /// Label of the edge from the parent, empty for the root
+    key_type label_;
+
+    /// Handle of the node of the suffix link, the root (handle 0) until one is set
+    handle_type suffix_ = 0;
+
+    T_Values data_;
+    /// Handles of the children, by first element of their label
+    typename edge_table<element_type, handle_type>::type children_;
+
+    bool add_index(const mapped_type &idx) {
+        return data_.insert(idx);
+    }
+
+public:
+    SuffixNode() = default;
+
+    explicit SuffixNode(const key_type &label) : label_(label) {}
+
+    const key_type &label() const { return label_; }
+
+    void add_child(const element_type &c, handle_type child) { children_[c] = child; }
+
+    /**
+     * Returns the handle of the child whose label starts with <tt>c</tt>, or null_handle.
+     */
+    handle_type get_child(const element_type &c) const {
+        SUFFIX_TREE_COUNT(get_edge_lookups);
+        auto it = children_.find(c);
+        if (it == children_.end()) {
+            SUFFIX_TREE_COUNT(get_edge_misses);
+            return null_handle;
+        }
+        return it->second;
+    }
+
+    handle_type get_suffix() const { return suffix_; }
+
+    void set_suffix(handle_type suffix) { suffix_ = suffix; }
+};
+
+/**
+ * Lists the distinct values of any range of an array of values in time proportional to the number of distinct
+ * values, not to the length of the range (Muthukrishnan's document listing).
+ *
+ * Every position keeps the position of the previous occurrence of its value. A value occurs in [from, to)
+ * for the first time exactly at the positions whose previous occurrence is before <tt>from</tt>; those are found
+ * one by one with range minimum queries over the previous occurrences, each of them splitting the range in two.
+ *
+ * Values are appended with push_back, then build() must be called once before any query.
+ */
+template<typename T_Mapped>
+class DocumentListing {
+public:
+    using mapped_type = T_Mapped;
+    using size_type = std::size_t;
+
+private:
+    /// Positions covered by one entry of the first level of sparse_, scanned linearly by queries
+    enum : size_type { block_size = 32 };
+
+    std::vector<mapped_type> documents_;
+    /// previous_[i]: 1 + position of the previous occurrence of documents_[i], 0 if there is none
+    std::vector<std::uint32_t> previous_;
+    /// sparse_[k][b]: position of the smallest previous_ in blocks [b, b + 2^k)
+    std::vector<std::vector<std::uint32_t>> sparse_;
+    /// ranges_[node]: positions [first, second) of the values of the subtree of a node, by handle, see enter
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> ranges_;
+    bool built_ = false;
+
+    size_type better(size_type a, size_type b) const {
+        return previous_[b] < previous_[a] ? b : a;
+    }
+
+    size_type scan(size_type best, size_type from, size_type to) const {
+        for (auto i = from; i < to; i++)
+            best = better(best, i);
+        return best;
+    }
+
+    /**
+     * Position of the smallest previous occurrence in [from, to), which must not be empty.
+     */
+    size_type argmin(size_type from, size_type to) const {
+        const auto first_block = (from + block_size - 1) / block_size;
+        const auto last_block = to / block_size;
+        if (first_block >= last_block)
+            return scan(from, from, to);
+
+        auto best = scan(from, from, first_block * block_size);
+        best = scan(best, last_block * block_size, to);
+
+        size_type level = 0;
+        while ((size_type(2) << level) <= last_block - first_block) level++;
+        best = better(best, sparse_[level][first_block]);
+        return better(best, sparse_[level][last_block - (size_type(1) << level)]);
+    }
+
+public:
+    size_type size() const { return documents_.size(); }
+
+    bool built() const { return built_; }
+
+    void push_back(const mapped_type &value) {
+        assert(!built_);
+        documents_.push_back(value);
+    }
+
+    /**
+     * Starts the range of the node of handle <tt>node</tt>: the values pushed until leave(node) are those of
+     * its subtree. Ranges are kept here rather than in the nodes, so trees without a listing don't pay for them.
+     */
+    void enter(size_type node) {
+        assert(!built_);
+        if (node >= ranges_.size())
+            ranges_.resize(node + 1);
+        ranges_[node].first = (std::uint32_t) documents_.size();
+    }
+
+    void leave(size_type node) {
+        assert(!built_);
+        ranges_[node].second = (std::uint32_t) documents_.size();
+    }
+
+    /**
+     * Positions [first, second) of the values of the subtree of <tt>node</tt>.
+     */
+    std::pair<size_type, size_type> range(size_type node) const {
+        return std::pair<size_type, size_type>(ranges_[node].first, ranges_[node].second);
+    }
+
+    /**
+     * Links every position to the previous occurrence of its value and builds the range minimum structure.
+     */
+    void build() {
+        const auto n = documents_.size();
+        assert(n < UINT32_MAX);
+
+        previous_.resize(n);
+        std::map<mapped_type, std::uint32_t> last;
+        for (size_type i = 0; i < n; i++) {
+            auto it = last.insert(std::make_pair(documents_[i], 0)).first;
+            previous_[i] = it->second;
+            it->second = (std::uint32_t) (i + 1);
+        }
+
+        sparse_.clear();
+        const auto blocks = n / block_size;
+        if (blocks) {
+            sparse_.emplace_back(blocks);
+            for (size_type b = 0; b < blocks; b++)
+                sparse_[0][b] = (std::uint32_t) scan(b * block_size, b * block_size + 1, (b + 1) * block_size);
+
+            for (size_type level = 1; (size_type(1) << level) <= blocks; level++) {
+                const auto half = size_type(1) << (level - 1);
+                auto &below = sparse_[level - 1];
+                std::vector<std::uint32_t> current(blocks - 2 * half + 1);
+                for (size_type b = 0; b < current.size(); b++)
+                    current[b] = (std::uint32_t) better(below[b], below[b + half]);
+                sparse_.push_back(std::move(current));
+            }
+        }
+
+        documents_.shrink_to_fit();
+        ranges_.shrink_to_fit();
+        built_ = true;
+    }
+
+    void clear() { *this = DocumentListing(); }
+
+    /**
+     * Calls <tt>output(value)</tt> with every distinct value of [from, to), in no particular order,
+     * until it returns false.
+     */
+    template<typename Output>
+    void list(size_type from, size_type to, Output output) const {
+        assert(built_);
+        std::vector<std::pair<size_type, size_type>> ranges;
+        if (from < to)
+            ranges.emplace_back(from, to);
+
+        while (!ranges.empty()) {
+            const auto l = ranges.back().first, r = ranges.back().second;
+            ranges.pop_back();
+
+            const auto i = argmin(l, r);
+            if (previous_[i] > from)
+                // every value of [l, r) already occurs before it, in [from, l)
+                continue;
+
+            if (!output(documents_[i]))
+                return;
+            if (i + 1 < r) ranges.emplace_back(i + 1, r);
+            if (l < i) ranges.emplace_back(l, i);
+        }
+    }
+
+    /**
+     * Inserts into <tt>set</tt> the distinct values of [from, to), until it holds <tt>count</tt> values.
+     */
+    void list(size_type from, size_type to, std::set<mapped_type> &set, int count) const {
+        if (set.size() == (size_type) count)
+            return;
+        list(from, to, [&set, count](const mapped_type &value) {
+            set.insert(value);
+            return set.size() != (size_type) count;
+        });
+    }
+
+    size_type memory_bytes() const {
+        size_type bytes = documents_.capacity() * sizeof(mapped_type) + previous_.capacity() * sizeof(std::uint32_t);
+        bytes += ranges_.capacity() * sizeof(ranges_[0]);
+        for (auto &level: sparse_) bytes += level.capacity() * sizeof(std::uint32_t);
+        return bytes;
+    }
+};
+
+/**
+ * A read-only copy of a suffix tree laid out in arrays, in breadth-first order.
+ *
+ * The children of every node are stored next to each other, with the edge leading to each child inlined in the
+ * child's slot, and the first elements of all edge labels are kept in an array of their own, so that choosing
+ * the child to follow is a binary search over a few contiguous elements. The top levels of the tree, which every
+ * search goes through, end up packed in the first few cache lines.
+ *
+ * Values are stored per node in the same order (offsets into one array).
+ */
+template<typename T_Key, typename T_Mapped, typename T_Values>
+class CompactLayout {
+public:
+    using key_type = T_Key;
+    using mapped_type = T_Mapped;
+    using size_type = std::size_t;
+    using node_type = SuffixNode<key_type, mapped_type, T_Values>;
+    using handle_type = ArenaHandle;
+
+    /// Returned by find when the word is not in the tree
+    enum : size_type { npos = size_type(-1) };
+
+private:
+    using element_type = typename key_type::value_type;
+
+    struct Slot {
+        /// label of the edge from the parent, empty for the root
+        key_type label;
+        /// slot of the first child, the others follow it
+        std::uint32_t first_child;
+        std::uint32_t child_count;
+    };
+
+    std::vector<Slot> slots_;
+    /// firsts_[i]: first element of the label of slot i + 1 (the root has no label)
+    std::vector<element_type> firsts_;
+    /// Values of slot i are values_[value_offsets_[i], value_offsets_[i + 1])
+    std::vector<std::uint32_t> value_offsets_;
+    std::vector<mapped_type> values_;
+    /// Handle of the node every slot was copied from
+    std::vector<handle_type> sources_;
+
+public:
+    bool built() const { return !slots_.empty(); }
+
+    size_type size() const { return slots_.size(); }
+
+    void clear() { *this = CompactLayout(); }
+
+    /**
+     * Copies the tree of <tt>nodes</tt>, from its root (handle 0).
+     */
+    void build(const Arena<node_type> &nodes) {
+        clear();
+        sources_.push_back(0);
+        slots_.push_back(Slot{key_type(), 0, 0});
+
+        for (size_type i = 0; i < sources_.size(); i++) {
+            const auto &node = nodes[sources_[i]];
+            assert(sources_.size() < UINT32_MAX);
+
+            slots_[i].first_child = (std::uint32_t) sources_.size();
+            slots_[i].child_count = (std::uint32_t) node.children_.size();
+            for (auto &p: node.children_) {
+                sources_.push_back(p.second);
+                slots_.push_back(Slot{nodes[p.second].label_, 0, 0});
+                firsts_.push_back(p.first);
+            }
+        }
+
+        value_offsets_.reserve(sources_.size() + 1);
+        for (auto source: sources_) {
+            const auto &data = nodes[source].data_;
+            value_offsets_.push_back((std::uint32_t) values_.size());
+            values_.insert(values_.end(), data.begin(), data.end());
+        }
+        value_offsets_.push_back((std::uint32_t) values_.size());
+        assert(values_.size() < UINT32_MAX);
+    }
+
+    /**
+     * Returns the slot of the node at or below which <tt>word</tt> ends, or npos. See SuffixTree::search_node.
+     */
+    template<typename T_String>
+    size_type find(const T_String &word) const {
+        size_type slot = 0;
+        auto it = word.begin();
+        const auto word_end = word.end();
+
+        while (it != word_end) {
+            SUFFIX_TREE_COUNT(get_edge_lookups);
+            const auto &node = slots_[slot];
+            const auto from = firsts_.begin() + (node.first_child - 1);
+            const auto to = from + node.child_count;
+            const auto child = std::lower_bound(from, to, *it);
+            if (child == to || *it < *child) {
+                SUFFIX_TREE_COUNT(get_edge_misses);
+                return npos;
+            }
+
+            slot = (size_type) (child - firsts_.begin()) + 1;
+            const auto &label = slots_[slot].label;
+
+            // the first element matched the child lookup, compare the rest of the label
+            auto il = label.begin();
+            const auto label_end = label.end();
+            for (++it, ++il; it != word_end && il != label_end; ++it, ++il) {
+                SUFFIX_TREE_COUNT(search_label_compares);
+                if (*it < *il || *il < *it)
+                    return npos;
+            }
+        }
+
+        return slot == 0 ? npos : slot;
+    }
+
+    handle_type source(size_type slot) const { return sources_[slot]; }
+
+    /**
+     * Inserts into <tt>set</tt> the values of the subtree of <tt>slot</tt>, until it holds <tt>count</tt> values.
+     * Nodes are visited in the same order as SuffixTree::get_data.
+     */
+    void get_data(size_type slot, std::set<mapped_type> &set, int count) const {
+        std::vector<std::uint32_t> stack{(std::uint32_t) slot};
+
+        while (!stack.empty()) {
+            const auto current = stack.back();
+            stack.pop_back();
+
+            for (auto i = value_offsets_[current]; i < value_offsets_[current + 1]; i++) {
+                set.insert(values_[i]);
+                if (set.size() == (size_type) count)
+                    return;
+            }
+
+            const auto &node = slots_[current];
+            for (auto child = node.first_child + node.child_count; child > node.first_child; child--)
+                stack.push_back(child - 1);
+        }
+    }
+
+    size_type memory_bytes() const {
+        return slots_.capacity() * sizeof(Slot) + firsts_.capacity() * sizeof(element_type) +
+               value_offsets_.capacity() * sizeof(std::uint32_t) + values_.capacity() * sizeof(mapped_type) +
+               sources_.capacity() * sizeof(handle_type);
+    }
+};
+
+/**
+ * A fixed set of worker threads running fork-join jobs over tasks that spawn more tasks.
+ *
+ * Every worker has its own deque: it pushes the tasks it spawns at the back and takes its next task from the back
+ * too (depth first, for locality), and when it runs out it steals from the front of another worker's deque,
+ * where the oldest and usually largest tasks are.
+ *
+ * The thread calling run takes part in the job, as the last worker. One job runs at a time, concurrent calls
+ * to run wait for each other.
+ */
+class WorkStealingPool {
+public:
+    /**
+     * The tasks of one call to run.
+     */
+    template<typename T_Task>
+    class Job {
+        friend class WorkStealingPool;
+
+        struct Deque {
+            std::mutex mutex;
+            std::deque<T_Task> tasks;
+        };
+
+        std::vector<Deque> deques_;
+        /// Tasks spawned and not finished yet, queued or running
+        std::atomic<std::size_t> pending_;
+
+        explicit Job(std::size_t workers) : deques_(workers), pending_(0) {}
+
+        bool pop(std::size_t worker, T_Task &task) {
+            auto &own = deques_[worker];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (own.tasks.empty())
+                return false;
+
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+        }
+
+        bool steal(std::size_t worker, T_Task &task) {
+            for (std::size_t i = 1; i < deques_.size(); i++) {
+                auto &victim = deques_[(worker + i) % deques_.size()];
+                std::lock_guard<std::mutex> lock(victim.mutex);
+                if (victim.tasks.empty())
+                    continue;
+
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                return true;
+            }
+            return false;
+        }
+
+    public:
+        /**
+         * Adds a task to the deque of <tt>worker</tt>, which must be the worker running the calling task.
+         */
+        void spawn(std::size_t worker, T_Task task) {
+            pending_++;
+            auto &own = deques_[worker];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            own.tasks.push_back(std::move(task));
+        }
+    };
+
+private:
+    std::vector<std::thread> threads_;
+
+    std::mutex run_mutex_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable idle_;
+    /// The job being run, called once by every worker
+    std::function<void(std::size_t)> job_;
+    std::uint64_t generation_ = 0;
+    /// Pool threads still inside the job
+    std::size_t busy_ = 0;
+    bool stop_ = false;
+
+    void work(std::size_t worker) {
+        std::uint64_t seen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                wake_.wait(lock, [this, seen]() { return stop_ || generation_ != seen; });
+                if (stop_)
+                    return;
+                seen = generation_;
+            }
+
+            job_(worker);
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (--busy_ == 0)
+                idle_.notify_all();
+        }
+    }
+
+public:
+    /**
+     * Starts <tt>threads</tt> workers, on top of the thread that will call run.
+     */
+    explicit WorkStealingPool(std::size_t threads) {
+        for (std::size_t i = 0; i < threads; i++)
+            threads_.emplace_back(&WorkStealingPool::work, this, i);
+    }
+
+    WorkStealingPool(const WorkStealingPool &) = delete;
+
+    WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+    ~WorkStealingPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for (auto &thread: threads_) thread.join();
+    }
+
+    /**
+     * Number of workers taking part in a job, the calling thread included.
+     */
+    std::size_t size() const { return threads_.size() + 1; }
+
+    /**
+     * Runs <tt>body(task, worker, job)</tt> on every task of <tt>tasks</tt> and on every task spawned meanwhile
+     * with <tt>job.spawn(worker, task)</tt>, and returns once they are all done.
+     * <tt>worker</tt> is in [0, size()), no two tasks run on the same worker at the same time.
+     */
+    template<typename T_Task, typename Body>
+    void run(const std::vector<T_Task> &tasks, Body body) {
+        std::lock_guard<std::mutex> serial(run_mutex_);
+
+        Job<T_Task> job(size());
+        for (std::size_t i = 0; i < tasks.size(); i++)
+            job.spawn(i % size(), tasks[i]);
+
+        auto loop = [&job, &body](std::size_t worker) {
+            T_Task task;
+            while (job.pending_.load() > 0) {
+                if (job.pop(worker, task) || job.steal(worker, task)) {
+                    body(task, worker, job);
+                    job.pending_--;
+                } else
+                    std::this_thread::yield();
+            }
+        };
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            job_ = loop;
+            busy_ = threads_.size();
+            generation_++;
+        }
+        wake_.notify_all();
+
+        loop(size() - 1);
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        idle_.wait(lock, [this]() { return busy_ == 0; });
+        job_ = nullptr;
+    }
+};
+
+/**
+ * Hit and miss counts of a ResultCache.
+ */
+struct ResultCacheStats {
+    std::uint64_t hits = 0;
+    std::uint64_t misses = 0;
+    /// Entries dropped to make room for new ones
+    std::uint64_t evictions = 0;
+    /// Times the whole cache was dropped because the tree changed
+    std::uint64_t invalidations = 0;
+    std::size_t size = 0;
+    std::size_t capacity = 0;
+
+    double hit_rate() const { return hits + misses ? (double) hits / (double) (hits + misses) : 0; }
+};
+
+/**
+ * A bounded cache of search results, keyed by the searched word and the result count, evicting the least
+ * recently used entry when full.
+ *
+ * Entries are valid for one generation of the tree: a lookup or insertion with another generation drops them all.
+ * All operations lock, so the cache can be shared by concurrent searches.
+ */
+template<typename T_Element, typename T_Mapped>
+class ResultCache {
+public:
+    using key_type = std::pair<std::vector<T_Element>, int>;
+    using result_type = std::set<T_Mapped>;
+
+private:
+    struct Entry {
+        key_type key;
+        result_type values;
+    };
+
+    /// Most recently used first
+    std::list<Entry> entries_;
+    std::map<key_type, typename std::list<Entry>::iterator> index_;
+    std::uint64_t generation_ = 0;
+
+    mutable std::mutex mutex_;
+    ResultCacheStats stats_;
+
+    void validate(std::uint64_t generation) {
+        if (generation == generation_)
+            return;
+
+        if (!entries_.empty())
+            stats_.invalidations++;
+        entries_.clear();
+        index_.clear();
+        generation_ = generation;
+    }
+
+public:
+    explicit ResultCache(std::size_t capacity) {
+        stats_.capacity = capacity;
+    }
+
+    /**
+     * Copies the cached result of searching [first, last) with <tt>count</tt> into <tt>result</tt>,
+     * returns false if there is none.
+     */
+    template<typename Iterator>
+    bool find(Iterator first, Iterator last, int count, std::uint64_t generation, result_type &result) {
+        key_type key(std::vector<T_Element>(first, last), count);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        validate(generation);
+
+        auto it = index_.find(key);
+        if (it == index_.end()) {
+            stats_.misses++;
+            return false;
+        }
+
+        stats_.hits++;
+        entries_.splice(entries_.begin(), entries_, it->second);
+        result = it->second->values;
+        return true;
+    }
+
+    template<typename Iterator>
+    void insert(Iterator first, Iterator last, int count, std::uint64_t generation, const result_type &result) {
+        if (!stats_.capacity)
+            return;
+        key_type key(std::vector<T_Element>(first, last), count);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        validate(generation);
+        if (index_.count(key))
+            // cached meanwhile by a concurrent search
+            return;
+
+        entries_.push_front(Entry{key, result});
+        index_.emplace(std::move(key), entries_.begin());
+
+        if (entries_.size() > stats_.capacity) {
+            index_.erase(entries_.back().key);
+            entries_.pop_back();
+            stats_.evictions++;
+        }
+    }
+
+    ResultCacheStats stats() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto stats = stats_;
+        stats.size = entries_.size();
+        return stats;
+    }
+};
+
+/**
+ * A sorted, duplicate-free list of values (a posting list), the candidates of a boolean query.
+ *
+ * Values are appended in any order and normalized once, then looked up by binary search while other lists are
+ * walked, and the values found (or not found) are kept.
+ */
+template<typename T_Mapped>
+class PostingList {
+public:
+    using mapped_type = T_Mapped;
+    using size_type = std::size_t;
+    using const_iterator = typename std::vector<mapped_type>::const_iterator;
+
+private:
+    std::vector<mapped_type> values_;
+
+public:
+    /**
+     * Appends a value in any order: normalize must be called before the list is used.
+     */
+    void push_back(const mapped_type &value) { values_.push_back(value); }
+
+    template<typename Iterator>
+    void append(Iterator first, Iterator last) { values_.insert(values_.end(), first, last); }
+
+    /**
+     * Sorts the values and drops the duplicates.
+     */
+    void normalize() {
+        std::sort(values_.begin(), values_.end());
+        values_.erase(std::unique(values_.begin(), values_.end(), [](const mapped_type &a, const mapped_type &b) {
+            return !(a < b) && !(b < a);
+        }), values_.end());
+    }
+
+    /**
+     * Position of <tt>value</tt> in the list, size() if it isn't in it.
+     */
+    size_type find(const mapped_type &value) const {
+        auto it = std::lower_bound(values_.begin(), values_.end(), value);
+        return it != values_.end() && !(value < *it) ? (size_type) (it - values_.begin()) : values_.size();
+    }
+
+    /**
+     * Keeps the values at the positions i where <tt>marks[i] == marked</tt>.
+     */
+    void retain(const std::vector<bool> &marks, bool marked) {
+        size_type out = 0;
+        for (size_type i = 0; i < values_.size(); i++)
+            if (marks[i] == marked)
+                values_[out++] = values_[i];
+        values_.resize(out);
+    }
+
+    /**
+     * Empties the list, keeping its storage.
+     */
+    void clear() { values_.clear(); }
+
+    bool empty() const { return values_.empty(); }
+
+    size_type size() const { return values_.size(); }
+
+    const_iterator begin() const { return values_.begin(); }
+
+    const_iterator end() const { return values_.end(); }
+};
+
+/**
+ * Direct lookup table of the values of the keys containing every word of 1 to q byte-sized elements (q-grams),
+ * so that very short searches are answered by one array load instead of a descent and a subtree walk.
+ *
+ * Every q-gram has a slot in a dense array: 256 + 256^2 + ... + 256^q slots, 4 bytes each (67 MB for q = 3),
+ * holding the position of its value list, sorted and without duplicates, in a list of lists allocated only
+ * for the q-grams that occur.
+ */
+template<typename T_Element, typename T_Mapped>
+class QGramTable {
+public:
+    using mapped_type = T_Mapped;
+    using size_type = std::size_t;
+
+    enum : size_type { max_q = 3 };
+
+private:
+    size_type q_;
+    /// 1 + position of the value list of every q-gram in lists_, 0 if it occurs in no key
+    std::vector<std::uint32_t> slots_;
+    std::vector<std::vector<mapped_type>> lists_;
+    /// slot of every list of lists_
+    std::vector<size_type> list_slots_;
+
+    static size_type byte(const T_Element &element) { return byte(element, std::is_integral<T_Element>()); }
+
+    static size_type byte(const T_Element &element, std::true_type) { return (unsigned char) element; }
+
+    /// Lets put compile for other elements, no table can be built for them
+    static size_type byte(const T_Element &, std::false_type) { return 0; }
+
+    /**
+     * Slot of the q-gram of <tt>length</tt> elements starting at <tt>first</tt>:
+     * the slots of the shorter q-grams come first.
+     */
+    template<typename Iterator>
+    static size_type slot(Iterator first, size_type length) {
+        size_type offset = 0, index = 0;
+        for (size_type i = 0; i < length; i++, ++first) {
+            offset = (offset << 8) + 1;
+            index = (index << 8) | byte(*first);
+        }
+        return offset - 1 + index;
+    }
+
+    std::vector<mapped_type> &list(size_type slot) {
+        if (!slots_[slot]) {
+            lists_.emplace_back();
+            list_slots_.push_back(slot);
+            slots_[slot] = (std::uint32_t) lists_.size();
+        }
+        return lists_[slots_[slot] - 1];
+    }
+
+public:
+    explicit QGramTable(size_type q) : q_(q) {
+        static_assert(sizeof(T_Element) == 1 && std::is_integral<T_Element>::value,
+                      "q-gram tables index byte-sized elements only");
+        assert(q >= 1 && q <= max_q);
+        slots_.assign(slot(std::vector<unsigned char>(q, 0xff).begin(), q) + 1, 0);
+    }
+
+    size_type q() const { return q_; }
+
+    /**
+     * Whether [first, last) is short enough to be looked up in the table.
+     */
+    template<typename Iterator>
+    bool covers(Iterator first, Iterator last) const {
+        size_type length = 0;
+        for (; first != last; ++first)
+            if (++length > q_)
+                return false;
+        return length > 0;
+    }
+
+    /**
+     * Adds <tt>value</tt> to the lists of all the q-grams of the key [first, last).
+     * Values are appended as put adds them, in non-decreasing order; others are inserted in place.
+     */
+    template<typename Iterator>
+    void add(Iterator first, Iterator last, const mapped_type &value) {
+        for (; first != last; ++first) {
+            auto end = first;
+            for (size_type length = 1; length <= q_ && end != last; length++) {
+                ++end;
+                auto &values = list(slot(first, length));
+                if (values.empty() || values.back() < value)
+                    values.push_back(value);
+                else if (value < values.back()) {
+                    auto it = std::lower_bound(values.begin(), values.end(), value);
+                    if (*it < value || value < *it)
+                        values.insert(it, value);
+                }
+            }
+        }
+    }
+
+    /**
+     * Sets the list of the q-gram [first, first + length) to the sorted, distinct values of [values_first, values_last).
+     */
+    template<typename Iterator, typename ValueIterator>
+    void assign(Iterator first, size_type length, ValueIterator values_first, ValueIterator values_last) {
+        assert(length >= 1 && length <= q_);
+        list(slot(first, length)).assign(values_first, values_last);
+    }
+
+    /**
+     * Adds the values of every q-gram of <tt>other</tt>, a table of the same q, to the q-gram's list.
+     * Costs time proportional to the lists of <tt>other</tt> and those they are united with, not to the slots.
+     */
+    void merge(const QGramTable &other) {
+        assert(other.q_ == q_);
+        std::vector<mapped_type> united;
+        for (size_type i = 0; i < other.lists_.size(); i++) {
+            const auto &added = other.lists_[i];
+            if (added.empty())
+                continue;
+            auto &values = list(other.list_slots_[i]);
+            if (values.empty() || values.back() < added.front()) {
+                values.insert(values.end(), added.begin(), added.end());
+                continue;
+            }
+
+            united.clear();
+            std::set_union(values.begin(), values.end(), added.begin(), added.end(), std::back_inserter(united));
+            values.swap(united);
+        }
+    }
+
+    /**
+     * Values of the keys containing [first, last), at most <tt>count</tt> of them, the smallest ones.
+     * [first, last) must be covered.
+     */
+    template<typename Iterator>
+    std::set<mapped_type> find(Iterator first, Iterator last, int count) const {
+        const auto index = slots_[slot(first, (size_type) std::distance(first, last))];
+        if (!index)
+            return std::set<mapped_type>();
+
+        const auto &values = lists_[index - 1];
+        const auto size = count < 0 ? values.size() : std::min(values.size(), (size_type) count);
+        return std::set<mapped_type>(values.begin(), values.begin() + size);
+    }
+
+    /**
+     * Empties every list, keeping the slots.
+     */
+    void clear() {
+        std::fill(slots_.begin(), slots_.end(), 0);
+        lists_.clear();
+        list_slots_.clear();
+    }
+
+    size_type memory_bytes() const {
+        size_type bytes = slots_.capacity() * sizeof(std::uint32_t) + lists_.capacity() * sizeof(lists_[0])
+                          + list_slots_.capacity() * sizeof(size_type);
+        for (auto &values: lists_) bytes += values.capacity() * sizeof(mapped_type);
+        return bytes;
+    }
+};
+
+/**
+ * A Generalized Suffix Tree, based on the Ukkonen's paper "On-line construction of suffix trees"
+ * http://www.cs.helsinki.fi/u/ukkonen/SuffixT1withFigs.pdf
+ *
+ * Allows for fast storage and fast(er) retrieval by creating a tree-based index out of a set of strings.
+ * Unlike common suffix trees, which are generally used to build an index out of one (very) long string,
+ * a Generalized Suffix Tree can be used to build an index over many strings.
+ *
+ * Its main operations are put and search:
+ * Put adds the given key to the index, allowing for later retrieval of the given value.
+ * Search can be used to retrieve the set of all the values that were put in the index with keys that contain a given input.
+ *
+ * In particular, after put(K, V), search(H) will return a set containing V for any string H that is substring of K.
+ *
+ * The overall complexity of the retrieval operation (search) is O(m) where m is the length of the string to search within the index.
+ *
+ * Although the implementation is based on the original design by Ukkonen, there are a few aspects where it differs significantly.
+ *
+ * The tree is composed of a set of nodes and labeled edges. The labels on the edges can have any length as long as it's greater than 0.
+ * The only constraint is that no two edges going out from the same node will start with the same character.
+ *
+ * Because of this, a given (startNode, stringSuffix) pair can denote a unique path within the tree, and it is the path (if any) that can be
+ * composed by sequentially traversing all the edges (e1, e2, ...) starting from startNode such that (e1.label + e2.label + ...) is equal
+ * to the stringSuffix.
+ * See the search method for details.
+ *
+ * The union of all the edge labels from the root to a given leaf node denotes the set of the strings explicitly contained within the GST.
+ * In addition to those strings, there are a set of different strings that are implicitly contained within the GST, and it is composed of
+ * the strings built by concatenating e1.label + e2.label + ... + $end, where e1, e2, ... is a proper path and $end is prefix of any of
+ * the labels of the edges starting from the last node of the path.
+ *
+ * This kind of "implicit path" is what is left of a key once its characters have all been read: such suffixes
+ * are made explicit at the end of put, so that every suffix of every key ends on a node holding the key's value.
+ *
+ * T_ValueSetPolicy picks the set type holding the values of each node, see ValueSet.h. The default keeps a couple
+ * of values inline in the node, which covers the vast majority of them (leaves hold a single value).
+ */
+template<typename T_String, typename T_Mapped, typename T_ValueSetPolicy = InlineValues<>>
+class SuffixTree {
+public:
+    using key_type = KeyInternal<T_String>;
+    using mapped_type = T_Mapped;
+    using value_type = std::pair<key_type, mapped_type>;
+    using size_type = std::size_t;
+
+    /**
+     * A substring found more than once in the tree, see frequent_repeats and maximal_repeats.
+     */
+    struct Repeat {
+        T_String text;
+        size_type length;
+        /// number of times it occurs, once per value at most at any position
+        size_type occurrences;
+        /// number of distinct values of the keys containing it
+        size_type frequency;
+    };
+
+private:
+    using element_type = typename key_type::value_type;
+    using value_set_type = typename T_ValueSetPolicy::template set_type<mapped_type>;
+    using node_type = SuffixNode<key_type, mapped_type, value_set_type>;
+    using handle_type = ArenaHandle;
+
+    /// Nodes refer to each other by their handle in it, each one holds the label of the edge leading to it
+    Arena<node_type> all_nodes;
+    /**
+     * The root of the suffix tree, the first node
+     */
+    enum : handle_type { root = 0 };
+
+    /// Values of all nodes in depth-first order, built on request and dropped by any change to the tree
+    DocumentListing<mapped_type> listing_;
+    /// Read-only copy of the tree searched instead of it, built on request and dropped by any change to the tree
+    CompactLayout<key_type, mapped_type, value_set_type> layout_;
+
+    /// Workers collecting the values of large subtrees, see enable_parallel_collection
+    std::unique_ptr<WorkStealingPool> pool_;
+    size_type parallel_threshold_ = 0;
+
+    /// Results of recent searches, see enable_result_cache
+    std::unique_ptr<ResultCache<element_type, mapped_type>> cache_;
+    /// Bumped by every change to what search returns, cached results of older generations are stale
+    std::uint64_t generation_ = 0;
+
+    /// Values of every word of up to q elements, see enable_short_queries
+    std::unique_ptr<QGramTable<element_type, mapped_type>> qgrams_;
+
+    handle_type make_node(const key_type &label) {
+        return all_nodes.emplace_back(label);
+    }
+
+    /**
+     * Depth-first traversal of the subtree of <tt>top</tt>, children in edge order, with an explicit stack instead
+     * of recursion, so that deep trees can't overflow the call stack. Every child is prefetched when it is pushed,
+     * well before it is visited.
+     *
+     * <tt>enter(node)</tt> is called with the handle of every node before its children and returns false to stop
+     * the traversal.
+     */
+    template<typename Enter>
+    void traverse(handle_type top, Enter enter) const {
+        std::vector<handle_type> stack{top};
+
+        while (!stack.empty()) {
+            auto node = stack.back();
+            stack.pop_back();
+            if (!enter(node))
+                return;
+
+            const auto &children = all_nodes[node].children_;
+            for (auto it = children.rbegin(); it != children.rend(); ++it) {
+                auto child = it->second;
+                SUFFIX_TREE_PREFETCH(&all_nodes[child]);
+                stack.push_back(child);
+            }
+        }
+    }
+
+    /**
+     * Same as above, also calling <tt>leave(node)</tt> once all the children of the node have been visited.
+     */
+    template<typename Enter, typename Leave>
+    void traverse(handle_type top, Enter enter, Leave leave) const {
+        // (node, whether its children have been visited)
+        std::vector<std::pair<handle_type, bool>> stack{{top, false}};
+
+        while (!stack.empty()) {
+            auto node = stack.back().first;
+            auto done = stack.back().second;
+            stack.pop_back();
+
+            if (done) {
+                leave(node);
+                continue;
+            }
+            if (!enter(node))
+                return;
+
+            stack.emplace_back(node, true);
+            const auto &children = all_nodes[node].children_;
+            for (auto it = children.rbegin(); it != children.rend(); ++it) {
+                auto child = it->second;
+                SUFFIX_TREE_PREFETCH(&all_nodes[child]);
+                stack.emplace_back(child, false);
+            }
+        }
+    }
+
+    /**
+     * Inserts into <tt>set</tt> the values of the subtree of <tt>top</tt>, until it holds <tt>count</tt> values.
+     */
+    void get_data(handle_type top, std::set<mapped_type> &set, int count) const {
+        traverse(top, [this, &set, count](handle_type node) {
+            for (const auto &num: all_nodes[node].data_) {
+                set.insert(num);
+                if (set.size() == (size_type) count)
+                    return false;
+            }
+            return true;
+        });
+    }
+
+    /**
+     * Returns the tree node (if present) that corresponds to the given string, or null_handle.
+     */
+    handle_type search_node(const T_String &word) const {
+        /*
+         * Verifies if exists a path from the root to a node such that the concatenation
+         * of all the labels on the path is a super string of the given word.
+         * If such a path is found, the last node on it is returned.
+         */
+        handle_type node = root;
+        auto it = word.begin();
+        const auto word_end = word.end();
+
+        while (it != word_end) {
+            // follow the edge corresponding to this char
+            node = all_nodes[node].get_child(*it);
+            if (node == null_handle)
+                return null_handle;
+            const auto &label = all_nodes[node].label_;
+
+            // the first element matched the child lookup, compare the rest of the label
+            auto il = label.begin();
+            const auto label_end = label.end();
+            for (++it, ++il; it != word_end && il != label_end; ++it, ++il) {
+                SUFFIX_TREE_COUNT(search_label_compares);
+                // *it != *il
+                if (*it < *il || *il < *it)
+                    // the label on the edge does not correspond to the one in the string to search
+                    return null_handle;
+            }
+        }
+
+        return node == root ? null_handle : node;
+    }
+
+    /**
+     * Length of the longest prefix of <tt>key</tt> that is a path from the root, the whole key when the tree
+     * already contains it (as a substring of some key).
+     */
+    size_type contained_prefix(const key_type &key) const {
+        handle_type node = root;
+        size_type length = 0;
+        auto it = key.begin();
+        const auto key_end = key.end();
+
+        while (it != key_end) {
+            node = all_nodes[node].get_child(*it);
+            if (node == null_handle)
+                return length;
+
+            const auto &label = all_nodes[node].label_;
+            auto il = label.begin();
+            const auto label_end = label.end();
+            for (++it, ++il, ++length; it != key_end && il != label_end; ++it, ++il, ++length)
+                if (*it < *il || *il < *it)
+                    return length;
+        }
+
+        return length;
+    }
+
+    using key_iterator = typename key_type::const_iterator;
+
+    /**
+     * The active point of Ukkonen's algorithm: the end of the longest suffix read so far that is not yet explicit.
+     *
+     * It lies <tt>length</tt> elements below <tt>node</tt>, on the edge to <tt>child</tt>. The path from <tt>node</tt> to the point
+     * is also the range of the key being inserted starting at <tt>pos</tt>, so the point can be moved around by
+     * comparing lengths only, never labels.
+     */
+    struct ActivePoint {
+        handle_type node;
+        /// child of node whose label starts with *pos, null_handle while length is 0
+        handle_type child;
+        key_iterator pos;
+        size_type length;
+    };
+
+    /**
+     * State of put while one key is being inserted.
+     */
+    struct Insertion {
+        ActivePoint active;
+        /// number of suffixes read so far that are not yet explicit (they end at the active point or above it)
+        size_type remainder;
+        /// end of the key being inserted, leaves are labeled up to it
+        key_iterator end;
+        /**
+         * The node of the last suffix that was given the value. Suffixes are made explicit in order of
+         * decreasing length, so the next one is its suffix link.
+         */
+        handle_type last_terminal;
+    };
+
+    /**
+     * Moves the active point down the tree for as long as it covers whole edges (skip/count descent),
+     * so that it ends up at a node or strictly inside an edge.
+     * If <tt>active.child</tt> is set, it must be the child the point starts towards.
+     */
+    void canonize(ActivePoint &active) const {
+        while (active.length > 0) {
+            auto child = active.child != null_handle ? active.child : all_nodes[active.node].get_child(*active.pos);
+            const auto label_size = all_nodes[child].label_.size();
+            if (active.length < label_size) {
+                active.child = child;
+                return;
+            }
+
+            SUFFIX_TREE_COUNT(canonize_iterations);
+            active.node = child;
+            active.child = null_handle;
+            active.pos = std::next(active.pos, label_size);
+            active.length -= label_size;
+        }
+
+        active.child = null_handle;
+    }
+
+    /**
+     * Moves the active point to the end of the next shorter suffix.
+     */
+    void follow_suffix_link(ActivePoint &active) const {
+        active.child = null_handle;
+        if (active.node == root) {
+            if (active.length > 0) {
+                active.length--;
+                ++active.pos;
+            }
+        } else
+            active.node = all_nodes[active.node].get_suffix();
+
+        canonize(active);
+    }
+
+    /**
+     * Splits the edge from <tt>node</tt> to its child <tt>child</tt> after its first <tt>length</tt> elements
+     * and returns the new node in the middle.
+     */
+    handle_type split_edge(handle_type node, handle_type child, size_type length) {
+        auto &label = all_nodes[child].label_;
+        const element_type first = *label.begin();
+
+        auto middle = make_node(label.substr(0, length));
+        label = label.substr(length);
+
+        all_nodes[middle].add_child(*label.begin(), child);
+        all_nodes[node].add_child(first, middle);
+
+        return middle;
+    }
+
+    /**
+     * Records that the next suffix of the key being inserted ends at <tt>node</tt>.
+     */
+    void add_terminal(Insertion &insertion, handle_type node, const mapped_type &value) {
+        all_nodes[node].add_index(value);
+
+        if (insertion.last_terminal != null_handle)
+            all_nodes[insertion.last_terminal].set_suffix(node);
+        insertion.last_terminal = node;
+    }
+
+    /**
+     * Links the internal node created by the previous extension of the same phase, if any, to <tt>node</tt>.
+     */
+    void resolve_suffix_link(handle_type &pending, handle_type node) {
+        if (pending != null_handle) {
+            all_nodes[pending].set_suffix(node);
+            pending = null_handle;
+        }
+    }
+
+    /**
+     * One phase of Ukkonen's algorithm: extends every implicit suffix of the key with the element at <tt>it</tt>,
+     * <tt>rest</tt> being the number of elements from <tt>it</tt> to the end of the key.
+     *
+     * Unlike in a suffix tree of a single string, the element may already follow the active point because it
+     * was added by another key; in that case the suffix, and all the shorter ones, stay implicit.
+     */
+    void extend(Insertion &insertion, key_iterator it, size_type rest, const mapped_type &value) {
+        auto &active = insertion.active;
+        const element_type &c = *it;
+        handle_type pending_link = null_handle;
+
+        insertion.remainder++;
+        while (insertion.remainder > 0) {
+            handle_type parent;
+
+            if (active.length == 0) {
+                auto child = all_nodes[active.node].get_child(c);
+                if (child != null_handle) {
+                    SUFFIX_TREE_COUNT(extension_found);
+                    resolve_suffix_link(pending_link, active.node);
+
+                    active.child = child;
+                    active.pos = it;
+                    active.length = 1;
+                    canonize(active);
+                    return;
+                }
+
+                SUFFIX_TREE_COUNT(extension_new_leaf);
+                parent = active.node;
+                resolve_suffix_link(pending_link, parent);
+            } else {
+                const auto &next = *all_nodes[active.child].label_.iter_at(active.length);
+                // next == c
+                // Strictly use operator < as next and c might be custom objects.
+                if (!(next < c) && !(c < next)) {
+                    SUFFIX_TREE_COUNT(extension_found);
+                    resolve_suffix_link(pending_link, active.node);
+
+                    active.length++;
+                    canonize(active);
+                    return;
+                }
+
+                SUFFIX_TREE_COUNT(extension_split);
+                parent = split_edge(active.node, active.child, active.length);
+                if (pending_link != null_handle)
+                    all_nodes[pending_link].set_suffix(parent);
+                pending_link = parent;
+            }
+
+            auto leaf = make_node(key_type(it, insertion.end, rest));
+            all_nodes[parent].add_child(c, leaf);
+            add_terminal(insertion, leaf, value);
+
+            insertion.remainder--;
+            follow_suffix_link(active);
+        }
+    }
+
+    /**
+     * Makes the suffixes that are still implicit once the whole key has been read explicit, and gives them the value.
+     * Each one ends at the active point, or at the node reached by following the suffix chain from it.
+     */
+    void finish(Insertion &insertion, const mapped_type &value) {
+        auto &active = insertion.active;
+        handle_type pending_link = null_handle;
+
+        while (insertion.remainder > 0) {
+            SUFFIX_TREE_COUNT(suffix_chain_steps);
+            handle_type node;
+
+            if (active.length == 0) {
+                node = active.node;
+                resolve_suffix_link(pending_link, node);
+            } else {
+                node = split_edge(active.node, active.child, active.length);
+                if (pending_link != null_handle)
+                    all_nodes[pending_link].set_suffix(node);
+                pending_link = node;
+            }
+            add_terminal(insertion, node, value);
+
+            insertion.remainder--;
+            follow_suffix_link(active);
+        }
+
+        resolve_suffix_link(pending_link, root);
+        if (insertion.last_terminal != null_handle)
+            // the shortest suffix is a single element
+            all_nodes[insertion.last_terminal].set_suffix(root);
+    }
+
+    /**
+     * Returns the node at the end of the path <tt>path</tt> starting from <tt>node</tt>.
+     * The path must end on a node, so the descent only compares lengths (skip/count).
+     */
+    handle_type descend(handle_type node, const key_type &path) const {
+        auto it = path.begin();
+        for (auto left = path.size(); left > 0;) {
+            node = all_nodes[node].get_child(*it);
+            const auto label_size = all_nodes[node].label_.size();
+            assert(label_size <= left);
+
+            it = std::next(it, label_size);
+            left -= label_size;
+        }
+
+        return node;
+    }
+
+    /**
+     * Sets the suffix links of the nodes created by merge, the handles from <tt>first_new</tt> on, parents before
+     * children: the link of a node is found by descending its edge label from the link of its parent.
+     * <tt>queue</tt> starts with the (parent, node) pairs of the new nodes hung below older ones, whose links
+     * are still right: nodes keep their paths when edges above them are split, so their links do too.
+     */
+    void link_new_nodes(size_type first_new, std::vector<std::pair<handle_type, handle_type>> queue) {
+        for (size_type i = 0; i < queue.size(); i++) {
+            const auto parent = queue[i].first;
+            const auto node = queue[i].second;
+            const auto &label = all_nodes[node].label_;
+
+            if (parent == root)
+                all_nodes[node].set_suffix(descend(root, label.substr(1)));
+            else
+                all_nodes[node].set_suffix(descend(all_nodes[parent].get_suffix(), label));
+
+            for (auto &p: all_nodes[node].children_)
+                if (p.second >= first_new)
+                    queue.emplace_back(node, p.second);
+        }
+    }
+
+    /**
+     * Length of the longest common prefix of two labels.
+     */
+    static size_type common_prefix(const key_type &a, const key_type &b) {
+        size_type length = 0;
+        for (auto ia = a.begin(), ib = b.begin(); ia != a.end() && ib != b.end(); ++ia, ++ib, ++length)
+            if (*ia < *ib || *ib < *ia)
+                break;
+
+        return length;
+    }
+
+    /// Length given to the key of a streamed put while its end is not known, see begin_put
+    enum : size_type { open_length = size_type(-1) / 2 };
+
+    /**
+     * State of a streamed put, between begin_put and end_put.
+     *
+     * Leaves created meanwhile are open: they are labeled as if the key were open_length elements long,
+     * so the active point never reaches their end, and end_put cuts them to the real length.
+     */
+    struct Stream {
+        /// tree-owned copy of the key, the last entry of records_
+        T_String *record;
+        Insertion insertion;
+        mapped_type value;
+        /// number of elements appended so far
+        size_type length;
+        /// handle of the first node created since begin_put
+        size_type first_node;
+    };
+
+    /// Keys owned by the tree: copied by streamed puts, or moved in by put
+    std::vector<T_String *> records_;
+    std::unique_ptr<Stream> stream_;
+
+    static bool is_open(const key_type &label) { return label.size() > open_length / 2; }
+
+    template<typename T>
+    static auto has_capacity(int) -> decltype(std::declval<T &>().capacity(), std::true_type());
+
+    template<typename T>
+    static std::false_type has_capacity(...);
+
+    /**
+     * Moves the labels and the active point of the streamed put from its record to <tt>copy</tt>, which replaces it.
+     */
+    void replace_record(T_String *copy) {
+        const T_String &from = *stream_->record;
+        const T_String &to = *copy;
+
+        auto &insertion = stream_->insertion;
+        insertion.active.pos = to.begin() + (insertion.active.pos - from.begin());
+        insertion.end = to.end();
+
+        if (!from.empty()) {
+            // only labels of nodes created since begin_put can point into the record, among other keys
+            const auto first = std::addressof(*from.begin());
+            const auto last = first + from.size();
+            const std::less<decltype(first)> less;
+
+            for (auto i = stream_->first_node; i < all_nodes.size(); i++) {
+                auto &label = all_nodes[(handle_type) i].label_;
+                const auto p = std::addressof(*label.begin());
+                if (less(p, first) || !less(p, last))
+                    continue;
+
+                const auto begin = to.begin() + (label.begin() - from.begin());
+                const auto size = label.size();
+                label = key_type(begin, is_open(label) ? to.end() : begin + size, size);
+            }
+        }
+
+        delete stream_->record;
+        stream_->record = records_.back() = copy;
+    }
+
+    /**
+     * Makes room for <tt>extra</tt> more elements in the record of the streamed put.
+     *
+     * Containers with a capacity (std::vector, std::string) would reallocate by themselves and leave the labels
+     * pointing into the old storage, so they are grown here instead, by doubling, and the labels are moved over.
+     */
+    void reserve_record(size_type extra, std::true_type) {
+        const auto &record = *stream_->record;
+        if (record.size() + extra <= record.capacity())
+            return;
+
+        auto copy = new T_String;
+        copy->reserve(std::max(2 * record.capacity(), record.size() + extra));
+        copy->insert(copy->end(), record.begin(), record.end());
+        replace_record(copy);
+    }
+
+    /// Other containers (std::list) keep their iterators valid when appended to
+    void reserve_record(size_type, std::false_type) {}
+
+    /**
+     * Gives back the spare capacity of the record of the streamed put.
+     */
+    void shrink_record(std::true_type) {
+        const auto &record = *stream_->record;
+        if (record.capacity() > record.size())
+            replace_record(new T_String(record.begin(), record.end()));
+    }
+
+    void shrink_record(std::false_type) {}
+
+    /**
+     * Inserts into <tt>set</tt> all the values of the subtree of <tt>node</tt>.
+     *
+     * The top of the subtree is walked by the calling thread alone, so that small subtrees never reach the pool.
+     * Past parallel_threshold_ nodes, the nodes left to visit are handed to the pool, every worker collects
+     * the values of the nodes it visits on its own, and the per-worker values are sorted and merged at the end.
+     */
+    void collect_parallel(handle_type node, std::set<mapped_type> &set) const {
+        std::vector<handle_type> stack{node};
+        for (size_type visited = 0; !stack.empty() && visited < parallel_threshold_; visited++) {
+            const auto &current = all_nodes[stack.back()];
+            stack.pop_back();
+
+            set.insert(current.data_.begin(), current.data_.end());
+            for (auto &p: current.children_)
+                stack.push_back(p.second);
+        }
+        if (stack.empty())
+            return;
+
+        std::vector<std::vector<mapped_type>> partial(pool_->size());
+        pool_->run(stack, [this, &partial](handle_type node, std::size_t worker,
+                                           WorkStealingPool::Job<handle_type> &job) {
+            auto &values = partial[worker];
+            // go on with one child, leave the others to be stolen
+            while (node != null_handle) {
+                const auto &current = all_nodes[node];
+                values.insert(values.end(), current.data_.begin(), current.data_.end());
+
+                handle_type next = null_handle;
+                for (auto &p: current.children_) {
+                    if (next != null_handle)
+                        job.spawn(worker, next);
+                    next = p.second;
+                }
+                node = next;
+            }
+        });
+
+        std::vector<size_type> workers;
+        for (size_type i = 0; i < partial.size(); i++) workers.push_back(i);
+        pool_->run(workers, [&partial](size_type i, std::size_t, WorkStealingPool::Job<size_type> &) {
+            auto &values = partial[i];
+            std::sort(values.begin(), values.end());
+            values.erase(std::unique(values.begin(), values.end(), [](const mapped_type &a, const mapped_type &b) {
+                return !(a < b) && !(b < a);
+            }), values.end());
+        });
+
+        // pairwise merges, then one ordered pass into the set
+        for (size_type width = 1; width < partial.size(); width *= 2)
+            for (size_type i = 0; i + width < partial.size(); i += 2 * width) {
+                std::vector<mapped_type> merged;
+                merged.reserve(partial[i].size() + partial[i + width].size());
+                std::set_union(partial[i].begin(), partial[i].end(), partial[i + width].begin(),
+                               partial[i + width].end(), std::back_inserter(merged));
+                partial[i].swap(merged);
+                std::vector<mapped_type>().swap(partial[i + width]);
+            }
+        for (auto &value: partial[0])
+            set.insert(set.end(), value);
+    }
+
+    /**
+     * Values of the keys containing <tt>word</tt>, at most <tt>count</tt> of them, see search.
+     */
+    std::set<mapped_type> find_values(const T_String &word, int count) const {
+        std::set<mapped_type> result;
+        handle_type tmp;
+
+        const bool parallel = pool_ && count < 0;
+
+        if (layout_.built()) {
+            auto slot = layout_.find(word);
+            if (slot == layout_.npos)
+                return result;
+            if (!listing_.built() && !parallel) {
+                layout_.get_data(slot, result, count);
+                return result;
+            }
+            tmp = layout_.source(slot);
+        } else {
+            tmp = search_node(word);
+            if (tmp == null_handle)
+                return result;
+        }
+
+        collect_values(tmp, result, count);
+        return result;
+    }
+
+    /**
+     * Inserts into <tt>result</tt> the values of the subtree of <tt>node</tt>, until it holds <tt>count</tt> values,
+     * from the document listing, on the pool or by walking the subtree.
+     */
+    void collect_values(handle_type node, std::set<mapped_type> &result, int count) const {
+        if (listing_.built())
+            listing_.list(listing_.range(node).first, listing_.range(node).second, result, count);
+        else if (pool_ && count < 0)
+            collect_parallel(node, result);
+        else
+            get_data(node, result, count);
+    }
+
+    /**
+     * Finds the node of every word of <tt>words</tt> like search_node, null_handle for those that are missing,
+     * advancing up to <tt>width</tt> of the descents in turns, one step each.
+     *
+     * A descent is a chain of dependent cache misses: the child handle is only known once the node is loaded,
+     * and the label elements once the child is. Each step of a descent ends by prefetching what its next step
+     * reads, the steps of the other descents run while it arrives, and the memory system serves many misses
+     * at once instead of one after the other.
+     */
+    std::vector<handle_type> search_nodes(const std::vector<const T_String *> &words, size_type width) const {
+        using word_iterator = typename key_type::const_iterator;
+        enum class Step { child, label, compare };
+        struct Descent {
+            size_type word;
+            handle_type node;
+            word_iterator it;
+            word_iterator end;
+            Step step;
+        };
+
+        std::vector<handle_type> nodes(words.size(), null_handle);
+        std::vector<Descent> active;
+        size_type next = 0;
+
+        while (next < words.size() || !active.empty()) {
+            // fill up the free places
+            while (active.size() < width && next < words.size()) {
+                const auto &word = *words[next];
+                if (std::begin(word) != std::end(word))
+                    active.push_back(Descent{next, root, std::begin(word), std::end(word), Step::child});
+                next++;
+            }
+
+            for (size_type i = 0; i < active.size();) {
+                auto &descent = active[i];
+                bool done = false;
+
+                switch (descent.step) {
+                    case Step::child:
+                        // the node has arrived: find the child for the next element
+                        descent.node = all_nodes[descent.node].get_child(*descent.it);
+                        if (descent.node == null_handle) {
+                            done = true;
+                            break;
+                        }
+                        SUFFIX_TREE_PREFETCH(&all_nodes[descent.node]);
+                        ++descent.it;
+                        descent.step = Step::label;
+                        break;
+
+                    case Step::label: {
+                        // the child has arrived: fetch the elements of its label
+                        const auto &label = all_nodes[descent.node].label_;
+                        if (descent.it == descent.end || label.size() == 1) {
+                            descent.step = Step::compare;
+                            continue;
+                        }
+                        SUFFIX_TREE_PREFETCH(&*label.begin());
+                        descent.step = Step::compare;
+                        break;
+                    }
+
+                    case Step::compare: {
+                        // the label has arrived: compare the rest of it, the first element matched the child lookup
+                        const auto &label = all_nodes[descent.node].label_;
+                        auto il = label.begin();
+                        const auto label_end = label.end();
+                        for (++il; descent.it != descent.end && il != label_end; ++descent.it, ++il) {
+                            SUFFIX_TREE_COUNT(search_label_compares);
+                            if (*descent.it < *il || *il < *descent.it) {
+                                descent.node = null_handle;
+                                break;
+                            }
+                        }
+
+                        if (descent.node == null_handle || descent.it == descent.end) {
+                            done = true;
+                            break;
+                        }
+                        descent.step = Step::child;
+                        break;
+                    }
+                }
+
+                if (done) {
+                    nodes[descent.word] = descent.node;
+                    descent = active.back();
+                    active.pop_back();
+                } else
+                    i++;
+            }
+        }
+
+        return nodes;
+    }
+
+    /// Whether the elements are byte-sized integers, the only ones a q-gram table indexes
+    using has_byte_elements = std::integral_constant<bool,
+            sizeof(element_type) == 1 && std::is_integral<element_type>::value>;
+
+    /**
+     * Adds the q-grams of the keys of <tt>other</tt> to the table of this tree, before <tt>other</tt> is merged
+     * into it: from the table of <tt>other</tt> if it has one of the same q, else from a walk of <tt>other</tt>.
+     */
+    void merge_short_queries(const SuffixTree &other, std::true_type) {
+        if (other.qgrams_ && other.qgrams_->q() == qgrams_->q()) {
+            qgrams_->merge(*other.qgrams_);
+            return;
+        }
+
+        QGramTable<element_type, mapped_type> added(qgrams_->q());
+        other.build_short_queries(added);
+        qgrams_->merge(added);
+    }
+
+    /// No table can be built for other elements
+    void merge_short_queries(const SuffixTree &, std::false_type) {}
+
+    /**
+     * Fills the q-gram table <tt>table</tt> from the tree: every q-gram ends on the edge into some node at most
+     * q elements deep, and is in the keys of the values of its subtree.
+     */
+    void build_short_queries(QGramTable<element_type, mapped_type> &table) const {
+        table.clear();
+        const auto q = table.q();
+
+        // (node, elements on the path to it), and the path of the current node
+        std::vector<std::pair<handle_type, size_type>> stack;
+        std::vector<element_type> path;
+        for (auto &p: all_nodes[root].children_)
+            stack.emplace_back(p.second, 0);
+
+        PostingList<mapped_type> values;
+        while (!stack.empty()) {
+            auto node = stack.back().first;
+            auto depth = stack.back().second;
+            stack.pop_back();
+
+            const auto &label = all_nodes[node].label_;
+            path.resize(depth);
+            for (auto it = label.begin(); it != label.end() && path.size() < q; ++it)
+                path.push_back(*it);
+
+            values.clear();
+            collect_postings(node, values);
+            values.normalize();
+            for (auto length = depth + 1; length <= path.size(); length++)
+                table.assign(path.begin(), length, values.begin(), values.end());
+
+            if (path.size() < q)
+                for (auto &p: all_nodes[node].children_)
+                    stack.emplace_back(p.second, path.size());
+        }
+    }
+
+    /**
+     * Node whose subtree holds the values of the keys containing <tt>word</tt>, null_handle if there is none.
+     */
+    handle_type locate(const T_String &word) const {
+        if (!layout_.built())
+            return search_node(word);
+        auto slot = layout_.find(word);
+        return slot == layout_.npos ? null_handle : layout_.source(slot);
+    }
+
+    /**
+     * Estimated number of values in the subtree of <tt>node</tt>, found for a word of <tt>length</tt> elements,
+     * to order the words of a query. The document listing knows it up to repeated values; without it, leaves
+     * come first with their exact count, then longer words, which tend to occur in fewer keys.
+     */
+    size_type estimate_values(handle_type node, size_type length) const {
+        const auto &current = all_nodes[node];
+        if (listing_.built())
+            return listing_.range(node).second - listing_.range(node).first;
+        if (current.children_.empty())
+            return current.data_.size();
+        return std::numeric_limits<size_type>::max() - length;
+    }
+
+    /**
+     * Appends to <tt>postings</tt> the distinct values of the subtree of <tt>node</tt>.
+     */
+    void collect_postings(handle_type node, PostingList<mapped_type> &postings) const {
+        if (listing_.built())
+            listing_.list(listing_.range(node).first, listing_.range(node).second,
+                          [&postings](const mapped_type &value) {
+                              postings.push_back(value);
+                              return true;
+                          });
+        else
+            traverse(node, [this, &postings](handle_type current) {
+                postings.append(all_nodes[current].data_.begin(), all_nodes[current].data_.end());
+                return true;
+            });
+    }
+
+    /**
+     * Marks in <tt>found</tt> the candidates that are values of the subtree of <tt>node</tt>, and returns how many are.
+     * The subtree is walked without collecting its values, and no further than until every candidate is found.
+     */
+    size_type probe_postings(handle_type node, const PostingList<mapped_type> &candidates,
+                             std::vector<bool> &found) const {
+        found.assign(candidates.size(), false);
+        size_type hits = 0;
+        auto probe = [&candidates, &found, &hits](const mapped_type &value) {
+            auto i = candidates.find(value);
+            if (i != candidates.size() && !found[i]) {
+                found[i] = true;
+                hits++;
+            }
+            return hits != candidates.size();
+        };
+
+        if (listing_.built())
+            listing_.list(listing_.range(node).first, listing_.range(node).second, probe);
+        else
+            traverse(node, [this, &probe](handle_type current) {
+                for (const auto &value: all_nodes[current].data_)
+                    if (!probe(value))
+                        return false;
+                return true;
+            });
+        return hits;
+    }
+
+    /**
+     * Drops from <tt>candidates</tt> the values of the keys containing any of <tt>excluded</tt>.
+     */
+    void exclude_postings(PostingList<mapped_type> &candidates, const std::vector<T_String> &excluded) const {
+        std::vector<bool> found;
+        for (const auto &word: excluded) {
+            if (candidates.empty())
+                return;
+            auto node = locate(word);
+            if (node != null_handle && probe_postings(node, candidates, found))
+                candidates.retain(found, false);
+        }
+    }
+
+    /**
+     * Per-node figures of the repeats of the tree, indexed by handle, see tabulate_repeats.
+     */
+    struct RepeatTable {
+        std::vector<handle_type> parent;
+        /// length of the path from the root
+        std::vector<size_type> depth;
+        /// number of (value, suffix) pairs in the subtree: the occurrences of the path, counted once per value
+        std::vector<size_type> occurrences;
+        /// number of distinct values in the subtree
+        std::vector<size_type> frequency;
+        /// largest number of occurrences of a node whose suffix link leads here, 0 if there is none
+        std::vector<size_type> left_occurrences;
+    };
+
+    /**
+     * Fills a RepeatTable in one depth-first pass over the nodes, plus one over their suffix links.
+     *
+     * Distinct values are counted as in Hui's color set size algorithm: every value is counted at each node
+     * it is found at, and uncounted once at the lowest common ancestor of every two nodes consecutive in
+     * depth-first order that hold it, found by Tarjan's offline algorithm (a node leaves its set for its parent's
+     * once visited). Every subtree of the root is independent of the others, so they are handed to the pool of
+     * enable_parallel_collection when there is one.
+     */
+    RepeatTable tabulate_repeats() const {
+        assert(!stream_);
+        const auto n = all_nodes.size();
+        RepeatTable table;
+        table.parent.assign(n, null_handle);
+        table.depth.assign(n, 0);
+        table.occurrences.assign(n, 0);
+        table.frequency.assign(n, 0);
+        table.left_occurrences.assign(n, 0);
+
+        // Tarjan's disjoint sets, distinct values counted (and uncounted) so far in each subtree
+        std::vector<handle_type> sets(n);
+        std::vector<std::ptrdiff_t> distinct(n, 0);
+
+        auto find = [&sets](handle_type node) {
+            auto top = node;
+            while (sets[top] != top) top = sets[top];
+            while (sets[node] != top) {
+                auto next = sets[node];
+                sets[node] = top;
+                node = next;
+            }
+            return top;
+        };
+
+        auto walk = [this, &table, &sets, &distinct, &find](handle_type top) {
+            // last node holding each value, in depth-first order
+            std::map<mapped_type, handle_type> last;
+
+            traverse(top, [this, &table, &sets, &distinct, &find, &last](handle_type node) {
+                const auto &current = all_nodes[node];
+                sets[node] = node;
+                table.depth[node] = table.depth[table.parent[node]] + current.label_.size();
+                for (auto &p: current.children_)
+                    table.parent[p.second] = node;
+
+                table.occurrences[node] = current.data_.size();
+                distinct[node] += (std::ptrdiff_t) current.data_.size();
+                for (const auto &value: current.data_) {
+                    auto it = last.insert(std::make_pair(value, node)).first;
+                    if (it->second != node) {
+                        distinct[find(it->second)]--;
+                        it->second = node;
+                    }
+                }
+                return true;
+            }, [&table, &sets, &distinct, top](handle_type node) {
+                table.frequency[node] = (size_type) distinct[node];
+                if (node == top)
+                    return;
+                const auto parent = table.parent[node];
+                sets[node] = parent;
+                distinct[parent] += distinct[node];
+                table.occurrences[parent] += table.occurrences[node];
+            });
+        };
+
+        std::vector<handle_type> tops;
+        for (auto &p: all_nodes[root].children_) {
+            table.parent[p.second] = root;
+            tops.push_back(p.second);
+        }
+        if (pool_)
+            pool_->run(tops, [&walk](handle_type top, std::size_t, WorkStealingPool::Job<handle_type> &) {
+                walk(top);
+            });
+        else
+            for (auto top: tops) walk(top);
+
+        for (size_type node = 1; node < n; node++) {
+            auto &left = table.left_occurrences[all_nodes[(handle_type) node].get_suffix()];
+            left = std::max(left, table.occurrences[node]);
+        }
+        return table;
+    }
+
+    /**
+     * The path from the root to <tt>node</tt>, as a string.
+     */
+    T_String path_of(handle_type node, const RepeatTable &table) const {
+        std::vector<handle_type> nodes;
+        for (; node != root; node = table.parent[node])
+            nodes.push_back(node);
+
+        T_String path;
+        for (auto it = nodes.rbegin(); it != nodes.rend(); ++it) {
+            const auto &label = all_nodes[*it].label_;
+            path.insert(path.end(), label.begin(), label.end());
+        }
+        return path;
+    }
+
+    Repeat make_repeat(handle_type node, const RepeatTable &table) const {
+        return Repeat{path_of(node, table), table.depth[node], table.occurrences[node], table.frequency[node]};
+    }
+
+    /**
+     * Copies the node <tt>node</tt> of <tt>other</tt> and its subtree into this tree
+     * and returns the handle of the copy, which isn't the child of any node yet.
+     */
+    handle_type adopt_subtree(const SuffixTree &other, handle_type node) {
+        handle_type top = null_handle;
+        // (node of other, parent of its copy in this tree)
+        std::vector<std::pair<handle_type, handle_type>> stack{{node, null_handle}};
+
+        while (!stack.empty()) {
+            const auto &source = other.all_nodes[stack.back().first];
+            const auto parent = stack.back().second;
+            stack.pop_back();
+
+            auto copy = make_node(source.label_);
+            all_nodes[copy].data_.insert(source.data_.begin(), source.data_.end());
+            if (parent == null_handle)
+                top = copy;
+            else
+                all_nodes[parent].add_child(*source.label_.begin(), copy);
+
+            for (auto &p: source.children_)
+                stack.emplace_back(p.second, copy);
+        }
+
+        return top;
+    }
+
+    void put_owned(T_String &&string, const mapped_type &index, std::false_type) {
+        assert(!stream_);
+        records_.push_back(new T_String(std::move(string)));
+        put(*records_.back(), index);
+    }
+
+    /// A view owns nothing, it is stored as it is
+    void put_owned(T_String &&string, const mapped_type &index, std::true_type) {
+        put(string, index);
+    }
+
+public:
+    SuffixTree() {
+        make_node(key_type());
+    }
+
+    SuffixTree(const SuffixTree &) = delete;
+
+    SuffixTree &operator=(const SuffixTree &) = delete;
 
     ~SuffixTree() {
-        for (auto &e: all_nodes) delete e;
-        for (auto &e: all_edges) delete e;
+        for (auto &e: records_) delete e;
+    }
+
+    /**
+     * Moves all the keys of <tt>other</tt> into this tree, leaving <tt>other</tt> empty.
+     *
+     * Both trees are traversed together from their roots: edges that only exist in the smaller tree are copied over
+     * with their whole subtrees, edges whose labels diverge are split, and nodes reached by the same path have their
+     * values united. Only the nodes created that way are given suffix links, the others keep theirs. This costs time
+     * proportional to the smaller tree plus the structure the two trees share, instead of putting every key of one
+     * tree again.
+     *
+     * With short queries enabled, the q-gram lists of <tt>other</tt> are added to those of this tree, which costs
+     * time proportional to them; if <tt>other</tt> has no table of the same q, its lists are first computed by
+     * walking it whole, as enable_short_queries would.
+     *
+     * The keys that were put into <tt>other</tt> must outlive this tree.
+     */
+    void merge(SuffixTree &&other) {
+        if (&other == this)
+            return;
+        assert(!stream_ && !other.stream_);
+
+        listing_.clear();
+        other.listing_.clear();
+        layout_.clear();
+        other.layout_.clear();
+        generation_++;
+        other.generation_++;
+
+        if (qgrams_)
+            merge_short_queries(other, has_byte_elements());
+
+        // walk the smaller tree
+        if (other.all_nodes.size() > all_nodes.size())
+            all_nodes.swap(other.all_nodes);
+
+        // nodes created from here on need suffix links, the others keep theirs
+        const size_type first_new = all_nodes.size();
+        // (node of this tree, new node hung below it) for the nodes that were already in the tree
+        std::vector<std::pair<handle_type, handle_type>> attached;
+
+        // (node of this tree, node of other that must become one of its children)
+        std::vector<std::pair<handle_type, handle_type>> pending;
+        const auto &other_root = other.all_nodes[root];
+        all_nodes[root].data_.insert(other_root.data_.begin(), other_root.data_.end());
+        for (auto &p: other_root.children_)
+            pending.emplace_back(root, p.second);
+
+        while (!pending.empty()) {
+            auto node = pending.back().first;
+            auto handle = pending.back().second;
+            pending.pop_back();
+            auto &source = other.all_nodes[handle];
+
+            auto own_child = all_nodes[node].get_child(*source.label_.begin());
+            if (own_child == null_handle) {
+                const auto copy = adopt_subtree(other, handle);
+                all_nodes[node].add_child(*source.label_.begin(), copy);
+                if (node < first_new)
+                    attached.emplace_back(node, copy);
+                continue;
+            }
+
+            const auto &own_label = all_nodes[own_child].label_;
+            const auto length = common_prefix(own_label, source.label_);
+            auto target = own_child;
+            if (length < own_label.size()) {
+                target = split_edge(node, own_child, length);
+                if (node < first_new)
+                    attached.emplace_back(node, target);
+            }
+
+            if (length < source.label_.size()) {
+                // the rest of the edge hangs below the shared part
+                source.label_ = source.label_.substr(length);
+                pending.emplace_back(target, handle);
+                continue;
+            }
+
+            all_nodes[target].data_.insert(source.data_.begin(), source.data_.end());
+            for (auto &p: source.children_)
+                pending.emplace_back(target, p.second);
+        }
+
+        other.all_nodes.clear();
+        records_.insert(records_.end(), other.records_.begin(), other.records_.end());
+        other.records_.clear();
+        other.make_node(key_type());
+        if (other.qgrams_)
+            other.qgrams_->clear();
+
+        link_new_nodes(first_new, std::move(attached));
+    }
+
+    /**
+     * Allocates room for the nodes of keys of <tt>total_elements</tt> elements in all, so that putting them
+     * doesn't grow the tree's storage: a generalized suffix tree of n elements has at most 2n nodes.
+     */
+    void reserve(size_type total_elements) {
+        all_nodes.reserve(2 * total_elements);
+    }
+
+    /**
+     * Removes all the keys, leaving the tree as it was constructed, but keeps the storage of its nodes
+     * for the next keys: rebuilding a tree of about the same size then allocates nothing for them.
+     */
+    void clear() {
+        assert(!stream_);
+        for (auto &e: records_) delete e;
+        records_.clear();
+
+        listing_.clear();
+        layout_.clear();
+        generation_++;
+
+        all_nodes.reset();
+        make_node(key_type());
+        if (qgrams_)
+            qgrams_->clear();
+    }
+
+    /**
+     * Number of nodes the tree holds without allocating, see reserve.
+     */
+    size_type node_capacity() const { return all_nodes.capacity(); }
+
+    /**
+     * Number of nodes in the tree, root included.
+     */
+    size_type node_count() const { return all_nodes.size(); }
+
+    /**
+     * Number of edges in the tree, one into every node but the root.
+     */
+    size_type edge_count() const { return all_nodes.size() - 1; }
+
+    /**
+     * Switches search to document listing: the values of all nodes are laid out in depth-first order, so that
+     * the subtree of any node covers one range of them, and search lists the distinct values of that range
+     * in time proportional to their number instead of visiting the whole subtree.
+     *
+     * Worth it when short words match many more suffixes than keys. The listing takes about
+     * 4 + sizeof(mapped_type) bytes per (node, value) pair plus 8 bytes per node and is dropped by the next put or merge,
+     * after which search walks the subtree again until this is called anew.
+     */
+    void build_document_listing() {
+        listing_.clear();
+        // a listing may pick other values than the tree when a search has a count
+        generation_++;
+
+        traverse(root, [this](handle_type node) {
+            listing_.enter(node);
+            for (const auto &value: all_nodes[node].data_)
+                listing_.push_back(value);
+            return true;
+        }, [this](handle_type node) {
+            listing_.leave(node);
+        });
+
+        listing_.build();
+    }
+
+    bool has_document_listing() const { return listing_.built(); }
+
+    /**
+     * Copies the tree into a compact array-based layout, in breadth-first order, that search uses from then on:
+     * children are contiguous and edges are inlined into them, so a search touches far fewer cache lines.
+     *
+     * The copy takes about 40 bytes per node plus one mapped_type per value, on top of the tree,
+     * and is dropped by the next put or merge.
+     */
+    void optimize_layout() {
+        layout_.build(all_nodes);
+        generation_++;
+    }
+
+    bool has_optimized_layout() const { return layout_.built(); }
+
+    /**
+     * Lets search collect the values of large subtrees on <tt>threads</tt> worker threads (plus the searching one),
+     * which cuts the latency of broad queries, such as very short words, on many cores.
+     *
+     * Only searches for all the values (no count) of subtrees of more than <tt>min_nodes</tt> nodes are parallel.
+     * A document listing, when built, is faster still and takes precedence. Parallel collections of concurrent
+     * searches on the same tree run one at a time.
+     */
+    void enable_parallel_collection(size_type threads, size_type min_nodes = 4096) {
+        pool_.reset(threads ? new WorkStealingPool(threads) : nullptr);
+        parallel_threshold_ = min_nodes;
+    }
+
+    void disable_parallel_collection() { pool_.reset(); }
+
+    /**
+     * Keeps the results of the last <tt>capacity</tt> distinct searches (word and count), so that a repeated
+     * search returns a copy of its result instead of walking the tree again. The least recently used result
+     * is evicted first.
+     *
+     * Any put, merge, document listing or layout change invalidates all cached results at once.
+     * Concurrent searches share the cache, which is locked for the lookup and the insertion of each result.
+     */
+    void enable_result_cache(size_type capacity) {
+        cache_.reset(capacity ? new ResultCache<element_type, mapped_type>(capacity) : nullptr);
+    }
+
+    void disable_result_cache() { cache_.reset(); }
+
+    /**
+     * Hits and misses of the result cache since enable_result_cache, all zero when it is disabled.
+     */
+    ResultCacheStats result_cache_stats() const { return cache_ ? cache_->stats() : ResultCacheStats(); }
+
+    /**
+     * Keeps the values of the keys containing every word of 1 to <tt>q</tt> elements (q <= 3) in a direct lookup
+     * table, so that searching such a word is one array load and a copy of its values, instead of a descent
+     * and a walk of what is often a very large subtree. Only for byte-sized elements.
+     *
+     * The table is filled from the tree once, then kept up to date by put, end_put, merge and clear.
+     * It takes 256^q slots of 4 bytes (64 KB for q = 2, 67 MB for q = 3) plus one mapped_type per q-gram
+     * and key containing it. Searches with a count return the smallest values.
+     */
+    void enable_short_queries(size_type q = 2) {
+        assert(!stream_);
+        qgrams_.reset(new QGramTable<element_type, mapped_type>(q));
+        build_short_queries(*qgrams_);
+        generation_++;
+    }
+
+    void disable_short_queries() {
+        qgrams_.reset();
+        generation_++;
+    }
+
+    bool has_short_queries() const { return qgrams_ != nullptr; }
+
+    /**
+     * Searches for the given word within the GST and returns at most the given number of matches.
+     *
+     * @param word the key to search for
+     * @param count the max number of results to return
+     * @return at most <tt>results</tt> values for the given word
+     */
+    std::set<mapped_type> search(const T_String &word, int count) const {
+        SUFFIX_TREE_TIMED_SCOPE(search_latency);
+        assert(!stream_);
+        if (qgrams_ && qgrams_->covers(std::begin(word), std::end(word))) {
+            SUFFIX_TREE_COUNT(short_query_hits);
+            return qgrams_->find(std::begin(word), std::end(word), count);
+        }
+        if (!cache_)
+            return find_values(word, count);
+
+        std::set<mapped_type> result;
+        if (cache_->find(std::begin(word), std::end(word), count, generation_, result))
+            return result;
+
+        result = find_values(word, count);
+        cache_->insert(std::begin(word), std::end(word), count, generation_, result);
+        return result;
+    }
+
+    /**
+     * Searches for every word of <tt>words</tt> at once, see search, and returns their results in the same order.
+     *
+     * The descents of the words through the tree are interleaved, <tt>width</tt> of them at a time, so that
+     * their cache misses overlap instead of each one waiting for the previous one: on trees much larger than
+     * the cache, finding the words is several times faster than one search after the other. Words answered
+     * by the q-gram table or the compact layout are searched one by one. With the result cache enabled, the
+     * words found in it are answered from it and only the others are interleaved, their results then cached.
+     */
+    std::vector<std::set<mapped_type>> search_batch(const std::vector<T_String> &words, int count = -1,
+                                                    size_type width = 16) const {
+        assert(!stream_);
+        assert(width > 0);
+        std::vector<std::set<mapped_type>> results(words.size());
+
+        std::vector<const T_String *> pending;
+        std::vector<size_type> positions;
+        for (size_type i = 0; i < words.size(); i++) {
+            const auto &word = words[i];
+            if (layout_.built() || (qgrams_ && qgrams_->covers(std::begin(word), std::end(word))))
+                results[i] = search(word, count);
+            else if (cache_ && cache_->find(std::begin(word), std::end(word), count, generation_, results[i]))
+                continue;
+            else {
+                pending.push_back(&word);
+                positions.push_back(i);
+            }
+        }
+
+        const auto nodes = search_nodes(pending, width);
+        for (size_type i = 0; i < nodes.size(); i++)
+            if (nodes[i] != null_handle)
+                collect_values(nodes[i], results[positions[i]], count);
+        if (cache_)
+            for (size_type i = 0; i < pending.size(); i++)
+                cache_->insert(std::begin(*pending[i]), std::end(*pending[i]), count, generation_, results[positions[i]]);
+        return results;
+    }
+
+    /**
+     * Searches for the given word within the GST.
+     *
+     * Returns all the indexes for which the key contains the <tt>word</tt> that was
+     * supplied as input.
+     *
+     * @param word the key to search for
+     * @return the collection of indexes associated with the input <tt>word</tt>
+     */
+    std::set<mapped_type> search(const T_String &word) const {
+        return search(word, -1);
+    }
+
+    /**
+     * Returns the values of the keys that contain every one of <tt>words</tt> and none of <tt>excluded</tt>.
+     *
+     * The words are looked up first, and any missing one ends the query. Only the values of the word expected
+     * to have the fewest (see build_document_listing) are collected, into a sorted list of candidates; the subtrees
+     * of the other words are then walked without collecting their values, looking up each of them among
+     * the candidates and stopping once all are found. Candidates not found are dropped, and an empty list
+     * ends the query. No set of values is built but the result.
+     */
+    std::set<mapped_type> search_all(const std::vector<T_String> &words,
+                                     const std::vector<T_String> &excluded = std::vector<T_String>()) const {
+        assert(!stream_);
+        std::set<mapped_type> result;
+
+        // (estimated number of values, node) of every word
+        std::vector<std::pair<size_type, handle_type>> terms;
+        for (const auto &word: words) {
+            auto node = locate(word);
+            if (node == null_handle)
+                return result;
+            terms.emplace_back(estimate_values(node, std::distance(std::begin(word), std::end(word))), node);
+        }
+        if (terms.empty())
+            return result;
+        std::sort(terms.begin(), terms.end());
+
+        PostingList<mapped_type> candidates;
+        collect_postings(terms[0].second, candidates);
+        candidates.normalize();
+
+        std::vector<bool> found;
+        for (size_type i = 1; i < terms.size() && !candidates.empty(); i++) {
+            if (terms[i].second == terms[i - 1].second)
+                // words ending on the same node have the same values
+                continue;
+            if (probe_postings(terms[i].second, candidates, found) != candidates.size())
+                candidates.retain(found, true);
+        }
+
+        exclude_postings(candidates, excluded);
+        result.insert(candidates.begin(), candidates.end());
+        return result;
+    }
+
+    /**
+     * Returns the values of the keys that contain any of <tt>words</tt> and none of <tt>excluded</tt>.
+     */
+    std::set<mapped_type> search_any(const std::vector<T_String> &words,
+                                     const std::vector<T_String> &excluded = std::vector<T_String>()) const {
+        assert(!stream_);
+        std::vector<handle_type> nodes;
+        for (const auto &word: words) {
+            auto node = locate(word);
+            if (node != null_handle)
+                nodes.push_back(node);
+        }
+        std::sort(nodes.begin(), nodes.end());
+        nodes.erase(std::unique(nodes.begin(), nodes.end()), nodes.end());
+
+        PostingList<mapped_type> candidates;
+        for (auto node: nodes)
+            collect_postings(node, candidates);
+        candidates.normalize();
+
+        exclude_postings(candidates, excluded);
+        return std::set<mapped_type>(candidates.begin(), candidates.end());
+    }
+
+    /**
+     * Returns the <tt>k</tt> substrings of at least <tt>min_length</tt> elements found in the most keys (distinct
+     * values), most frequent first, then longest first.
+     *
+     * Substrings that end on the same edge are in the same keys, only the longest of them, which ends on a node,
+     * is returned. A substring can be returned along with longer ones that are in the same keys; maximal_repeats
+     * leaves those out.
+     */
+    std::vector<Repeat> frequent_repeats(size_type k, size_type min_length = 1) const {
+        const auto table = tabulate_repeats();
+        std::vector<handle_type> nodes;
+        for (size_type node = 1; node < all_nodes.size(); node++)
+            if (table.depth[node] >= min_length)
+                nodes.push_back((handle_type) node);
+
+        auto more_frequent = [&table](handle_type a, handle_type b) {
+            if (table.frequency[a] != table.frequency[b])
+                return table.frequency[a] > table.frequency[b];
+            if (table.depth[a] != table.depth[b])
+                return table.depth[a] > table.depth[b];
+            return a < b;
+        };
+        k = std::min(k, nodes.size());
+        std::partial_sort(nodes.begin(), nodes.begin() + k, nodes.end(), more_frequent);
+
+        std::vector<Repeat> result;
+        for (size_type i = 0; i < k; i++)
+            result.push_back(make_repeat(nodes[i], table));
+        return result;
+    }
+
+    /**
+     * Returns the maximal repeats of at least <tt>min_length</tt> elements, in no particular order: the substrings
+     * occurring at least <tt>min_occurrences</tt> times (at least twice) that occur less often once extended by one
+     * element on either side.
+     *
+     * Occurrences are counted per value and suffix: where keys of one value end alike, their common suffixes
+     * count once.
+     */
+    std::vector<Repeat> maximal_repeats(size_type min_length = 1, size_type min_occurrences = 2) const {
+        const auto table = tabulate_repeats();
+        min_occurrences = std::max(min_occurrences, size_type(2));
+
+        // every node is followed by different elements (or ends a key), it is maximal unless it is always
+        // preceded by the same element: then the node for both has as many occurrences and links to it
+        std::vector<Repeat> result;
+        for (size_type node = 1; node < all_nodes.size(); node++)
+            if (table.depth[node] >= min_length && table.occurrences[node] >= min_occurrences
+                && table.left_occurrences[node] < table.occurrences[node])
+                result.push_back(make_repeat((handle_type) node, table));
+        return result;
+    }
+
+    /**
+     * Returns the supermaximal repeats of at least <tt>min_length</tt> elements, in no particular order:
+     * the repeats that are not part of any longer repeat.
+     */
+    std::vector<Repeat> supermaximal_repeats(size_type min_length = 1) const {
+        const auto table = tabulate_repeats();
+
+        std::vector<Repeat> result;
+        for (size_type node = 1; node < all_nodes.size(); node++) {
+            if (table.depth[node] < min_length || table.occurrences[node] < 2 || table.left_occurrences[node] >= 2)
+                continue;
+
+            bool longer = false;
+            for (auto &p: all_nodes[(handle_type) node].children_)
+                longer = longer || table.occurrences[p.second] >= 2;
+            if (!longer)
+                result.push_back(make_repeat((handle_type) node, table));
+        }
+        return result;
+    }
+
+    /**
+     * Calls <tt>output(from, to, length)</tt> for every two values such that the longest suffix of the key of
+     * <tt>from</tt> that is also a prefix of the key of <tt>to</tt> is <tt>length</tt> >= <tt>min_length</tt> elements
+     * long, as for assembling fragments. A key contained in the other one at its start or end overlaps it whole.
+     *
+     * Each value must have been put with a single key. Pairs are passed to <tt>output</tt> as they are found,
+     * never stored: two passes over the nodes cost time proportional to the tree plus the number of pairs,
+     * with a stack per value of the depths of its suffixes on the path to the current node (Gusfield's algorithm).
+     */
+    template<typename Output>
+    void overlaps(size_type min_length, Output output) const {
+        assert(!stream_);
+        min_length = std::max(min_length, size_type(1));
+
+        // length of the key of every value, the longest of its suffixes
+        std::vector<size_type> depth(all_nodes.size(), 0);
+        std::map<mapped_type, size_type> lengths;
+        traverse(root, [this, &depth, &lengths](handle_type node) {
+            const auto &current = all_nodes[node];
+            for (auto &p: current.children_)
+                depth[p.second] = depth[node] + all_nodes[p.second].label_.size();
+            for (const auto &value: current.data_) {
+                auto &length = lengths[value];
+                length = std::max(length, depth[node]);
+            }
+            return true;
+        });
+
+        // depths of the suffixes of at least min_length elements on the path to the current node, by value:
+        // the deepest one of each value is its longest suffix that is a prefix of the path
+        std::map<mapped_type, std::vector<size_type>> suffixes;
+        traverse(root, [this, &depth, &lengths, &suffixes, &output, min_length](handle_type node) {
+            if (depth[node] < min_length)
+                return true;
+            const auto &current = all_nodes[node];
+            for (const auto &value: current.data_)
+                suffixes[value].push_back(depth[node]);
+
+            for (const auto &to: current.data_) {
+                if (lengths.find(to)->second != depth[node])
+                    // a suffix of the key of to, not the key itself
+                    continue;
+                for (const auto &from: suffixes)
+                    if (from.first < to || to < from.first)
+                        output(from.first, to, from.second.back());
+            }
+            return true;
+        }, [this, &depth, &suffixes, min_length](handle_type node) {
+            if (depth[node] < min_length)
+                return;
+            for (const auto &value: all_nodes[node].data_) {
+                auto it = suffixes.find(value);
+                it->second.pop_back();
+                if (it->second.empty())
+                    suffixes.erase(it);
+            }
+        });
+    }
+
+    /**
+     * Adds the specified <tt>index</tt> to the GST under the given <tt>key</tt>.
+     *
+     * Indexes may be put in any order, but non-decreasing order is the fast one: every node's value set
+     * then appends the index instead of shifting its larger values. Must not be called while a put started by
+     * begin_put is in progress (asserted).
+     *
+     * @param string the string key that will be added to the index
+     * @param index the value that will be added to the index
+     */
+    void put(const T_String &string, const mapped_type &index) {
+        SUFFIX_TREE_TIMED_SCOPE(put_latency);
+        assert(!stream_);
+        key_type key(string);
+
+        if (listing_.built())
+            listing_.clear();
+        if (layout_.built())
+            layout_.clear();
+        generation_++;
+
+        // the phases of the leading elements already in the tree would only find them below the active point:
+        // skip to the state they leave, the end of that prefix with all of its suffixes implicit
+        const auto contained = contained_prefix(key);
+        SUFFIX_TREE_COUNT_N(contained_prefix_elements, contained);
+        Insertion insertion{{root, null_handle, key.begin(), contained}, contained, key.end(), null_handle};
+        canonize(insertion.active);
+
+        // proceed with tree construction (Ukkonen's algorithm, one phase per char)
+        size_type rest = key.size() - contained;
+        for (auto it = std::next(key.begin(), contained); it != key.end(); ++it, --rest)
+            extend(insertion, it, rest, index);
+
+        finish(insertion, index);
+
+        if (qgrams_)
+            qgrams_->add(key.begin(), key.end(), index);
+    }
+
+    /**
+     * Adds the specified <tt>index</tt> under a key given as a temporary, see put.
+     *
+     * The key is moved into storage owned by the tree, so it doesn't need to be kept alive.
+     * Views (see is_key_view) are stored as they are: what they refer to must still outlive the tree.
+     */
+    void put(T_String &&string, const mapped_type &index) {
+        put_owned(std::move(string), index, is_key_view<T_String>());
+    }
+
+    /**
+     * Starts adding <tt>index</tt> under a key whose elements are not known yet: they are passed in chunks to append,
+     * and end_put completes the key. Ukkonen's construction carries on from one chunk to the next, so every chunk
+     * is indexed as it arrives and the whole key is never needed at once.
+     *
+     * Unlike with put, the elements are copied into storage owned by the tree, so chunks may be destroyed
+     * after append. No other operation may be called on the tree until end_put.
+     */
+    void begin_put(mapped_type index) {
+        assert(!stream_);
+        if (listing_.built())
+            listing_.clear();
+        if (layout_.built())
+            layout_.clear();
+        generation_++;
+
+        records_.push_back(new T_String);
+        const T_String &record = *records_.back();
+        stream_.reset(new Stream{records_.back(),
+                                 Insertion{{root, null_handle, record.begin(), 0}, 0, record.end(), null_handle},
+                                 std::move(index), 0, all_nodes.size()});
+    }
+
+    /**
+     * Appends the elements in [first, last) to the key of the put started by begin_put.
+     */
+    template<typename Iterator>
+    void append(Iterator first, Iterator last) {
+        assert(stream_);
+        const auto extra = (size_type) std::distance(first, last);
+        if (!extra)
+            return;
+        reserve_record(extra, decltype(has_capacity<T_String>(0))());
+
+        auto &record = *stream_->record;
+        const T_String &view = record;
+        const bool was_empty = view.empty();
+        const auto before = was_empty ? view.end() : std::prev(view.end());
+        record.insert(record.end(), first, last);
+
+        auto &insertion = stream_->insertion;
+        insertion.end = view.end();
+        for (auto it = was_empty ? view.begin() : std::next(before); it != view.end(); ++it, stream_->length++)
+            extend(insertion, it, open_length - stream_->length, stream_->value);
+    }
+
+    void append(const T_String &chunk) {
+        append(std::begin(chunk), std::end(chunk));
+    }
+
+    /**
+     * Completes the put started by begin_put.
+     */
+    void end_put() {
+        assert(stream_);
+        shrink_record(decltype(has_capacity<T_String>(0))());
+
+        // cut the open leaves to the end of the key
+        const T_String &record = *stream_->record;
+        const auto excess = open_length - stream_->length;
+        for (auto i = stream_->first_node; i < all_nodes.size(); i++) {
+            auto &label = all_nodes[(handle_type) i].label_;
+            if (is_open(label))
+                label = key_type(label.begin(), record.end(), label.size() - excess);
+        }
+
+        stream_->insertion.end = record.end();
+        finish(stream_->insertion, stream_->value);
+        if (qgrams_)
+            qgrams_->add(record.begin(), record.end(), stream_->value);
+
+        if (record.empty()) {
+            delete records_.back();
+            records_.pop_back();
+        }
+        stream_.reset();
+    }
+};
+
+/**
+ * How ShardedSuffixTree assigns a value to a shard.
+ */
+enum class ShardingPolicy {
+    /// shard = hash(value) % shard count
+    hash,
+    /// shard = number of boundaries <= value
+    range
+};
+
+/**
+ * A set of independent SuffixTree shards behind the SuffixTree interface.
+ *
+ * Every key is stored in the shard its value maps to, so a value lives in exactly one shard and search
+ * can query all shards concurrently and union their results.
+ * Shards can be built in parallel with put_batch.
+ *
+ * Shards are queried and built on a pool of threads started with the tree, one per shard up to the number of
+ * cores, the calling thread included; with one shard or one core they run on the calling thread alone.
+ * Concurrent searches of the same tree take turns on the pool.
+ *
+ * Besides put and search, the streaming put (begin_put, append, end_put), search_batch, search_all, search_any,
+ * merge, reserve and clear are forwarded to the shards. The repeat and overlap queries (frequent_repeats,
+ * maximal_repeats, supermaximal_repeats, overlaps) are left out on purpose: the occurrences of a repeat and the two
+ * keys of an overlap may lie in different shards, which no shard can see on its own. The search accelerators
+ * (document listing, compact layout, result cache, short queries) are not forwarded either.
+ *
+ * T_Hash is only used with ShardingPolicy::hash. T_ValueSetPolicy is passed on to every shard.
+ */
+template<typename T_String, typename T_Mapped, typename T_Hash = std::hash<T_Mapped>,
+        typename T_ValueSetPolicy = InlineValues<>>
+class ShardedSuffixTree {
+public:
+    using tree_type = SuffixTree<T_String, T_Mapped, T_ValueSetPolicy>;
+    using key_type = typename tree_type::key_type;
+    using mapped_type = typename tree_type::mapped_type;
+    using size_type = typename tree_type::size_type;
+
+    struct ShardStats {
+        /// number of put calls routed to the shard
+        size_type keys = 0;
+        /// total length of those keys
+        size_type elements = 0;
+        size_type nodes = 0;
+        size_type edges = 0;
+    };
+
+private:
+    std::vector<std::unique_ptr<tree_type>> shards_;
+    std::vector<ShardStats> stats_;
+
+    ShardingPolicy policy_;
+    /// Sorted split points for ShardingPolicy::range
+    std::vector<mapped_type> boundaries_;
+    T_Hash hash_;
+
+    /// Shard of the put started by begin_put, if any
+    size_type streaming_ = 0;
+
+    /// Runs one task per shard, see for_each_shard
+    std::unique_ptr<WorkStealingPool> pool_;
+
+    void start_pool() {
+        const size_type cores = std::max(1u, std::thread::hardware_concurrency());
+        pool_.reset(new WorkStealingPool(std::min(shards_.size(), cores) - 1));
+    }
+
+    /**
+     * Calls <tt>body(shard)</tt> for every shard, shards spread over the pool.
+     */
+    template<typename Body>
+    void for_each_shard(Body body) const {
+        if (pool_->size() == 1) {
+            for (size_type shard = 0; shard < shards_.size(); shard++)
+                body(shard);
+            return;
+        }
+
+        std::vector<size_type> tasks(shards_.size());
+        std::iota(tasks.begin(), tasks.end(), size_type(0));
+        pool_->run(tasks, [&body](size_type shard, std::size_t, WorkStealingPool::Job<size_type> &) {
+            body(shard);
+        });
+    }
+
+    /**
+     * Puts the key into the shard, moving it into the shard's storage if it is given as a temporary.
+     */
+    template<typename String>
+    void put_in_shard(size_type shard, String &&string, const mapped_type &index) {
+        auto &stats = stats_[shard];
+        stats.keys++;
+        stats.elements += std::distance(std::begin(string), std::end(string));
+
+        shards_[shard]->put(std::forward<String>(string), index);
+    }
+
+    /**
+     * Routes the entries in [first, last) to their shards and calls <tt>put(shard, it)</tt> for each of them,
+     * the shards being filled in parallel.
+     */
+    template<typename Iterator, typename Put>
+    void put_routed(Iterator first, Iterator last, Put put) {
+        std::vector<std::vector<Iterator>> routed(shards_.size());
+        for (auto it = first; it != last; ++it)
+            routed[shard_of(it->second)].push_back(it);
+
+        for_each_shard([&routed, &put](size_type shard) {
+            for (auto &it: routed[shard])
+                put(shard, it);
+        });
+    }
+
+    /**
+     * Runs <tt>query</tt> on all shards concurrently and returns the union of their results.
+     */
+    template<typename Query>
+    std::set<mapped_type> unite_shards(Query query) const {
+        std::vector<std::set<mapped_type>> partial(shards_.size());
+        for_each_shard([this, &partial, &query](size_type shard) {
+            partial[shard] = query(*shards_[shard]);
+        });
+
+        auto result = std::move(partial[0]);
+        for (size_type shard = 1; shard < shards_.size(); shard++)
+            result.insert(partial[shard].begin(), partial[shard].end());
+        return result;
+    }
+
+public:
+    /**
+     * Creates <tt>shard_count</tt> shards, values are spread by hash.
+     */
+    explicit ShardedSuffixTree(size_type shard_count, T_Hash hash = T_Hash())
+            : policy_(ShardingPolicy::hash), hash_(std::move(hash)) {
+        assert(shard_count > 0);
+        for (size_type i = 0; i < shard_count; i++)
+            shards_.emplace_back(new tree_type);
+        stats_.resize(shard_count);
+        start_pool();
+    }
+
+    /**
+     * Creates <tt>boundaries.size() + 1</tt> shards, values are spread by range:
+     * shard i holds the values v with boundaries[i - 1] <= v < boundaries[i].
+     */
+    explicit ShardedSuffixTree(std::vector<mapped_type> boundaries)
+            : policy_(ShardingPolicy::range), boundaries_(std::move(boundaries)) {
+        std::sort(boundaries_.begin(), boundaries_.end());
+        for (size_type i = 0; i <= boundaries_.size(); i++)
+            shards_.emplace_back(new tree_type);
+        stats_.resize(shards_.size());
+        start_pool();
+    }
+
+    ShardingPolicy policy() const { return policy_; }
+
+    size_type shard_count() const { return shards_.size(); }
+
+    /**
+     * Returns the index of the shard that holds <tt>index</tt>.
+     */
+    size_type shard_of(const mapped_type &index) const {
+        if (policy_ == ShardingPolicy::hash)
+            return hash_(index) % shards_.size();
+        return std::upper_bound(boundaries_.begin(), boundaries_.end(), index) - boundaries_.begin();
+    }
+
+    tree_type const &shard(size_type i) const { return *shards_[i]; }
+
+    /**
+     * Per-shard statistics, in shard order.
+     */
+    std::vector<ShardStats> stats() const {
+        auto result = stats_;
+        for (size_type i = 0; i < shards_.size(); i++) {
+            result[i].nodes = shards_[i]->node_count();
+            result[i].edges = shards_[i]->edge_count();
+        }
+        return result;
+    }
+
+    /**
+     * Adds the specified <tt>index</tt> under the given <tt>key</tt>, in the shard the index maps to.
+     * See SuffixTree::put.
+     */
+    void put(const T_String &string, const mapped_type &index) {
+        put_in_shard(shard_of(index), string, index);
+    }
+
+    /**
+     * Adds the specified <tt>index</tt> under a key given as a temporary, moved into the shard's storage.
+     * See SuffixTree::put.
+     */
+    void put(T_String &&string, const mapped_type &index) {
+        put_in_shard(shard_of(index), std::move(string), index);
+    }
+
+    /**
+     * Adds a range of (key, index) pairs, building the shards in parallel.
+     * As with put, the keys must outlive the tree.
+     */
+    template<typename Iterator>
+    void put_batch(Iterator first, Iterator last) {
+        put_routed(first, last, [this](size_type shard, Iterator it) {
+            put_in_shard(shard, it->first, it->second);
+        });
+    }
+
+    /**
+     * Adds (key, index) pairs, building the shards in parallel. The keys are moved into the shards,
+     * so they don't need to be kept alive; <tt>entries</tt> is left with moved-from keys.
+     */
+    void put_batch(std::vector<std::pair<T_String, mapped_type>> &&entries) {
+        using iterator = typename std::vector<std::pair<T_String, mapped_type>>::iterator;
+        put_routed(entries.begin(), entries.end(), [this](size_type shard, iterator it) {
+            put_in_shard(shard, std::move(it->first), it->second);
+        });
+    }
+
+    /**
+     * Starts adding <tt>index</tt> under a key passed in chunks, in the shard the index maps to.
+     * See SuffixTree::begin_put.
+     */
+    void begin_put(mapped_type index) {
+        streaming_ = shard_of(index);
+        stats_[streaming_].keys++;
+        shards_[streaming_]->begin_put(std::move(index));
+    }
+
+    /**
+     * Appends the elements in [first, last) to the key of the put started by begin_put.
+     */
+    template<typename Iterator>
+    void append(Iterator first, Iterator last) {
+        stats_[streaming_].elements += std::distance(first, last);
+        shards_[streaming_]->append(first, last);
+    }
+
+    void append(const T_String &chunk) {
+        append(std::begin(chunk), std::end(chunk));
+    }
+
+    /**
+     * Completes the put started by begin_put.
+     */
+    void end_put() {
+        shards_[streaming_]->end_put();
+    }
+
+    /**
+     * Moves all the keys of <tt>other</tt> into this tree shard by shard, leaving <tt>other</tt> empty,
+     * see SuffixTree::merge. Both trees must spread values alike: same policy, shard count and boundaries
+     * (and hash, with ShardingPolicy::hash).
+     */
+    void merge(ShardedSuffixTree &&other) {
+        if (&other == this)
+            return;
+        assert(policy_ == other.policy_ && shards_.size() == other.shards_.size() && boundaries_ == other.boundaries_);
+
+        for_each_shard([this, &other](size_type shard) {
+            shards_[shard]->merge(std::move(*other.shards_[shard]));
+        });
+        for (size_type shard = 0; shard < shards_.size(); shard++) {
+            stats_[shard].keys += other.stats_[shard].keys;
+            stats_[shard].elements += other.stats_[shard].elements;
+            other.stats_[shard] = ShardStats();
+        }
+    }
+
+    /**
+     * Allocates room for keys of <tt>total_elements</tt> elements in all, assuming they spread evenly
+     * over the shards, see SuffixTree::reserve.
+     */
+    void reserve(size_type total_elements) {
+        const auto per_shard = (total_elements + shards_.size() - 1) / shards_.size();
+        for (auto &shard: shards_) shard->reserve(per_shard);
+    }
+
+    /**
+     * Removes all the keys of all shards, keeping their storage, see SuffixTree::clear.
+     */
+    void clear() {
+        for (auto &shard: shards_) shard->clear();
+        std::fill(stats_.begin(), stats_.end(), ShardStats());
+    }
+
+    /**
+     * Searches all shards concurrently and returns at most <tt>count</tt> values, see SuffixTree::search.
+     *
+     * Which values come back differs from a single SuffixTree holding the same keys: each shard returns the
+     * first <tt>count</tt> values it finds in tree order, and of their union the smallest <tt>count</tt> are kept.
+     * The result doesn't depend on how the pool spreads the shards.
+     */
+    std::set<mapped_type> search(const T_String &word, int count) const {
+        auto result = unite_shards([&word, count](const tree_type &tree) { return tree.search(word, count); });
+
+        if (count >= 0 && result.size() > (size_type) count)
+            result.erase(std::next(result.begin(), count), result.end());
+        return result;
+    }
+
+    /**
+     * Searches all shards concurrently, see SuffixTree::search.
+     */
+    std::set<mapped_type> search(const T_String &word) const {
+        return search(word, -1);
+    }
+
+    /**
+     * Searches for every word of <tt>words</tt>, see SuffixTree::search_batch: every shard runs the whole batch,
+     * and the results of each word are united and trimmed as with search.
+     */
+    std::vector<std::set<mapped_type>> search_batch(const std::vector<T_String> &words, int count = -1,
+                                                    size_type width = 16) const {
+        std::vector<std::vector<std::set<mapped_type>>> partial(shards_.size());
+        for_each_shard([this, &partial, &words, count, width](size_type shard) {
+            partial[shard] = shards_[shard]->search_batch(words, count, width);
+        });
+
+        auto result = std::move(partial[0]);
+        for (size_type i = 0; i < words.size(); i++) {
+            for (size_type shard = 1; shard < shards_.size(); shard++)
+                result[i].insert(partial[shard][i].begin(), partial[shard][i].end());
+            if (count >= 0 && result[i].size() > (size_type) count)
+                result[i].erase(std::next(result[i].begin(), count), result[i].end());
+        }
+        return result;
+    }
+
+    /**
+     * Values of the keys that contain all of <tt>words</tt> and none of <tt>excluded</tt>, see SuffixTree::search_all.
+     * All the keys of a value are in its shard, so every shard answers the query on its own.
+     */
+    std::set<mapped_type> search_all(const std::vector<T_String> &words,
+                                     const std::vector<T_String> &excluded = std::vector<T_String>()) const {
+        return unite_shards([&words, &excluded](const tree_type &tree) { return tree.search_all(words, excluded); });
+    }
+
+    /**
+     * Values of the keys that contain any of <tt>words</tt> and none of <tt>excluded</tt>, see SuffixTree::search_any.
+     */
+    std::set<mapped_type> search_any(const std::vector<T_String> &words,
+                                     const std::vector<T_String> &excluded = std::vector<T_String>()) const {
+        return unite_shards([&words, &excluded](const tree_type &tree) { return tree.search_any(words, excluded); });
+    }
+};
+
+/**
+ * A SuffixTree over a sliding window of the most recent keys: keys are put with non-decreasing values
+ * (sequence numbers), and expire_before drops the keys of values below a given one.
+ *
+ * Keys are spread over a queue of generation trees of <tt>generation_keys</tt> keys each, oldest first.
+ * The newest generation takes the puts; once it is full a new one is started. Expiring drops whole generations
+ * at once, without touching the others, while search skips the expired values of the oldest generation left.
+ * A dropped generation is cleared and kept, storage included, to become the next new one, so memory stays
+ * bounded by the keys of the window plus one generation under continuous ingest.
+ */
+template<typename T_String, typename T_Mapped, typename T_ValueSetPolicy = InlineValues<>>
+class WindowedSuffixTree {
+public:
+    using tree_type = SuffixTree<T_String, T_Mapped, T_ValueSetPolicy>;
+    using key_type = typename tree_type::key_type;
+    using mapped_type = T_Mapped;
+    using size_type = typename tree_type::size_type;
+
+private:
+    struct Generation {
+        std::unique_ptr<tree_type> tree;
+        /// smallest and largest values put into the tree
+        mapped_type first;
+        mapped_type last;
+        size_type keys;
+    };
+
+    size_type generation_keys_;
+    std::deque<Generation> generations_;
+    /// a cleared generation tree, reused by the next new generation
+    std::unique_ptr<tree_type> spare_;
+
+    /// values below it are expired, when expired_
+    mapped_type oldest_;
+    bool expired_ = false;
+
+    bool live(const mapped_type &value) const {
+        return !expired_ || !(value < oldest_);
     }
 
     /**
-     * Searches for the given word within the GST and returns at most the given number of matches.
-     *
-     * @param word the key to search for
-     * @param count the max number of results to return
-     * @return at most <tt>results</tt> values for the given word
+     * The generation to put <tt>index</tt> into, a new one if the newest is full.
+     */
+    tree_type &generation_for(const mapped_type &index) {
+        if (!generations_.empty()) {
+            auto &newest = generations_.back();
+            assert(!(index < newest.last));
+            // all the keys of a value stay in one generation
+            if (newest.keys < generation_keys_ || !(newest.last < index)) {
+                newest.last = index;
+                newest.keys++;
+                return *newest.tree;
+            }
+        }
+
+        std::unique_ptr<tree_type> tree(spare_ ? spare_.release() : new tree_type);
+        generations_.push_back(Generation{std::move(tree), index, index, 1});
+        return *generations_.back().tree;
+    }
+
+public:
+    explicit WindowedSuffixTree(size_type generation_keys) : generation_keys_(generation_keys) {
+        assert(generation_keys > 0);
+    }
+
+    /**
+     * Adds the specified <tt>index</tt> under the given <tt>key</tt>, see SuffixTree::put.
+     * Indexes must not decrease from one put to the next.
+     */
+    void put(const T_String &string, const mapped_type &index) {
+        assert(live(index));
+        generation_for(index).put(string, index);
+    }
+
+    /**
+     * Adds the specified <tt>index</tt> under a key given as a temporary, moved into the tree and freed
+     * when it expires.
+     */
+    void put(T_String &&string, const mapped_type &index) {
+        assert(live(index));
+        generation_for(index).put(std::move(string), index);
+    }
+
+    /**
+     * Expires the keys of the values below <tt>index</tt>: search no longer returns them, and generations
+     * holding nothing else are dropped.
+     */
+    void expire_before(const mapped_type &index) {
+        if (expired_ && !(oldest_ < index))
+            return;
+        oldest_ = index;
+        expired_ = true;
+
+        while (!generations_.empty() && generations_.front().last < oldest_) {
+            auto tree = std::move(generations_.front().tree);
+            generations_.pop_front();
+            tree->clear();
+            spare_ = std::move(tree);
+        }
+    }
+
+    /**
+     * Searches all generations, newest first, for at most <tt>count</tt> values, see SuffixTree::search.
      */
     std::set<mapped_type> search(const T_String &word, int count) const {
-        auto tmp = search_node(word);
+        std::set<mapped_type> result;
+
+        for (auto it = generations_.rbegin(); it != generations_.rend() && result.size() != (size_type) count; ++it) {
+            const auto left = count < 0 ? -1 : count - (int) result.size();
+            if (live(it->first)) {
+                auto values = it->tree->search(word, left);
+                result.insert(values.begin(), values.end());
+                continue;
+            }
+
+            // the oldest generation, partly expired
+            auto values = it->tree->search(word);
+            for (auto value = values.lower_bound(oldest_); value != values.end(); ++value) {
+                if (result.size() == (size_type) count)
+                    break;
+                result.insert(*value);
+            }
+        }
+        return result;
+    }
 
-        if (tmp)
-            return tmp->get_data(count);
-        return {};
+    std::set<mapped_type> search(const T_String &word) const {
+        return search(word, -1);
     }
 
     /**
-     * Searches for the given word within the GST.
-     *
-     * Returns all the indexes for which the key contains the <tt>word</tt> that was
-     * supplied as input.
-     *
-     * @param word the key to search for
-     * @return the collection of indexes associated with the input <tt>word</tt>
+     * Number of generation trees holding live keys.
+     */
+    size_type generation_count() const { return generations_.size(); }
+
+    tree_type const &generation(size_type i) const { return *generations_[i].tree; }
+
+    /**
+     * Number of nodes in all generations, expired keys of the oldest one included.
+     */
+    size_type node_count() const {
+        size_type nodes = 0;
+        for (auto &generation: generations_) nodes += generation.tree->node_count();
+        return nodes;
+    }
+};
+
+/**
+ * A SuffixTree over the dense codes of the elements of its keys, behind the SuffixTree interface.
+ *
+ * put maps every element of the key to its code in an alphabet owned by the tree, and the tree is built over
+ * the codes: comparisons are integer comparisons and children are kept in sorted arrays (see EdgeArray),
+ * however costly the elements are to compare. search maps the word the same way, and a word holding an element
+ * that is in no key is a miss without touching the tree.
+ *
+ * Worth it for keys of custom objects with a user-defined operator<, such as <tt>std::vector<Obj></tt>.
+ * The encoded keys are stored in the tree, so unlike with SuffixTree::put the keys don't need to outlive it.
+ */
+template<typename T_String, typename T_Mapped, typename T_ValueSetPolicy = InlineValues<>>
+class AlphabetSuffixTree {
+public:
+    using element_type = typename KeyInternal<T_String>::value_type;
+    using alphabet_type = Alphabet<element_type>;
+    using tree_type = SuffixTree<std::vector<Symbol>, T_Mapped, T_ValueSetPolicy>;
+    using mapped_type = typename tree_type::mapped_type;
+    using size_type = typename tree_type::size_type;
+
+private:
+    alphabet_type alphabet_;
+    tree_type tree_;
+
+public:
+    alphabet_type const &alphabet() const { return alphabet_; }
+
+    /**
+     * The tree over the codes, for its search options (optimize_layout, enable_result_cache, ...).
+     */
+    tree_type &tree() { return tree_; }
+
+    tree_type const &tree() const { return tree_; }
+
+    /**
+     * Adds the specified <tt>index</tt> under the given <tt>key</tt>, see SuffixTree::put.
+     */
+    void put(const T_String &string, const mapped_type &index) {
+        std::vector<Symbol> codes;
+        codes.reserve(std::distance(std::begin(string), std::end(string)));
+        for (auto it = std::begin(string); it != std::end(string); ++it)
+            codes.push_back(alphabet_.encode(*it));
+
+        tree_.put(std::move(codes), index);
+    }
+
+    /**
+     * Searches for the given word and returns at most <tt>count</tt> values, see SuffixTree::search.
      */
+    std::set<mapped_type> search(const T_String &word, int count) const {
+        std::vector<Symbol> codes;
+        for (auto it = std::begin(word); it != std::end(word); ++it) {
+            codes.emplace_back();
+            if (!alphabet_.find(*it, codes.back()))
+                return std::set<mapped_type>();
+        }
+
+        return tree_.search(codes, count);
+    }
+
     std::set<mapped_type> search(const T_String &word) const {
         return search(word, -1);
     }
+};
+
+/**
+ * A bit vector answering rank queries in constant time.
+ *
+ * Bits are set with set(), then build_rank() must be called once before any rank query.
+ */
+class RankBitVector {
+private:
+    /// Number of 64-bit words covered by one entry of block_ranks_
+    static constexpr std::size_t words_per_block = 4;
+
+    std::vector<std::uint64_t> words_;
+    /// Number of ones before each block
+    std::vector<std::uint64_t> block_ranks_;
+    std::size_t size_ = 0;
+
+    static std::size_t popcount(std::uint64_t word) { return std::bitset<64>(word).count(); }
+
+public:
+    RankBitVector() = default;
+
+    explicit RankBitVector(std::size_t size) : words_((size + 63) / 64), size_(size) {}
+
+    void set(std::size_t i) { words_[i / 64] |= std::uint64_t(1) << (i % 64); }
+
+    bool get(std::size_t i) const { return (words_[i / 64] >> (i % 64)) & 1; }
+
+    std::size_t size() const { return size_; }
+
+    void build_rank() {
+        block_ranks_.assign(words_.size() / words_per_block + 1, 0);
+
+        std::uint64_t ones = 0;
+        for (std::size_t w = 0; w < words_.size(); w++) {
+            if (w % words_per_block == 0)
+                block_ranks_[w / words_per_block] = ones;
+            ones += popcount(words_[w]);
+        }
+        if (words_.size() % words_per_block == 0)
+            block_ranks_.back() = ones;
+    }
 
     /**
-     * Adds the specified <tt>index</tt> to the GST under the given <tt>key</tt>.
-     *
-     * Entries must be inserted so that their indexes are in non-decreasing order,
-     * otherwise an IllegalStateException will be raised.
-     *
-     * @param string the string key that will be added to the index
-     * @param index the value that will be added to the index
+     * Number of ones in [0, i).
      */
-    void put(const T_String &string, mapped_type index) {
-        key_type key(string);
+    std::size_t rank1(std::size_t i) const {
+        const auto word = i / 64;
+        std::size_t ones = block_ranks_[word / words_per_block];
+
+        for (auto w = word - word % words_per_block; w < word; w++)
+            ones += popcount(words_[w]);
+        if (i % 64)
+            ones += popcount(words_[word] & ((std::uint64_t(1) << (i % 64)) - 1));
+
+        return ones;
+    }
+
+    /**
+     * Number of zeros in [0, i).
+     */
+    std::size_t rank0(std::size_t i) const { return i - rank1(i); }
+
+    std::size_t memory_bytes() const {
+        return words_.capacity() * sizeof(std::uint64_t) + block_ranks_.capacity() * sizeof(std::uint64_t);
+    }
+};
+
+/**
+ * A wavelet tree over a sequence of integer symbols in [0, sigma), stored level by level
+ * (the wavelet matrix layout): one bit vector per bit of the symbols, with no pointers between nodes.
+ *
+ * It takes about n * ceil(log2(sigma)) bits and answers access and rank in O(log sigma).
+ */
+class WaveletMatrix {
+private:
+    std::vector<RankBitVector> levels_;
+    /// Number of zeros in each level
+    std::vector<std::size_t> zeros_;
+    std::size_t size_ = 0;
+
+public:
+    WaveletMatrix() = default;
+
+    WaveletMatrix(std::vector<std::uint32_t> symbols, std::uint32_t sigma) : size_(symbols.size()) {
+        std::size_t bits = 1;
+        while (bits < 32 && (std::uint64_t(1) << bits) < sigma) bits++;
+
+        std::vector<std::uint32_t> next(symbols.size());
+        for (std::size_t level = 0; level < bits; level++) {
+            const auto shift = bits - 1 - level;
+            RankBitVector bv(symbols.size());
+
+            // stable partition: symbols with a 0 at this bit first
+            std::size_t zeros = 0;
+            for (std::size_t i = 0; i < symbols.size(); i++)
+                if (!((symbols[i] >> shift) & 1)) zeros++;
 
-        // reset active_leaf
-        active_leaf = root;
+            std::size_t z = 0, o = zeros;
+            for (std::size_t i = 0; i < symbols.size(); i++) {
+                if ((symbols[i] >> shift) & 1) {
+                    bv.set(i);
+                    next[o++] = symbols[i];
+                } else
+                    next[z++] = symbols[i];
+            }
+
+            bv.build_rank();
+            levels_.push_back(std::move(bv));
+            zeros_.push_back(zeros);
+            symbols.swap(next);
+        }
+    }
+
+    std::size_t size() const { return size_; }
+
+    /**
+     * Returns the i-th symbol.
+     */
+    std::uint32_t access(std::size_t i) const {
+        std::uint32_t symbol = 0;
+        for (std::size_t level = 0; level < levels_.size(); level++) {
+            auto &bv = levels_[level];
+            const bool bit = bv.get(i);
 
-        // proceed with tree construction (closely related to procedure in
-        // Ukkonen's paper)
-        auto node = root;
-        key_type text(key.begin(), key.begin());
-        // iterate over the string, one char at a time
-        for (auto i = 0; i < key.size(); i++) {
-            text = {text.begin(), ++text.end()};
+            symbol = (symbol << 1) | (bit ? 1 : 0);
+            i = bit ? zeros_[level] + bv.rank1(i) : bv.rank0(i);
+        }
+        return symbol;
+    }
 
-            // update the tree with the new transitions due to this new char
-            auto active = update(node, text, key.at(i), key.substr(i), index);
+    /**
+     * Number of occurrences of <tt>symbol</tt> in [0, i).
+     */
+    std::size_t rank(std::uint32_t symbol, std::size_t i) const {
+        std::size_t start = 0;
+        for (std::size_t level = 0; level < levels_.size(); level++) {
+            auto &bv = levels_[level];
+            const auto shift = levels_.size() - 1 - level;
 
-            // make sure the active pair is canonical
-            active = canonize(active.first, active.second);
-            node = active.first;
-            text = active.second;
+            if ((symbol >> shift) & 1) {
+                start = zeros_[level] + bv.rank1(start);
+                i = zeros_[level] + bv.rank1(i);
+            } else {
+                start = bv.rank0(start);
+                i = bv.rank0(i);
+            }
         }
+        return i - start;
+    }
 
-        // add leaf suffix link, is necessary
-        if (!active_leaf->get_suffix() && active_leaf != root && active_leaf != node)
-            active_leaf->set_suffix(node);
+    std::size_t memory_bytes() const {
+        std::size_t bytes = zeros_.capacity() * sizeof(std::size_t);
+        for (auto &bv: levels_) bytes += bv.memory_bytes();
+        return bytes;
     }
 };
+
+/**
+ * A compressed alternative to SuffixTree with the same put and search operations, for corpora too large for
+ * a pointer-based tree.
+ *
+ * The keys are concatenated into one text (each followed by a separator) and indexed by an FM-index:
+ * the Burrows-Wheeler transform of the text stored in a wavelet tree, plus a suffix array sampled every
+ * <tt>sample_rate</tt> text positions. Key boundaries are kept as a bit vector over the text, which maps any
+ * text position to its key (the document array, stored implicitly) and from there to the key's value.
+ *
+ * The index is built offline: put only records the key, build() (re)creates the index over everything put so far,
+ * and search only sees keys added before the last build().
+ * Unlike SuffixTree, keys are copied, so they don't need to outlive the index.
+ *
+ * Search costs O(m log sigma) to find the range of suffixes starting with the word, then
+ * O(sample_rate log sigma) per occurrence to locate it.
+ */
+template<typename T_String, typename T_Mapped>
+class FMIndex {
+public:
+    using mapped_type = T_Mapped;
+    using size_type = std::size_t;
+
+private:
+    using element_type = typename KeyInternal<T_String>::value_type;
+    using code_type = std::uint32_t;
+
+    enum : code_type {
+        /// Code of the single sentinel ending the text, smaller than anything else
+        end_code = 0,
+        /// Code of the separator following every key
+        separator_code = 1
+    };
+
+    /// Sorted distinct elements, alphabet_[k] is encoded as k + 2
+    std::vector<element_type> alphabet_;
+
+    WaveletMatrix bwt_;
+    /// counts_[c]: number of symbols of the text smaller than c
+    std::vector<size_type> counts_;
+    /// Row of the sorted suffixes holding the whole text
+    size_type primary_ = 0;
+
+    size_type sample_rate_;
+    /// Rows whose suffix starts at a multiple of sample_rate_, and those starting positions in row order
+    RankBitVector sampled_rows_;
+    std::vector<std::uint32_t> samples_;
+
+    /// Bit set at the first text position of every key
+    RankBitVector key_starts_;
+    /// Value of every key, in text order
+    std::vector<mapped_type> values_;
+
+    std::vector<std::vector<element_type>> pending_keys_;
+    std::vector<mapped_type> pending_values_;
+
+    static bool equal(const element_type &a, const element_type &b) { return !(a < b) && !(b < a); }
+
+    /**
+     * Returns the code of <tt>e</tt>, or end_code if it is not part of the alphabet.
+     */
+    code_type encode(const element_type &e) const {
+        auto it = std::lower_bound(alphabet_.begin(), alphabet_.end(), e);
+        if (it == alphabet_.end() || !equal(*it, e))
+            return end_code;
+        return (code_type) (it - alphabet_.begin()) + 2;
+    }
+
+    /**
+     * Row of the suffix starting one position before the one in <tt>row</tt> (the LF mapping).
+     */
+    size_type lf(size_type row) const {
+        const auto c = bwt_.access(row);
+        return counts_[c] + bwt_.rank(c, row);
+    }
+
+    /**
+     * Text position of the suffix in <tt>row</tt>.
+     */
+    size_type locate(size_type row) const {
+        size_type steps = 0;
+        while (!sampled_rows_.get(row)) {
+            row = lf(row);
+            steps++;
+        }
+        return samples_[sampled_rows_.rank1(row)] + steps;
+    }
+
+    /**
+     * Rebuilds the text from the transform, by walking the LF mapping backwards from its last symbol.
+     */
+    std::vector<code_type> extract_text() const {
+        std::vector<code_type> text(bwt_.size());
+
+        auto row = primary_;
+        for (auto i = text.size(); i > 0; i--) {
+            text[i - 1] = bwt_.access(row);
+            row = lf(row);
+        }
+        // the symbol preceding the whole text is the sentinel at its end
+        return text;
+    }
+
+    /**
+     * Sorts the cyclic shifts of <tt>text</tt>, whose symbols are in [0, sigma), by prefix doubling.
+     * The text ends with a unique smallest symbol, so this is also the order of its suffixes.
+     */
+    static std::vector<std::uint32_t> sort_suffixes(const std::vector<code_type> &text, size_type sigma) {
+        const auto n = text.size();
+        std::vector<std::uint32_t> order(n), classes(n), next_order(n), next_classes(n);
+        std::vector<std::uint32_t> counts(std::max(sigma, n), 0);
+
+        for (auto c: text) counts[c]++;
+        for (size_type c = 1; c < sigma; c++) counts[c] += counts[c - 1];
+        for (auto i = n; i > 0; i--) order[--counts[text[i - 1]]] = (std::uint32_t) (i - 1);
+
+        size_type class_count = 1;
+        classes[order[0]] = 0;
+        for (size_type i = 1; i < n; i++) {
+            if (text[order[i]] != text[order[i - 1]]) class_count++;
+            classes[order[i]] = (std::uint32_t) (class_count - 1);
+        }
+
+        for (size_type h = 1; h < n && class_count < n; h <<= 1) {
+            // order by the second half is the current order shifted left by h
+            for (size_type i = 0; i < n; i++)
+                next_order[i] = (std::uint32_t) ((order[i] + n - h) % n);
+
+            std::fill(counts.begin(), counts.begin() + class_count, 0);
+            for (size_type i = 0; i < n; i++) counts[classes[next_order[i]]]++;
+            for (size_type c = 1; c < class_count; c++) counts[c] += counts[c - 1];
+            for (auto i = n; i > 0; i--) order[--counts[classes[next_order[i - 1]]]] = next_order[i - 1];
+
+            class_count = 1;
+            next_classes[order[0]] = 0;
+            for (size_type i = 1; i < n; i++) {
+                if (classes[order[i]] != classes[order[i - 1]] ||
+                    classes[(order[i] + h) % n] != classes[(order[i - 1] + h) % n])
+                    class_count++;
+                next_classes[order[i]] = (std::uint32_t) (class_count - 1);
+            }
+            classes.swap(next_classes);
+        }
+
+        return order;
+    }
+
+public:
+    explicit FMIndex(size_type sample_rate = 32) : sample_rate_(sample_rate) {
+        assert(sample_rate > 0);
+    }
+
+    /**
+     * Records <tt>string</tt> under <tt>index</tt>. It becomes searchable after the next build().
+     */
+    void put(const T_String &string, mapped_type index) {
+        pending_keys_.emplace_back(std::begin(string), std::end(string));
+        pending_values_.push_back(std::move(index));
+    }
+
+    /**
+     * Number of keys put since the last build().
+     */
+    size_type pending() const { return pending_keys_.size(); }
+
+    /**
+     * Number of keys in the index.
+     */
+    size_type size() const { return values_.size(); }
+
+    /**
+     * Builds the index over all the keys put so far.
+     */
+    void build() {
+        if (pending_keys_.empty() && bwt_.size())
+            return;
+
+        // the keys already indexed are recovered from the index itself
+        auto old_text = bwt_.size() ? extract_text() : std::vector<code_type>();
+        auto old_alphabet = std::move(alphabet_);
+
+        alphabet_ = old_alphabet;
+        for (auto &key: pending_keys_)
+            alphabet_.insert(alphabet_.end(), key.begin(), key.end());
+        std::sort(alphabet_.begin(), alphabet_.end());
+        alphabet_.erase(std::unique(alphabet_.begin(), alphabet_.end(), equal), alphabet_.end());
+        assert(alphabet_.size() < UINT32_MAX - 2);
+
+        size_type text_size = old_text.size() + pending_keys_.size() + 1;
+        for (auto &key: pending_keys_) text_size += key.size();
+
+        std::vector<code_type> text;
+        text.reserve(text_size);
+        for (size_type i = 0; i + 1 < old_text.size(); i++) {
+            auto c = old_text[i];
+            text.push_back(c < 2 ? c : encode(old_alphabet[c - 2]));
+        }
+        for (auto &key: pending_keys_) {
+            for (auto &e: key) text.push_back(encode(e));
+            text.push_back(separator_code);
+        }
+        text.push_back(end_code);
+        assert(text.size() < UINT32_MAX);
+
+        values_.insert(values_.end(), pending_values_.begin(), pending_values_.end());
+        pending_keys_.clear();
+        pending_values_.clear();
+
+        const auto n = text.size();
+        const auto sigma = alphabet_.size() + 2;
+        auto suffixes = sort_suffixes(text, sigma);
+
+        counts_.assign(sigma + 1, 0);
+        for (auto c: text) counts_[c + 1]++;
+        for (size_type c = 1; c <= sigma; c++) counts_[c] += counts_[c - 1];
+
+        std::vector<code_type> last_column(n);
+        sampled_rows_ = RankBitVector(n);
+        samples_.clear();
+        for (size_type row = 0; row < n; row++) {
+            const auto pos = suffixes[row];
+            last_column[row] = text[(pos + n - 1) % n];
+            if (pos == 0)
+                primary_ = row;
+            if (pos % sample_rate_ == 0) {
+                sampled_rows_.set(row);
+                samples_.push_back(pos);
+            }
+        }
+        sampled_rows_.build_rank();
+        samples_.shrink_to_fit();
+
+        key_starts_ = RankBitVector(n);
+        bool at_start = true;
+        for (size_type pos = 0; pos + 1 < n; pos++) {
+            if (at_start) key_starts_.set(pos);
+            at_start = text[pos] == separator_code;
+        }
+        key_starts_.build_rank();
+
+        bwt_ = WaveletMatrix(std::move(last_column), (std::uint32_t) sigma);
+    }
+
+    /**
+     * Returns at most <tt>count</tt> values of the keys containing <tt>word</tt>, see SuffixTree::search.
+     */
+    std::set<mapped_type> search(const T_String &word, int count) const {
+        std::set<mapped_type> result;
+        if (!bwt_.size())
+            return result;
+
+        std::vector<code_type> pattern;
+        for (auto &e: word) {
+            auto c = encode(e);
+            if (c == end_code)
+                // not in any key
+                return result;
+            pattern.push_back(c);
+        }
+        if (pattern.empty())
+            return result;
+
+        // backward search: [from, to) are the rows of the suffixes starting with the part of the word read so far
+        size_type from = 0, to = bwt_.size();
+        for (auto it = pattern.rbegin(); it != pattern.rend() && from < to; ++it) {
+            from = counts_[*it] + bwt_.rank(*it, from);
+            to = counts_[*it] + bwt_.rank(*it, to);
+        }
+
+        for (auto row = from; row < to && result.size() != (size_type) count; row++) {
+            const auto key = key_starts_.rank1(locate(row) + 1) - 1;
+            result.insert(values_[key]);
+        }
+        return result;
+    }
+
+    std::set<mapped_type> search(const T_String &word) const {
+        return search(word, -1);
+    }
+
+    /**
+     * Heap memory held by the index, pending keys excluded.
+     */
+    size_type memory_bytes() const {
+        return alphabet_.capacity() * sizeof(element_type) + bwt_.memory_bytes() +
+               counts_.capacity() * sizeof(size_type) + sampled_rows_.memory_bytes() +
+               samples_.capacity() * sizeof(std::uint32_t) + key_starts_.memory_bytes() +
+               values_.capacity() * sizeof(mapped_type);
+    }
+};
\ No newline at end of file
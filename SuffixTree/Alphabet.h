@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+/**
+ * Dense integer code of an element in an Alphabet.
+ */
+enum class Symbol : std::uint32_t {};
+
+/**
+ * A symbol table mapping every distinct element to a dense code, in order of first appearance.
+ *
+ * Elements only need operator<, and are compared once per element when a key is encoded instead of at every
+ * step of the tree construction and search.
+ */
+template<typename T_Element>
+class Alphabet {
+public:
+    using element_type = T_Element;
+    using size_type = std::size_t;
+
+private:
+    std::map<element_type, Symbol> codes_;
+    /// elements_[code]: the element encoded as code
+    std::vector<element_type> elements_;
+
+public:
+    size_type size() const { return elements_.size(); }
+
+    /**
+     * Returns the code of <tt>element</tt>, adding it to the alphabet if it isn't there yet.
+     */
+    Symbol encode(const element_type &element) {
+        auto it = codes_.lower_bound(element);
+        if (it != codes_.end() && !(element < it->first))
+            return it->second;
+
+        assert(elements_.size() < UINT32_MAX);
+        const auto code = (Symbol) elements_.size();
+        codes_.emplace_hint(it, element, code);
+        elements_.push_back(element);
+        return code;
+    }
+
+    /**
+     * Sets <tt>code</tt> to the code of <tt>element</tt>, returns false if it isn't in the alphabet.
+     */
+    bool find(const element_type &element, Symbol &code) const {
+        auto it = codes_.find(element);
+        if (it == codes_.end())
+            return false;
+
+        code = it->second;
+        return true;
+    }
+
+    const element_type &decode(Symbol code) const { return elements_[(size_type) code]; }
+};
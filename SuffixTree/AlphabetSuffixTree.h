@@ -0,0 +1,73 @@
+#pragma once
+
+#include <iterator>
+#include <set>
+#include <vector>
+
+#include "Alphabet.h"
+#include "SuffixTree.h"
+
+/**
+ * A SuffixTree over the dense codes of the elements of its keys, behind the SuffixTree interface.
+ *
+ * put maps every element of the key to its code in an alphabet owned by the tree, and the tree is built over
+ * the codes: comparisons are integer comparisons and children are kept in sorted arrays (see EdgeArray),
+ * however costly the elements are to compare. search maps the word the same way, and a word holding an element
+ * that is in no key is a miss without touching the tree.
+ *
+ * Worth it for keys of custom objects with a user-defined operator<, such as <tt>std::vector<Obj></tt>.
+ * The encoded keys are stored in the tree, so unlike with SuffixTree::put the keys don't need to outlive it.
+ */
+template<typename T_String, typename T_Mapped, typename T_ValueSetPolicy = InlineValues<>>
+class AlphabetSuffixTree {
+public:
+    using element_type = typename KeyInternal<T_String>::value_type;
+    using alphabet_type = Alphabet<element_type>;
+    using tree_type = SuffixTree<std::vector<Symbol>, T_Mapped, T_ValueSetPolicy>;
+    using mapped_type = typename tree_type::mapped_type;
+    using size_type = typename tree_type::size_type;
+
+private:
+    alphabet_type alphabet_;
+    tree_type tree_;
+
+public:
+    alphabet_type const &alphabet() const { return alphabet_; }
+
+    /**
+     * The tree over the codes, for its search options (optimize_layout, enable_result_cache, ...).
+     */
+    tree_type &tree() { return tree_; }
+
+    tree_type const &tree() const { return tree_; }
+
+    /**
+     * Adds the specified <tt>index</tt> under the given <tt>key</tt>, see SuffixTree::put.
+     */
+    void put(const T_String &string, const mapped_type &index) {
+        std::vector<Symbol> codes;
+        codes.reserve(std::distance(std::begin(string), std::end(string)));
+        for (auto it = std::begin(string); it != std::end(string); ++it)
+            codes.push_back(alphabet_.encode(*it));
+
+        tree_.put(std::move(codes), index);
+    }
+
+    /**
+     * Searches for the given word and returns at most <tt>count</tt> values, see SuffixTree::search.
+     */
+    std::set<mapped_type> search(const T_String &word, int count) const {
+        std::vector<Symbol> codes;
+        for (auto it = std::begin(word); it != std::end(word); ++it) {
+            codes.emplace_back();
+            if (!alphabet_.find(*it, codes.back()))
+                return std::set<mapped_type>();
+        }
+
+        return tree_.search(codes, count);
+    }
+
+    std::set<mapped_type> search(const T_String &word) const {
+        return search(word, -1);
+    }
+};
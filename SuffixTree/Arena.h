@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+/**
+ * Handle of an element of an Arena, its index.
+ *
+ * 32 bits hold trees of up to 4 billion nodes at half the size of a pointer; define
+ * SUFFIX_TREE_64BIT_HANDLES before including the tree to lift that limit.
+ */
+#ifdef SUFFIX_TREE_64BIT_HANDLES
+using ArenaHandle = std::uint64_t;
+#else
+using ArenaHandle = std::uint32_t;
+#endif
+
+/// Handle of no element
+constexpr ArenaHandle null_handle = ArenaHandle(-1);
+
+/**
+ * Storage for the nodes of a tree, which refer to each other by handle instead of by pointer.
+ *
+ * Elements are allocated in chunks of a thousand instead of one by one, and never move: references to them
+ * stay valid as more are added. Handles are positions, not addresses, so they also stay valid when the contents
+ * of two arenas are swapped.
+ */
+template<typename T>
+class Arena {
+public:
+    using handle_type = ArenaHandle;
+    using size_type = std::size_t;
+
+private:
+    enum : size_type { chunk_bits = 10, chunk_size = size_type(1) << chunk_bits };
+
+    std::vector<T *> chunks_;
+    size_type size_ = 0;
+
+public:
+    Arena() = default;
+
+    Arena(const Arena &) = delete;
+
+    Arena &operator=(const Arena &) = delete;
+
+    ~Arena() { clear(); }
+
+    /**
+     * Constructs an element from <tt>args</tt> at the end of the arena and returns its handle.
+     * Throws std::length_error if every handle is taken (see SUFFIX_TREE_64BIT_HANDLES).
+     */
+    template<typename... Args>
+    handle_type emplace_back(Args &&... args) {
+        if (size_ >= (size_type) null_handle)
+            throw std::length_error("Arena: out of handles, define SUFFIX_TREE_64BIT_HANDLES");
+        if (size_ == capacity())
+            chunks_.push_back(static_cast<T *>(::operator new(chunk_size * sizeof(T))));
+
+        new(chunks_[size_ >> chunk_bits] + (size_ & (chunk_size - 1))) T(std::forward<Args>(args)...);
+        return (handle_type) size_++;
+    }
+
+    T &operator[](handle_type handle) { return chunks_[handle >> chunk_bits][handle & (chunk_size - 1)]; }
+
+    const T &operator[](handle_type handle) const { return chunks_[handle >> chunk_bits][handle & (chunk_size - 1)]; }
+
+    size_type size() const { return size_; }
+
+    /**
+     * Number of elements the arena holds without allocating.
+     */
+    size_type capacity() const { return chunks_.size() * chunk_size; }
+
+    /**
+     * Allocates storage for at least <tt>count</tt> elements up front.
+     * Throws std::length_error if there are fewer handles than that (see SUFFIX_TREE_64BIT_HANDLES).
+     */
+    void reserve(size_type count) {
+        if (count > (size_type) null_handle)
+            throw std::length_error("Arena: out of handles, define SUFFIX_TREE_64BIT_HANDLES");
+        chunks_.reserve((count + chunk_size - 1) >> chunk_bits);
+        while (capacity() < count)
+            chunks_.push_back(static_cast<T *>(::operator new(chunk_size * sizeof(T))));
+    }
+
+    /**
+     * Destroys all the elements but keeps their storage for the next ones.
+     */
+    void reset() {
+        for (size_type i = 0; i < size_; i++) (*this)[(handle_type) i].~T();
+        size_ = 0;
+    }
+
+    /**
+     * Destroys all the elements and frees their storage.
+     */
+    void clear() {
+        reset();
+        for (auto chunk: chunks_) ::operator delete(chunk);
+        chunks_.clear();
+    }
+
+    void swap(Arena &other) {
+        chunks_.swap(other.chunks_);
+        std::swap(size_, other.size_);
+    }
+
+    size_type memory_bytes() const { return chunks_.size() * chunk_size * sizeof(T) + chunks_.capacity() * sizeof(T *); }
+};
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <set>
+#include <vector>
+
+#include "SuffixNode.h"
+#include "Instrumentation.h"
+
+/**
+ * A read-only copy of a suffix tree laid out in arrays, in breadth-first order.
+ *
+ * The children of every node are stored next to each other, with the edge leading to each child inlined in the
+ * child's slot, and the first elements of all edge labels are kept in an array of their own, so that choosing
+ * the child to follow is a binary search over a few contiguous elements. The top levels of the tree, which every
+ * search goes through, end up packed in the first few cache lines.
+ *
+ * Values are stored per node in the same order (offsets into one array).
+ */
+template<typename T_Key, typename T_Mapped, typename T_Values>
+class CompactLayout {
+public:
+    using key_type = T_Key;
+    using mapped_type = T_Mapped;
+    using size_type = std::size_t;
+    using node_type = SuffixNode<key_type, mapped_type, T_Values>;
+    using handle_type = ArenaHandle;
+
+    /// Returned by find when the word is not in the tree
+    enum : size_type { npos = size_type(-1) };
+
+private:
+    using element_type = typename key_type::value_type;
+
+    struct Slot {
+        /// label of the edge from the parent, empty for the root
+        key_type label;
+        /// slot of the first child, the others follow it
+        std::uint32_t first_child;
+        std::uint32_t child_count;
+    };
+
+    std::vector<Slot> slots_;
+    /// firsts_[i]: first element of the label of slot i + 1 (the root has no label)
+    std::vector<element_type> firsts_;
+    /// Values of slot i are values_[value_offsets_[i], value_offsets_[i + 1])
+    std::vector<std::uint32_t> value_offsets_;
+    std::vector<mapped_type> values_;
+    /// Handle of the node every slot was copied from
+    std::vector<handle_type> sources_;
+
+public:
+    bool built() const { return !slots_.empty(); }
+
+    size_type size() const { return slots_.size(); }
+
+    void clear() { *this = CompactLayout(); }
+
+    /**
+     * Copies the tree of <tt>nodes</tt>, from its root (handle 0).
+     */
+    void build(const Arena<node_type> &nodes) {
+        clear();
+        sources_.push_back(0);
+        slots_.push_back(Slot{key_type(), 0, 0});
+
+        for (size_type i = 0; i < sources_.size(); i++) {
+            const auto &node = nodes[sources_[i]];
+            assert(sources_.size() < UINT32_MAX);
+
+            slots_[i].first_child = (std::uint32_t) sources_.size();
+            slots_[i].child_count = (std::uint32_t) node.children_.size();
+            for (auto &p: node.children_) {
+                sources_.push_back(p.second);
+                slots_.push_back(Slot{nodes[p.second].label_, 0, 0});
+                firsts_.push_back(p.first);
+            }
+        }
+
+        value_offsets_.reserve(sources_.size() + 1);
+        for (auto source: sources_) {
+            const auto &data = nodes[source].data_;
+            value_offsets_.push_back((std::uint32_t) values_.size());
+            values_.insert(values_.end(), data.begin(), data.end());
+        }
+        value_offsets_.push_back((std::uint32_t) values_.size());
+        assert(values_.size() < UINT32_MAX);
+    }
+
+    /**
+     * Returns the slot of the node at or below which <tt>word</tt> ends, or npos. See SuffixTree::search_node.
+     */
+    template<typename T_String>
+    size_type find(const T_String &word) const {
+        size_type slot = 0;
+        auto it = word.begin();
+        const auto word_end = word.end();
+
+        while (it != word_end) {
+            SUFFIX_TREE_COUNT(get_edge_lookups);
+            const auto &node = slots_[slot];
+            const auto from = firsts_.begin() + (node.first_child - 1);
+            const auto to = from + node.child_count;
+            const auto child = std::lower_bound(from, to, *it);
+            if (child == to || *it < *child) {
+                SUFFIX_TREE_COUNT(get_edge_misses);
+                return npos;
+            }
+
+            slot = (size_type) (child - firsts_.begin()) + 1;
+            const auto &label = slots_[slot].label;
+
+            // the first element matched the child lookup, compare the rest of the label
+            auto il = label.begin();
+            const auto label_end = label.end();
+            for (++it, ++il; it != word_end && il != label_end; ++it, ++il) {
+                SUFFIX_TREE_COUNT(search_label_compares);
+                if (*it < *il || *il < *it)
+                    return npos;
+            }
+        }
+
+        return slot == 0 ? npos : slot;
+    }
+
+    handle_type source(size_type slot) const { return sources_[slot]; }
+
+    /**
+     * Inserts into <tt>set</tt> the values of the subtree of <tt>slot</tt>, until it holds <tt>count</tt> values.
+     * Nodes are visited in the same order as SuffixTree::get_data.
+     */
+    void get_data(size_type slot, std::set<mapped_type> &set, int count) const {
+        std::vector<std::uint32_t> stack{(std::uint32_t) slot};
+
+        while (!stack.empty()) {
+            const auto current = stack.back();
+            stack.pop_back();
+
+            for (auto i = value_offsets_[current]; i < value_offsets_[current + 1]; i++) {
+                set.insert(values_[i]);
+                if (set.size() == (size_type) count)
+                    return;
+            }
+
+            const auto &node = slots_[current];
+            for (auto child = node.first_child + node.child_count; child > node.first_child; child--)
+                stack.push_back(child - 1);
+        }
+    }
+
+    size_type memory_bytes() const {
+        return slots_.capacity() * sizeof(Slot) + firsts_.capacity() * sizeof(element_type) +
+               value_offsets_.capacity() * sizeof(std::uint32_t) + values_.capacity() * sizeof(mapped_type) +
+               sources_.capacity() * sizeof(handle_type);
+    }
+};
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <map>
+#include <set>
+#include <utility>
+#include <vector>
+
+/**
+ * Lists the distinct values of any range of an array of values in time proportional to the number of distinct
+ * values, not to the length of the range (Muthukrishnan's document listing).
+ *
+ * Every position keeps the position of the previous occurrence of its value. A value occurs in [from, to)
+ * for the first time exactly at the positions whose previous occurrence is before <tt>from</tt>; those are found
+ * one by one with range minimum queries over the previous occurrences, each of them splitting the range in two.
+ *
+ * Values are appended with push_back, then build() must be called once before any query.
+ */
+template<typename T_Mapped>
+class DocumentListing {
+public:
+    using mapped_type = T_Mapped;
+    using size_type = std::size_t;
+
+private:
+    /// Positions covered by one entry of the first level of sparse_, scanned linearly by queries
+    enum : size_type { block_size = 32 };
+
+    std::vector<mapped_type> documents_;
+    /// previous_[i]: 1 + position of the previous occurrence of documents_[i], 0 if there is none
+    std::vector<std::uint32_t> previous_;
+    /// sparse_[k][b]: position of the smallest previous_ in blocks [b, b + 2^k)
+    std::vector<std::vector<std::uint32_t>> sparse_;
+    /// ranges_[node]: positions [first, second) of the values of the subtree of a node, by handle, see enter
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> ranges_;
+    bool built_ = false;
+
+    size_type better(size_type a, size_type b) const {
+        return previous_[b] < previous_[a] ? b : a;
+    }
+
+    size_type scan(size_type best, size_type from, size_type to) const {
+        for (auto i = from; i < to; i++)
+            best = better(best, i);
+        return best;
+    }
+
+    /**
+     * Position of the smallest previous occurrence in [from, to), which must not be empty.
+     */
+    size_type argmin(size_type from, size_type to) const {
+        const auto first_block = (from + block_size - 1) / block_size;
+        const auto last_block = to / block_size;
+        if (first_block >= last_block)
+            return scan(from, from, to);
+
+        auto best = scan(from, from, first_block * block_size);
+        best = scan(best, last_block * block_size, to);
+
+        size_type level = 0;
+        while ((size_type(2) << level) <= last_block - first_block) level++;
+        best = better(best, sparse_[level][first_block]);
+        return better(best, sparse_[level][last_block - (size_type(1) << level)]);
+    }
+
+public:
+    size_type size() const { return documents_.size(); }
+
+    bool built() const { return built_; }
+
+    void push_back(const mapped_type &value) {
+        assert(!built_);
+        documents_.push_back(value);
+    }
+
+    /**
+     * Starts the range of the node of handle <tt>node</tt>: the values pushed until leave(node) are those of
+     * its subtree. Ranges are kept here rather than in the nodes, so trees without a listing don't pay for them.
+     */
+    void enter(size_type node) {
+        assert(!built_);
+        if (node >= ranges_.size())
+            ranges_.resize(node + 1);
+        ranges_[node].first = (std::uint32_t) documents_.size();
+    }
+
+    void leave(size_type node) {
+        assert(!built_);
+        ranges_[node].second = (std::uint32_t) documents_.size();
+    }
+
+    /**
+     * Positions [first, second) of the values of the subtree of <tt>node</tt>.
+     */
+    std::pair<size_type, size_type> range(size_type node) const {
+        return std::pair<size_type, size_type>(ranges_[node].first, ranges_[node].second);
+    }
+
+    /**
+     * Links every position to the previous occurrence of its value and builds the range minimum structure.
+     */
+    void build() {
+        const auto n = documents_.size();
+        assert(n < UINT32_MAX);
+
+        previous_.resize(n);
+        std::map<mapped_type, std::uint32_t> last;
+        for (size_type i = 0; i < n; i++) {
+            auto it = last.insert(std::make_pair(documents_[i], 0)).first;
+            previous_[i] = it->second;
+            it->second = (std::uint32_t) (i + 1);
+        }
+
+        sparse_.clear();
+        const auto blocks = n / block_size;
+        if (blocks) {
+            sparse_.emplace_back(blocks);
+            for (size_type b = 0; b < blocks; b++)
+                sparse_[0][b] = (std::uint32_t) scan(b * block_size, b * block_size + 1, (b + 1) * block_size);
+
+            for (size_type level = 1; (size_type(1) << level) <= blocks; level++) {
+                const auto half = size_type(1) << (level - 1);
+                auto &below = sparse_[level - 1];
+                std::vector<std::uint32_t> current(blocks - 2 * half + 1);
+                for (size_type b = 0; b < current.size(); b++)
+                    current[b] = (std::uint32_t) better(below[b], below[b + half]);
+                sparse_.push_back(std::move(current));
+            }
+        }
+
+        documents_.shrink_to_fit();
+        ranges_.shrink_to_fit();
+        built_ = true;
+    }
+
+    void clear() { *this = DocumentListing(); }
+
+    /**
+     * Calls <tt>output(value)</tt> with every distinct value of [from, to), in no particular order,
+     * until it returns false.
+     */
+    template<typename Output>
+    void list(size_type from, size_type to, Output output) const {
+        assert(built_);
+        std::vector<std::pair<size_type, size_type>> ranges;
+        if (from < to)
+            ranges.emplace_back(from, to);
+
+        while (!ranges.empty()) {
+            const auto l = ranges.back().first, r = ranges.back().second;
+            ranges.pop_back();
+
+            const auto i = argmin(l, r);
+            if (previous_[i] > from)
+                // every value of [l, r) already occurs before it, in [from, l)
+                continue;
+
+            if (!output(documents_[i]))
+                return;
+            if (i + 1 < r) ranges.emplace_back(i + 1, r);
+            if (l < i) ranges.emplace_back(l, i);
+        }
+    }
+
+    /**
+     * Inserts into <tt>set</tt> the distinct values of [from, to), until it holds <tt>count</tt> values.
+     */
+    void list(size_type from, size_type to, std::set<mapped_type> &set, int count) const {
+        if (set.size() == (size_type) count)
+            return;
+        list(from, to, [&set, count](const mapped_type &value) {
+            set.insert(value);
+            return set.size() != (size_type) count;
+        });
+    }
+
+    size_type memory_bytes() const {
+        size_type bytes = documents_.capacity() * sizeof(mapped_type) + previous_.capacity() * sizeof(std::uint32_t);
+        bytes += ranges_.capacity() * sizeof(ranges_[0]);
+        for (auto &level: sparse_) bytes += level.capacity() * sizeof(std::uint32_t);
+        return bytes;
+    }
+};
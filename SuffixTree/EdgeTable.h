@@ -0,0 +1,84 @@
+#pragma once
+
+#include <algorithm>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "Alphabet.h"
+
+/**
+ * The children of a node as an array of (first element of their label, child) pairs sorted by element.
+ *
+ * Has the subset of the std::map interface that SuffixNode uses. Lookups are a binary search over a few
+ * contiguous pairs, and a node costs one allocation for all its children instead of one per child,
+ * which pays off when elements are small and cheap to compare.
+ */
+template<typename T_Element, typename T_Edge>
+class EdgeArray {
+public:
+    using value_type = std::pair<T_Element, T_Edge>;
+    using iterator = typename std::vector<value_type>::iterator;
+    using const_iterator = typename std::vector<value_type>::const_iterator;
+    using reverse_iterator = typename std::vector<value_type>::reverse_iterator;
+    using const_reverse_iterator = typename std::vector<value_type>::const_reverse_iterator;
+
+private:
+    std::vector<value_type> edges_;
+
+    static bool before(const value_type &edge, const T_Element &c) { return edge.first < c; }
+
+public:
+    iterator find(const T_Element &c) {
+        auto it = std::lower_bound(edges_.begin(), edges_.end(), c, before);
+        return it != edges_.end() && !(c < it->first) ? it : edges_.end();
+    }
+
+    const_iterator find(const T_Element &c) const {
+        auto it = std::lower_bound(edges_.begin(), edges_.end(), c, before);
+        return it != edges_.end() && !(c < it->first) ? it : edges_.end();
+    }
+
+    T_Edge &operator[](const T_Element &c) {
+        auto it = std::lower_bound(edges_.begin(), edges_.end(), c, before);
+        if (it == edges_.end() || c < it->first)
+            it = edges_.insert(it, value_type(c, T_Edge()));
+        return it->second;
+    }
+
+    iterator begin() { return edges_.begin(); }
+
+    iterator end() { return edges_.end(); }
+
+    const_iterator begin() const { return edges_.begin(); }
+
+    const_iterator end() const { return edges_.end(); }
+
+    reverse_iterator rbegin() { return edges_.rbegin(); }
+
+    reverse_iterator rend() { return edges_.rend(); }
+
+    const_reverse_iterator rbegin() const { return edges_.rbegin(); }
+
+    const_reverse_iterator rend() const { return edges_.rend(); }
+
+    std::size_t size() const { return edges_.size(); }
+
+    bool empty() const { return edges_.empty(); }
+};
+
+/**
+ * The container SuffixNode keeps its children in, by the first element of their label: a std::map in general,
+ * an EdgeArray for the dense codes of an Alphabet.
+ *
+ * Specialize it for other element types.
+ */
+template<typename T_Element, typename T_Edge>
+struct edge_table {
+    using type = std::map<T_Element, T_Edge>;
+};
+
+template<typename T_Edge>
+struct edge_table<Symbol, T_Edge> {
+    using type = EdgeArray<Symbol, T_Edge>;
+};
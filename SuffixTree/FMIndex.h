@@ -0,0 +1,300 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <set>
+#include <vector>
+
+#include "KeyInternal.h"
+#include "WaveletMatrix.h"
+
+/**
+ * A compressed alternative to SuffixTree with the same put and search operations, for corpora too large for
+ * a pointer-based tree.
+ *
+ * The keys are concatenated into one text (each followed by a separator) and indexed by an FM-index:
+ * the Burrows-Wheeler transform of the text stored in a wavelet tree, plus a suffix array sampled every
+ * <tt>sample_rate</tt> text positions. Key boundaries are kept as a bit vector over the text, which maps any
+ * text position to its key (the document array, stored implicitly) and from there to the key's value.
+ *
+ * The index is built offline: put only records the key, build() (re)creates the index over everything put so far,
+ * and search only sees keys added before the last build().
+ * Unlike SuffixTree, keys are copied, so they don't need to outlive the index.
+ *
+ * Search costs O(m log sigma) to find the range of suffixes starting with the word, then
+ * O(sample_rate log sigma) per occurrence to locate it.
+ */
+template<typename T_String, typename T_Mapped>
+class FMIndex {
+public:
+    using mapped_type = T_Mapped;
+    using size_type = std::size_t;
+
+private:
+    using element_type = typename KeyInternal<T_String>::value_type;
+    using code_type = std::uint32_t;
+
+    enum : code_type {
+        /// Code of the single sentinel ending the text, smaller than anything else
+        end_code = 0,
+        /// Code of the separator following every key
+        separator_code = 1
+    };
+
+    /// Sorted distinct elements, alphabet_[k] is encoded as k + 2
+    std::vector<element_type> alphabet_;
+
+    WaveletMatrix bwt_;
+    /// counts_[c]: number of symbols of the text smaller than c
+    std::vector<size_type> counts_;
+    /// Row of the sorted suffixes holding the whole text
+    size_type primary_ = 0;
+
+    size_type sample_rate_;
+    /// Rows whose suffix starts at a multiple of sample_rate_, and those starting positions in row order
+    RankBitVector sampled_rows_;
+    std::vector<std::uint32_t> samples_;
+
+    /// Bit set at the first text position of every key
+    RankBitVector key_starts_;
+    /// Value of every key, in text order
+    std::vector<mapped_type> values_;
+
+    std::vector<std::vector<element_type>> pending_keys_;
+    std::vector<mapped_type> pending_values_;
+
+    static bool equal(const element_type &a, const element_type &b) { return !(a < b) && !(b < a); }
+
+    /**
+     * Returns the code of <tt>e</tt>, or end_code if it is not part of the alphabet.
+     */
+    code_type encode(const element_type &e) const {
+        auto it = std::lower_bound(alphabet_.begin(), alphabet_.end(), e);
+        if (it == alphabet_.end() || !equal(*it, e))
+            return end_code;
+        return (code_type) (it - alphabet_.begin()) + 2;
+    }
+
+    /**
+     * Row of the suffix starting one position before the one in <tt>row</tt> (the LF mapping).
+     */
+    size_type lf(size_type row) const {
+        const auto c = bwt_.access(row);
+        return counts_[c] + bwt_.rank(c, row);
+    }
+
+    /**
+     * Text position of the suffix in <tt>row</tt>.
+     */
+    size_type locate(size_type row) const {
+        size_type steps = 0;
+        while (!sampled_rows_.get(row)) {
+            row = lf(row);
+            steps++;
+        }
+        return samples_[sampled_rows_.rank1(row)] + steps;
+    }
+
+    /**
+     * Rebuilds the text from the transform, by walking the LF mapping backwards from its last symbol.
+     */
+    std::vector<code_type> extract_text() const {
+        std::vector<code_type> text(bwt_.size());
+
+        auto row = primary_;
+        for (auto i = text.size(); i > 0; i--) {
+            text[i - 1] = bwt_.access(row);
+            row = lf(row);
+        }
+        // the symbol preceding the whole text is the sentinel at its end
+        return text;
+    }
+
+    /**
+     * Sorts the cyclic shifts of <tt>text</tt>, whose symbols are in [0, sigma), by prefix doubling.
+     * The text ends with a unique smallest symbol, so this is also the order of its suffixes.
+     */
+    static std::vector<std::uint32_t> sort_suffixes(const std::vector<code_type> &text, size_type sigma) {
+        const auto n = text.size();
+        std::vector<std::uint32_t> order(n), classes(n), next_order(n), next_classes(n);
+        std::vector<std::uint32_t> counts(std::max(sigma, n), 0);
+
+        for (auto c: text) counts[c]++;
+        for (size_type c = 1; c < sigma; c++) counts[c] += counts[c - 1];
+        for (auto i = n; i > 0; i--) order[--counts[text[i - 1]]] = (std::uint32_t) (i - 1);
+
+        size_type class_count = 1;
+        classes[order[0]] = 0;
+        for (size_type i = 1; i < n; i++) {
+            if (text[order[i]] != text[order[i - 1]]) class_count++;
+            classes[order[i]] = (std::uint32_t) (class_count - 1);
+        }
+
+        for (size_type h = 1; h < n && class_count < n; h <<= 1) {
+            // order by the second half is the current order shifted left by h
+            for (size_type i = 0; i < n; i++)
+                next_order[i] = (std::uint32_t) ((order[i] + n - h) % n);
+
+            std::fill(counts.begin(), counts.begin() + class_count, 0);
+            for (size_type i = 0; i < n; i++) counts[classes[next_order[i]]]++;
+            for (size_type c = 1; c < class_count; c++) counts[c] += counts[c - 1];
+            for (auto i = n; i > 0; i--) order[--counts[classes[next_order[i - 1]]]] = next_order[i - 1];
+
+            class_count = 1;
+            next_classes[order[0]] = 0;
+            for (size_type i = 1; i < n; i++) {
+                if (classes[order[i]] != classes[order[i - 1]] ||
+                    classes[(order[i] + h) % n] != classes[(order[i - 1] + h) % n])
+                    class_count++;
+                next_classes[order[i]] = (std::uint32_t) (class_count - 1);
+            }
+            classes.swap(next_classes);
+        }
+
+        return order;
+    }
+
+public:
+    explicit FMIndex(size_type sample_rate = 32) : sample_rate_(sample_rate) {
+        assert(sample_rate > 0);
+    }
+
+    /**
+     * Records <tt>string</tt> under <tt>index</tt>. It becomes searchable after the next build().
+     */
+    void put(const T_String &string, mapped_type index) {
+        pending_keys_.emplace_back(std::begin(string), std::end(string));
+        pending_values_.push_back(std::move(index));
+    }
+
+    /**
+     * Number of keys put since the last build().
+     */
+    size_type pending() const { return pending_keys_.size(); }
+
+    /**
+     * Number of keys in the index.
+     */
+    size_type size() const { return values_.size(); }
+
+    /**
+     * Builds the index over all the keys put so far.
+     */
+    void build() {
+        if (pending_keys_.empty() && bwt_.size())
+            return;
+
+        // the keys already indexed are recovered from the index itself
+        auto old_text = bwt_.size() ? extract_text() : std::vector<code_type>();
+        auto old_alphabet = std::move(alphabet_);
+
+        alphabet_ = old_alphabet;
+        for (auto &key: pending_keys_)
+            alphabet_.insert(alphabet_.end(), key.begin(), key.end());
+        std::sort(alphabet_.begin(), alphabet_.end());
+        alphabet_.erase(std::unique(alphabet_.begin(), alphabet_.end(), equal), alphabet_.end());
+        assert(alphabet_.size() < UINT32_MAX - 2);
+
+        size_type text_size = old_text.size() + pending_keys_.size() + 1;
+        for (auto &key: pending_keys_) text_size += key.size();
+
+        std::vector<code_type> text;
+        text.reserve(text_size);
+        for (size_type i = 0; i + 1 < old_text.size(); i++) {
+            auto c = old_text[i];
+            text.push_back(c < 2 ? c : encode(old_alphabet[c - 2]));
+        }
+        for (auto &key: pending_keys_) {
+            for (auto &e: key) text.push_back(encode(e));
+            text.push_back(separator_code);
+        }
+        text.push_back(end_code);
+        assert(text.size() < UINT32_MAX);
+
+        values_.insert(values_.end(), pending_values_.begin(), pending_values_.end());
+        pending_keys_.clear();
+        pending_values_.clear();
+
+        const auto n = text.size();
+        const auto sigma = alphabet_.size() + 2;
+        auto suffixes = sort_suffixes(text, sigma);
+
+        counts_.assign(sigma + 1, 0);
+        for (auto c: text) counts_[c + 1]++;
+        for (size_type c = 1; c <= sigma; c++) counts_[c] += counts_[c - 1];
+
+        std::vector<code_type> last_column(n);
+        sampled_rows_ = RankBitVector(n);
+        samples_.clear();
+        for (size_type row = 0; row < n; row++) {
+            const auto pos = suffixes[row];
+            last_column[row] = text[(pos + n - 1) % n];
+            if (pos == 0)
+                primary_ = row;
+            if (pos % sample_rate_ == 0) {
+                sampled_rows_.set(row);
+                samples_.push_back(pos);
+            }
+        }
+        sampled_rows_.build_rank();
+        samples_.shrink_to_fit();
+
+        key_starts_ = RankBitVector(n);
+        bool at_start = true;
+        for (size_type pos = 0; pos + 1 < n; pos++) {
+            if (at_start) key_starts_.set(pos);
+            at_start = text[pos] == separator_code;
+        }
+        key_starts_.build_rank();
+
+        bwt_ = WaveletMatrix(std::move(last_column), (std::uint32_t) sigma);
+    }
+
+    /**
+     * Returns at most <tt>count</tt> values of the keys containing <tt>word</tt>, see SuffixTree::search.
+     */
+    std::set<mapped_type> search(const T_String &word, int count) const {
+        std::set<mapped_type> result;
+        if (!bwt_.size())
+            return result;
+
+        std::vector<code_type> pattern;
+        for (auto &e: word) {
+            auto c = encode(e);
+            if (c == end_code)
+                // not in any key
+                return result;
+            pattern.push_back(c);
+        }
+        if (pattern.empty())
+            return result;
+
+        // backward search: [from, to) are the rows of the suffixes starting with the part of the word read so far
+        size_type from = 0, to = bwt_.size();
+        for (auto it = pattern.rbegin(); it != pattern.rend() && from < to; ++it) {
+            from = counts_[*it] + bwt_.rank(*it, from);
+            to = counts_[*it] + bwt_.rank(*it, to);
+        }
+
+        for (auto row = from; row < to && result.size() != (size_type) count; row++) {
+            const auto key = key_starts_.rank1(locate(row) + 1) - 1;
+            result.insert(values_[key]);
+        }
+        return result;
+    }
+
+    std::set<mapped_type> search(const T_String &word) const {
+        return search(word, -1);
+    }
+
+    /**
+     * Heap memory held by the index, pending keys excluded.
+     */
+    size_type memory_bytes() const {
+        return alphabet_.capacity() * sizeof(element_type) + bwt_.memory_bytes() +
+               counts_.capacity() * sizeof(size_type) + sampled_rows_.memory_bytes() +
+               samples_.capacity() * sizeof(std::uint32_t) + key_starts_.memory_bytes() +
+               values_.capacity() * sizeof(mapped_type);
+    }
+};
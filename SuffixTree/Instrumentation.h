@@ -0,0 +1,160 @@
+#pragma once
+
+/**
+ * Optional hot-path instrumentation.
+ *
+ * Compile with SUFFIX_TREE_INSTRUMENTATION defined to count the inner steps of put and search
+ * and to record their latencies. Without it, every macro below expands to nothing.
+ *
+ * Counters are kept per thread, see suffix_tree_counters().
+ */
+
+#ifdef SUFFIX_TREE_INSTRUMENTATION
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+/**
+ * Latency histogram with power-of-two nanosecond buckets: bucket i holds samples in [2^i, 2^(i+1)).
+ */
+class SuffixTreeLatencyHistogram {
+public:
+    static constexpr int bucket_count = 48;
+
+private:
+    std::uint64_t buckets_[bucket_count] = {};
+    std::uint64_t count_ = 0;
+    std::uint64_t total_ns_ = 0;
+    std::uint64_t max_ns_ = 0;
+
+public:
+    void record(std::uint64_t ns) {
+        int bucket = 0;
+        for (auto v = ns; v > 1 && bucket < bucket_count - 1; v >>= 1) bucket++;
+
+        buckets_[bucket]++;
+        count_++;
+        total_ns_ += ns;
+        if (ns > max_ns_) max_ns_ = ns;
+    }
+
+    std::uint64_t count() const { return count_; }
+
+    std::uint64_t total_ns() const { return total_ns_; }
+
+    std::uint64_t max_ns() const { return max_ns_; }
+
+    double mean_ns() const { return count_ ? (double) total_ns_ / (double) count_ : 0; }
+
+    /**
+     * Returns the upper bound of the bucket containing the p-th percentile (0 <= p <= 100).
+     */
+    std::uint64_t percentile_ns(double p) const {
+        if (!count_) return 0;
+
+        auto rank = (std::uint64_t) ((double) count_ * p / 100.0);
+        if (rank >= count_) rank = count_ - 1;
+
+        std::uint64_t seen = 0;
+        for (int i = 0; i < bucket_count; i++) {
+            seen += buckets_[i];
+            if (seen > rank) return std::uint64_t(1) << (i + 1);
+        }
+        return max_ns_;
+    }
+
+    void reset() { *this = SuffixTreeLatencyHistogram(); }
+
+    void print(std::ostream &os) const {
+        os << "count=" << count_ << " mean=" << mean_ns() << "ns p50<=" << percentile_ns(50)
+           << "ns p99<=" << percentile_ns(99) << "ns max=" << max_ns_ << "ns";
+    }
+};
+
+struct SuffixTreeCounters {
+    /// Edges skipped by canonize
+    std::uint64_t canonize_iterations = 0;
+    /// Outcomes of one extension step of put: suffix already present, edge split, new leaf under a node
+    std::uint64_t extension_found = 0;
+    std::uint64_t extension_split = 0;
+    std::uint64_t extension_new_leaf = 0;
+    /// Leading key elements of put already in the tree, read in one descent instead of by extension steps
+    std::uint64_t contained_prefix_elements = 0;
+    /// Implicit suffixes given the value at the end of put, walking the suffix chain
+    std::uint64_t suffix_chain_steps = 0;
+    /// Child lookups, and how many of them found no edge
+    std::uint64_t get_edge_lookups = 0;
+    std::uint64_t get_edge_misses = 0;
+    /// Label elements compared by search_node
+    std::uint64_t search_label_compares = 0;
+    /// Searches answered by the q-gram table, see enable_short_queries
+    std::uint64_t short_query_hits = 0;
+
+    SuffixTreeLatencyHistogram put_latency;
+    SuffixTreeLatencyHistogram search_latency;
+
+    void reset() { *this = SuffixTreeCounters(); }
+
+    void print(std::ostream &os) const {
+        os << "canonize_iterations " << canonize_iterations << '\n'
+           << "extension_found " << extension_found << '\n'
+           << "extension_split " << extension_split << '\n'
+           << "extension_new_leaf " << extension_new_leaf << '\n'
+           << "contained_prefix_elements " << contained_prefix_elements << '\n'
+           << "suffix_chain_steps " << suffix_chain_steps << '\n'
+           << "get_edge_lookups " << get_edge_lookups << '\n'
+           << "get_edge_misses " << get_edge_misses << '\n'
+           << "search_label_compares " << search_label_compares << '\n'
+           << "short_query_hits " << short_query_hits << '\n'
+           << "put_latency ";
+        put_latency.print(os);
+        os << "\nsearch_latency ";
+        search_latency.print(os);
+        os << '\n';
+    }
+};
+
+/**
+ * Counters of the calling thread.
+ */
+inline SuffixTreeCounters &suffix_tree_counters() {
+    static thread_local SuffixTreeCounters counters;
+    return counters;
+}
+
+/**
+ * Records the lifetime of the enclosing scope into a histogram.
+ */
+class SuffixTreeScopedTimer {
+    using clock = std::chrono::steady_clock;
+
+    SuffixTreeLatencyHistogram &histogram_;
+    clock::time_point start_;
+
+public:
+    explicit SuffixTreeScopedTimer(SuffixTreeLatencyHistogram &histogram)
+            : histogram_(histogram), start_(clock::now()) {}
+
+    SuffixTreeScopedTimer(const SuffixTreeScopedTimer &) = delete;
+
+    SuffixTreeScopedTimer &operator=(const SuffixTreeScopedTimer &) = delete;
+
+    ~SuffixTreeScopedTimer() {
+        histogram_.record((std::uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+                clock::now() - start_).count());
+    }
+};
+
+#define SUFFIX_TREE_COUNT(field) (++suffix_tree_counters().field)
+#define SUFFIX_TREE_COUNT_N(field, n) (suffix_tree_counters().field += (n))
+#define SUFFIX_TREE_TIMED_SCOPE(histogram) \
+    SuffixTreeScopedTimer suffix_tree_scoped_timer_(suffix_tree_counters().histogram)
+
+#else
+
+#define SUFFIX_TREE_COUNT(field) ((void) 0)
+#define SUFFIX_TREE_COUNT_N(field, n) ((void) 0)
+#define SUFFIX_TREE_TIMED_SCOPE(histogram) ((void) 0)
+
+#endif
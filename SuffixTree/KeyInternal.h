@@ -1,27 +1,69 @@
 #pragma once
 
 #include <algorithm>
-
+#include <cstddef>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
+#if __cplusplus >= 202002L && defined(__has_include)
+#if __has_include(<span>)
+#include <span>
+#endif
+#endif
+
+/**
+ * Whether T_Key is a view over elements stored elsewhere, rather than a container owning them.
+ * A view is cheap to copy and owns nothing, so SuffixTree::put stores it as is even when given a temporary.
+ *
+ * Specialize it for other view types.
+ */
+template<typename T_Key>
+struct is_key_view : std::false_type {};
+
+#if __cplusplus >= 201703L
+template<typename T_Char, typename T_Traits>
+struct is_key_view<std::basic_string_view<T_Char, T_Traits>> : std::true_type {};
+#endif
+#if defined(__cpp_lib_span)
+template<typename T_Element, std::size_t Extent>
+struct is_key_view<std::span<T_Element, Extent>> : std::true_type {};
+#endif
+
+/**
+ * A range of a key, as a pair of iterators.
+ *
+ * T_Key only has to be iterable with std::begin and std::end, so that besides containers, views such as
+ * std::string_view and std::span can be used as keys.
+ */
 template<typename T_Key>
 class KeyInternal {
+public:
+    using const_iterator = decltype(std::begin(std::declval<const T_Key &>()));
+    using value_type = typename std::iterator_traits<const_iterator>::value_type;
+    using size_type = std::size_t;
+
 private:
     /// Start and end (1 past last position) of a substring
-    using const_iterator = typename T_Key::const_iterator;
-
     const_iterator begin_;
     const_iterator end_;
+    /// Number of elements in [begin_, end_), cached so that no operation has to walk the range to measure it
+    size_type size_ = 0;
 
 public:
-    using value_type = typename T_Key::value_type;
-    using size_type = typename T_Key::size_type;
-
     KeyInternal() = default;
 
     KeyInternal(const T_Key &key)
-            : begin_(std::begin(key)), end_(std::end(key)) {}
+            : begin_(std::begin(key)), end_(std::end(key)), size_(std::distance(begin_, end_)) {}
 
     KeyInternal(const const_iterator &begin, const const_iterator &end)
-            : begin_(begin), end_(end) {}
+            : begin_(begin), end_(end), size_(std::distance(begin, end)) {}
+
+    KeyInternal(const const_iterator &begin, const const_iterator &end, size_type size)
+            : begin_(begin), end_(end), size_(size) {}
 
     KeyInternal(const KeyInternal &src) = default;
 
@@ -43,67 +85,55 @@ public:
 
     inline const_iterator end() const { return end_; }
 
-    inline const_iterator iter_at(int idx) const { return std::next(this->begin(), idx); }
+    inline const_iterator iter_at(size_type idx) const { return std::next(this->begin(), idx); }
 
-    inline value_type at(int idx) const { return *std::next(this->begin(), idx); }
+    inline value_type at(size_type idx) const { return *std::next(this->begin(), idx); }
 
     [[nodiscard]] inline size_type size(size_type from_idx = 0) const {
-        const auto begin = std::next(this->begin(), from_idx);
-        const auto end = this->end();
-        auto size = std::distance(begin, end);
-
-        return size < 0 ? 0 : size;
+        return from_idx < size_ ? size_ - from_idx : 0;
     }
 
     [[nodiscard]] inline bool empty() const {
-        return std::distance(this->begin(), this->end()) <= 0;
+        return size_ == 0;
     }
 
     inline KeyInternal substr(size_type from_idx) const {
-        const auto start_used = std::next(this->begin(), from_idx);
-        const auto key_end = this->end();
-        auto result = KeyInternal(std::distance(start_used, key_end) > 0 ? start_used : key_end,
-                                  key_end);
+        if (from_idx >= size_)
+            return KeyInternal(end_, end_, 0);
 
-        return result;
+        return KeyInternal(std::next(this->begin(), from_idx), end_, size_ - from_idx);
     }
 
     inline KeyInternal substr(size_type from_idx, size_type len) const {
-        const auto start_used = std::next(this->begin(), from_idx);
-        const auto end_used = std::next(start_used, len);
-        const auto key_end = this->end();
-        auto result = KeyInternal(std::distance(start_used, key_end) > 0 ? start_used : key_end,
-                                  std::distance(end_used, key_end) > 0 ? end_used : key_end);
+        if (from_idx >= size_)
+            return KeyInternal(end_, end_, 0);
+        if (len >= size_ - from_idx)
+            return substr(from_idx);
 
-        return result;
+        const auto start_used = std::next(this->begin(), from_idx);
+        return KeyInternal(start_used, std::next(start_used, len), len);
     }
 
     bool has_prefix(const KeyInternal &prefix, size_type str_begin_idx = 0, size_type prefix_begin_idx = 0) const {
-        if (this->size() < prefix.size()) return false;
+        if (this->size(str_begin_idx) < prefix.size(prefix_begin_idx)) return false;
 
-        const auto prefix_begin = std::next(prefix.begin(), prefix_begin_idx);
         const auto prefix_end = prefix.end();
 
-        auto pit = prefix_begin;
-        {
-            for (auto it = std::next(this->begin(), str_begin_idx);
-                 it != this->end() && pit != prefix_end; it++, pit++) {
-                auto e = *it;
-                auto pe = *pit;
-                if (e < pe || pe < e) break;
-            }
+        auto pit = std::next(prefix.begin(), prefix_begin_idx);
+        for (auto it = std::next(this->begin(), str_begin_idx); pit != prefix_end; it++, pit++) {
+            auto &e = *it;
+            auto &pe = *pit;
+            if (e < pe || pe < e) break;
         }
 
         return pit == prefix_end;
     }
 
     [[nodiscard]] T_Key debug(size_type pos = 0) const {
-        const auto key_start = std::next(this->begin(), pos);
-        const auto key_end = this->end();
-        if (std::distance(key_start, key_end) <= 0) {
+        if (pos >= size_) {
             return {};
         }
 
-        return T_Key(key_start, key_end);
+        return T_Key(std::next(this->begin(), pos), this->end());
     }
 };
\ No newline at end of file
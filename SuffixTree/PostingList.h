@@ -0,0 +1,73 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+/**
+ * A sorted, duplicate-free list of values (a posting list), the candidates of a boolean query.
+ *
+ * Values are appended in any order and normalized once, then looked up by binary search while other lists are
+ * walked, and the values found (or not found) are kept.
+ */
+template<typename T_Mapped>
+class PostingList {
+public:
+    using mapped_type = T_Mapped;
+    using size_type = std::size_t;
+    using const_iterator = typename std::vector<mapped_type>::const_iterator;
+
+private:
+    std::vector<mapped_type> values_;
+
+public:
+    /**
+     * Appends a value in any order: normalize must be called before the list is used.
+     */
+    void push_back(const mapped_type &value) { values_.push_back(value); }
+
+    template<typename Iterator>
+    void append(Iterator first, Iterator last) { values_.insert(values_.end(), first, last); }
+
+    /**
+     * Sorts the values and drops the duplicates.
+     */
+    void normalize() {
+        std::sort(values_.begin(), values_.end());
+        values_.erase(std::unique(values_.begin(), values_.end(), [](const mapped_type &a, const mapped_type &b) {
+            return !(a < b) && !(b < a);
+        }), values_.end());
+    }
+
+    /**
+     * Position of <tt>value</tt> in the list, size() if it isn't in it.
+     */
+    size_type find(const mapped_type &value) const {
+        auto it = std::lower_bound(values_.begin(), values_.end(), value);
+        return it != values_.end() && !(value < *it) ? (size_type) (it - values_.begin()) : values_.size();
+    }
+
+    /**
+     * Keeps the values at the positions i where <tt>marks[i] == marked</tt>.
+     */
+    void retain(const std::vector<bool> &marks, bool marked) {
+        size_type out = 0;
+        for (size_type i = 0; i < values_.size(); i++)
+            if (marks[i] == marked)
+                values_[out++] = values_[i];
+        values_.resize(out);
+    }
+
+    /**
+     * Empties the list, keeping its storage.
+     */
+    void clear() { values_.clear(); }
+
+    bool empty() const { return values_.empty(); }
+
+    size_type size() const { return values_.size(); }
+
+    const_iterator begin() const { return values_.begin(); }
+
+    const_iterator end() const { return values_.end(); }
+};
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <set>
+#include <type_traits>
+#include <vector>
+
+/**
+ * Direct lookup table of the values of the keys containing every word of 1 to q byte-sized elements (q-grams),
+ * so that very short searches are answered by one array load instead of a descent and a subtree walk.
+ *
+ * Every q-gram has a slot in a dense array: 256 + 256^2 + ... + 256^q slots, 4 bytes each (67 MB for q = 3),
+ * holding the position of its value list, sorted and without duplicates, in a list of lists allocated only
+ * for the q-grams that occur.
+ */
+template<typename T_Element, typename T_Mapped>
+class QGramTable {
+public:
+    using mapped_type = T_Mapped;
+    using size_type = std::size_t;
+
+    enum : size_type { max_q = 3 };
+
+private:
+    size_type q_;
+    /// 1 + position of the value list of every q-gram in lists_, 0 if it occurs in no key
+    std::vector<std::uint32_t> slots_;
+    std::vector<std::vector<mapped_type>> lists_;
+    /// slot of every list of lists_
+    std::vector<size_type> list_slots_;
+
+    static size_type byte(const T_Element &element) { return byte(element, std::is_integral<T_Element>()); }
+
+    static size_type byte(const T_Element &element, std::true_type) { return (unsigned char) element; }
+
+    /// Lets put compile for other elements, no table can be built for them
+    static size_type byte(const T_Element &, std::false_type) { return 0; }
+
+    /**
+     * Slot of the q-gram of <tt>length</tt> elements starting at <tt>first</tt>:
+     * the slots of the shorter q-grams come first.
+     */
+    template<typename Iterator>
+    static size_type slot(Iterator first, size_type length) {
+        size_type offset = 0, index = 0;
+        for (size_type i = 0; i < length; i++, ++first) {
+            offset = (offset << 8) + 1;
+            index = (index << 8) | byte(*first);
+        }
+        return offset - 1 + index;
+    }
+
+    std::vector<mapped_type> &list(size_type slot) {
+        if (!slots_[slot]) {
+            lists_.emplace_back();
+            list_slots_.push_back(slot);
+            slots_[slot] = (std::uint32_t) lists_.size();
+        }
+        return lists_[slots_[slot] - 1];
+    }
+
+public:
+    explicit QGramTable(size_type q) : q_(q) {
+        static_assert(sizeof(T_Element) == 1 && std::is_integral<T_Element>::value,
+                      "q-gram tables index byte-sized elements only");
+        assert(q >= 1 && q <= max_q);
+        slots_.assign(slot(std::vector<unsigned char>(q, 0xff).begin(), q) + 1, 0);
+    }
+
+    size_type q() const { return q_; }
+
+    /**
+     * Whether [first, last) is short enough to be looked up in the table.
+     */
+    template<typename Iterator>
+    bool covers(Iterator first, Iterator last) const {
+        size_type length = 0;
+        for (; first != last; ++first)
+            if (++length > q_)
+                return false;
+        return length > 0;
+    }
+
+    /**
+     * Adds <tt>value</tt> to the lists of all the q-grams of the key [first, last).
+     * Values are appended as put adds them, in non-decreasing order; others are inserted in place.
+     */
+    template<typename Iterator>
+    void add(Iterator first, Iterator last, const mapped_type &value) {
+        for (; first != last; ++first) {
+            auto end = first;
+            for (size_type length = 1; length <= q_ && end != last; length++) {
+                ++end;
+                auto &values = list(slot(first, length));
+                if (values.empty() || values.back() < value)
+                    values.push_back(value);
+                else if (value < values.back()) {
+                    auto it = std::lower_bound(values.begin(), values.end(), value);
+                    if (*it < value || value < *it)
+                        values.insert(it, value);
+                }
+            }
+        }
+    }
+
+    /**
+     * Sets the list of the q-gram [first, first + length) to the sorted, distinct values of [values_first, values_last).
+     */
+    template<typename Iterator, typename ValueIterator>
+    void assign(Iterator first, size_type length, ValueIterator values_first, ValueIterator values_last) {
+        assert(length >= 1 && length <= q_);
+        list(slot(first, length)).assign(values_first, values_last);
+    }
+
+    /**
+     * Adds the values of every q-gram of <tt>other</tt>, a table of the same q, to the q-gram's list.
+     * Costs time proportional to the lists of <tt>other</tt> and those they are united with, not to the slots.
+     */
+    void merge(const QGramTable &other) {
+        assert(other.q_ == q_);
+        std::vector<mapped_type> united;
+        for (size_type i = 0; i < other.lists_.size(); i++) {
+            const auto &added = other.lists_[i];
+            if (added.empty())
+                continue;
+            auto &values = list(other.list_slots_[i]);
+            if (values.empty() || values.back() < added.front()) {
+                values.insert(values.end(), added.begin(), added.end());
+                continue;
+            }
+
+            united.clear();
+            std::set_union(values.begin(), values.end(), added.begin(), added.end(), std::back_inserter(united));
+            values.swap(united);
+        }
+    }
+
+    /**
+     * Values of the keys containing [first, last), at most <tt>count</tt> of them, the smallest ones.
+     * [first, last) must be covered.
+     */
+    template<typename Iterator>
+    std::set<mapped_type> find(Iterator first, Iterator last, int count) const {
+        const auto index = slots_[slot(first, (size_type) std::distance(first, last))];
+        if (!index)
+            return std::set<mapped_type>();
+
+        const auto &values = lists_[index - 1];
+        const auto size = count < 0 ? values.size() : std::min(values.size(), (size_type) count);
+        return std::set<mapped_type>(values.begin(), values.begin() + size);
+    }
+
+    /**
+     * Empties every list, keeping the slots.
+     */
+    void clear() {
+        std::fill(slots_.begin(), slots_.end(), 0);
+        lists_.clear();
+        list_slots_.clear();
+    }
+
+    size_type memory_bytes() const {
+        size_type bytes = slots_.capacity() * sizeof(std::uint32_t) + lists_.capacity() * sizeof(lists_[0])
+                          + list_slots_.capacity() * sizeof(size_type);
+        for (auto &values: lists_) bytes += values.capacity() * sizeof(mapped_type);
+        return bytes;
+    }
+};
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <map>
+#include <mutex>
+#include <set>
+#include <utility>
+#include <vector>
+
+/**
+ * Hit and miss counts of a ResultCache.
+ */
+struct ResultCacheStats {
+    std::uint64_t hits = 0;
+    std::uint64_t misses = 0;
+    /// Entries dropped to make room for new ones
+    std::uint64_t evictions = 0;
+    /// Times the whole cache was dropped because the tree changed
+    std::uint64_t invalidations = 0;
+    std::size_t size = 0;
+    std::size_t capacity = 0;
+
+    double hit_rate() const { return hits + misses ? (double) hits / (double) (hits + misses) : 0; }
+};
+
+/**
+ * A bounded cache of search results, keyed by the searched word and the result count, evicting the least
+ * recently used entry when full.
+ *
+ * Entries are valid for one generation of the tree: a lookup or insertion with another generation drops them all.
+ * All operations lock, so the cache can be shared by concurrent searches.
+ */
+template<typename T_Element, typename T_Mapped>
+class ResultCache {
+public:
+    using key_type = std::pair<std::vector<T_Element>, int>;
+    using result_type = std::set<T_Mapped>;
+
+private:
+    struct Entry {
+        key_type key;
+        result_type values;
+    };
+
+    /// Most recently used first
+    std::list<Entry> entries_;
+    std::map<key_type, typename std::list<Entry>::iterator> index_;
+    std::uint64_t generation_ = 0;
+
+    mutable std::mutex mutex_;
+    ResultCacheStats stats_;
+
+    void validate(std::uint64_t generation) {
+        if (generation == generation_)
+            return;
+
+        if (!entries_.empty())
+            stats_.invalidations++;
+        entries_.clear();
+        index_.clear();
+        generation_ = generation;
+    }
+
+public:
+    explicit ResultCache(std::size_t capacity) {
+        stats_.capacity = capacity;
+    }
+
+    /**
+     * Copies the cached result of searching [first, last) with <tt>count</tt> into <tt>result</tt>,
+     * returns false if there is none.
+     */
+    template<typename Iterator>
+    bool find(Iterator first, Iterator last, int count, std::uint64_t generation, result_type &result) {
+        key_type key(std::vector<T_Element>(first, last), count);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        validate(generation);
+
+        auto it = index_.find(key);
+        if (it == index_.end()) {
+            stats_.misses++;
+            return false;
+        }
+
+        stats_.hits++;
+        entries_.splice(entries_.begin(), entries_, it->second);
+        result = it->second->values;
+        return true;
+    }
+
+    template<typename Iterator>
+    void insert(Iterator first, Iterator last, int count, std::uint64_t generation, const result_type &result) {
+        if (!stats_.capacity)
+            return;
+        key_type key(std::vector<T_Element>(first, last), count);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        validate(generation);
+        if (index_.count(key))
+            // cached meanwhile by a concurrent search
+            return;
+
+        entries_.push_front(Entry{key, result});
+        index_.emplace(std::move(key), entries_.begin());
+
+        if (entries_.size() > stats_.capacity) {
+            index_.erase(entries_.back().key);
+            entries_.pop_back();
+            stats_.evictions++;
+        }
+    }
+
+    ResultCacheStats stats() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto stats = stats_;
+        stats.size = entries_.size();
+        return stats;
+    }
+};
@@ -0,0 +1,361 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <functional>
+#include <memory>
+#include <numeric>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "SuffixTree.h"
+#include "WorkStealingPool.h"
+
+/**
+ * How ShardedSuffixTree assigns a value to a shard.
+ */
+enum class ShardingPolicy {
+    /// shard = hash(value) % shard count
+    hash,
+    /// shard = number of boundaries <= value
+    range
+};
+
+/**
+ * A set of independent SuffixTree shards behind the SuffixTree interface.
+ *
+ * Every key is stored in the shard its value maps to, so a value lives in exactly one shard and search
+ * can query all shards concurrently and union their results.
+ * Shards can be built in parallel with put_batch.
+ *
+ * Shards are queried and built on a pool of threads started with the tree, one per shard up to the number of
+ * cores, the calling thread included; with one shard or one core they run on the calling thread alone.
+ * Concurrent searches of the same tree take turns on the pool.
+ *
+ * Besides put and search, the streaming put (begin_put, append, end_put), search_batch, search_all, search_any,
+ * merge, reserve and clear are forwarded to the shards. The repeat and overlap queries (frequent_repeats,
+ * maximal_repeats, supermaximal_repeats, overlaps) are left out on purpose: the occurrences of a repeat and the two
+ * keys of an overlap may lie in different shards, which no shard can see on its own. The search accelerators
+ * (document listing, compact layout, result cache, short queries) are not forwarded either.
+ *
+ * T_Hash is only used with ShardingPolicy::hash. T_ValueSetPolicy is passed on to every shard.
+ */
+template<typename T_String, typename T_Mapped, typename T_Hash = std::hash<T_Mapped>,
+        typename T_ValueSetPolicy = InlineValues<>>
+class ShardedSuffixTree {
+public:
+    using tree_type = SuffixTree<T_String, T_Mapped, T_ValueSetPolicy>;
+    using key_type = typename tree_type::key_type;
+    using mapped_type = typename tree_type::mapped_type;
+    using size_type = typename tree_type::size_type;
+
+    struct ShardStats {
+        /// number of put calls routed to the shard
+        size_type keys = 0;
+        /// total length of those keys
+        size_type elements = 0;
+        size_type nodes = 0;
+        size_type edges = 0;
+    };
+
+private:
+    std::vector<std::unique_ptr<tree_type>> shards_;
+    std::vector<ShardStats> stats_;
+
+    ShardingPolicy policy_;
+    /// Sorted split points for ShardingPolicy::range
+    std::vector<mapped_type> boundaries_;
+    T_Hash hash_;
+
+    /// Shard of the put started by begin_put, if any
+    size_type streaming_ = 0;
+
+    /// Runs one task per shard, see for_each_shard
+    std::unique_ptr<WorkStealingPool> pool_;
+
+    void start_pool() {
+        const size_type cores = std::max(1u, std::thread::hardware_concurrency());
+        pool_.reset(new WorkStealingPool(std::min(shards_.size(), cores) - 1));
+    }
+
+    /**
+     * Calls <tt>body(shard)</tt> for every shard, shards spread over the pool.
+     */
+    template<typename Body>
+    void for_each_shard(Body body) const {
+        if (pool_->size() == 1) {
+            for (size_type shard = 0; shard < shards_.size(); shard++)
+                body(shard);
+            return;
+        }
+
+        std::vector<size_type> tasks(shards_.size());
+        std::iota(tasks.begin(), tasks.end(), size_type(0));
+        pool_->run(tasks, [&body](size_type shard, std::size_t, WorkStealingPool::Job<size_type> &) {
+            body(shard);
+        });
+    }
+
+    /**
+     * Puts the key into the shard, moving it into the shard's storage if it is given as a temporary.
+     */
+    template<typename String>
+    void put_in_shard(size_type shard, String &&string, const mapped_type &index) {
+        auto &stats = stats_[shard];
+        stats.keys++;
+        stats.elements += std::distance(std::begin(string), std::end(string));
+
+        shards_[shard]->put(std::forward<String>(string), index);
+    }
+
+    /**
+     * Routes the entries in [first, last) to their shards and calls <tt>put(shard, it)</tt> for each of them,
+     * the shards being filled in parallel.
+     */
+    template<typename Iterator, typename Put>
+    void put_routed(Iterator first, Iterator last, Put put) {
+        std::vector<std::vector<Iterator>> routed(shards_.size());
+        for (auto it = first; it != last; ++it)
+            routed[shard_of(it->second)].push_back(it);
+
+        for_each_shard([&routed, &put](size_type shard) {
+            for (auto &it: routed[shard])
+                put(shard, it);
+        });
+    }
+
+    /**
+     * Runs <tt>query</tt> on all shards concurrently and returns the union of their results.
+     */
+    template<typename Query>
+    std::set<mapped_type> unite_shards(Query query) const {
+        std::vector<std::set<mapped_type>> partial(shards_.size());
+        for_each_shard([this, &partial, &query](size_type shard) {
+            partial[shard] = query(*shards_[shard]);
+        });
+
+        auto result = std::move(partial[0]);
+        for (size_type shard = 1; shard < shards_.size(); shard++)
+            result.insert(partial[shard].begin(), partial[shard].end());
+        return result;
+    }
+
+public:
+    /**
+     * Creates <tt>shard_count</tt> shards, values are spread by hash.
+     */
+    explicit ShardedSuffixTree(size_type shard_count, T_Hash hash = T_Hash())
+            : policy_(ShardingPolicy::hash), hash_(std::move(hash)) {
+        assert(shard_count > 0);
+        for (size_type i = 0; i < shard_count; i++)
+            shards_.emplace_back(new tree_type);
+        stats_.resize(shard_count);
+        start_pool();
+    }
+
+    /**
+     * Creates <tt>boundaries.size() + 1</tt> shards, values are spread by range:
+     * shard i holds the values v with boundaries[i - 1] <= v < boundaries[i].
+     */
+    explicit ShardedSuffixTree(std::vector<mapped_type> boundaries)
+            : policy_(ShardingPolicy::range), boundaries_(std::move(boundaries)) {
+        std::sort(boundaries_.begin(), boundaries_.end());
+        for (size_type i = 0; i <= boundaries_.size(); i++)
+            shards_.emplace_back(new tree_type);
+        stats_.resize(shards_.size());
+        start_pool();
+    }
+
+    ShardingPolicy policy() const { return policy_; }
+
+    size_type shard_count() const { return shards_.size(); }
+
+    /**
+     * Returns the index of the shard that holds <tt>index</tt>.
+     */
+    size_type shard_of(const mapped_type &index) const {
+        if (policy_ == ShardingPolicy::hash)
+            return hash_(index) % shards_.size();
+        return std::upper_bound(boundaries_.begin(), boundaries_.end(), index) - boundaries_.begin();
+    }
+
+    tree_type const &shard(size_type i) const { return *shards_[i]; }
+
+    /**
+     * Per-shard statistics, in shard order.
+     */
+    std::vector<ShardStats> stats() const {
+        auto result = stats_;
+        for (size_type i = 0; i < shards_.size(); i++) {
+            result[i].nodes = shards_[i]->node_count();
+            result[i].edges = shards_[i]->edge_count();
+        }
+        return result;
+    }
+
+    /**
+     * Adds the specified <tt>index</tt> under the given <tt>key</tt>, in the shard the index maps to.
+     * See SuffixTree::put.
+     */
+    void put(const T_String &string, const mapped_type &index) {
+        put_in_shard(shard_of(index), string, index);
+    }
+
+    /**
+     * Adds the specified <tt>index</tt> under a key given as a temporary, moved into the shard's storage.
+     * See SuffixTree::put.
+     */
+    void put(T_String &&string, const mapped_type &index) {
+        put_in_shard(shard_of(index), std::move(string), index);
+    }
+
+    /**
+     * Adds a range of (key, index) pairs, building the shards in parallel.
+     * As with put, the keys must outlive the tree.
+     */
+    template<typename Iterator>
+    void put_batch(Iterator first, Iterator last) {
+        put_routed(first, last, [this](size_type shard, Iterator it) {
+            put_in_shard(shard, it->first, it->second);
+        });
+    }
+
+    /**
+     * Adds (key, index) pairs, building the shards in parallel. The keys are moved into the shards,
+     * so they don't need to be kept alive; <tt>entries</tt> is left with moved-from keys.
+     */
+    void put_batch(std::vector<std::pair<T_String, mapped_type>> &&entries) {
+        using iterator = typename std::vector<std::pair<T_String, mapped_type>>::iterator;
+        put_routed(entries.begin(), entries.end(), [this](size_type shard, iterator it) {
+            put_in_shard(shard, std::move(it->first), it->second);
+        });
+    }
+
+    /**
+     * Starts adding <tt>index</tt> under a key passed in chunks, in the shard the index maps to.
+     * See SuffixTree::begin_put.
+     */
+    void begin_put(mapped_type index) {
+        streaming_ = shard_of(index);
+        stats_[streaming_].keys++;
+        shards_[streaming_]->begin_put(std::move(index));
+    }
+
+    /**
+     * Appends the elements in [first, last) to the key of the put started by begin_put.
+     */
+    template<typename Iterator>
+    void append(Iterator first, Iterator last) {
+        stats_[streaming_].elements += std::distance(first, last);
+        shards_[streaming_]->append(first, last);
+    }
+
+    void append(const T_String &chunk) {
+        append(std::begin(chunk), std::end(chunk));
+    }
+
+    /**
+     * Completes the put started by begin_put.
+     */
+    void end_put() {
+        shards_[streaming_]->end_put();
+    }
+
+    /**
+     * Moves all the keys of <tt>other</tt> into this tree shard by shard, leaving <tt>other</tt> empty,
+     * see SuffixTree::merge. Both trees must spread values alike: same policy, shard count and boundaries
+     * (and hash, with ShardingPolicy::hash).
+     */
+    void merge(ShardedSuffixTree &&other) {
+        if (&other == this)
+            return;
+        assert(policy_ == other.policy_ && shards_.size() == other.shards_.size() && boundaries_ == other.boundaries_);
+
+        for_each_shard([this, &other](size_type shard) {
+            shards_[shard]->merge(std::move(*other.shards_[shard]));
+        });
+        for (size_type shard = 0; shard < shards_.size(); shard++) {
+            stats_[shard].keys += other.stats_[shard].keys;
+            stats_[shard].elements += other.stats_[shard].elements;
+            other.stats_[shard] = ShardStats();
+        }
+    }
+
+    /**
+     * Allocates room for keys of <tt>total_elements</tt> elements in all, assuming they spread evenly
+     * over the shards, see SuffixTree::reserve.
+     */
+    void reserve(size_type total_elements) {
+        const auto per_shard = (total_elements + shards_.size() - 1) / shards_.size();
+        for (auto &shard: shards_) shard->reserve(per_shard);
+    }
+
+    /**
+     * Removes all the keys of all shards, keeping their storage, see SuffixTree::clear.
+     */
+    void clear() {
+        for (auto &shard: shards_) shard->clear();
+        std::fill(stats_.begin(), stats_.end(), ShardStats());
+    }
+
+    /**
+     * Searches all shards concurrently and returns at most <tt>count</tt> values, see SuffixTree::search.
+     *
+     * Which values come back differs from a single SuffixTree holding the same keys: each shard returns the
+     * first <tt>count</tt> values it finds in tree order, and of their union the smallest <tt>count</tt> are kept.
+     * The result doesn't depend on how the pool spreads the shards.
+     */
+    std::set<mapped_type> search(const T_String &word, int count) const {
+        auto result = unite_shards([&word, count](const tree_type &tree) { return tree.search(word, count); });
+
+        if (count >= 0 && result.size() > (size_type) count)
+            result.erase(std::next(result.begin(), count), result.end());
+        return result;
+    }
+
+    /**
+     * Searches all shards concurrently, see SuffixTree::search.
+     */
+    std::set<mapped_type> search(const T_String &word) const {
+        return search(word, -1);
+    }
+
+    /**
+     * Searches for every word of <tt>words</tt>, see SuffixTree::search_batch: every shard runs the whole batch,
+     * and the results of each word are united and trimmed as with search.
+     */
+    std::vector<std::set<mapped_type>> search_batch(const std::vector<T_String> &words, int count = -1,
+                                                    size_type width = 16) const {
+        std::vector<std::vector<std::set<mapped_type>>> partial(shards_.size());
+        for_each_shard([this, &partial, &words, count, width](size_type shard) {
+            partial[shard] = shards_[shard]->search_batch(words, count, width);
+        });
+
+        auto result = std::move(partial[0]);
+        for (size_type i = 0; i < words.size(); i++) {
+            for (size_type shard = 1; shard < shards_.size(); shard++)
+                result[i].insert(partial[shard][i].begin(), partial[shard][i].end());
+            if (count >= 0 && result[i].size() > (size_type) count)
+                result[i].erase(std::next(result[i].begin(), count), result[i].end());
+        }
+        return result;
+    }
+
+    /**
+     * Values of the keys that contain all of <tt>words</tt> and none of <tt>excluded</tt>, see SuffixTree::search_all.
+     * All the keys of a value are in its shard, so every shard answers the query on its own.
+     */
+    std::set<mapped_type> search_all(const std::vector<T_String> &words,
+                                     const std::vector<T_String> &excluded = std::vector<T_String>()) const {
+        return unite_shards([&words, &excluded](const tree_type &tree) { return tree.search_all(words, excluded); });
+    }
+
+    /**
+     * Values of the keys that contain any of <tt>words</tt> and none of <tt>excluded</tt>, see SuffixTree::search_any.
+     */
+    std::set<mapped_type> search_any(const std::vector<T_String> &words,
+                                     const std::vector<T_String> &excluded = std::vector<T_String>()) const {
+        return unite_shards([&words, &excluded](const tree_type &tree) { return tree.search_any(words, excluded); });
+    }
+};
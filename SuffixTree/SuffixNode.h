@@ -1,91 +1,78 @@
 #pragma once
 
-#include <map>
-#include <set>
-
-#include "SuffixEdge.h"
-
-template<typename T_Key, typename T_Mapped>
+#include <utility>
+
+#include "Arena.h"
+#include "KeyInternal.h"
+#include "EdgeTable.h"
+#include "ValueSet.h"
+#include "Instrumentation.h"
+
+#if defined(__GNUC__) || defined(__clang__)
+#define SUFFIX_TREE_PREFETCH(address) __builtin_prefetch(address)
+#else
+#define SUFFIX_TREE_PREFETCH(address) ((void) 0)
+#endif
+
+/**
+ * A node of a SuffixTree, holding the label of the edge that leads to it from its parent: every node but the root
+ * has exactly one incoming edge, so the edge needs no object of its own, and following it is reading the child.
+ *
+ * T_Values is the set type holding the values of the node, see ValueSet.h.
+ */
+template<typename T_Key, typename T_Mapped, typename T_Values>
 class SuffixNode {
-    template<typename T1, typename T2> friend
+    template<typename T1, typename T2, typename T3> friend
     class SuffixTree;
 
+    template<typename T1, typename T2, typename T3> friend
+    class CompactLayout;
+
 public:
     using key_type = T_Key;
     using mapped_type = T_Mapped;
 
 private:
     using element_type = typename key_type::value_type;
-    using edge_type = SuffixEdge<key_type, mapped_type>;
+    using handle_type = ArenaHandle;
 
-    SuffixNode *suffix_;
+    /// Label of the edge from the parent, empty for the root
+    key_type label_;
 
-    std::set<mapped_type> data_;
-    std::map<element_type, edge_type *> edges_;
-
-    void get_data(std::set<mapped_type> &set, int count) const {
-        for (auto &num: data_) {
-            set.insert(num);
-            if (set.size() == count)
-
-                break;
-        }
+    /// Handle of the node of the suffix link, the root (handle 0) until one is set
+    handle_type suffix_ = 0;
 
-        if (set.size() != count) {
-            for (std::pair<element_type, edge_type *> p: edges_) {
-                edge_type const *e = p.second;
-                e->dest()->get_data(set, count);
-                if (set.size() == count)
-
-                    break;
-            }
-        }
-    }
+    T_Values data_;
+    /// Handles of the children, by first element of their label
+    typename edge_table<element_type, handle_type>::type children_;
 
     bool add_index(const mapped_type &idx) {
-        if (data_.find(idx) != data_.end())
-            return false;
-
-        data_.insert(idx);
-        return true;
+        return data_.insert(idx);
     }
 
 public:
-    SuffixNode() : suffix_{nullptr} {}
+    SuffixNode() = default;
 
-    [[nodiscard]] std::set<mapped_type> get_data() const {
-        return get_data(-1);
-    }
+    explicit SuffixNode(const key_type &label) : label_(label) {}
 
-    [[nodiscard]] std::set<mapped_type> get_data(int count) const {
-        std::set<mapped_type> set;
-        get_data(set, count);
+    const key_type &label() const { return label_; }
 
-        return set;
-    }
-
-    bool add_ref(const mapped_type &idx) {
-        if (!add_index(idx))
-            return false;
-
-        for (auto iter = this->suffix_; iter != nullptr && iter->add_ref(idx); iter = iter->suffix_);
-
-        return true;
-    }
+    void add_child(const element_type &c, handle_type child) { children_[c] = child; }
 
-    void add_edge(const element_type &c, edge_type *e) { edges_[c] = e; }
-
-    edge_type const *get_edge(const element_type &c) const {
-        return edges_.find(c) != edges_.end() ? edges_.at(c) : nullptr;
-    }
-
-    edge_type *get_edge(const element_type &c) {
-        return edges_.find(c) != edges_.end() ? edges_.at(c) : nullptr;
+    /**
+     * Returns the handle of the child whose label starts with <tt>c</tt>, or null_handle.
+     */
+    handle_type get_child(const element_type &c) const {
+        SUFFIX_TREE_COUNT(get_edge_lookups);
+        auto it = children_.find(c);
+        if (it == children_.end()) {
+            SUFFIX_TREE_COUNT(get_edge_misses);
+            return null_handle;
+        }
+        return it->second;
     }
 
-    SuffixNode const *get_suffix() const { return this->suffix_; }
-
-    SuffixNode *get_suffix() { return this->suffix_; }
+    handle_type get_suffix() const { return suffix_; }
 
-    void set_suffix(SuffixNode *suffix) { this->suffix_ = suffix; }
+    void set_suffix(handle_type suffix) { suffix_ = suffix; }
 };
\ No newline at end of file
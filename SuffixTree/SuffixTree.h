@@ -1,15 +1,26 @@
 #pragma once
 
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <memory>
+#include <set>
+#include <type_traits>
 #include <utility>
+#include <vector>
 
 #include "SuffixNode.h"
-
-template<typename T_Key>
-static KeyInternal<T_Key> safe_cut_last_char(const KeyInternal<T_Key> &s) {
-    if (s.empty())
-        return s;
-    return s.substr(0, s.size() - 1);
-}
+#include "DocumentListing.h"
+#include "CompactLayout.h"
+#include "WorkStealingPool.h"
+#include "ResultCache.h"
+#include "PostingList.h"
+#include "QGramTable.h"
+#include "Instrumentation.h"
 
 /**
  * A Generalized Suffix Tree, based on the Ukkonen's paper "On-line construction of suffix trees"
@@ -42,10 +53,13 @@ static KeyInternal<T_Key> safe_cut_last_char(const KeyInternal<T_Key> &s) {
  * the strings built by concatenating e1.label + e2.label + ... + $end, where e1, e2, ... is a proper path and $end is prefix of any of
  * the labels of the edges starting from the last node of the path.
  *
- * This kind of "implicit path" is important in the testAndSplit method.
+ * This kind of "implicit path" is what is left of a key once its characters have all been read: such suffixes
+ * are made explicit at the end of put, so that every suffix of every key ends on a node holding the key's value.
  *
+ * T_ValueSetPolicy picks the set type holding the values of each node, see ValueSet.h. The default keeps a couple
+ * of values inline in the node, which covers the vast majority of them (leaves hold a single value).
  */
-template<typename T_String, typename T_Mapped>
+template<typename T_String, typename T_Mapped, typename T_ValueSetPolicy = InlineValues<>>
 class SuffixTree {
 public:
     using key_type = KeyInternal<T_String>;
@@ -53,293 +67,1286 @@ public:
     using value_type = std::pair<key_type, mapped_type>;
     using size_type = std::size_t;
 
+    /**
+     * A substring found more than once in the tree, see frequent_repeats and maximal_repeats.
+     */
+    struct Repeat {
+        T_String text;
+        size_type length;
+        /// number of times it occurs, once per value at most at any position
+        size_type occurrences;
+        /// number of distinct values of the keys containing it
+        size_type frequency;
+    };
+
 private:
     using element_type = typename key_type::value_type;
-    using node_type = SuffixNode<key_type, mapped_type>;
-    using edge_type = SuffixEdge<key_type, mapped_type>;
+    using value_set_type = typename T_ValueSetPolicy::template set_type<mapped_type>;
+    using node_type = SuffixNode<key_type, mapped_type, value_set_type>;
+    using handle_type = ArenaHandle;
 
-    std::vector<node_type *> all_nodes;
-    std::vector<edge_type *> all_edges;
+    /// Nodes refer to each other by their handle in it, each one holds the label of the edge leading to it
+    Arena<node_type> all_nodes;
     /**
-     * The root of the suffix tree
+     * The root of the suffix tree, the first node
      */
-    node_type *root;
+    enum : handle_type { root = 0 };
+
+    /// Values of all nodes in depth-first order, built on request and dropped by any change to the tree
+    DocumentListing<mapped_type> listing_;
+    /// Read-only copy of the tree searched instead of it, built on request and dropped by any change to the tree
+    CompactLayout<key_type, mapped_type, value_set_type> layout_;
+
+    /// Workers collecting the values of large subtrees, see enable_parallel_collection
+    std::unique_ptr<WorkStealingPool> pool_;
+    size_type parallel_threshold_ = 0;
+
+    /// Results of recent searches, see enable_result_cache
+    std::unique_ptr<ResultCache<element_type, mapped_type>> cache_;
+    /// Bumped by every change to what search returns, cached results of older generations are stale
+    std::uint64_t generation_ = 0;
+
+    /// Values of every word of up to q elements, see enable_short_queries
+    std::unique_ptr<QGramTable<element_type, mapped_type>> qgrams_;
+
+    handle_type make_node(const key_type &label) {
+        return all_nodes.emplace_back(label);
+    }
+
     /**
-     * The last leaf that was added during the update operation
+     * Depth-first traversal of the subtree of <tt>top</tt>, children in edge order, with an explicit stack instead
+     * of recursion, so that deep trees can't overflow the call stack. Every child is prefetched when it is pushed,
+     * well before it is visited.
+     *
+     * <tt>enter(node)</tt> is called with the handle of every node before its children and returns false to stop
+     * the traversal.
      */
-    node_type *active_leaf;
+    template<typename Enter>
+    void traverse(handle_type top, Enter enter) const {
+        std::vector<handle_type> stack{top};
+
+        while (!stack.empty()) {
+            auto node = stack.back();
+            stack.pop_back();
+            if (!enter(node))
+                return;
 
-    node_type *make_node() {
-        all_nodes.push_back(new node_type);
-        return all_nodes.back();
+            const auto &children = all_nodes[node].children_;
+            for (auto it = children.rbegin(); it != children.rend(); ++it) {
+                auto child = it->second;
+                SUFFIX_TREE_PREFETCH(&all_nodes[child]);
+                stack.push_back(child);
+            }
+        }
     }
 
-    edge_type *make_edge(const key_type &label, node_type *dest) {
-        all_edges.push_back(new edge_type(label, dest));
-        return all_edges.back();
+    /**
+     * Same as above, also calling <tt>leave(node)</tt> once all the children of the node have been visited.
+     */
+    template<typename Enter, typename Leave>
+    void traverse(handle_type top, Enter enter, Leave leave) const {
+        // (node, whether its children have been visited)
+        std::vector<std::pair<handle_type, bool>> stack{{top, false}};
+
+        while (!stack.empty()) {
+            auto node = stack.back().first;
+            auto done = stack.back().second;
+            stack.pop_back();
+
+            if (done) {
+                leave(node);
+                continue;
+            }
+            if (!enter(node))
+                return;
+
+            stack.emplace_back(node, true);
+            const auto &children = all_nodes[node].children_;
+            for (auto it = children.rbegin(); it != children.rend(); ++it) {
+                auto child = it->second;
+                SUFFIX_TREE_PREFETCH(&all_nodes[child]);
+                stack.emplace_back(child, false);
+            }
+        }
     }
 
     /**
-     * Returns the tree node (if present) that corresponds to the given string.
+     * Inserts into <tt>set</tt> the values of the subtree of <tt>top</tt>, until it holds <tt>count</tt> values.
      */
-    node_type const *search_node(const T_String &word) const {
+    void get_data(handle_type top, std::set<mapped_type> &set, int count) const {
+        traverse(top, [this, &set, count](handle_type node) {
+            for (const auto &num: all_nodes[node].data_) {
+                set.insert(num);
+                if (set.size() == (size_type) count)
+                    return false;
+            }
+            return true;
+        });
+    }
+
+    /**
+     * Returns the tree node (if present) that corresponds to the given string, or null_handle.
+     */
+    handle_type search_node(const T_String &word) const {
         /*
          * Verifies if exists a path from the root to a node such that the concatenation
          * of all the labels on the path is a super string of the given word.
          * If such a path is found, the last node on it is returned.
          */
-        auto node = root;
+        handle_type node = root;
+        auto it = word.begin();
+        const auto word_end = word.end();
 
-        for (auto it = word.begin(); it != word.end(); it++) {
+        while (it != word_end) {
             // follow the edge corresponding to this char
-            auto edge = node->get_edge(*it);
-
-            if (edge) {
-                for (auto iw = it, il = edge->label.begin(); iw != word.end() && il != edge->label.end(); iw++, il++)
-                    // *iw != *il
-                    if (*iw < *il || *il < *iw)
-                        // the label on the edge does not correspond to the one in the string to search
-                        return nullptr;
-
-                if (edge->label.size() < std::distance(it, word.end())) {
-                    // advance to next node
-                    node = edge->dest();
-                    it = std::next(it, edge->label.size() - 1);
-                } else
-                    // there is no edge starting with this char
-                    return edge->dest();
-            } else
-                return nullptr;
+            node = all_nodes[node].get_child(*it);
+            if (node == null_handle)
+                return null_handle;
+            const auto &label = all_nodes[node].label_;
+
+            // the first element matched the child lookup, compare the rest of the label
+            auto il = label.begin();
+            const auto label_end = label.end();
+            for (++it, ++il; it != word_end && il != label_end; ++it, ++il) {
+                SUFFIX_TREE_COUNT(search_label_compares);
+                // *it != *il
+                if (*it < *il || *il < *it)
+                    // the label on the edge does not correspond to the one in the string to search
+                    return null_handle;
+            }
         }
 
-        return nullptr;
+        return node == root ? null_handle : node;
     }
 
     /**
-     * Return a (Node, string) (n, remainder) pair such that n is a farthest descendant of
-     * input_node (the input node) that can be reached by following a path of edges denoting
-     * a prefix of input and remainder will be string that must be
-     * appended to the concatenation of labels from input_node to n to get input.
+     * Length of the longest prefix of <tt>key</tt> that is a path from the root, the whole key when the tree
+     * already contains it (as a substring of some key).
      */
-    std::pair<node_type *, key_type>
-    canonize(node_type *input_node, key_type input) {
-        if (!input.empty()) {
-            auto edge = input_node->get_edge(*input.begin());
+    size_type contained_prefix(const key_type &key) const {
+        handle_type node = root;
+        size_type length = 0;
+        auto it = key.begin();
+        const auto key_end = key.end();
 
-            // descend the tree as long as a proper label is found
-            while (edge && input.has_prefix(edge->label)) {
-                input = input.substr(edge->label.size());
-                input_node = edge->dest();
-                if (!input.empty())
-                    edge = input_node->get_edge(*input.begin());
-            }
+        while (it != key_end) {
+            node = all_nodes[node].get_child(*it);
+            if (node == null_handle)
+                return length;
+
+            const auto &label = all_nodes[node].label_;
+            auto il = label.begin();
+            const auto label_end = label.end();
+            for (++it, ++il, ++length; it != key_end && il != label_end; ++it, ++il, ++length)
+                if (*it < *il || *il < *it)
+                    return length;
         }
 
-        return std::make_pair(input_node, std::move(input));
+        return length;
     }
 
+    using key_iterator = typename key_type::const_iterator;
+
     /**
-     * Tests whether the string part + t is contained in the subtree that has input_node as root.
-     * If that's not the case, and there exists a path of edges e1, e2, ... such that
-     *     e1.label + e2.label + ... + $end = part
-     * and there is an edge g such that
-     *     g.label = part + rest
-     *
-     * Then g will be split in two different edges, one having $end as label, and the other one
-     * having rest as label.
-     *
-     * @param input_node starting node
-     * @param part the string to search
-     * @param t the following character
-     * @param remainder the remainder of the string to add to the index
-     * @param value the value to add to the index
-     * @return a pair containing:
-     *                  true/false depending on whether (part + t) is contained in the subtree starting in input_node
-     *                  the last node that can be reached by following the path denoted by part starting from input_node
+     * The active point of Ukkonen's algorithm: the end of the longest suffix read so far that is not yet explicit.
      *
+     * It lies <tt>length</tt> elements below <tt>node</tt>, on the edge to <tt>child</tt>. The path from <tt>node</tt> to the point
+     * is also the range of the key being inserted starting at <tt>pos</tt>, so the point can be moved around by
+     * comparing lengths only, never labels.
+     */
+    struct ActivePoint {
+        handle_type node;
+        /// child of node whose label starts with *pos, null_handle while length is 0
+        handle_type child;
+        key_iterator pos;
+        size_type length;
+    };
+
+    /**
+     * State of put while one key is being inserted.
+     */
+    struct Insertion {
+        ActivePoint active;
+        /// number of suffixes read so far that are not yet explicit (they end at the active point or above it)
+        size_type remainder;
+        /// end of the key being inserted, leaves are labeled up to it
+        key_iterator end;
+        /**
+         * The node of the last suffix that was given the value. Suffixes are made explicit in order of
+         * decreasing length, so the next one is its suffix link.
+         */
+        handle_type last_terminal;
+    };
+
+    /**
+     * Moves the active point down the tree for as long as it covers whole edges (skip/count descent),
+     * so that it ends up at a node or strictly inside an edge.
+     * If <tt>active.child</tt> is set, it must be the child the point starts towards.
      */
-    std::pair<bool, node_type *>
-    test_and_split(node_type *input_node,
-                   const key_type &part,
-                   const element_type &t,
-                   const key_type &remainder,
-                   mapped_type value) {
-        // descend the tree as far as possible
-        node_type *node;
-        key_type str;
-        {
-            auto p = canonize(input_node, part);
-            node = p.first;
-            str = p.second;
+    void canonize(ActivePoint &active) const {
+        while (active.length > 0) {
+            auto child = active.child != null_handle ? active.child : all_nodes[active.node].get_child(*active.pos);
+            const auto label_size = all_nodes[child].label_.size();
+            if (active.length < label_size) {
+                active.child = child;
+                return;
+            }
+
+            SUFFIX_TREE_COUNT(canonize_iterations);
+            active.node = child;
+            active.child = null_handle;
+            active.pos = std::next(active.pos, label_size);
+            active.length -= label_size;
         }
 
-        std::pair<bool, node_type *> re;
+        active.child = null_handle;
+    }
 
-        if (!str.empty()) {
-            auto edge = node->get_edge(*str.begin());
-            auto &label = edge->label;
+    /**
+     * Moves the active point to the end of the next shorter suffix.
+     */
+    void follow_suffix_link(ActivePoint &active) const {
+        active.child = null_handle;
+        if (active.node == root) {
+            if (active.length > 0) {
+                active.length--;
+                ++active.pos;
+            }
+        } else
+            active.node = all_nodes[active.node].get_suffix();
 
-            // must see whether "str" is substring of the label of an edge
-            if (label.size() > str.size() &&
-                // label[str.size()] == t
-                // Strictly use operator < as label[str.size()] and t might be custom objects.
-                !(*(label.iter_at(str.size())) < t) &&
-                !(t < *(label.iter_at(str.size()))))
+        canonize(active);
+    }
 
-                re = std::make_pair(true, node);
-            else {
-                // need to split the edge
-                assert(label.has_prefix(str));
-                label = label.substr(str.size());
+    /**
+     * Splits the edge from <tt>node</tt> to its child <tt>child</tt> after its first <tt>length</tt> elements
+     * and returns the new node in the middle.
+     */
+    handle_type split_edge(handle_type node, handle_type child, size_type length) {
+        auto &label = all_nodes[child].label_;
+        const element_type first = *label.begin();
 
-                // build a new node
-                auto new_node = make_node();
-                // build a new edge
-                auto new_edge = make_edge(str, new_node);
+        auto middle = make_node(label.substr(0, length));
+        label = label.substr(length);
 
-                // link node -> new_node
-                new_node->add_edge(*label.begin(), edge);
-                node->add_edge(*str.begin(), new_edge);
+        all_nodes[middle].add_child(*label.begin(), child);
+        all_nodes[node].add_child(first, middle);
 
-                re = std::make_pair(false, new_node);
-            }
-        } else {
-            auto edge = node->get_edge(t);
-            if (edge) {
-                if (remainder == edge->label) {
-                    // update payload of destination node
-                    edge->dest()->add_ref(value);
-
-                    re = std::make_pair(true, node);
-                } else if (remainder.has_prefix(edge->label)) {
-
-                    re = std::make_pair(true, node);
-                } else if (edge->label.has_prefix(remainder)) {
-                    // need to split as above
-                    auto new_node = make_node();
-                    new_node->add_ref(value);
-
-                    auto new_edge = make_edge(remainder, new_node);
-                    edge->label = edge->label.substr(remainder.size());
-                    new_node->add_edge(*edge->label.begin(), edge);
-                    node->add_edge(t, new_edge);
-
-                    re = std::make_pair(false, node);
-                } else {
-                    // they are different words. No prefix. but they may still share some common substr
-                    re = std::make_pair(true, node);
+        return middle;
+    }
+
+    /**
+     * Records that the next suffix of the key being inserted ends at <tt>node</tt>.
+     */
+    void add_terminal(Insertion &insertion, handle_type node, const mapped_type &value) {
+        all_nodes[node].add_index(value);
+
+        if (insertion.last_terminal != null_handle)
+            all_nodes[insertion.last_terminal].set_suffix(node);
+        insertion.last_terminal = node;
+    }
+
+    /**
+     * Links the internal node created by the previous extension of the same phase, if any, to <tt>node</tt>.
+     */
+    void resolve_suffix_link(handle_type &pending, handle_type node) {
+        if (pending != null_handle) {
+            all_nodes[pending].set_suffix(node);
+            pending = null_handle;
+        }
+    }
+
+    /**
+     * One phase of Ukkonen's algorithm: extends every implicit suffix of the key with the element at <tt>it</tt>,
+     * <tt>rest</tt> being the number of elements from <tt>it</tt> to the end of the key.
+     *
+     * Unlike in a suffix tree of a single string, the element may already follow the active point because it
+     * was added by another key; in that case the suffix, and all the shorter ones, stay implicit.
+     */
+    void extend(Insertion &insertion, key_iterator it, size_type rest, const mapped_type &value) {
+        auto &active = insertion.active;
+        const element_type &c = *it;
+        handle_type pending_link = null_handle;
+
+        insertion.remainder++;
+        while (insertion.remainder > 0) {
+            handle_type parent;
+
+            if (active.length == 0) {
+                auto child = all_nodes[active.node].get_child(c);
+                if (child != null_handle) {
+                    SUFFIX_TREE_COUNT(extension_found);
+                    resolve_suffix_link(pending_link, active.node);
+
+                    active.child = child;
+                    active.pos = it;
+                    active.length = 1;
+                    canonize(active);
+                    return;
                 }
+
+                SUFFIX_TREE_COUNT(extension_new_leaf);
+                parent = active.node;
+                resolve_suffix_link(pending_link, parent);
+            } else {
+                const auto &next = *all_nodes[active.child].label_.iter_at(active.length);
+                // next == c
+                // Strictly use operator < as next and c might be custom objects.
+                if (!(next < c) && !(c < next)) {
+                    SUFFIX_TREE_COUNT(extension_found);
+                    resolve_suffix_link(pending_link, active.node);
+
+                    active.length++;
+                    canonize(active);
+                    return;
+                }
+
+                SUFFIX_TREE_COUNT(extension_split);
+                parent = split_edge(active.node, active.child, active.length);
+                if (pending_link != null_handle)
+                    all_nodes[pending_link].set_suffix(parent);
+                pending_link = parent;
+            }
+
+            auto leaf = make_node(key_type(it, insertion.end, rest));
+            all_nodes[parent].add_child(c, leaf);
+            add_terminal(insertion, leaf, value);
+
+            insertion.remainder--;
+            follow_suffix_link(active);
+        }
+    }
+
+    /**
+     * Makes the suffixes that are still implicit once the whole key has been read explicit, and gives them the value.
+     * Each one ends at the active point, or at the node reached by following the suffix chain from it.
+     */
+    void finish(Insertion &insertion, const mapped_type &value) {
+        auto &active = insertion.active;
+        handle_type pending_link = null_handle;
+
+        while (insertion.remainder > 0) {
+            SUFFIX_TREE_COUNT(suffix_chain_steps);
+            handle_type node;
+
+            if (active.length == 0) {
+                node = active.node;
+                resolve_suffix_link(pending_link, node);
             } else {
-                // if there is no t-transition from node
-                re = std::make_pair(false, node);
+                node = split_edge(active.node, active.child, active.length);
+                if (pending_link != null_handle)
+                    all_nodes[pending_link].set_suffix(node);
+                pending_link = node;
+            }
+            add_terminal(insertion, node, value);
+
+            insertion.remainder--;
+            follow_suffix_link(active);
+        }
+
+        resolve_suffix_link(pending_link, root);
+        if (insertion.last_terminal != null_handle)
+            // the shortest suffix is a single element
+            all_nodes[insertion.last_terminal].set_suffix(root);
+    }
+
+    /**
+     * Returns the node at the end of the path <tt>path</tt> starting from <tt>node</tt>.
+     * The path must end on a node, so the descent only compares lengths (skip/count).
+     */
+    handle_type descend(handle_type node, const key_type &path) const {
+        auto it = path.begin();
+        for (auto left = path.size(); left > 0;) {
+            node = all_nodes[node].get_child(*it);
+            const auto label_size = all_nodes[node].label_.size();
+            assert(label_size <= left);
+
+            it = std::next(it, label_size);
+            left -= label_size;
+        }
+
+        return node;
+    }
+
+    /**
+     * Sets the suffix links of the nodes created by merge, the handles from <tt>first_new</tt> on, parents before
+     * children: the link of a node is found by descending its edge label from the link of its parent.
+     * <tt>queue</tt> starts with the (parent, node) pairs of the new nodes hung below older ones, whose links
+     * are still right: nodes keep their paths when edges above them are split, so their links do too.
+     */
+    void link_new_nodes(size_type first_new, std::vector<std::pair<handle_type, handle_type>> queue) {
+        for (size_type i = 0; i < queue.size(); i++) {
+            const auto parent = queue[i].first;
+            const auto node = queue[i].second;
+            const auto &label = all_nodes[node].label_;
+
+            if (parent == root)
+                all_nodes[node].set_suffix(descend(root, label.substr(1)));
+            else
+                all_nodes[node].set_suffix(descend(all_nodes[parent].get_suffix(), label));
+
+            for (auto &p: all_nodes[node].children_)
+                if (p.second >= first_new)
+                    queue.emplace_back(node, p.second);
+        }
+    }
+
+    /**
+     * Length of the longest common prefix of two labels.
+     */
+    static size_type common_prefix(const key_type &a, const key_type &b) {
+        size_type length = 0;
+        for (auto ia = a.begin(), ib = b.begin(); ia != a.end() && ib != b.end(); ++ia, ++ib, ++length)
+            if (*ia < *ib || *ib < *ia)
+                break;
+
+        return length;
+    }
+
+    /// Length given to the key of a streamed put while its end is not known, see begin_put
+    enum : size_type { open_length = size_type(-1) / 2 };
+
+    /**
+     * State of a streamed put, between begin_put and end_put.
+     *
+     * Leaves created meanwhile are open: they are labeled as if the key were open_length elements long,
+     * so the active point never reaches their end, and end_put cuts them to the real length.
+     */
+    struct Stream {
+        /// tree-owned copy of the key, the last entry of records_
+        T_String *record;
+        Insertion insertion;
+        mapped_type value;
+        /// number of elements appended so far
+        size_type length;
+        /// handle of the first node created since begin_put
+        size_type first_node;
+    };
+
+    /// Keys owned by the tree: copied by streamed puts, or moved in by put
+    std::vector<T_String *> records_;
+    std::unique_ptr<Stream> stream_;
+
+    static bool is_open(const key_type &label) { return label.size() > open_length / 2; }
+
+    template<typename T>
+    static auto has_capacity(int) -> decltype(std::declval<T &>().capacity(), std::true_type());
+
+    template<typename T>
+    static std::false_type has_capacity(...);
+
+    /**
+     * Moves the labels and the active point of the streamed put from its record to <tt>copy</tt>, which replaces it.
+     */
+    void replace_record(T_String *copy) {
+        const T_String &from = *stream_->record;
+        const T_String &to = *copy;
+
+        auto &insertion = stream_->insertion;
+        insertion.active.pos = to.begin() + (insertion.active.pos - from.begin());
+        insertion.end = to.end();
+
+        if (!from.empty()) {
+            // only labels of nodes created since begin_put can point into the record, among other keys
+            const auto first = std::addressof(*from.begin());
+            const auto last = first + from.size();
+            const std::less<decltype(first)> less;
+
+            for (auto i = stream_->first_node; i < all_nodes.size(); i++) {
+                auto &label = all_nodes[(handle_type) i].label_;
+                const auto p = std::addressof(*label.begin());
+                if (less(p, first) || !less(p, last))
+                    continue;
+
+                const auto begin = to.begin() + (label.begin() - from.begin());
+                const auto size = label.size();
+                label = key_type(begin, is_open(label) ? to.end() : begin + size, size);
             }
         }
 
-        return re;
+        delete stream_->record;
+        stream_->record = records_.back() = copy;
     }
 
     /**
-     * Updates the tree starting from input_node and by adding part.
+     * Makes room for <tt>extra</tt> more elements in the record of the streamed put.
      *
-     * Returns a reference (Node, string) pair for the string that has been added so far.
-     * This means:
-     * - the Node will be the Node that can be reached by the longest path string (S1)
-     *   that can be obtained by concatenating consecutive edges in the tree and
-     *   that is a substring of the string added so far to the tree.
-     * - the string will be the remainder that must be added to S1 to get the string
-     *   added so far.
+     * Containers with a capacity (std::vector, std::string) would reallocate by themselves and leave the labels
+     * pointing into the old storage, so they are grown here instead, by doubling, and the labels are moved over.
+     */
+    void reserve_record(size_type extra, std::true_type) {
+        const auto &record = *stream_->record;
+        if (record.size() + extra <= record.capacity())
+            return;
+
+        auto copy = new T_String;
+        copy->reserve(std::max(2 * record.capacity(), record.size() + extra));
+        copy->insert(copy->end(), record.begin(), record.end());
+        replace_record(copy);
+    }
+
+    /// Other containers (std::list) keep their iterators valid when appended to
+    void reserve_record(size_type, std::false_type) {}
+
+    /**
+     * Gives back the spare capacity of the record of the streamed put.
+     */
+    void shrink_record(std::true_type) {
+        const auto &record = *stream_->record;
+        if (record.capacity() > record.size())
+            replace_record(new T_String(record.begin(), record.end()));
+    }
+
+    void shrink_record(std::false_type) {}
+
+    /**
+     * Inserts into <tt>set</tt> all the values of the subtree of <tt>node</tt>.
      *
-     * @param input_node the node to start from
-     * @param part the string to add to the tree
-     * @param rest the rest of the string
-     * @param value the value to add to the index
-     */
-    std::pair<node_type *, key_type>
-    update(node_type *input_node, const key_type &part, const element_type &new_char,
-           const key_type &rest, mapped_type value) {
-        auto tmp_part = part;
-        auto input = input_node;
-
-        bool endpoint;
-        node_type *node;
-        {
-            auto p = test_and_split(input,
-                                    part.substr(0, part.size() - 1),
-                                    new_char,
-                                    rest,
-                                    value);
-            endpoint = p.first;
-            node = p.second;
+     * The top of the subtree is walked by the calling thread alone, so that small subtrees never reach the pool.
+     * Past parallel_threshold_ nodes, the nodes left to visit are handed to the pool, every worker collects
+     * the values of the nodes it visits on its own, and the per-worker values are sorted and merged at the end.
+     */
+    void collect_parallel(handle_type node, std::set<mapped_type> &set) const {
+        std::vector<handle_type> stack{node};
+        for (size_type visited = 0; !stack.empty() && visited < parallel_threshold_; visited++) {
+            const auto &current = all_nodes[stack.back()];
+            stack.pop_back();
+
+            set.insert(current.data_.begin(), current.data_.end());
+            for (auto &p: current.children_)
+                stack.push_back(p.second);
         }
+        if (stack.empty())
+            return;
 
-        auto old_root = root;
+        std::vector<std::vector<mapped_type>> partial(pool_->size());
+        pool_->run(stack, [this, &partial](handle_type node, std::size_t worker,
+                                           WorkStealingPool::Job<handle_type> &job) {
+            auto &values = partial[worker];
+            // go on with one child, leave the others to be stolen
+            while (node != null_handle) {
+                const auto &current = all_nodes[node];
+                values.insert(values.end(), current.data_.begin(), current.data_.end());
 
-        while (!endpoint) {
-            node_type *leaf;
-            auto tmp_edge = node->get_edge(new_char);
-            if (tmp_edge)
-                // such a node is already present. This is one of the main differences from Ukkonen's case:
-                // the tree can contain deeper nodes at this stage because different strings were added by previous iterations.
-                leaf = tmp_edge->dest();
-            else {
-                // must build a new leaf
-                leaf = make_node();
-                leaf->add_ref(value);
-                node->add_edge(new_char, make_edge(rest, leaf));
+                handle_type next = null_handle;
+                for (auto &p: current.children_) {
+                    if (next != null_handle)
+                        job.spawn(worker, next);
+                    next = p.second;
+                }
+                node = next;
+            }
+        });
+
+        std::vector<size_type> workers;
+        for (size_type i = 0; i < partial.size(); i++) workers.push_back(i);
+        pool_->run(workers, [&partial](size_type i, std::size_t, WorkStealingPool::Job<size_type> &) {
+            auto &values = partial[i];
+            std::sort(values.begin(), values.end());
+            values.erase(std::unique(values.begin(), values.end(), [](const mapped_type &a, const mapped_type &b) {
+                return !(a < b) && !(b < a);
+            }), values.end());
+        });
+
+        // pairwise merges, then one ordered pass into the set
+        for (size_type width = 1; width < partial.size(); width *= 2)
+            for (size_type i = 0; i + width < partial.size(); i += 2 * width) {
+                std::vector<mapped_type> merged;
+                merged.reserve(partial[i].size() + partial[i + width].size());
+                std::set_union(partial[i].begin(), partial[i].end(), partial[i + width].begin(),
+                               partial[i + width].end(), std::back_inserter(merged));
+                partial[i].swap(merged);
+                std::vector<mapped_type>().swap(partial[i + width]);
             }
+        for (auto &value: partial[0])
+            set.insert(set.end(), value);
+    }
 
-            // update suffix link for newly created leaf
-            if (active_leaf != root)
-                active_leaf->set_suffix(leaf);
-            active_leaf = leaf;
+    /**
+     * Values of the keys containing <tt>word</tt>, at most <tt>count</tt> of them, see search.
+     */
+    std::set<mapped_type> find_values(const T_String &word, int count) const {
+        std::set<mapped_type> result;
+        handle_type tmp;
 
-            if (old_root != root)
-                old_root->set_suffix(node);
-            old_root = node;
+        const bool parallel = pool_ && count < 0;
 
-            if (!input->get_suffix()) { // root node
-                assert(root == input);
-                // this is a special case to handle what is referred to as node _|_ on the paper
-                tmp_part = tmp_part.substr(1);
-            } else {
-                key_type str;
-                {
-                    auto p = canonize(input->get_suffix(),
-                                      safe_cut_last_char(tmp_part));
-                    input = p.first;
-                    str = p.second;
+        if (layout_.built()) {
+            auto slot = layout_.find(word);
+            if (slot == layout_.npos)
+                return result;
+            if (!listing_.built() && !parallel) {
+                layout_.get_data(slot, result, count);
+                return result;
+            }
+            tmp = layout_.source(slot);
+        } else {
+            tmp = search_node(word);
+            if (tmp == null_handle)
+                return result;
+        }
+
+        collect_values(tmp, result, count);
+        return result;
+    }
+
+    /**
+     * Inserts into <tt>result</tt> the values of the subtree of <tt>node</tt>, until it holds <tt>count</tt> values,
+     * from the document listing, on the pool or by walking the subtree.
+     */
+    void collect_values(handle_type node, std::set<mapped_type> &result, int count) const {
+        if (listing_.built())
+            listing_.list(listing_.range(node).first, listing_.range(node).second, result, count);
+        else if (pool_ && count < 0)
+            collect_parallel(node, result);
+        else
+            get_data(node, result, count);
+    }
+
+    /**
+     * Finds the node of every word of <tt>words</tt> like search_node, null_handle for those that are missing,
+     * advancing up to <tt>width</tt> of the descents in turns, one step each.
+     *
+     * A descent is a chain of dependent cache misses: the child handle is only known once the node is loaded,
+     * and the label elements once the child is. Each step of a descent ends by prefetching what its next step
+     * reads, the steps of the other descents run while it arrives, and the memory system serves many misses
+     * at once instead of one after the other.
+     */
+    std::vector<handle_type> search_nodes(const std::vector<const T_String *> &words, size_type width) const {
+        using word_iterator = typename key_type::const_iterator;
+        enum class Step { child, label, compare };
+        struct Descent {
+            size_type word;
+            handle_type node;
+            word_iterator it;
+            word_iterator end;
+            Step step;
+        };
+
+        std::vector<handle_type> nodes(words.size(), null_handle);
+        std::vector<Descent> active;
+        size_type next = 0;
+
+        while (next < words.size() || !active.empty()) {
+            // fill up the free places
+            while (active.size() < width && next < words.size()) {
+                const auto &word = *words[next];
+                if (std::begin(word) != std::end(word))
+                    active.push_back(Descent{next, root, std::begin(word), std::end(word), Step::child});
+                next++;
+            }
+
+            for (size_type i = 0; i < active.size();) {
+                auto &descent = active[i];
+                bool done = false;
+
+                switch (descent.step) {
+                    case Step::child:
+                        // the node has arrived: find the child for the next element
+                        descent.node = all_nodes[descent.node].get_child(*descent.it);
+                        if (descent.node == null_handle) {
+                            done = true;
+                            break;
+                        }
+                        SUFFIX_TREE_PREFETCH(&all_nodes[descent.node]);
+                        ++descent.it;
+                        descent.step = Step::label;
+                        break;
+
+                    case Step::label: {
+                        // the child has arrived: fetch the elements of its label
+                        const auto &label = all_nodes[descent.node].label_;
+                        if (descent.it == descent.end || label.size() == 1) {
+                            descent.step = Step::compare;
+                            continue;
+                        }
+                        SUFFIX_TREE_PREFETCH(&*label.begin());
+                        descent.step = Step::compare;
+                        break;
+                    }
+
+                    case Step::compare: {
+                        // the label has arrived: compare the rest of it, the first element matched the child lookup
+                        const auto &label = all_nodes[descent.node].label_;
+                        auto il = label.begin();
+                        const auto label_end = label.end();
+                        for (++il; descent.it != descent.end && il != label_end; ++descent.it, ++il) {
+                            SUFFIX_TREE_COUNT(search_label_compares);
+                            if (*descent.it < *il || *il < *descent.it) {
+                                descent.node = null_handle;
+                                break;
+                            }
+                        }
+
+                        if (descent.node == null_handle || descent.it == descent.end) {
+                            done = true;
+                            break;
+                        }
+                        descent.step = Step::child;
+                        break;
+                    }
                 }
-                tmp_part = {str.begin(), ++str.end()};
+
+                if (done) {
+                    nodes[descent.word] = descent.node;
+                    descent = active.back();
+                    active.pop_back();
+                } else
+                    i++;
+            }
+        }
+
+        return nodes;
+    }
+
+    /// Whether the elements are byte-sized integers, the only ones a q-gram table indexes
+    using has_byte_elements = std::integral_constant<bool,
+            sizeof(element_type) == 1 && std::is_integral<element_type>::value>;
+
+    /**
+     * Adds the q-grams of the keys of <tt>other</tt> to the table of this tree, before <tt>other</tt> is merged
+     * into it: from the table of <tt>other</tt> if it has one of the same q, else from a walk of <tt>other</tt>.
+     */
+    void merge_short_queries(const SuffixTree &other, std::true_type) {
+        if (other.qgrams_ && other.qgrams_->q() == qgrams_->q()) {
+            qgrams_->merge(*other.qgrams_);
+            return;
+        }
+
+        QGramTable<element_type, mapped_type> added(qgrams_->q());
+        other.build_short_queries(added);
+        qgrams_->merge(added);
+    }
+
+    /// No table can be built for other elements
+    void merge_short_queries(const SuffixTree &, std::false_type) {}
+
+    /**
+     * Fills the q-gram table <tt>table</tt> from the tree: every q-gram ends on the edge into some node at most
+     * q elements deep, and is in the keys of the values of its subtree.
+     */
+    void build_short_queries(QGramTable<element_type, mapped_type> &table) const {
+        table.clear();
+        const auto q = table.q();
+
+        // (node, elements on the path to it), and the path of the current node
+        std::vector<std::pair<handle_type, size_type>> stack;
+        std::vector<element_type> path;
+        for (auto &p: all_nodes[root].children_)
+            stack.emplace_back(p.second, 0);
+
+        PostingList<mapped_type> values;
+        while (!stack.empty()) {
+            auto node = stack.back().first;
+            auto depth = stack.back().second;
+            stack.pop_back();
+
+            const auto &label = all_nodes[node].label_;
+            path.resize(depth);
+            for (auto it = label.begin(); it != label.end() && path.size() < q; ++it)
+                path.push_back(*it);
+
+            values.clear();
+            collect_postings(node, values);
+            values.normalize();
+            for (auto length = depth + 1; length <= path.size(); length++)
+                table.assign(path.begin(), length, values.begin(), values.end());
+
+            if (path.size() < q)
+                for (auto &p: all_nodes[node].children_)
+                    stack.emplace_back(p.second, path.size());
+        }
+    }
+
+    /**
+     * Node whose subtree holds the values of the keys containing <tt>word</tt>, null_handle if there is none.
+     */
+    handle_type locate(const T_String &word) const {
+        if (!layout_.built())
+            return search_node(word);
+        auto slot = layout_.find(word);
+        return slot == layout_.npos ? null_handle : layout_.source(slot);
+    }
+
+    /**
+     * Estimated number of values in the subtree of <tt>node</tt>, found for a word of <tt>length</tt> elements,
+     * to order the words of a query. The document listing knows it up to repeated values; without it, leaves
+     * come first with their exact count, then longer words, which tend to occur in fewer keys.
+     */
+    size_type estimate_values(handle_type node, size_type length) const {
+        const auto &current = all_nodes[node];
+        if (listing_.built())
+            return listing_.range(node).second - listing_.range(node).first;
+        if (current.children_.empty())
+            return current.data_.size();
+        return std::numeric_limits<size_type>::max() - length;
+    }
+
+    /**
+     * Appends to <tt>postings</tt> the distinct values of the subtree of <tt>node</tt>.
+     */
+    void collect_postings(handle_type node, PostingList<mapped_type> &postings) const {
+        if (listing_.built())
+            listing_.list(listing_.range(node).first, listing_.range(node).second,
+                          [&postings](const mapped_type &value) {
+                              postings.push_back(value);
+                              return true;
+                          });
+        else
+            traverse(node, [this, &postings](handle_type current) {
+                postings.append(all_nodes[current].data_.begin(), all_nodes[current].data_.end());
+                return true;
+            });
+    }
+
+    /**
+     * Marks in <tt>found</tt> the candidates that are values of the subtree of <tt>node</tt>, and returns how many are.
+     * The subtree is walked without collecting its values, and no further than until every candidate is found.
+     */
+    size_type probe_postings(handle_type node, const PostingList<mapped_type> &candidates,
+                             std::vector<bool> &found) const {
+        found.assign(candidates.size(), false);
+        size_type hits = 0;
+        auto probe = [&candidates, &found, &hits](const mapped_type &value) {
+            auto i = candidates.find(value);
+            if (i != candidates.size() && !found[i]) {
+                found[i] = true;
+                hits++;
             }
+            return hits != candidates.size();
+        };
 
-            {
-                auto p = test_and_split(input,
-                                        safe_cut_last_char(tmp_part),
-                                        new_char,
-                                        rest,
-                                        value);
-                endpoint = p.first;
-                node = p.second;
+        if (listing_.built())
+            listing_.list(listing_.range(node).first, listing_.range(node).second, probe);
+        else
+            traverse(node, [this, &probe](handle_type current) {
+                for (const auto &value: all_nodes[current].data_)
+                    if (!probe(value))
+                        return false;
+                return true;
+            });
+        return hits;
+    }
+
+    /**
+     * Drops from <tt>candidates</tt> the values of the keys containing any of <tt>excluded</tt>.
+     */
+    void exclude_postings(PostingList<mapped_type> &candidates, const std::vector<T_String> &excluded) const {
+        std::vector<bool> found;
+        for (const auto &word: excluded) {
+            if (candidates.empty())
+                return;
+            auto node = locate(word);
+            if (node != null_handle && probe_postings(node, candidates, found))
+                candidates.retain(found, false);
+        }
+    }
+
+    /**
+     * Per-node figures of the repeats of the tree, indexed by handle, see tabulate_repeats.
+     */
+    struct RepeatTable {
+        std::vector<handle_type> parent;
+        /// length of the path from the root
+        std::vector<size_type> depth;
+        /// number of (value, suffix) pairs in the subtree: the occurrences of the path, counted once per value
+        std::vector<size_type> occurrences;
+        /// number of distinct values in the subtree
+        std::vector<size_type> frequency;
+        /// largest number of occurrences of a node whose suffix link leads here, 0 if there is none
+        std::vector<size_type> left_occurrences;
+    };
+
+    /**
+     * Fills a RepeatTable in one depth-first pass over the nodes, plus one over their suffix links.
+     *
+     * Distinct values are counted as in Hui's color set size algorithm: every value is counted at each node
+     * it is found at, and uncounted once at the lowest common ancestor of every two nodes consecutive in
+     * depth-first order that hold it, found by Tarjan's offline algorithm (a node leaves its set for its parent's
+     * once visited). Every subtree of the root is independent of the others, so they are handed to the pool of
+     * enable_parallel_collection when there is one.
+     */
+    RepeatTable tabulate_repeats() const {
+        assert(!stream_);
+        const auto n = all_nodes.size();
+        RepeatTable table;
+        table.parent.assign(n, null_handle);
+        table.depth.assign(n, 0);
+        table.occurrences.assign(n, 0);
+        table.frequency.assign(n, 0);
+        table.left_occurrences.assign(n, 0);
+
+        // Tarjan's disjoint sets, distinct values counted (and uncounted) so far in each subtree
+        std::vector<handle_type> sets(n);
+        std::vector<std::ptrdiff_t> distinct(n, 0);
+
+        auto find = [&sets](handle_type node) {
+            auto top = node;
+            while (sets[top] != top) top = sets[top];
+            while (sets[node] != top) {
+                auto next = sets[node];
+                sets[node] = top;
+                node = next;
             }
+            return top;
+        };
+
+        auto walk = [this, &table, &sets, &distinct, &find](handle_type top) {
+            // last node holding each value, in depth-first order
+            std::map<mapped_type, handle_type> last;
+
+            traverse(top, [this, &table, &sets, &distinct, &find, &last](handle_type node) {
+                const auto &current = all_nodes[node];
+                sets[node] = node;
+                table.depth[node] = table.depth[table.parent[node]] + current.label_.size();
+                for (auto &p: current.children_)
+                    table.parent[p.second] = node;
+
+                table.occurrences[node] = current.data_.size();
+                distinct[node] += (std::ptrdiff_t) current.data_.size();
+                for (const auto &value: current.data_) {
+                    auto it = last.insert(std::make_pair(value, node)).first;
+                    if (it->second != node) {
+                        distinct[find(it->second)]--;
+                        it->second = node;
+                    }
+                }
+                return true;
+            }, [&table, &sets, &distinct, top](handle_type node) {
+                table.frequency[node] = (size_type) distinct[node];
+                if (node == top)
+                    return;
+                const auto parent = table.parent[node];
+                sets[node] = parent;
+                distinct[parent] += distinct[node];
+                table.occurrences[parent] += table.occurrences[node];
+            });
+        };
+
+        std::vector<handle_type> tops;
+        for (auto &p: all_nodes[root].children_) {
+            table.parent[p.second] = root;
+            tops.push_back(p.second);
         }
+        if (pool_)
+            pool_->run(tops, [&walk](handle_type top, std::size_t, WorkStealingPool::Job<handle_type> &) {
+                walk(top);
+            });
+        else
+            for (auto top: tops) walk(top);
 
-        if (old_root != root)
-            old_root->set_suffix(node);
+        for (size_type node = 1; node < n; node++) {
+            auto &left = table.left_occurrences[all_nodes[(handle_type) node].get_suffix()];
+            left = std::max(left, table.occurrences[node]);
+        }
+        return table;
+    }
+
+    /**
+     * The path from the root to <tt>node</tt>, as a string.
+     */
+    T_String path_of(handle_type node, const RepeatTable &table) const {
+        std::vector<handle_type> nodes;
+        for (; node != root; node = table.parent[node])
+            nodes.push_back(node);
 
-        return std::make_pair(input, tmp_part);
+        T_String path;
+        for (auto it = nodes.rbegin(); it != nodes.rend(); ++it) {
+            const auto &label = all_nodes[*it].label_;
+            path.insert(path.end(), label.begin(), label.end());
+        }
+        return path;
+    }
+
+    Repeat make_repeat(handle_type node, const RepeatTable &table) const {
+        return Repeat{path_of(node, table), table.depth[node], table.occurrences[node], table.frequency[node]};
+    }
+
+    /**
+     * Copies the node <tt>node</tt> of <tt>other</tt> and its subtree into this tree
+     * and returns the handle of the copy, which isn't the child of any node yet.
+     */
+    handle_type adopt_subtree(const SuffixTree &other, handle_type node) {
+        handle_type top = null_handle;
+        // (node of other, parent of its copy in this tree)
+        std::vector<std::pair<handle_type, handle_type>> stack{{node, null_handle}};
+
+        while (!stack.empty()) {
+            const auto &source = other.all_nodes[stack.back().first];
+            const auto parent = stack.back().second;
+            stack.pop_back();
+
+            auto copy = make_node(source.label_);
+            all_nodes[copy].data_.insert(source.data_.begin(), source.data_.end());
+            if (parent == null_handle)
+                top = copy;
+            else
+                all_nodes[parent].add_child(*source.label_.begin(), copy);
+
+            for (auto &p: source.children_)
+                stack.emplace_back(p.second, copy);
+        }
+
+        return top;
+    }
+
+    void put_owned(T_String &&string, const mapped_type &index, std::false_type) {
+        assert(!stream_);
+        records_.push_back(new T_String(std::move(string)));
+        put(*records_.back(), index);
+    }
+
+    /// A view owns nothing, it is stored as it is
+    void put_owned(T_String &&string, const mapped_type &index, std::true_type) {
+        put(string, index);
     }
 
 public:
     SuffixTree() {
-        root = make_node();
-        active_leaf = root;
+        make_node(key_type());
     }
 
+    SuffixTree(const SuffixTree &) = delete;
+
+    SuffixTree &operator=(const SuffixTree &) = delete;
+
     ~SuffixTree() {
-        for (auto &e: all_nodes) delete e;
-        for (auto &e: all_edges) delete e;
+        for (auto &e: records_) delete e;
+    }
+
+    /**
+     * Moves all the keys of <tt>other</tt> into this tree, leaving <tt>other</tt> empty.
+     *
+     * Both trees are traversed together from their roots: edges that only exist in the smaller tree are copied over
+     * with their whole subtrees, edges whose labels diverge are split, and nodes reached by the same path have their
+     * values united. Only the nodes created that way are given suffix links, the others keep theirs. This costs time
+     * proportional to the smaller tree plus the structure the two trees share, instead of putting every key of one
+     * tree again.
+     *
+     * With short queries enabled, the q-gram lists of <tt>other</tt> are added to those of this tree, which costs
+     * time proportional to them; if <tt>other</tt> has no table of the same q, its lists are first computed by
+     * walking it whole, as enable_short_queries would.
+     *
+     * The keys that were put into <tt>other</tt> must outlive this tree.
+     */
+    void merge(SuffixTree &&other) {
+        if (&other == this)
+            return;
+        assert(!stream_ && !other.stream_);
+
+        listing_.clear();
+        other.listing_.clear();
+        layout_.clear();
+        other.layout_.clear();
+        generation_++;
+        other.generation_++;
+
+        if (qgrams_)
+            merge_short_queries(other, has_byte_elements());
+
+        // walk the smaller tree
+        if (other.all_nodes.size() > all_nodes.size())
+            all_nodes.swap(other.all_nodes);
+
+        // nodes created from here on need suffix links, the others keep theirs
+        const size_type first_new = all_nodes.size();
+        // (node of this tree, new node hung below it) for the nodes that were already in the tree
+        std::vector<std::pair<handle_type, handle_type>> attached;
+
+        // (node of this tree, node of other that must become one of its children)
+        std::vector<std::pair<handle_type, handle_type>> pending;
+        const auto &other_root = other.all_nodes[root];
+        all_nodes[root].data_.insert(other_root.data_.begin(), other_root.data_.end());
+        for (auto &p: other_root.children_)
+            pending.emplace_back(root, p.second);
+
+        while (!pending.empty()) {
+            auto node = pending.back().first;
+            auto handle = pending.back().second;
+            pending.pop_back();
+            auto &source = other.all_nodes[handle];
+
+            auto own_child = all_nodes[node].get_child(*source.label_.begin());
+            if (own_child == null_handle) {
+                const auto copy = adopt_subtree(other, handle);
+                all_nodes[node].add_child(*source.label_.begin(), copy);
+                if (node < first_new)
+                    attached.emplace_back(node, copy);
+                continue;
+            }
+
+            const auto &own_label = all_nodes[own_child].label_;
+            const auto length = common_prefix(own_label, source.label_);
+            auto target = own_child;
+            if (length < own_label.size()) {
+                target = split_edge(node, own_child, length);
+                if (node < first_new)
+                    attached.emplace_back(node, target);
+            }
+
+            if (length < source.label_.size()) {
+                // the rest of the edge hangs below the shared part
+                source.label_ = source.label_.substr(length);
+                pending.emplace_back(target, handle);
+                continue;
+            }
+
+            all_nodes[target].data_.insert(source.data_.begin(), source.data_.end());
+            for (auto &p: source.children_)
+                pending.emplace_back(target, p.second);
+        }
+
+        other.all_nodes.clear();
+        records_.insert(records_.end(), other.records_.begin(), other.records_.end());
+        other.records_.clear();
+        other.make_node(key_type());
+        if (other.qgrams_)
+            other.qgrams_->clear();
+
+        link_new_nodes(first_new, std::move(attached));
+    }
+
+    /**
+     * Allocates room for the nodes of keys of <tt>total_elements</tt> elements in all, so that putting them
+     * doesn't grow the tree's storage: a generalized suffix tree of n elements has at most 2n nodes.
+     */
+    void reserve(size_type total_elements) {
+        all_nodes.reserve(2 * total_elements);
+    }
+
+    /**
+     * Removes all the keys, leaving the tree as it was constructed, but keeps the storage of its nodes
+     * for the next keys: rebuilding a tree of about the same size then allocates nothing for them.
+     */
+    void clear() {
+        assert(!stream_);
+        for (auto &e: records_) delete e;
+        records_.clear();
+
+        listing_.clear();
+        layout_.clear();
+        generation_++;
+
+        all_nodes.reset();
+        make_node(key_type());
+        if (qgrams_)
+            qgrams_->clear();
+    }
+
+    /**
+     * Number of nodes the tree holds without allocating, see reserve.
+     */
+    size_type node_capacity() const { return all_nodes.capacity(); }
+
+    /**
+     * Number of nodes in the tree, root included.
+     */
+    size_type node_count() const { return all_nodes.size(); }
+
+    /**
+     * Number of edges in the tree, one into every node but the root.
+     */
+    size_type edge_count() const { return all_nodes.size() - 1; }
+
+    /**
+     * Switches search to document listing: the values of all nodes are laid out in depth-first order, so that
+     * the subtree of any node covers one range of them, and search lists the distinct values of that range
+     * in time proportional to their number instead of visiting the whole subtree.
+     *
+     * Worth it when short words match many more suffixes than keys. The listing takes about
+     * 4 + sizeof(mapped_type) bytes per (node, value) pair plus 8 bytes per node and is dropped by the next put or merge,
+     * after which search walks the subtree again until this is called anew.
+     */
+    void build_document_listing() {
+        listing_.clear();
+        // a listing may pick other values than the tree when a search has a count
+        generation_++;
+
+        traverse(root, [this](handle_type node) {
+            listing_.enter(node);
+            for (const auto &value: all_nodes[node].data_)
+                listing_.push_back(value);
+            return true;
+        }, [this](handle_type node) {
+            listing_.leave(node);
+        });
+
+        listing_.build();
+    }
+
+    bool has_document_listing() const { return listing_.built(); }
+
+    /**
+     * Copies the tree into a compact array-based layout, in breadth-first order, that search uses from then on:
+     * children are contiguous and edges are inlined into them, so a search touches far fewer cache lines.
+     *
+     * The copy takes about 40 bytes per node plus one mapped_type per value, on top of the tree,
+     * and is dropped by the next put or merge.
+     */
+    void optimize_layout() {
+        layout_.build(all_nodes);
+        generation_++;
+    }
+
+    bool has_optimized_layout() const { return layout_.built(); }
+
+    /**
+     * Lets search collect the values of large subtrees on <tt>threads</tt> worker threads (plus the searching one),
+     * which cuts the latency of broad queries, such as very short words, on many cores.
+     *
+     * Only searches for all the values (no count) of subtrees of more than <tt>min_nodes</tt> nodes are parallel.
+     * A document listing, when built, is faster still and takes precedence. Parallel collections of concurrent
+     * searches on the same tree run one at a time.
+     */
+    void enable_parallel_collection(size_type threads, size_type min_nodes = 4096) {
+        pool_.reset(threads ? new WorkStealingPool(threads) : nullptr);
+        parallel_threshold_ = min_nodes;
+    }
+
+    void disable_parallel_collection() { pool_.reset(); }
+
+    /**
+     * Keeps the results of the last <tt>capacity</tt> distinct searches (word and count), so that a repeated
+     * search returns a copy of its result instead of walking the tree again. The least recently used result
+     * is evicted first.
+     *
+     * Any put, merge, document listing or layout change invalidates all cached results at once.
+     * Concurrent searches share the cache, which is locked for the lookup and the insertion of each result.
+     */
+    void enable_result_cache(size_type capacity) {
+        cache_.reset(capacity ? new ResultCache<element_type, mapped_type>(capacity) : nullptr);
     }
 
+    void disable_result_cache() { cache_.reset(); }
+
+    /**
+     * Hits and misses of the result cache since enable_result_cache, all zero when it is disabled.
+     */
+    ResultCacheStats result_cache_stats() const { return cache_ ? cache_->stats() : ResultCacheStats(); }
+
+    /**
+     * Keeps the values of the keys containing every word of 1 to <tt>q</tt> elements (q <= 3) in a direct lookup
+     * table, so that searching such a word is one array load and a copy of its values, instead of a descent
+     * and a walk of what is often a very large subtree. Only for byte-sized elements.
+     *
+     * The table is filled from the tree once, then kept up to date by put, end_put, merge and clear.
+     * It takes 256^q slots of 4 bytes (64 KB for q = 2, 67 MB for q = 3) plus one mapped_type per q-gram
+     * and key containing it. Searches with a count return the smallest values.
+     */
+    void enable_short_queries(size_type q = 2) {
+        assert(!stream_);
+        qgrams_.reset(new QGramTable<element_type, mapped_type>(q));
+        build_short_queries(*qgrams_);
+        generation_++;
+    }
+
+    void disable_short_queries() {
+        qgrams_.reset();
+        generation_++;
+    }
+
+    bool has_short_queries() const { return qgrams_ != nullptr; }
+
     /**
      * Searches for the given word within the GST and returns at most the given number of matches.
      *
@@ -348,11 +1355,61 @@ public:
      * @return at most <tt>results</tt> values for the given word
      */
     std::set<mapped_type> search(const T_String &word, int count) const {
-        auto tmp = search_node(word);
+        SUFFIX_TREE_TIMED_SCOPE(search_latency);
+        assert(!stream_);
+        if (qgrams_ && qgrams_->covers(std::begin(word), std::end(word))) {
+            SUFFIX_TREE_COUNT(short_query_hits);
+            return qgrams_->find(std::begin(word), std::end(word), count);
+        }
+        if (!cache_)
+            return find_values(word, count);
 
-        if (tmp)
-            return tmp->get_data(count);
-        return {};
+        std::set<mapped_type> result;
+        if (cache_->find(std::begin(word), std::end(word), count, generation_, result))
+            return result;
+
+        result = find_values(word, count);
+        cache_->insert(std::begin(word), std::end(word), count, generation_, result);
+        return result;
+    }
+
+    /**
+     * Searches for every word of <tt>words</tt> at once, see search, and returns their results in the same order.
+     *
+     * The descents of the words through the tree are interleaved, <tt>width</tt> of them at a time, so that
+     * their cache misses overlap instead of each one waiting for the previous one: on trees much larger than
+     * the cache, finding the words is several times faster than one search after the other. Words answered
+     * by the q-gram table or the compact layout are searched one by one. With the result cache enabled, the
+     * words found in it are answered from it and only the others are interleaved, their results then cached.
+     */
+    std::vector<std::set<mapped_type>> search_batch(const std::vector<T_String> &words, int count = -1,
+                                                    size_type width = 16) const {
+        assert(!stream_);
+        assert(width > 0);
+        std::vector<std::set<mapped_type>> results(words.size());
+
+        std::vector<const T_String *> pending;
+        std::vector<size_type> positions;
+        for (size_type i = 0; i < words.size(); i++) {
+            const auto &word = words[i];
+            if (layout_.built() || (qgrams_ && qgrams_->covers(std::begin(word), std::end(word))))
+                results[i] = search(word, count);
+            else if (cache_ && cache_->find(std::begin(word), std::end(word), count, generation_, results[i]))
+                continue;
+            else {
+                pending.push_back(&word);
+                positions.push_back(i);
+            }
+        }
+
+        const auto nodes = search_nodes(pending, width);
+        for (size_type i = 0; i < nodes.size(); i++)
+            if (nodes[i] != null_handle)
+                collect_values(nodes[i], results[positions[i]], count);
+        if (cache_)
+            for (size_type i = 0; i < pending.size(); i++)
+                cache_->insert(std::begin(*pending[i]), std::end(*pending[i]), count, generation_, results[positions[i]]);
+        return results;
     }
 
     /**
@@ -368,40 +1425,331 @@ public:
         return search(word, -1);
     }
 
+    /**
+     * Returns the values of the keys that contain every one of <tt>words</tt> and none of <tt>excluded</tt>.
+     *
+     * The words are looked up first, and any missing one ends the query. Only the values of the word expected
+     * to have the fewest (see build_document_listing) are collected, into a sorted list of candidates; the subtrees
+     * of the other words are then walked without collecting their values, looking up each of them among
+     * the candidates and stopping once all are found. Candidates not found are dropped, and an empty list
+     * ends the query. No set of values is built but the result.
+     */
+    std::set<mapped_type> search_all(const std::vector<T_String> &words,
+                                     const std::vector<T_String> &excluded = std::vector<T_String>()) const {
+        assert(!stream_);
+        std::set<mapped_type> result;
+
+        // (estimated number of values, node) of every word
+        std::vector<std::pair<size_type, handle_type>> terms;
+        for (const auto &word: words) {
+            auto node = locate(word);
+            if (node == null_handle)
+                return result;
+            terms.emplace_back(estimate_values(node, std::distance(std::begin(word), std::end(word))), node);
+        }
+        if (terms.empty())
+            return result;
+        std::sort(terms.begin(), terms.end());
+
+        PostingList<mapped_type> candidates;
+        collect_postings(terms[0].second, candidates);
+        candidates.normalize();
+
+        std::vector<bool> found;
+        for (size_type i = 1; i < terms.size() && !candidates.empty(); i++) {
+            if (terms[i].second == terms[i - 1].second)
+                // words ending on the same node have the same values
+                continue;
+            if (probe_postings(terms[i].second, candidates, found) != candidates.size())
+                candidates.retain(found, true);
+        }
+
+        exclude_postings(candidates, excluded);
+        result.insert(candidates.begin(), candidates.end());
+        return result;
+    }
+
+    /**
+     * Returns the values of the keys that contain any of <tt>words</tt> and none of <tt>excluded</tt>.
+     */
+    std::set<mapped_type> search_any(const std::vector<T_String> &words,
+                                     const std::vector<T_String> &excluded = std::vector<T_String>()) const {
+        assert(!stream_);
+        std::vector<handle_type> nodes;
+        for (const auto &word: words) {
+            auto node = locate(word);
+            if (node != null_handle)
+                nodes.push_back(node);
+        }
+        std::sort(nodes.begin(), nodes.end());
+        nodes.erase(std::unique(nodes.begin(), nodes.end()), nodes.end());
+
+        PostingList<mapped_type> candidates;
+        for (auto node: nodes)
+            collect_postings(node, candidates);
+        candidates.normalize();
+
+        exclude_postings(candidates, excluded);
+        return std::set<mapped_type>(candidates.begin(), candidates.end());
+    }
+
+    /**
+     * Returns the <tt>k</tt> substrings of at least <tt>min_length</tt> elements found in the most keys (distinct
+     * values), most frequent first, then longest first.
+     *
+     * Substrings that end on the same edge are in the same keys, only the longest of them, which ends on a node,
+     * is returned. A substring can be returned along with longer ones that are in the same keys; maximal_repeats
+     * leaves those out.
+     */
+    std::vector<Repeat> frequent_repeats(size_type k, size_type min_length = 1) const {
+        const auto table = tabulate_repeats();
+        std::vector<handle_type> nodes;
+        for (size_type node = 1; node < all_nodes.size(); node++)
+            if (table.depth[node] >= min_length)
+                nodes.push_back((handle_type) node);
+
+        auto more_frequent = [&table](handle_type a, handle_type b) {
+            if (table.frequency[a] != table.frequency[b])
+                return table.frequency[a] > table.frequency[b];
+            if (table.depth[a] != table.depth[b])
+                return table.depth[a] > table.depth[b];
+            return a < b;
+        };
+        k = std::min(k, nodes.size());
+        std::partial_sort(nodes.begin(), nodes.begin() + k, nodes.end(), more_frequent);
+
+        std::vector<Repeat> result;
+        for (size_type i = 0; i < k; i++)
+            result.push_back(make_repeat(nodes[i], table));
+        return result;
+    }
+
+    /**
+     * Returns the maximal repeats of at least <tt>min_length</tt> elements, in no particular order: the substrings
+     * occurring at least <tt>min_occurrences</tt> times (at least twice) that occur less often once extended by one
+     * element on either side.
+     *
+     * Occurrences are counted per value and suffix: where keys of one value end alike, their common suffixes
+     * count once.
+     */
+    std::vector<Repeat> maximal_repeats(size_type min_length = 1, size_type min_occurrences = 2) const {
+        const auto table = tabulate_repeats();
+        min_occurrences = std::max(min_occurrences, size_type(2));
+
+        // every node is followed by different elements (or ends a key), it is maximal unless it is always
+        // preceded by the same element: then the node for both has as many occurrences and links to it
+        std::vector<Repeat> result;
+        for (size_type node = 1; node < all_nodes.size(); node++)
+            if (table.depth[node] >= min_length && table.occurrences[node] >= min_occurrences
+                && table.left_occurrences[node] < table.occurrences[node])
+                result.push_back(make_repeat((handle_type) node, table));
+        return result;
+    }
+
+    /**
+     * Returns the supermaximal repeats of at least <tt>min_length</tt> elements, in no particular order:
+     * the repeats that are not part of any longer repeat.
+     */
+    std::vector<Repeat> supermaximal_repeats(size_type min_length = 1) const {
+        const auto table = tabulate_repeats();
+
+        std::vector<Repeat> result;
+        for (size_type node = 1; node < all_nodes.size(); node++) {
+            if (table.depth[node] < min_length || table.occurrences[node] < 2 || table.left_occurrences[node] >= 2)
+                continue;
+
+            bool longer = false;
+            for (auto &p: all_nodes[(handle_type) node].children_)
+                longer = longer || table.occurrences[p.second] >= 2;
+            if (!longer)
+                result.push_back(make_repeat((handle_type) node, table));
+        }
+        return result;
+    }
+
+    /**
+     * Calls <tt>output(from, to, length)</tt> for every two values such that the longest suffix of the key of
+     * <tt>from</tt> that is also a prefix of the key of <tt>to</tt> is <tt>length</tt> >= <tt>min_length</tt> elements
+     * long, as for assembling fragments. A key contained in the other one at its start or end overlaps it whole.
+     *
+     * Each value must have been put with a single key. Pairs are passed to <tt>output</tt> as they are found,
+     * never stored: two passes over the nodes cost time proportional to the tree plus the number of pairs,
+     * with a stack per value of the depths of its suffixes on the path to the current node (Gusfield's algorithm).
+     */
+    template<typename Output>
+    void overlaps(size_type min_length, Output output) const {
+        assert(!stream_);
+        min_length = std::max(min_length, size_type(1));
+
+        // length of the key of every value, the longest of its suffixes
+        std::vector<size_type> depth(all_nodes.size(), 0);
+        std::map<mapped_type, size_type> lengths;
+        traverse(root, [this, &depth, &lengths](handle_type node) {
+            const auto &current = all_nodes[node];
+            for (auto &p: current.children_)
+                depth[p.second] = depth[node] + all_nodes[p.second].label_.size();
+            for (const auto &value: current.data_) {
+                auto &length = lengths[value];
+                length = std::max(length, depth[node]);
+            }
+            return true;
+        });
+
+        // depths of the suffixes of at least min_length elements on the path to the current node, by value:
+        // the deepest one of each value is its longest suffix that is a prefix of the path
+        std::map<mapped_type, std::vector<size_type>> suffixes;
+        traverse(root, [this, &depth, &lengths, &suffixes, &output, min_length](handle_type node) {
+            if (depth[node] < min_length)
+                return true;
+            const auto &current = all_nodes[node];
+            for (const auto &value: current.data_)
+                suffixes[value].push_back(depth[node]);
+
+            for (const auto &to: current.data_) {
+                if (lengths.find(to)->second != depth[node])
+                    // a suffix of the key of to, not the key itself
+                    continue;
+                for (const auto &from: suffixes)
+                    if (from.first < to || to < from.first)
+                        output(from.first, to, from.second.back());
+            }
+            return true;
+        }, [this, &depth, &suffixes, min_length](handle_type node) {
+            if (depth[node] < min_length)
+                return;
+            for (const auto &value: all_nodes[node].data_) {
+                auto it = suffixes.find(value);
+                it->second.pop_back();
+                if (it->second.empty())
+                    suffixes.erase(it);
+            }
+        });
+    }
+
     /**
      * Adds the specified <tt>index</tt> to the GST under the given <tt>key</tt>.
      *
-     * Entries must be inserted so that their indexes are in non-decreasing order,
-     * otherwise an IllegalStateException will be raised.
+     * Indexes may be put in any order, but non-decreasing order is the fast one: every node's value set
+     * then appends the index instead of shifting its larger values. Must not be called while a put started by
+     * begin_put is in progress (asserted).
      *
      * @param string the string key that will be added to the index
      * @param index the value that will be added to the index
      */
-    void put(const T_String &string, mapped_type index) {
+    void put(const T_String &string, const mapped_type &index) {
+        SUFFIX_TREE_TIMED_SCOPE(put_latency);
+        assert(!stream_);
         key_type key(string);
 
-        // reset active_leaf
-        active_leaf = root;
+        if (listing_.built())
+            listing_.clear();
+        if (layout_.built())
+            layout_.clear();
+        generation_++;
+
+        // the phases of the leading elements already in the tree would only find them below the active point:
+        // skip to the state they leave, the end of that prefix with all of its suffixes implicit
+        const auto contained = contained_prefix(key);
+        SUFFIX_TREE_COUNT_N(contained_prefix_elements, contained);
+        Insertion insertion{{root, null_handle, key.begin(), contained}, contained, key.end(), null_handle};
+        canonize(insertion.active);
 
-        // proceed with tree construction (closely related to procedure in
-        // Ukkonen's paper)
-        auto node = root;
-        key_type text(key.begin(), key.begin());
-        // iterate over the string, one char at a time
-        for (auto i = 0; i < key.size(); i++) {
-            text = {text.begin(), ++text.end()};
+        // proceed with tree construction (Ukkonen's algorithm, one phase per char)
+        size_type rest = key.size() - contained;
+        for (auto it = std::next(key.begin(), contained); it != key.end(); ++it, --rest)
+            extend(insertion, it, rest, index);
 
-            // update the tree with the new transitions due to this new char
-            auto active = update(node, text, key.at(i), key.substr(i), index);
+        finish(insertion, index);
 
-            // make sure the active pair is canonical
-            active = canonize(active.first, active.second);
-            node = active.first;
-            text = active.second;
+        if (qgrams_)
+            qgrams_->add(key.begin(), key.end(), index);
+    }
+
+    /**
+     * Adds the specified <tt>index</tt> under a key given as a temporary, see put.
+     *
+     * The key is moved into storage owned by the tree, so it doesn't need to be kept alive.
+     * Views (see is_key_view) are stored as they are: what they refer to must still outlive the tree.
+     */
+    void put(T_String &&string, const mapped_type &index) {
+        put_owned(std::move(string), index, is_key_view<T_String>());
+    }
+
+    /**
+     * Starts adding <tt>index</tt> under a key whose elements are not known yet: they are passed in chunks to append,
+     * and end_put completes the key. Ukkonen's construction carries on from one chunk to the next, so every chunk
+     * is indexed as it arrives and the whole key is never needed at once.
+     *
+     * Unlike with put, the elements are copied into storage owned by the tree, so chunks may be destroyed
+     * after append. No other operation may be called on the tree until end_put.
+     */
+    void begin_put(mapped_type index) {
+        assert(!stream_);
+        if (listing_.built())
+            listing_.clear();
+        if (layout_.built())
+            layout_.clear();
+        generation_++;
+
+        records_.push_back(new T_String);
+        const T_String &record = *records_.back();
+        stream_.reset(new Stream{records_.back(),
+                                 Insertion{{root, null_handle, record.begin(), 0}, 0, record.end(), null_handle},
+                                 std::move(index), 0, all_nodes.size()});
+    }
+
+    /**
+     * Appends the elements in [first, last) to the key of the put started by begin_put.
+     */
+    template<typename Iterator>
+    void append(Iterator first, Iterator last) {
+        assert(stream_);
+        const auto extra = (size_type) std::distance(first, last);
+        if (!extra)
+            return;
+        reserve_record(extra, decltype(has_capacity<T_String>(0))());
+
+        auto &record = *stream_->record;
+        const T_String &view = record;
+        const bool was_empty = view.empty();
+        const auto before = was_empty ? view.end() : std::prev(view.end());
+        record.insert(record.end(), first, last);
+
+        auto &insertion = stream_->insertion;
+        insertion.end = view.end();
+        for (auto it = was_empty ? view.begin() : std::next(before); it != view.end(); ++it, stream_->length++)
+            extend(insertion, it, open_length - stream_->length, stream_->value);
+    }
+
+    void append(const T_String &chunk) {
+        append(std::begin(chunk), std::end(chunk));
+    }
+
+    /**
+     * Completes the put started by begin_put.
+     */
+    void end_put() {
+        assert(stream_);
+        shrink_record(decltype(has_capacity<T_String>(0))());
+
+        // cut the open leaves to the end of the key
+        const T_String &record = *stream_->record;
+        const auto excess = open_length - stream_->length;
+        for (auto i = stream_->first_node; i < all_nodes.size(); i++) {
+            auto &label = all_nodes[(handle_type) i].label_;
+            if (is_open(label))
+                label = key_type(label.begin(), record.end(), label.size() - excess);
         }
 
-        // add leaf suffix link, is necessary
-        if (!active_leaf->get_suffix() && active_leaf != root && active_leaf != node)
-            active_leaf->set_suffix(node);
+        stream_->insertion.end = record.end();
+        finish(stream_->insertion, stream_->value);
+        if (qgrams_)
+            qgrams_->add(record.begin(), record.end(), stream_->value);
+
+        if (record.empty()) {
+            delete records_.back();
+            records_.pop_back();
+        }
+        stream_.reset();
     }
-};
+};
\ No newline at end of file
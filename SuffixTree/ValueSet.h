@@ -0,0 +1,363 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <new>
+#include <set>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * Sets of values held by the nodes of a SuffixTree, chosen with its T_ValueSetPolicy parameter.
+ *
+ * A policy is a struct with a member alias template <tt>set_type<T></tt>. The set type must be default
+ * constructible and provide:
+ * - <tt>bool insert(const T &)</tt>, returning whether the value was not in the set yet;
+ * - <tt>insert(first, last)</tt>, adding a range of values in increasing order;
+ * - <tt>begin()</tt>, <tt>end()</tt>, iterating over the values in increasing order;
+ * - <tt>size()</tt> and <tt>empty()</tt>.
+ */
+
+/**
+ * std::set with the value set interface.
+ */
+template<typename T>
+class StdValueSet : public std::set<T> {
+public:
+    using std::set<T>::insert;
+
+    bool insert(const T &value) { return std::set<T>::insert(value).second; }
+};
+
+/**
+ * A set kept as a sorted array, stored inline for up to N values and on the heap beyond that.
+ *
+ * Most nodes of a suffix tree are leaves holding a single value, which then costs no allocation at all.
+ * Values put in increasing order (the usual case, see SuffixTree::put) are appended in constant time.
+ */
+template<typename T, std::size_t N>
+class InlineValueSet {
+    static_assert(N > 0, "use SortedVectorValueSet for no inline storage");
+
+    std::uint32_t size_ = 0;
+    std::uint32_t capacity_ = N;
+
+    union {
+        alignas(T) unsigned char inline_[N * sizeof(T)];
+        T *heap_;
+    };
+
+    bool spilled() const { return capacity_ > N; }
+
+    T *data() { return spilled() ? heap_ : reinterpret_cast<T *>(inline_); }
+
+    const T *data() const { return spilled() ? heap_ : reinterpret_cast<const T *>(inline_); }
+
+    void destroy() {
+        auto values = data();
+        for (std::uint32_t i = 0; i < size_; i++) values[i].~T();
+        if (spilled())
+            ::operator delete(heap_);
+    }
+
+    /**
+     * Moves the values to a heap array of <tt>capacity</tt> slots.
+     */
+    void grow(std::size_t capacity) {
+        assert(capacity < UINT32_MAX);
+        auto grown = static_cast<T *>(::operator new(capacity * sizeof(T)));
+        auto values = data();
+        for (std::uint32_t i = 0; i < size_; i++) {
+            new(grown + i) T(std::move(values[i]));
+            values[i].~T();
+        }
+
+        if (spilled())
+            ::operator delete(heap_);
+        heap_ = grown;
+        capacity_ = (std::uint32_t) capacity;
+    }
+
+public:
+    using const_iterator = const T *;
+
+    InlineValueSet() {}
+
+    InlineValueSet(const InlineValueSet &) = delete;
+
+    InlineValueSet &operator=(const InlineValueSet &) = delete;
+
+    ~InlineValueSet() { destroy(); }
+
+    bool insert(const T &value) {
+        auto values = data();
+        auto pos = std::lower_bound(values, values + size_, value);
+        if (pos != values + size_ && !(value < *pos))
+            return false;
+
+        if (size_ == capacity_) {
+            const auto offset = pos - values;
+            grow(2 * (std::size_t) capacity_);
+            values = data();
+            pos = values + offset;
+        }
+
+        auto end = values + size_;
+        if (pos == end)
+            new(end) T(value);
+        else {
+            new(end) T(std::move(end[-1]));
+            std::move_backward(pos, end - 1, end);
+            *pos = value;
+        }
+        size_++;
+        return true;
+    }
+
+    template<typename Iterator>
+    void insert(Iterator first, Iterator last) {
+        std::vector<T> added(first, last);
+        if (added.empty())
+            return;
+
+        // union of two sorted ranges, then moved back in place
+        std::vector<T> merged;
+        merged.reserve(size_ + added.size());
+        std::set_union(begin(), end(), added.begin(), added.end(), std::back_inserter(merged));
+
+        destroy();
+        size_ = 0;
+        capacity_ = N;
+        if (merged.size() > N)
+            grow(merged.size());
+
+        auto values = data();
+        for (auto &value: merged)
+            new(values + size_++) T(std::move(value));
+    }
+
+    const_iterator begin() const { return data(); }
+
+    const_iterator end() const { return data() + size_; }
+
+    std::size_t size() const { return size_; }
+
+    bool empty() const { return size_ == 0; }
+};
+
+/**
+ * A set kept as a sorted std::vector.
+ */
+template<typename T>
+class SortedVectorValueSet {
+    std::vector<T> values_;
+
+public:
+    using const_iterator = typename std::vector<T>::const_iterator;
+
+    bool insert(const T &value) {
+        auto pos = std::lower_bound(values_.begin(), values_.end(), value);
+        if (pos != values_.end() && !(value < *pos))
+            return false;
+
+        values_.insert(pos, value);
+        return true;
+    }
+
+    template<typename Iterator>
+    void insert(Iterator first, Iterator last) {
+        std::vector<T> merged;
+        std::set_union(values_.begin(), values_.end(), first, last, std::back_inserter(merged));
+        merged.shrink_to_fit();
+        values_.swap(merged);
+    }
+
+    const_iterator begin() const { return values_.begin(); }
+
+    const_iterator end() const { return values_.end(); }
+
+    std::size_t size() const { return values_.size(); }
+
+    bool empty() const { return values_.empty(); }
+};
+
+/**
+ * A set of non-negative integers, kept as a sorted array while it is sparse and as a bit vector once it is dense.
+ *
+ * The bit vector only spans the words from the smallest value to the largest one, and a set switches to it once
+ * that takes no more room than the array, at least one value in 64 consecutive ids. So a node never costs more
+ * than one 64-bit word per value, and a node holding many dense integral ids takes one bit per id in its range.
+ * Every set takes 40 bytes in its node; a single value (all leaves) is held there, without an allocation.
+ */
+template<typename T>
+class BitsetValueSet {
+    static_assert(std::is_integral<T>::value, "BitsetValueSet holds integral values only");
+
+    enum : std::size_t { sparse = std::size_t(-1) };
+
+    /**
+     * The sorted values while base_ is sparse, else the bits of the values from base_ * 64 on.
+     * A single value is held in base_ instead, with no words.
+     */
+    std::vector<std::uint64_t> words_;
+    std::size_t base_ = sparse;
+    std::size_t size_ = 0;
+
+    bool single() const { return size_ == 1; }
+
+    bool dense() const { return size_ > 1 && base_ != sparse; }
+
+    /**
+     * Turns the array into a bit vector if that takes no more words.
+     */
+    void densify() {
+        const auto first = words_.front() / 64, last = words_.back() / 64;
+        if (last - first + 1 > words_.size())
+            return;
+
+        std::vector<std::uint64_t> bits(last - first + 1, 0);
+        for (auto value: words_)
+            bits[value / 64 - first] |= std::uint64_t(1) << (value % 64);
+        words_.swap(bits);
+        base_ = (std::size_t) first;
+    }
+
+public:
+    class const_iterator {
+        const BitsetValueSet *set_;
+        /// index in the array, or bit from base_ * 64 in the bit vector
+        std::size_t pos_;
+
+        void skip_zeros() {
+            if (!set_->dense())
+                return;
+
+            const auto &words = set_->words_;
+            const auto bits = words.size() * 64;
+            while (pos_ < bits) {
+                const auto word = words[pos_ / 64] >> (pos_ % 64);
+                if (word & 1)
+                    return;
+                // jump to the next word when the rest of this one is empty
+                pos_ = word ? pos_ + 1 : (pos_ / 64 + 1) * 64;
+            }
+        }
+
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const T *;
+        using reference = T;
+
+        const_iterator(const BitsetValueSet *set, std::size_t pos) : set_(set), pos_(pos) {
+            skip_zeros();
+        }
+
+        T operator*() const {
+            if (set_->single())
+                return (T) set_->base_;
+            return (T) (set_->dense() ? set_->base_ * 64 + pos_ : set_->words_[pos_]);
+        }
+
+        const_iterator &operator++() {
+            pos_++;
+            skip_zeros();
+            return *this;
+        }
+
+        const_iterator operator++(int) {
+            auto old = *this;
+            ++*this;
+            return old;
+        }
+
+        bool operator==(const const_iterator &other) const { return pos_ == other.pos_; }
+
+        bool operator!=(const const_iterator &other) const { return pos_ != other.pos_; }
+    };
+
+    bool insert(const T &value) {
+        assert(value >= 0);
+        const auto i = (std::size_t) value;
+
+        if (size_ == 0) {
+            base_ = i;
+            size_ = 1;
+            return true;
+        }
+        if (single()) {
+            if (base_ == i)
+                return false;
+            words_.push_back(base_);
+            base_ = sparse;
+        }
+
+        if (!dense()) {
+            auto pos = std::lower_bound(words_.begin(), words_.end(), (std::uint64_t) i);
+            if (pos != words_.end() && *pos == i)
+                return false;
+
+            words_.insert(pos, (std::uint64_t) i);
+            size_++;
+            densify();
+            return true;
+        }
+
+        // widen the bit vector to the word of the value
+        if (i / 64 < base_) {
+            words_.insert(words_.begin(), base_ - i / 64, 0);
+            base_ = i / 64;
+        } else if (i / 64 - base_ >= words_.size())
+            words_.resize(i / 64 - base_ + 1, 0);
+
+        auto &word = words_[i / 64 - base_];
+        const auto bit = std::uint64_t(1) << (i % 64);
+        if (word & bit)
+            return false;
+
+        word |= bit;
+        size_++;
+        return true;
+    }
+
+    template<typename Iterator>
+    void insert(Iterator first, Iterator last) {
+        for (; first != last; ++first)
+            insert(*first);
+    }
+
+    const_iterator begin() const { return const_iterator(this, 0); }
+
+    const_iterator end() const {
+        return const_iterator(this, single() ? 1 : dense() ? words_.size() * 64 : words_.size());
+    }
+
+    std::size_t size() const { return size_; }
+
+    bool empty() const { return size_ == 0; }
+};
+
+/// Values in a std::set, as before value set policies existed
+struct StdSetValues {
+    template<typename T> using set_type = StdValueSet<T>;
+};
+
+/// Up to N values inline in the node, the default
+template<std::size_t N = 2>
+struct InlineValues {
+    template<typename T> using set_type = InlineValueSet<T, N>;
+};
+
+struct SortedVectorValues {
+    template<typename T> using set_type = SortedVectorValueSet<T>;
+};
+
+/// For non-negative integral values only
+struct BitsetValues {
+    template<typename T> using set_type = BitsetValueSet<T>;
+};
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <bitset>
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+/**
+ * A bit vector answering rank queries in constant time.
+ *
+ * Bits are set with set(), then build_rank() must be called once before any rank query.
+ */
+class RankBitVector {
+private:
+    /// Number of 64-bit words covered by one entry of block_ranks_
+    static constexpr std::size_t words_per_block = 4;
+
+    std::vector<std::uint64_t> words_;
+    /// Number of ones before each block
+    std::vector<std::uint64_t> block_ranks_;
+    std::size_t size_ = 0;
+
+    static std::size_t popcount(std::uint64_t word) { return std::bitset<64>(word).count(); }
+
+public:
+    RankBitVector() = default;
+
+    explicit RankBitVector(std::size_t size) : words_((size + 63) / 64), size_(size) {}
+
+    void set(std::size_t i) { words_[i / 64] |= std::uint64_t(1) << (i % 64); }
+
+    bool get(std::size_t i) const { return (words_[i / 64] >> (i % 64)) & 1; }
+
+    std::size_t size() const { return size_; }
+
+    void build_rank() {
+        block_ranks_.assign(words_.size() / words_per_block + 1, 0);
+
+        std::uint64_t ones = 0;
+        for (std::size_t w = 0; w < words_.size(); w++) {
+            if (w % words_per_block == 0)
+                block_ranks_[w / words_per_block] = ones;
+            ones += popcount(words_[w]);
+        }
+        if (words_.size() % words_per_block == 0)
+            block_ranks_.back() = ones;
+    }
+
+    /**
+     * Number of ones in [0, i).
+     */
+    std::size_t rank1(std::size_t i) const {
+        const auto word = i / 64;
+        std::size_t ones = block_ranks_[word / words_per_block];
+
+        for (auto w = word - word % words_per_block; w < word; w++)
+            ones += popcount(words_[w]);
+        if (i % 64)
+            ones += popcount(words_[word] & ((std::uint64_t(1) << (i % 64)) - 1));
+
+        return ones;
+    }
+
+    /**
+     * Number of zeros in [0, i).
+     */
+    std::size_t rank0(std::size_t i) const { return i - rank1(i); }
+
+    std::size_t memory_bytes() const {
+        return words_.capacity() * sizeof(std::uint64_t) + block_ranks_.capacity() * sizeof(std::uint64_t);
+    }
+};
+
+/**
+ * A wavelet tree over a sequence of integer symbols in [0, sigma), stored level by level
+ * (the wavelet matrix layout): one bit vector per bit of the symbols, with no pointers between nodes.
+ *
+ * It takes about n * ceil(log2(sigma)) bits and answers access and rank in O(log sigma).
+ */
+class WaveletMatrix {
+private:
+    std::vector<RankBitVector> levels_;
+    /// Number of zeros in each level
+    std::vector<std::size_t> zeros_;
+    std::size_t size_ = 0;
+
+public:
+    WaveletMatrix() = default;
+
+    WaveletMatrix(std::vector<std::uint32_t> symbols, std::uint32_t sigma) : size_(symbols.size()) {
+        std::size_t bits = 1;
+        while (bits < 32 && (std::uint64_t(1) << bits) < sigma) bits++;
+
+        std::vector<std::uint32_t> next(symbols.size());
+        for (std::size_t level = 0; level < bits; level++) {
+            const auto shift = bits - 1 - level;
+            RankBitVector bv(symbols.size());
+
+            // stable partition: symbols with a 0 at this bit first
+            std::size_t zeros = 0;
+            for (std::size_t i = 0; i < symbols.size(); i++)
+                if (!((symbols[i] >> shift) & 1)) zeros++;
+
+            std::size_t z = 0, o = zeros;
+            for (std::size_t i = 0; i < symbols.size(); i++) {
+                if ((symbols[i] >> shift) & 1) {
+                    bv.set(i);
+                    next[o++] = symbols[i];
+                } else
+                    next[z++] = symbols[i];
+            }
+
+            bv.build_rank();
+            levels_.push_back(std::move(bv));
+            zeros_.push_back(zeros);
+            symbols.swap(next);
+        }
+    }
+
+    std::size_t size() const { return size_; }
+
+    /**
+     * Returns the i-th symbol.
+     */
+    std::uint32_t access(std::size_t i) const {
+        std::uint32_t symbol = 0;
+        for (std::size_t level = 0; level < levels_.size(); level++) {
+            auto &bv = levels_[level];
+            const bool bit = bv.get(i);
+
+            symbol = (symbol << 1) | (bit ? 1 : 0);
+            i = bit ? zeros_[level] + bv.rank1(i) : bv.rank0(i);
+        }
+        return symbol;
+    }
+
+    /**
+     * Number of occurrences of <tt>symbol</tt> in [0, i).
+     */
+    std::size_t rank(std::uint32_t symbol, std::size_t i) const {
+        std::size_t start = 0;
+        for (std::size_t level = 0; level < levels_.size(); level++) {
+            auto &bv = levels_[level];
+            const auto shift = levels_.size() - 1 - level;
+
+            if ((symbol >> shift) & 1) {
+                start = zeros_[level] + bv.rank1(start);
+                i = zeros_[level] + bv.rank1(i);
+            } else {
+                start = bv.rank0(start);
+                i = bv.rank0(i);
+            }
+        }
+        return i - start;
+    }
+
+    std::size_t memory_bytes() const {
+        std::size_t bytes = zeros_.capacity() * sizeof(std::size_t);
+        for (auto &bv: levels_) bytes += bv.memory_bytes();
+        return bytes;
+    }
+};
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <cassert>
+#include <deque>
+#include <memory>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "SuffixTree.h"
+
+/**
+ * A SuffixTree over a sliding window of the most recent keys: keys are put with non-decreasing values
+ * (sequence numbers), and expire_before drops the keys of values below a given one.
+ *
+ * Keys are spread over a queue of generation trees of <tt>generation_keys</tt> keys each, oldest first.
+ * The newest generation takes the puts; once it is full a new one is started. Expiring drops whole generations
+ * at once, without touching the others, while search skips the expired values of the oldest generation left.
+ * A dropped generation is cleared and kept, storage included, to become the next new one, so memory stays
+ * bounded by the keys of the window plus one generation under continuous ingest.
+ */
+template<typename T_String, typename T_Mapped, typename T_ValueSetPolicy = InlineValues<>>
+class WindowedSuffixTree {
+public:
+    using tree_type = SuffixTree<T_String, T_Mapped, T_ValueSetPolicy>;
+    using key_type = typename tree_type::key_type;
+    using mapped_type = T_Mapped;
+    using size_type = typename tree_type::size_type;
+
+private:
+    struct Generation {
+        std::unique_ptr<tree_type> tree;
+        /// smallest and largest values put into the tree
+        mapped_type first;
+        mapped_type last;
+        size_type keys;
+    };
+
+    size_type generation_keys_;
+    std::deque<Generation> generations_;
+    /// a cleared generation tree, reused by the next new generation
+    std::unique_ptr<tree_type> spare_;
+
+    /// values below it are expired, when expired_
+    mapped_type oldest_;
+    bool expired_ = false;
+
+    bool live(const mapped_type &value) const {
+        return !expired_ || !(value < oldest_);
+    }
+
+    /**
+     * The generation to put <tt>index</tt> into, a new one if the newest is full.
+     */
+    tree_type &generation_for(const mapped_type &index) {
+        if (!generations_.empty()) {
+            auto &newest = generations_.back();
+            assert(!(index < newest.last));
+            // all the keys of a value stay in one generation
+            if (newest.keys < generation_keys_ || !(newest.last < index)) {
+                newest.last = index;
+                newest.keys++;
+                return *newest.tree;
+            }
+        }
+
+        std::unique_ptr<tree_type> tree(spare_ ? spare_.release() : new tree_type);
+        generations_.push_back(Generation{std::move(tree), index, index, 1});
+        return *generations_.back().tree;
+    }
+
+public:
+    explicit WindowedSuffixTree(size_type generation_keys) : generation_keys_(generation_keys) {
+        assert(generation_keys > 0);
+    }
+
+    /**
+     * Adds the specified <tt>index</tt> under the given <tt>key</tt>, see SuffixTree::put.
+     * Indexes must not decrease from one put to the next.
+     */
+    void put(const T_String &string, const mapped_type &index) {
+        assert(live(index));
+        generation_for(index).put(string, index);
+    }
+
+    /**
+     * Adds the specified <tt>index</tt> under a key given as a temporary, moved into the tree and freed
+     * when it expires.
+     */
+    void put(T_String &&string, const mapped_type &index) {
+        assert(live(index));
+        generation_for(index).put(std::move(string), index);
+    }
+
+    /**
+     * Expires the keys of the values below <tt>index</tt>: search no longer returns them, and generations
+     * holding nothing else are dropped.
+     */
+    void expire_before(const mapped_type &index) {
+        if (expired_ && !(oldest_ < index))
+            return;
+        oldest_ = index;
+        expired_ = true;
+
+        while (!generations_.empty() && generations_.front().last < oldest_) {
+            auto tree = std::move(generations_.front().tree);
+            generations_.pop_front();
+            tree->clear();
+            spare_ = std::move(tree);
+        }
+    }
+
+    /**
+     * Searches all generations, newest first, for at most <tt>count</tt> values, see SuffixTree::search.
+     */
+    std::set<mapped_type> search(const T_String &word, int count) const {
+        std::set<mapped_type> result;
+
+        for (auto it = generations_.rbegin(); it != generations_.rend() && result.size() != (size_type) count; ++it) {
+            const auto left = count < 0 ? -1 : count - (int) result.size();
+            if (live(it->first)) {
+                auto values = it->tree->search(word, left);
+                result.insert(values.begin(), values.end());
+                continue;
+            }
+
+            // the oldest generation, partly expired
+            auto values = it->tree->search(word);
+            for (auto value = values.lower_bound(oldest_); value != values.end(); ++value) {
+                if (result.size() == (size_type) count)
+                    break;
+                result.insert(*value);
+            }
+        }
+        return result;
+    }
+
+    std::set<mapped_type> search(const T_String &word) const {
+        return search(word, -1);
+    }
+
+    /**
+     * Number of generation trees holding live keys.
+     */
+    size_type generation_count() const { return generations_.size(); }
+
+    tree_type const &generation(size_type i) const { return *generations_[i].tree; }
+
+    /**
+     * Number of nodes in all generations, expired keys of the oldest one included.
+     */
+    size_type node_count() const {
+        size_type nodes = 0;
+        for (auto &generation: generations_) nodes += generation.tree->node_count();
+        return nodes;
+    }
+};
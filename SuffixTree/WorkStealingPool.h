@@ -0,0 +1,177 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * A fixed set of worker threads running fork-join jobs over tasks that spawn more tasks.
+ *
+ * Every worker has its own deque: it pushes the tasks it spawns at the back and takes its next task from the back
+ * too (depth first, for locality), and when it runs out it steals from the front of another worker's deque,
+ * where the oldest and usually largest tasks are.
+ *
+ * The thread calling run takes part in the job, as the last worker. One job runs at a time, concurrent calls
+ * to run wait for each other.
+ */
+class WorkStealingPool {
+public:
+    /**
+     * The tasks of one call to run.
+     */
+    template<typename T_Task>
+    class Job {
+        friend class WorkStealingPool;
+
+        struct Deque {
+            std::mutex mutex;
+            std::deque<T_Task> tasks;
+        };
+
+        std::vector<Deque> deques_;
+        /// Tasks spawned and not finished yet, queued or running
+        std::atomic<std::size_t> pending_;
+
+        explicit Job(std::size_t workers) : deques_(workers), pending_(0) {}
+
+        bool pop(std::size_t worker, T_Task &task) {
+            auto &own = deques_[worker];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (own.tasks.empty())
+                return false;
+
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+        }
+
+        bool steal(std::size_t worker, T_Task &task) {
+            for (std::size_t i = 1; i < deques_.size(); i++) {
+                auto &victim = deques_[(worker + i) % deques_.size()];
+                std::lock_guard<std::mutex> lock(victim.mutex);
+                if (victim.tasks.empty())
+                    continue;
+
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                return true;
+            }
+            return false;
+        }
+
+    public:
+        /**
+         * Adds a task to the deque of <tt>worker</tt>, which must be the worker running the calling task.
+         */
+        void spawn(std::size_t worker, T_Task task) {
+            pending_++;
+            auto &own = deques_[worker];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            own.tasks.push_back(std::move(task));
+        }
+    };
+
+private:
+    std::vector<std::thread> threads_;
+
+    std::mutex run_mutex_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable idle_;
+    /// The job being run, called once by every worker
+    std::function<void(std::size_t)> job_;
+    std::uint64_t generation_ = 0;
+    /// Pool threads still inside the job
+    std::size_t busy_ = 0;
+    bool stop_ = false;
+
+    void work(std::size_t worker) {
+        std::uint64_t seen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                wake_.wait(lock, [this, seen]() { return stop_ || generation_ != seen; });
+                if (stop_)
+                    return;
+                seen = generation_;
+            }
+
+            job_(worker);
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (--busy_ == 0)
+                idle_.notify_all();
+        }
+    }
+
+public:
+    /**
+     * Starts <tt>threads</tt> workers, on top of the thread that will call run.
+     */
+    explicit WorkStealingPool(std::size_t threads) {
+        for (std::size_t i = 0; i < threads; i++)
+            threads_.emplace_back(&WorkStealingPool::work, this, i);
+    }
+
+    WorkStealingPool(const WorkStealingPool &) = delete;
+
+    WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+    ~WorkStealingPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for (auto &thread: threads_) thread.join();
+    }
+
+    /**
+     * Number of workers taking part in a job, the calling thread included.
+     */
+    std::size_t size() const { return threads_.size() + 1; }
+
+    /**
+     * Runs <tt>body(task, worker, job)</tt> on every task of <tt>tasks</tt> and on every task spawned meanwhile
+     * with <tt>job.spawn(worker, task)</tt>, and returns once they are all done.
+     * <tt>worker</tt> is in [0, size()), no two tasks run on the same worker at the same time.
+     */
+    template<typename T_Task, typename Body>
+    void run(const std::vector<T_Task> &tasks, Body body) {
+        std::lock_guard<std::mutex> serial(run_mutex_);
+
+        Job<T_Task> job(size());
+        for (std::size_t i = 0; i < tasks.size(); i++)
+            job.spawn(i % size(), tasks[i]);
+
+        auto loop = [&job, &body](std::size_t worker) {
+            T_Task task;
+            while (job.pending_.load() > 0) {
+                if (job.pop(worker, task) || job.steal(worker, task)) {
+                    body(task, worker, job);
+                    job.pending_--;
+                } else
+                    std::this_thread::yield();
+            }
+        };
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            job_ = loop;
+            busy_ = threads_.size();
+            generation_++;
+        }
+        wake_.notify_all();
+
+        loop(size() - 1);
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        idle_.wait(lock, [this]() { return busy_ == 0; });
+        job_ = nullptr;
+    }
+};
@@ -0,0 +1,897 @@
+/**
+ * Benchmark suite for SuffixTree.
+ *
+ * For each corpus shape it measures build throughput, search latency percentiles (hits and misses,
+ * short and long queries), heap usage and teardown time of SuffixTree, and the same figures except teardown
+ * for the compressed FMIndex backend. Searches are also timed on the tree's compact
+ * layout, and hits on its document listing and with parallel collection.
+ *
+ * All inputs come from fixed seeds, so two runs of the same binary see the same data.
+ * Results are written to stdout as one JSON object per line, progress goes to stderr.
+ *
+ * Usage: suffix_tree_benchmark [--scale <factor>] [--corpus <name>]
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+
+#include <sys/resource.h>
+
+#endif
+
+#if defined(__APPLE__)
+
+#include <malloc/malloc.h>
+
+#elif defined(__linux__) || defined(_WIN32)
+
+#include <malloc.h>
+
+#endif
+
+#include "../SuffixTree.h"
+
+/*
+ * Heap accounting: every allocation is counted with the size the allocator reports for it, so the benchmark can
+ * report the live and peak number of bytes the tree holds independently of the allocator's page reuse.
+ * Allocations carry no header, so what new returns is exactly what malloc returned and is freed as such.
+ * The counters are atomic, as the workers of parallel collection allocate too.
+ */
+namespace {
+
+std::atomic<long long> heap_live_bytes(0);
+std::atomic<long long> heap_peak_bytes(0);
+
+/**
+ * Usable size of a block returned by malloc, 0 where the platform can't tell (heap figures are then 0).
+ */
+std::size_t allocation_size(void *p) {
+#if defined(__APPLE__)
+    return malloc_size(p);
+#elif defined(__linux__)
+    return malloc_usable_size(p);
+#elif defined(_WIN32)
+    return _msize(p);
+#else
+    (void) p;
+    return 0;
+#endif
+}
+
+void *count_allocation(void *p) {
+    if (!p) throw std::bad_alloc();
+
+    const auto size = (long long) allocation_size(p);
+    const auto live = heap_live_bytes.fetch_add(size, std::memory_order_relaxed) + size;
+    auto peak = heap_peak_bytes.load(std::memory_order_relaxed);
+    while (live > peak && !heap_peak_bytes.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {}
+    return p;
+}
+
+/*
+ * Kept out of line: once inlined into a delete expression, GCC sees free called on what operator new returned
+ * and warns about a mismatched deallocation (-Wmismatched-new-delete).
+ */
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((noinline))
+#endif
+void free_counted(void *p) {
+    if (!p) return;
+
+    heap_live_bytes.fetch_sub((long long) allocation_size(p), std::memory_order_relaxed);
+    std::free(p);
+}
+
+}
+
+void *operator new(std::size_t size) { return count_allocation(std::malloc(size ? size : 1)); }
+
+void *operator new[](std::size_t size) { return count_allocation(std::malloc(size ? size : 1)); }
+
+void operator delete(void *ptr) noexcept { free_counted(ptr); }
+
+void operator delete[](void *ptr) noexcept { free_counted(ptr); }
+
+#if defined(__cpp_sized_deallocation)
+
+void operator delete(void *ptr, std::size_t) noexcept { free_counted(ptr); }
+
+void operator delete[](void *ptr, std::size_t) noexcept { free_counted(ptr); }
+
+#endif
+
+#if defined(__cpp_aligned_new) && !defined(_WIN32)
+
+namespace {
+
+void *aligned_malloc(std::size_t size, std::align_val_t alignment) {
+    void *p = nullptr;
+    if (posix_memalign(&p, std::max((std::size_t) alignment, sizeof(void *)), size ? size : 1))
+        return nullptr;
+    return p;
+}
+
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment) {
+    return count_allocation(aligned_malloc(size, alignment));
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment) {
+    return count_allocation(aligned_malloc(size, alignment));
+}
+
+void operator delete(void *ptr, std::align_val_t) noexcept { free_counted(ptr); }
+
+void operator delete[](void *ptr, std::align_val_t) noexcept { free_counted(ptr); }
+
+void operator delete(void *ptr, std::size_t, std::align_val_t) noexcept { free_counted(ptr); }
+
+void operator delete[](void *ptr, std::size_t, std::align_val_t) noexcept { free_counted(ptr); }
+
+#endif
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+double elapsed_ns(clock_type::time_point from, clock_type::time_point to) {
+    return (double) std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count();
+}
+
+/**
+ * Peak resident set size of the process in bytes, or 0 if unavailable.
+ */
+long long peak_rss_bytes() {
+#if defined(__unix__) || defined(__APPLE__)
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+    return (long long) usage.ru_maxrss;
+#else
+    return (long long) usage.ru_maxrss * 1024;
+#endif
+#else
+    return 0;
+#endif
+}
+
+/**
+ * Builds one line of JSON output.
+ */
+class Record {
+    std::ostringstream out_;
+    bool first_ = true;
+
+    void key(const char *name) {
+        out_ << (first_ ? "{" : ",") << '"' << name << "\":";
+        first_ = false;
+    }
+
+public:
+    Record &field(const char *name, const std::string &value) {
+        key(name);
+        out_ << '"' << value << '"';
+        return *this;
+    }
+
+    Record &field(const char *name, double value) {
+        key(name);
+        out_ << value;
+        return *this;
+    }
+
+    Record &field(const char *name, long long value) {
+        key(name);
+        out_ << value;
+        return *this;
+    }
+
+    void emit() {
+        std::cout << out_.str() << "}\n";
+        std::cout.flush();
+    }
+};
+
+double percentile(std::vector<double> &sorted, double p) {
+    if (sorted.empty()) return 0;
+    auto rank = (std::size_t) ((double) sorted.size() * p / 100.0);
+    return sorted[std::min(rank, sorted.size() - 1)];
+}
+
+/**
+ * Uniform integer in [lo, hi]. Unlike std::uniform_int_distribution the result only depends on the engine,
+ * so the corpora are the same across standard libraries.
+ */
+int uniform(std::mt19937 &rng, int lo, int hi) {
+    return lo + (int) (rng() % (std::uint32_t) (hi - lo + 1));
+}
+
+/**
+ * Draws an index with probability proportional to its weight, given the cumulative weights.
+ */
+std::size_t weighted(std::mt19937 &rng, const std::vector<double> &cumulative) {
+    double x = (double) rng() / 4294967296.0 * cumulative.back();
+    auto it = std::upper_bound(cumulative.begin(), cumulative.end(), x);
+    return std::min((std::size_t) (it - cumulative.begin()), cumulative.size() - 1);
+}
+
+std::vector<double> cumulative_of(const std::vector<double> &weights) {
+    std::vector<double> cumulative(weights.size());
+    double sum = 0;
+    for (std::size_t i = 0; i < weights.size(); i++) cumulative[i] = sum += weights[i];
+    return cumulative;
+}
+
+template<typename T_String>
+struct Corpus {
+    std::string name;
+    std::vector<T_String> keys;
+    typename T_String::value_type miss_element;
+};
+
+template<typename T_String>
+long long total_elements(const std::vector<T_String> &keys) {
+    long long total = 0;
+    for (auto &k: keys) total += (long long) std::distance(k.begin(), k.end());
+    return total;
+}
+
+/**
+ * Picks random substrings of the keys, with length in [min_len, max_len].
+ * If <tt>miss</tt> is set, the last element of each query is replaced by an element that never occurs in the corpus.
+ */
+template<typename T_String>
+std::vector<T_String> make_queries(const Corpus<T_String> &corpus, std::size_t count,
+                                   int min_len, int max_len, bool miss, std::mt19937 &rng) {
+    std::vector<T_String> queries;
+    std::vector<const T_String *> candidates;
+    for (auto &k: corpus.keys)
+        if ((int) std::distance(k.begin(), k.end()) >= min_len)
+            candidates.push_back(&k);
+    if (candidates.empty()) return queries;
+
+    while (queries.size() < count) {
+        auto &key = *candidates[rng() % candidates.size()];
+        int key_len = (int) std::distance(key.begin(), key.end());
+        int len = std::min(key_len, uniform(rng, min_len, max_len));
+        int from = uniform(rng, 0, key_len - len);
+
+        auto begin = std::next(key.begin(), from);
+        queries.emplace_back(begin, std::next(begin, len));
+        if (miss)
+            queries.back().back() = corpus.miss_element;
+    }
+
+    return queries;
+}
+
+template<typename T_String, typename T_Index>
+void bench_search(const std::string &corpus_name, const char *backend, const T_Index &index,
+                  const char *kind, const std::vector<T_String> &queries) {
+    if (queries.empty()) return;
+
+    std::vector<double> latencies;
+    latencies.reserve(queries.size());
+    long long results = 0;
+
+    auto all_start = clock_type::now();
+    for (auto &q: queries) {
+        auto t1 = clock_type::now();
+        results += (long long) index.search(q).size();
+        auto t2 = clock_type::now();
+        latencies.push_back(elapsed_ns(t1, t2));
+    }
+    auto all_end = clock_type::now();
+
+    std::sort(latencies.begin(), latencies.end());
+    Record()
+            .field("corpus", corpus_name)
+            .field("backend", std::string(backend))
+            .field("metric", std::string("search"))
+            .field("kind", std::string(kind))
+            .field("queries", (long long) queries.size())
+            .field("results", results)
+            .field("total_ms", elapsed_ns(all_start, all_end) / 1e6)
+            .field("p50_ns", percentile(latencies, 50))
+            .field("p90_ns", percentile(latencies, 90))
+            .field("p99_ns", percentile(latencies, 99))
+            .field("max_ns", latencies.back())
+            .emit();
+}
+
+/**
+ * Times queries for the keys containing both words of every pair, answered by <tt>query(first, second)</tt>.
+ */
+template<typename T_String, typename Query>
+void bench_conjunction(const std::string &corpus_name, const char *backend, const char *kind,
+                       const std::vector<T_String> &first, const std::vector<T_String> &second, Query query) {
+    const auto count = std::min(first.size(), second.size());
+    if (!count) return;
+
+    std::vector<double> latencies;
+    latencies.reserve(count);
+    long long results = 0;
+
+    auto all_start = clock_type::now();
+    for (std::size_t i = 0; i < count; i++) {
+        auto t1 = clock_type::now();
+        results += (long long) query(first[i], second[i]).size();
+        auto t2 = clock_type::now();
+        latencies.push_back(elapsed_ns(t1, t2));
+    }
+    auto all_end = clock_type::now();
+
+    std::sort(latencies.begin(), latencies.end());
+    Record()
+            .field("corpus", corpus_name)
+            .field("backend", std::string(backend))
+            .field("metric", std::string("search_all"))
+            .field("kind", std::string(kind))
+            .field("queries", (long long) count)
+            .field("results", results)
+            .field("total_ms", elapsed_ns(all_start, all_end) / 1e6)
+            .field("p50_ns", percentile(latencies, 50))
+            .field("p99_ns", percentile(latencies, 99))
+            .emit();
+}
+
+/**
+ * Times short searches answered by a q-gram table, which only trees of byte-sized elements have.
+ */
+#ifdef SUFFIX_TREE_INSTRUMENTATION
+
+void emit_histogram(Record &record, const char *name, const SuffixTreeLatencyHistogram &histogram) {
+    const std::string prefix(name);
+    record.field((prefix + "_count").c_str(), (long long) histogram.count())
+            .field((prefix + "_mean_ns").c_str(), histogram.mean_ns())
+            .field((prefix + "_p50_ns").c_str(), (long long) histogram.percentile_ns(50))
+            .field((prefix + "_p99_ns").c_str(), (long long) histogram.percentile_ns(99))
+            .field((prefix + "_max_ns").c_str(), (long long) histogram.max_ns());
+}
+
+/**
+ * Emits the instrumentation counters of the calling thread as one line of <tt>backend</tt>, then resets them, so
+ * that each line only counts the work of its backend since the previous line. A backend run in several phases
+ * has several lines, to be summed.
+ */
+void emit_counters(const std::string &corpus_name, const char *backend) {
+    auto &counters = suffix_tree_counters();
+    Record record;
+    record.field("corpus", corpus_name)
+            .field("backend", std::string(backend))
+            .field("metric", std::string("counters"))
+            .field("canonize_iterations", (long long) counters.canonize_iterations)
+            .field("extension_found", (long long) counters.extension_found)
+            .field("extension_split", (long long) counters.extension_split)
+            .field("extension_new_leaf", (long long) counters.extension_new_leaf)
+            .field("contained_prefix_elements", (long long) counters.contained_prefix_elements)
+            .field("suffix_chain_steps", (long long) counters.suffix_chain_steps)
+            .field("get_edge_lookups", (long long) counters.get_edge_lookups)
+            .field("get_edge_misses", (long long) counters.get_edge_misses)
+            .field("search_label_compares", (long long) counters.search_label_compares)
+            .field("short_query_hits", (long long) counters.short_query_hits);
+    emit_histogram(record, "put_latency", counters.put_latency);
+    emit_histogram(record, "search_latency", counters.search_latency);
+    record.emit();
+    counters.reset();
+}
+
+void reset_counters() { suffix_tree_counters().reset(); }
+
+#else
+
+void emit_counters(const std::string &, const char *) {}
+
+void reset_counters() {}
+
+#endif
+
+template<typename T_String>
+void bench_short_queries(const std::string &corpus_name, SuffixTree<T_String, int> &tree,
+                         const std::vector<T_String> &queries, std::true_type) {
+    auto heap_before = heap_live_bytes.load();
+    auto build_start = clock_type::now();
+    tree.enable_short_queries(3);
+    auto build_end = clock_type::now();
+    Record()
+            .field("corpus", corpus_name)
+            .field("backend", std::string("tree_qgrams"))
+            .field("metric", std::string("build"))
+            .field("total_ms", elapsed_ns(build_start, build_end) / 1e6)
+            .field("heap_bytes", heap_live_bytes - heap_before)
+            .emit();
+
+    bench_search(corpus_name, "tree_qgrams", tree, "hit_short", queries);
+    tree.disable_short_queries();
+    emit_counters(corpus_name, "tree_qgrams");
+}
+
+template<typename T_String>
+void bench_short_queries(const std::string &, SuffixTree<T_String, int> &, const std::vector<T_String> &,
+                         std::false_type) {}
+
+/**
+ * Times one search_batch over all the queries, reported per query.
+ */
+template<typename T_String>
+void bench_search_batch(const std::string &corpus_name, const SuffixTree<T_String, int> &tree, const char *kind,
+                        const std::vector<T_String> &queries) {
+    if (queries.empty()) return;
+
+    auto start = clock_type::now();
+    auto results = tree.search_batch(queries);
+    auto end = clock_type::now();
+
+    long long found = 0;
+    for (auto &result: results) found += (long long) result.size();
+    Record()
+            .field("corpus", corpus_name)
+            .field("backend", std::string("tree_batch"))
+            .field("metric", std::string("search"))
+            .field("kind", std::string(kind))
+            .field("queries", (long long) queries.size())
+            .field("results", found)
+            .field("total_ms", elapsed_ns(start, end) / 1e6)
+            .field("mean_ns", elapsed_ns(start, end) / (double) queries.size())
+            .emit();
+}
+
+template<typename T_String>
+void run(const Corpus<T_String> &corpus, std::size_t query_count, std::uint32_t seed) {
+    std::cerr << "corpus " << corpus.name << ": " << corpus.keys.size() << " keys\n";
+
+    std::mt19937 rng(seed);
+    auto hit_short = make_queries(corpus, query_count, 1, 3, false, rng);
+    auto hit_long = make_queries(corpus, query_count, 10, 30, false, rng);
+    auto miss_short = make_queries(corpus, query_count, 1, 3, true, rng);
+    auto miss_long = make_queries(corpus, query_count, 10, 30, true, rng);
+
+    auto elements = total_elements(corpus.keys);
+    reset_counters();
+    auto heap_before = heap_live_bytes.load();
+    heap_peak_bytes = heap_live_bytes.load();
+
+    std::unique_ptr<SuffixTree<T_String, int>> tree(new SuffixTree<T_String, int>);
+    std::vector<double> put_latencies;
+    put_latencies.reserve(corpus.keys.size());
+
+    auto build_start = clock_type::now();
+    for (std::size_t i = 0; i < corpus.keys.size(); i++) {
+        auto t1 = clock_type::now();
+        tree->put(corpus.keys[i], (int) i);
+        auto t2 = clock_type::now();
+        put_latencies.push_back(elapsed_ns(t1, t2));
+    }
+    auto build_end = clock_type::now();
+    auto build_ns = elapsed_ns(build_start, build_end);
+
+    std::sort(put_latencies.begin(), put_latencies.end());
+    Record()
+            .field("corpus", corpus.name)
+            .field("backend", std::string("tree"))
+            .field("metric", std::string("build"))
+            .field("keys", (long long) corpus.keys.size())
+            .field("elements", elements)
+            .field("total_ms", build_ns / 1e6)
+            .field("elements_per_sec", build_ns > 0 ? (double) elements * 1e9 / build_ns : 0)
+            .field("put_p50_ns", percentile(put_latencies, 50))
+            .field("put_p99_ns", percentile(put_latencies, 99))
+            .field("put_max_ns", put_latencies.empty() ? 0 : put_latencies.back())
+            .emit();
+
+    // the latency vector is part of the measurement harness, not of the tree
+    auto harness_bytes = (long long) (put_latencies.capacity() * sizeof(double));
+    auto tree_bytes = heap_live_bytes - heap_before - harness_bytes;
+    Record()
+            .field("corpus", corpus.name)
+            .field("backend", std::string("tree"))
+            .field("metric", std::string("memory"))
+            .field("heap_bytes", tree_bytes)
+            .field("heap_peak_bytes", heap_peak_bytes - heap_before - harness_bytes)
+            .field("bytes_per_element", elements ? (double) tree_bytes / (double) elements : 0)
+            .field("process_peak_rss_bytes", peak_rss_bytes())
+            .emit();
+
+    // putting the corpus again only reads the tree, every key is already in it
+    auto reput_start = clock_type::now();
+    for (std::size_t i = 0; i < corpus.keys.size(); i++)
+        tree->put(corpus.keys[i], (int) i);
+    auto reput_end = clock_type::now();
+    auto reput_ns = elapsed_ns(reput_start, reput_end);
+    Record()
+            .field("corpus", corpus.name)
+            .field("backend", std::string("tree"))
+            .field("metric", std::string("reput"))
+            .field("total_ms", reput_ns / 1e6)
+            .field("elements_per_sec", reput_ns > 0 ? (double) elements * 1e9 / reput_ns : 0)
+            .emit();
+
+    // one pass over the nodes finds all the repeats
+    auto repeats_start = clock_type::now();
+    auto repeats = tree->maximal_repeats(8);
+    auto repeats_end = clock_type::now();
+    Record()
+            .field("corpus", corpus.name)
+            .field("backend", std::string("tree"))
+            .field("metric", std::string("maximal_repeats"))
+            .field("repeats", (long long) repeats.size())
+            .field("total_ms", elapsed_ns(repeats_start, repeats_end) / 1e6)
+            .emit();
+    repeats.clear();
+
+    // suffix-prefix overlaps of every two keys, counted as they stream out
+    long long overlap_pairs = 0;
+    auto overlaps_start = clock_type::now();
+    tree->overlaps(12, [&overlap_pairs](int, int, std::size_t) { overlap_pairs++; });
+    auto overlaps_end = clock_type::now();
+    Record()
+            .field("corpus", corpus.name)
+            .field("backend", std::string("tree"))
+            .field("metric", std::string("overlaps"))
+            .field("pairs", overlap_pairs)
+            .field("total_ms", elapsed_ns(overlaps_start, overlaps_end) / 1e6)
+            .emit();
+
+    bench_search(corpus.name, "tree", *tree, "hit_short", hit_short);
+    bench_search(corpus.name, "tree", *tree, "hit_long", hit_long);
+    bench_search(corpus.name, "tree", *tree, "miss_short", miss_short);
+    bench_search(corpus.name, "tree", *tree, "miss_long", miss_long);
+    emit_counters(corpus.name, "tree");
+
+    // the same searches, their descents interleaved
+    bench_search_batch(corpus.name, *tree, "hit_long", hit_long);
+    bench_search_batch(corpus.name, *tree, "miss_short", miss_short);
+    bench_search_batch(corpus.name, *tree, "miss_long", miss_long);
+    emit_counters(corpus.name, "tree_batch");
+
+    // the same tree collecting large results on every core
+    tree->enable_parallel_collection(std::max(1u, std::thread::hardware_concurrency()) - 1);
+    bench_search(corpus.name, "tree_parallel", *tree, "hit_short", hit_short);
+    tree->disable_parallel_collection();
+    emit_counters(corpus.name, "tree_parallel");
+
+    // short words repeat, their results are served from the cache after the first search
+    tree->enable_result_cache(1024);
+    bench_search(corpus.name, "tree_cached", *tree, "hit_short", hit_short);
+    Record()
+            .field("corpus", corpus.name)
+            .field("backend", std::string("tree_cached"))
+            .field("metric", std::string("cache"))
+            .field("hit_rate", tree->result_cache_stats().hit_rate())
+            .emit();
+    tree->disable_result_cache();
+    emit_counters(corpus.name, "tree_cached");
+
+    // short words looked up in a q-gram table
+    using element_type = typename std::decay<decltype(*std::begin(corpus.keys[0]))>::type;
+    bench_short_queries(corpus.name, *tree, hit_short, std::integral_constant<bool, sizeof(element_type) == 1>());
+
+    // keys containing a short and a long word, intersected by the tree or by the caller from two searches
+    bench_conjunction(corpus.name, "tree", "short_and_long", hit_short, hit_long,
+                      [&tree](const T_String &a, const T_String &b) {
+                          return tree->search_all(std::vector<T_String>{a, b});
+                      });
+    emit_counters(corpus.name, "tree");
+    bench_conjunction(corpus.name, "tree_two_searches", "short_and_long", hit_short, hit_long,
+                      [&tree](const T_String &a, const T_String &b) {
+                          auto sa = tree->search(a), sb = tree->search(b);
+                          std::set<int> result;
+                          std::set_intersection(sa.begin(), sa.end(), sb.begin(), sb.end(),
+                                                std::inserter(result, result.end()));
+                          return result;
+                      });
+    emit_counters(corpus.name, "tree_two_searches");
+
+    // the same tree searched through its compact layout
+    heap_before = heap_live_bytes.load();
+    auto layout_start = clock_type::now();
+    tree->optimize_layout();
+    auto layout_end = clock_type::now();
+    Record()
+            .field("corpus", corpus.name)
+            .field("backend", std::string("tree_layout"))
+            .field("metric", std::string("build"))
+            .field("total_ms", elapsed_ns(layout_start, layout_end) / 1e6)
+            .field("heap_bytes", heap_live_bytes - heap_before)
+            .emit();
+
+    bench_search(corpus.name, "tree_layout", *tree, "hit_short", hit_short);
+    bench_search(corpus.name, "tree_layout", *tree, "hit_long", hit_long);
+    bench_search(corpus.name, "tree_layout", *tree, "miss_short", miss_short);
+    bench_search(corpus.name, "tree_layout", *tree, "miss_long", miss_long);
+    emit_counters(corpus.name, "tree_layout");
+
+    // and answering from its document listing
+    heap_before = heap_live_bytes.load();
+    auto listing_start = clock_type::now();
+    tree->build_document_listing();
+    auto listing_end = clock_type::now();
+    Record()
+            .field("corpus", corpus.name)
+            .field("backend", std::string("tree_listing"))
+            .field("metric", std::string("build"))
+            .field("total_ms", elapsed_ns(listing_start, listing_end) / 1e6)
+            .field("heap_bytes", heap_live_bytes - heap_before)
+            .emit();
+
+    bench_search(corpus.name, "tree_listing", *tree, "hit_short", hit_short);
+    bench_search(corpus.name, "tree_listing", *tree, "hit_long", hit_long);
+    emit_counters(corpus.name, "tree_listing");
+
+    // the next build cycle reuses the storage of the nodes instead of allocating it anew
+    auto clear_start = clock_type::now();
+    tree->clear();
+    auto rebuild_start = clock_type::now();
+    for (std::size_t i = 0; i < corpus.keys.size(); i++)
+        tree->put(corpus.keys[i], (int) i);
+    auto rebuild_end = clock_type::now();
+    auto rebuild_ns = elapsed_ns(rebuild_start, rebuild_end);
+    Record()
+            .field("corpus", corpus.name)
+            .field("backend", std::string("tree"))
+            .field("metric", std::string("rebuild"))
+            .field("clear_ms", elapsed_ns(clear_start, rebuild_start) / 1e6)
+            .field("total_ms", rebuild_ns / 1e6)
+            .field("elements_per_sec", rebuild_ns > 0 ? (double) elements * 1e9 / rebuild_ns : 0)
+            .emit();
+
+    auto teardown_start = clock_type::now();
+    tree.reset();
+    auto teardown_end = clock_type::now();
+    Record()
+            .field("corpus", corpus.name)
+            .field("backend", std::string("tree"))
+            .field("metric", std::string("teardown"))
+            .field("total_ms", elapsed_ns(teardown_start, teardown_end) / 1e6)
+            .emit();
+    emit_counters(corpus.name, "tree");
+
+    // a rolling window of the last quarter of the keys, expired as every key arrives
+    {
+        const auto window = std::max<std::size_t>(corpus.keys.size() / 4, 1);
+        heap_before = heap_live_bytes.load();
+        heap_peak_bytes = heap_live_bytes.load();
+        WindowedSuffixTree<T_String, int> windowed(std::max<std::size_t>(window / 4, 1));
+
+        auto window_start = clock_type::now();
+        for (std::size_t i = 0; i < corpus.keys.size(); i++) {
+            windowed.put(corpus.keys[i], (int) i);
+            if (i >= window)
+                windowed.expire_before((int) (i - window));
+        }
+        auto window_end = clock_type::now();
+        auto window_ns = elapsed_ns(window_start, window_end);
+        Record()
+                .field("corpus", corpus.name)
+                .field("backend", std::string("tree_window"))
+                .field("metric", std::string("build"))
+                .field("keys", (long long) corpus.keys.size())
+                .field("window", (long long) window)
+                .field("total_ms", window_ns / 1e6)
+                .field("elements_per_sec", window_ns > 0 ? (double) elements * 1e9 / window_ns : 0)
+                .field("heap_bytes", heap_live_bytes - heap_before)
+                .field("heap_peak_bytes", heap_peak_bytes - heap_before)
+                .emit();
+        emit_counters(corpus.name, "tree_window");
+    }
+
+    // the same corpus in the compressed backend
+    heap_before = heap_live_bytes.load();
+    heap_peak_bytes = heap_live_bytes.load();
+
+    FMIndex<T_String, int> fm_index;
+    build_start = clock_type::now();
+    for (std::size_t i = 0; i < corpus.keys.size(); i++)
+        fm_index.put(corpus.keys[i], (int) i);
+    fm_index.build();
+    build_end = clock_type::now();
+    build_ns = elapsed_ns(build_start, build_end);
+
+    Record()
+            .field("corpus", corpus.name)
+            .field("backend", std::string("fm_index"))
+            .field("metric", std::string("build"))
+            .field("keys", (long long) corpus.keys.size())
+            .field("elements", elements)
+            .field("total_ms", build_ns / 1e6)
+            .field("elements_per_sec", build_ns > 0 ? (double) elements * 1e9 / build_ns : 0)
+            .emit();
+
+    auto index_bytes = heap_live_bytes - heap_before;
+    Record()
+            .field("corpus", corpus.name)
+            .field("backend", std::string("fm_index"))
+            .field("metric", std::string("memory"))
+            .field("heap_bytes", index_bytes)
+            .field("heap_peak_bytes", heap_peak_bytes - heap_before)
+            .field("bytes_per_element", elements ? (double) index_bytes / (double) elements : 0)
+            .field("process_peak_rss_bytes", peak_rss_bytes())
+            .emit();
+
+    bench_search(corpus.name, "fm_index", fm_index, "hit_short", hit_short);
+    bench_search(corpus.name, "fm_index", fm_index, "hit_long", hit_long);
+    bench_search(corpus.name, "fm_index", fm_index, "miss_short", miss_short);
+    bench_search(corpus.name, "fm_index", fm_index, "miss_long", miss_long);
+    emit_counters(corpus.name, "fm_index");
+
+    // and in a tree over the alphabet codes of its elements
+    heap_before = heap_live_bytes.load();
+    heap_peak_bytes = heap_live_bytes.load();
+
+    std::unique_ptr<AlphabetSuffixTree<T_String, int>> encoded(new AlphabetSuffixTree<T_String, int>);
+    build_start = clock_type::now();
+    for (std::size_t i = 0; i < corpus.keys.size(); i++)
+        encoded->put(corpus.keys[i], (int) i);
+    build_end = clock_type::now();
+    build_ns = elapsed_ns(build_start, build_end);
+
+    Record()
+            .field("corpus", corpus.name)
+            .field("backend", std::string("tree_alphabet"))
+            .field("metric", std::string("build"))
+            .field("keys", (long long) corpus.keys.size())
+            .field("elements", elements)
+            .field("alphabet", (long long) encoded->alphabet().size())
+            .field("total_ms", build_ns / 1e6)
+            .field("elements_per_sec", build_ns > 0 ? (double) elements * 1e9 / build_ns : 0)
+            .emit();
+
+    // the encoded tree owns a copy of the keys, as codes
+    index_bytes = heap_live_bytes - heap_before;
+    Record()
+            .field("corpus", corpus.name)
+            .field("backend", std::string("tree_alphabet"))
+            .field("metric", std::string("memory"))
+            .field("heap_bytes", index_bytes)
+            .field("heap_peak_bytes", heap_peak_bytes - heap_before)
+            .field("bytes_per_element", elements ? (double) index_bytes / (double) elements : 0)
+            .emit();
+
+    bench_search(corpus.name, "tree_alphabet", *encoded, "hit_short", hit_short);
+    bench_search(corpus.name, "tree_alphabet", *encoded, "hit_long", hit_long);
+    bench_search(corpus.name, "tree_alphabet", *encoded, "miss_short", miss_short);
+    bench_search(corpus.name, "tree_alphabet", *encoded, "miss_long", miss_long);
+    encoded.reset();
+    emit_counters(corpus.name, "tree_alphabet");
+}
+
+/**
+ * Word-like tokens drawn from a Zipf-distributed vocabulary, joined into short phrases.
+ */
+Corpus<std::string> make_words(std::size_t count, std::mt19937 &rng) {
+    // rough English letter frequencies, a..z
+    const auto letters = cumulative_of({8.2, 1.5, 2.8, 4.3, 12.7, 2.2, 2.0, 6.1, 7.0, 0.2, 0.8, 4.0, 2.4,
+                                        6.7, 7.5, 1.9, 0.1, 6.0, 6.3, 9.1, 2.8, 1.0, 2.4, 0.2, 2.0, 0.1});
+
+    std::vector<std::string> vocabulary(5000);
+    std::vector<double> zipf(vocabulary.size());
+    for (std::size_t i = 0; i < vocabulary.size(); i++) {
+        for (int j = uniform(rng, 2, 10); j > 0; j--) vocabulary[i] += (char) ('a' + weighted(rng, letters));
+        zipf[i] = 1.0 / (double) (i + 1);
+    }
+    const auto words = cumulative_of(zipf);
+
+    Corpus<std::string> corpus{"words", {}, '#'};
+    for (std::size_t i = 0; i < count; i++) {
+        std::string key;
+        for (int w = uniform(rng, 1, 4); w > 0; w--) {
+            if (!key.empty()) key += ' ';
+            key += vocabulary[weighted(rng, words)];
+        }
+        corpus.keys.push_back(std::move(key));
+    }
+    return corpus;
+}
+
+Corpus<std::string> make_dna(std::size_t count, std::mt19937 &rng) {
+    static const char bases[] = "ACGT";
+
+    Corpus<std::string> corpus{"dna", {}, 'N'};
+    for (std::size_t i = 0; i < count; i++) {
+        std::string key;
+        for (int j = uniform(rng, 50, 200); j > 0; j--) key += bases[rng() % 4];
+        corpus.keys.push_back(std::move(key));
+    }
+    return corpus;
+}
+
+/**
+ * Short motifs repeated many times, with rare point mutations.
+ */
+Corpus<std::string> make_repetitive(std::size_t count, std::mt19937 &rng) {
+    std::vector<std::string> motifs(16);
+    for (auto &m: motifs)
+        for (int j = uniform(rng, 2, 8); j > 0; j--) m += (char) ('a' + rng() % 4);
+
+    Corpus<std::string> corpus{"repetitive", {}, '#'};
+    for (std::size_t i = 0; i < count; i++) {
+        auto &motif = motifs[rng() % motifs.size()];
+        std::string key;
+        for (int j = uniform(rng, 100, 300); j > 0; j--) {
+            char c = motif[key.size() % motif.size()];
+            key += (rng() % 100 == 0) ? (char) ('a' + rng() % 26) : c;
+        }
+        corpus.keys.push_back(std::move(key));
+    }
+    return corpus;
+}
+
+template<typename T_String>
+Corpus<T_String> make_ints(const std::string &name, std::size_t count, std::mt19937 &rng) {
+    Corpus<T_String> corpus{name, {}, -1};
+    for (std::size_t i = 0; i < count; i++) {
+        T_String key;
+        for (int j = uniform(rng, 1, 100); j > 0; j--) key.push_back(uniform(rng, 0, 999));
+        corpus.keys.push_back(std::move(key));
+    }
+    return corpus;
+}
+
+std::size_t scaled(std::size_t n, double scale) {
+    return std::max<std::size_t>(1, (std::size_t) ((double) n * scale));
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    double scale = 1;
+    std::string only;
+    for (int i = 1; i < argc; i++) {
+        if (!std::strcmp(argv[i], "--scale") && i + 1 < argc)
+            scale = std::atof(argv[++i]);
+        else if (!std::strcmp(argv[i], "--corpus") && i + 1 < argc)
+            only = argv[++i];
+        else {
+            std::cerr << "usage: " << argv[0] << " [--scale <factor>] [--corpus <name>]\n";
+            return 1;
+        }
+    }
+
+#ifndef NDEBUG
+    std::cerr << "warning: built without NDEBUG, configure with -DCMAKE_BUILD_TYPE=Release for real numbers\n";
+#endif
+
+    const std::size_t queries = scaled(2000, scale);
+    auto wanted = [&](const char *name) { return only.empty() || only == name; };
+
+    {
+        std::mt19937 rng(1);
+        if (wanted("words")) run(make_words(scaled(50000, scale), rng), queries, 101);
+    }
+    {
+        std::mt19937 rng(2);
+        if (wanted("dna")) run(make_dna(scaled(5000, scale), rng), queries, 102);
+    }
+    {
+        std::mt19937 rng(3);
+        if (wanted("repetitive")) run(make_repetitive(scaled(2000, scale), rng), queries, 103);
+    }
+    {
+        std::mt19937 rng(4);
+        if (wanted("vector_int")) run(make_ints<std::vector<int>>("vector_int", scaled(20000, scale), rng), queries, 104);
+    }
+    {
+        std::mt19937 rng(5);
+        if (wanted("list_int")) run(make_ints<std::list<int>>("list_int", scaled(5000, scale), rng), queries, 105);
+    }
+
+    return 0;
+}
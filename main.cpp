@@ -1,82 +1,14 @@
 #include <iostream>
 #include <cstdlib>
 #include <ctime>
-#include <chrono>
+#include <algorithm>
+#include <map>
 #include <vector>
 #include <list>
 
 //#include "SuffixTree/SuffixTree.h"
 #include "SuffixTree.h"
 
-using std::chrono::high_resolution_clock;
-using std::chrono::duration_cast;
-using std::chrono::duration;
-using std::chrono::milliseconds;
-
-void test_speed() {
-    srand(time(nullptr));
-    int sz = 80000;
-    int max_len = 100;
-    int test = 30;
-    std::cout << "Remember to set to release.\nConfiguration: " << sz << " strings, " << max_len
-              << " chars max. 26 lowercase letters.\n";
-
-    double avg = 0, avg_cnt = 0;
-    for (int t = 1; t <= test; t++) {
-        std::cout << "TIME " << t << '\n';
-
-        SuffixTree<std::string, int> tree;
-
-        std::vector<std::string> words;
-        int cnt = 0;
-        for (int i = 0; i < sz; i++) {
-            int len = rand() % max_len + 1;
-            words.emplace_back();
-            for (int j = 0; j < len; j++) {
-                char c = rand() % 26 + 'a';
-                words.back() += c;
-            }
-
-            cnt += len;
-        }
-
-        std::cout << cnt << '\n';
-        avg_cnt += cnt;
-
-        double avg_f = 0, avg_f_cnt = 0;
-        auto t1 = high_resolution_clock::now();
-
-        for (int idx = 0; idx < sz; idx++) {
-            auto &s = words[idx];
-
-            auto t1 = high_resolution_clock::now();
-            tree.put(s, idx);
-            auto t2 = high_resolution_clock::now();
-
-            avg_f_cnt += s.size();
-
-            //tree.search(s);
-
-            duration<double, std::milli> ms_double = t2 - t1;
-            avg_f += ms_double.count();
-        }
-
-        auto t2 = high_resolution_clock::now();
-        /* Getting number of milliseconds as a double. */
-        duration<double, std::milli> ms_double = t2 - t1;
-        std::cout << ms_double.count() << "ms\n";
-        avg += ms_double.count();
-
-        avg_f /= (double) sz;
-        avg_f_cnt /= (double) sz;
-        std::cout << avg_f << "ms " << (avg_f * sz) << "ms " << avg_f_cnt << '\n';
-    }
-
-    avg /= (double) test;
-    avg_cnt /= (double) test;
-    std::cout << "AVG " << avg << "ms " << avg_cnt << "\n";
-}
-
 void test_correctness() {
     srand(time(nullptr));
     int sz = 100;
@@ -351,12 +283,1084 @@ void test_correctness_list() {
     }
 }
 
+void test_exact_results() {
+    srand(time(nullptr));
+    int sz = 30;
+    int max_len = 20;
+    int test = 50;
+    std::cout << "Configuration: " << sz << " strings, " << max_len
+              << " chars max. 3 lowercase letters, results compared with a naive scan.\n";
+
+    for (int t = 1; t <= test; t++) {
+        SuffixTree<std::string, int> tree;
+        std::vector<std::string> words;
+        // the tree keeps iterators into the keys, they must not move
+        words.reserve(sz);
+
+        for (int idx = 0; idx < sz; idx++) {
+            int len = rand() % max_len + 1;
+            words.emplace_back();
+            for (int j = 0; j < len; j++)
+                words.back() += (char) (rand() % 3 + 'a');
+            // some values are shared by several keys
+            tree.put(words.back(), idx / 2);
+
+            for (auto &w: words)
+                for (int i = 0; i < w.size(); i++)
+                    for (int j = 1; j <= w.size() - i; j++) {
+                        auto query = w.substr(i, j);
+                        std::set<int> expected;
+                        for (int k = 0; k < words.size(); k++)
+                            if (words[k].find(query) != std::string::npos)
+                                expected.insert(k / 2);
+                        assert(tree.search(query) == expected);
+                    }
+        }
+        assert(tree.search("d").empty());
+    }
+}
+
+void test_contained_keys() {
+    srand(time(nullptr));
+    int sz = 300;
+    std::cout << "Configuration: " << sz << " keys cut from earlier ones or repeated, results compared with a naive scan.\n";
+
+    std::vector<std::string> words;
+    // the tree keeps iterators into the keys, they must not move
+    words.reserve(sz);
+    words.emplace_back("abcabcabd");
+    SuffixTree<std::string, int> tree;
+    tree.put(words[0], 0);
+
+    for (int idx = 1; idx < sz; idx++) {
+        auto &from = words[rand() % words.size()];
+        int i = rand() % from.size();
+        auto word = from.substr(i, rand() % (from.size() - i) + 1);
+        if (rand() % 4 == 0)
+            // only its prefix is in the tree
+            word += (char) (rand() % 4 + 'a');
+        words.push_back(word);
+
+        tree.put(words.back(), idx);
+        if (rand() % 3 == 0) {
+            // the same key again adds no node
+            auto nodes = tree.node_count();
+            tree.put(words.back(), idx);
+            assert(tree.node_count() == nodes);
+        }
+    }
+
+    for (auto &w: words)
+        for (int i = 0; i < w.size(); i++)
+            for (int j = 1; j <= w.size() - i; j++) {
+                auto query = w.substr(i, j);
+                std::set<int> expected;
+                for (int k = 0; k < words.size(); k++)
+                    if (words[k].find(query) != std::string::npos)
+                        expected.insert(k);
+                assert(tree.search(query) == expected);
+            }
+
+    auto nodes = tree.node_count();
+    for (auto &w: words) tree.put(w, sz);
+    assert(tree.node_count() == nodes);
+    assert(tree.search("a").count(sz));
+}
+
+void test_sharded() {
+    srand(time(nullptr));
+    int sz = 200;
+    int max_len = 30;
+    std::cout << "Configuration: " << sz << " strings, " << max_len
+              << " chars max. 4 lowercase letters, sharded trees compared with a single tree.\n";
+
+    std::vector<std::pair<std::string, int>> entries;
+    for (int idx = 0; idx < sz; idx++) {
+        std::string s;
+        for (int len = rand() % max_len + 1; len > 0; len--)
+            s += (char) (rand() % 4 + 'a');
+        entries.emplace_back(s, idx);
+    }
+
+    SuffixTree<std::string, int> tree;
+    for (auto &e: entries) tree.put(e.first, e.second);
+
+    ShardedSuffixTree<std::string, int> by_hash(4);
+    by_hash.put_batch(entries.begin(), entries.end());
+    ShardedSuffixTree<std::string, int> by_range(std::vector<int>{50, 100, 150});
+    for (auto &e: entries) by_range.put(e.first, e.second);
+
+    for (auto &e: entries) {
+        auto &s = e.first;
+        for (int i = 0; i < s.size(); i++)
+            for (int j = 1; j <= s.size() - i && j <= 5; j++) {
+                auto expected = tree.search(s.substr(i, j));
+                assert(by_hash.search(s.substr(i, j)) == expected);
+                assert(by_range.search(s.substr(i, j)) == expected);
+                assert(by_range.search(s.substr(i, j), 3).size() == std::min<size_t>(3, expected.size()));
+            }
+    }
+
+    size_t keys = 0;
+    for (auto &stats: by_hash.stats()) keys += stats.keys;
+    assert(keys == sz);
+    assert(by_range.stats()[0].keys == 50);
+
+    // the rest of the interface: streamed keys, two halves merged, batched searches
+    ShardedSuffixTree<std::string, int> streamed(4), second_half(4);
+    streamed.reserve(sz * max_len);
+    for (auto &e: entries) {
+        if (e.second % 2) {
+            second_half.put(e.first, e.second);
+            continue;
+        }
+        streamed.begin_put(e.second);
+        streamed.append(e.first.substr(0, e.first.size() / 2));
+        streamed.append(e.first.substr(e.first.size() / 2));
+        streamed.end_put();
+    }
+    streamed.merge(std::move(second_half));
+    assert(second_half.search("a").empty());
+
+    std::vector<std::string> words;
+    for (auto &e: entries) words.push_back(e.first.substr(0, 3));
+    auto batched = streamed.search_batch(words);
+    for (size_t i = 0; i < words.size(); i++) {
+        assert(batched[i] == tree.search(words[i]));
+        assert(streamed.search(words[i]) == batched[i]);
+    }
+
+    keys = 0;
+    for (auto &stats: streamed.stats()) keys += stats.keys;
+    assert(keys == sz);
+
+    streamed.clear();
+    assert(streamed.search("a").empty() && streamed.stats()[0].keys == 0);
+}
+
+void test_merge() {
+    srand(time(nullptr));
+    int sz = 100;
+    int max_len = 30;
+    int test = 10;
+    std::cout << "Configuration: " << sz << " strings, " << max_len
+              << " chars max. 4 lowercase letters, merged trees compared with a single tree.\n";
+
+    for (int t = 1; t <= test; t++) {
+        std::vector<std::string> words;
+        for (int idx = 0; idx < sz; idx++) {
+            words.emplace_back();
+            for (int len = rand() % max_len + 1; len > 0; len--)
+                words.back() += (char) (rand() % 4 + 'a');
+        }
+
+        SuffixTree<std::string, int> tree, main_part, delta;
+        for (int idx = 0; idx < sz; idx++) {
+            tree.put(words[idx], idx);
+            (idx % 3 ? main_part : delta).put(words[idx], idx);
+        }
+        main_part.merge(std::move(delta));
+        assert(delta.node_count() == 1);
+
+        // the merged tree keeps growing like any other
+        std::string extra = words[0] + words[1];
+        tree.put(extra, sz);
+        main_part.put(extra, sz);
+
+        for (auto &s: words)
+            for (int i = 0; i < s.size(); i++)
+                for (int j = 1; j <= s.size() - i; j++)
+                    assert(main_part.search(s.substr(i, j)) == tree.search(s.substr(i, j)));
+    }
+
+    // keys of other elements than bytes, which no q-gram table indexes
+    std::vector<std::list<int>> lists;
+    for (int idx = 0; idx < sz; idx++) {
+        lists.emplace_back();
+        for (int len = rand() % max_len + 1; len > 0; len--)
+            lists.back().push_back(rand() % 200);
+    }
+
+    SuffixTree<std::list<int>, int> tree, main_part, delta;
+    for (int idx = 0; idx < sz; idx++) {
+        tree.put(lists[idx], idx);
+        (idx % 2 ? main_part : delta).put(lists[idx], idx);
+    }
+    main_part.merge(std::move(delta));
+
+    for (auto &l: lists)
+        for (auto from = l.begin(); from != l.end(); ++from) {
+            auto to = from;
+            for (int j = 1; j <= 3 && to != l.end(); j++) {
+                std::list<int> word(from, ++to);
+                assert(main_part.search(word) == tree.search(word));
+            }
+        }
+}
+
+void test_fm_index() {
+    srand(time(nullptr));
+    int sz = 200;
+    int max_len = 50;
+    std::cout << "Configuration: " << sz << " strings, " << max_len
+              << " chars max. 4 lowercase letters, FM-index compared with a tree.\n";
+
+    std::vector<std::string> words;
+    for (int idx = 0; idx < sz; idx++) {
+        words.emplace_back();
+        for (int len = rand() % max_len + 1; len > 0; len--)
+            words.back() += (char) (rand() % 4 + 'a');
+    }
+
+    SuffixTree<std::string, int> tree;
+    FMIndex<std::string, int> index(8);
+    for (int idx = 0; idx < sz; idx++) {
+        tree.put(words[idx], idx);
+        index.put(words[idx], idx);
+        // build in two rounds, the second one extends the first
+        if (idx == sz / 2) index.build();
+    }
+    index.build();
+    assert(index.size() == sz);
+
+    for (auto &s: words)
+        for (int i = 0; i < s.size(); i++)
+            for (int j = 1; j <= s.size() - i && j <= 8; j++)
+                assert(index.search(s.substr(i, j)) == tree.search(s.substr(i, j)));
+    assert(index.search("abcde").empty());
+}
+
+void test_document_listing() {
+    srand(time(nullptr));
+    int sz = 300;
+    int max_len = 40;
+    std::cout << "Configuration: " << sz << " strings, " << max_len
+              << " chars max. 3 lowercase letters, document listing compared with subtree walks.\n";
+
+    std::vector<std::string> words;
+    words.reserve(sz + 1);
+    for (int idx = 0; idx < sz; idx++) {
+        words.emplace_back();
+        for (int len = rand() % max_len + 1; len > 0; len--)
+            words.back() += (char) (rand() % 3 + 'a');
+    }
+
+    SuffixTree<std::string, int> tree, listed;
+    for (int idx = 0; idx < sz; idx++) {
+        tree.put(words[idx], idx);
+        listed.put(words[idx], idx);
+    }
+    listed.build_document_listing();
+    assert(listed.has_document_listing());
+
+    for (auto &s: words)
+        for (int i = 0; i < s.size(); i++)
+            for (int j = 1; j <= s.size() - i && j <= 6; j++) {
+                auto word = s.substr(i, j);
+                auto all = tree.search(word);
+                assert(listed.search(word) == all);
+
+                auto some = listed.search(word, 5);
+                assert(some.size() == std::min<std::size_t>(5, all.size()));
+                for (auto &v: some)
+                    assert(all.count(v));
+            }
+
+    // any change drops the listing
+    words.push_back("abcabc");
+    listed.put(words.back(), sz);
+    tree.put(words.back(), sz);
+    assert(!listed.has_document_listing());
+    assert(listed.search("abc") == tree.search("abc"));
+}
+
+void test_optimized_layout() {
+    srand(time(nullptr));
+    int sz = 300;
+    int max_len = 40;
+    std::cout << "Configuration: " << sz << " strings, " << max_len
+              << " chars max. 4 lowercase letters, optimized layout compared with the tree.\n";
+
+    std::vector<std::string> words;
+    words.reserve(sz + 1);
+    for (int idx = 0; idx < sz; idx++) {
+        words.emplace_back();
+        for (int len = rand() % max_len + 1; len > 0; len--)
+            words.back() += (char) (rand() % 4 + 'a');
+    }
+
+    SuffixTree<std::string, int> tree, optimized;
+    for (int idx = 0; idx < sz; idx++) {
+        tree.put(words[idx], idx);
+        optimized.put(words[idx], idx);
+    }
+    optimized.optimize_layout();
+    assert(optimized.has_optimized_layout());
+
+    for (auto &s: words)
+        for (int i = 0; i < s.size(); i++)
+            for (int j = 1; j <= s.size() - i; j++) {
+                auto word = s.substr(i, j);
+                assert(optimized.search(word) == tree.search(word));
+                assert(optimized.search(word, 3) == tree.search(word, 3));
+            }
+    assert(optimized.search("abcde" + words[0]).empty());
+
+    // both modes together
+    optimized.build_document_listing();
+    for (int idx = 0; idx < sz; idx++)
+        assert(optimized.search(words[idx]) == tree.search(words[idx]));
+
+    // any change drops the layout
+    words.push_back("abcabc");
+    optimized.put(words.back(), sz);
+    tree.put(words.back(), sz);
+    assert(!optimized.has_optimized_layout());
+    assert(optimized.search("abc") == tree.search("abc"));
+}
+
+void test_streaming_put() {
+    srand(time(nullptr));
+    int sz = 200;
+    int max_len = 200;
+    std::cout << "Configuration: " << sz << " strings, " << max_len
+              << " chars max. 3 lowercase letters, keys streamed in chunks compared with whole keys.\n";
+
+    std::vector<std::string> words;
+    for (int idx = 0; idx < sz; idx++) {
+        words.emplace_back();
+        for (int len = rand() % max_len + 1; len > 0; len--)
+            words.back() += (char) (rand() % 3 + 'a');
+    }
+
+    SuffixTree<std::string, int> tree, streamed;
+    for (int idx = 0; idx < sz; idx++) {
+        tree.put(words[idx], idx);
+
+        streamed.begin_put(idx);
+        for (int from = 0; from < words[idx].size();) {
+            int len = rand() % 8 + 1;
+            // the chunk is destroyed right after being appended
+            streamed.append(words[idx].substr(from, len));
+            from += len;
+        }
+        streamed.end_put();
+    }
+    assert(streamed.node_count() == tree.node_count());
+
+    for (auto &s: words)
+        for (int i = 0; i < s.size(); i += 5)
+            for (int j = 1; j <= s.size() - i && j <= 20; j++)
+                assert(streamed.search(s.substr(i, j)) == tree.search(s.substr(i, j)));
+}
+
+template<typename T_ValueSetPolicy>
+void test_value_set_policy() {
+    int sz = 200;
+    int max_len = 30;
+
+    std::vector<std::string> words;
+    for (int idx = 0; idx < sz; idx++) {
+        words.emplace_back();
+        for (int len = rand() % max_len + 1; len > 0; len--)
+            words.back() += (char) (rand() % 3 + 'a');
+    }
+
+    SuffixTree<std::string, int, StdSetValues> tree;
+    SuffixTree<std::string, int, T_ValueSetPolicy> other, delta;
+    for (int idx = 0; idx < sz; idx++) {
+        // values out of order, and shared by several keys
+        int value = idx * 7 % sz / 2;
+        tree.put(words[idx], value);
+        (idx % 4 ? other : delta).put(words[idx], value);
+    }
+    other.merge(std::move(delta));
+
+    for (auto &s: words)
+        for (int i = 0; i < s.size(); i++)
+            for (int j = 1; j <= s.size() - i && j <= 6; j++)
+                assert(other.search(s.substr(i, j)) == tree.search(s.substr(i, j)));
+}
+
+void test_value_set_policies() {
+    srand(time(nullptr));
+    std::cout << "Configuration: 200 strings, 30 chars max. 3 lowercase letters, "
+                 "every value set policy compared with std::set.\n";
+
+    test_value_set_policy<InlineValues<>>();
+    test_value_set_policy<InlineValues<1>>();
+    test_value_set_policy<SortedVectorValues>();
+    test_value_set_policy<BitsetValues>();
+
+    // bitsets start as arrays and turn to a bit vector over their range once dense, growing it both ways
+    for (int range: {3, 100, 5000, 1000000}) {
+        BitsetValueSet<int> bits;
+        std::set<int> expected;
+        for (int i = 0; i < 300; i++) {
+            int value = range / 2 + (rand() % range - range / 2) * (i % 2 ? 1 : -1) / 2;
+            assert(bits.insert(value) == expected.insert(value).second);
+            assert(bits.size() == expected.size());
+            assert(std::equal(bits.begin(), bits.end(), expected.begin()));
+        }
+    }
+}
+
+void test_owned_keys() {
+    srand(time(nullptr));
+    int sz = 200;
+    int max_len = 30;
+    std::cout << "Configuration: " << sz << " strings, " << max_len
+              << " chars max. 3 lowercase letters, keys moved into the tree.\n";
+
+    std::vector<std::string> words;
+    for (int idx = 0; idx < sz; idx++) {
+        words.emplace_back();
+        for (int len = rand() % max_len + 1; len > 0; len--)
+            words.back() += (char) (rand() % 3 + 'a');
+    }
+
+    SuffixTree<std::string, int> tree, owning;
+    for (int idx = 0; idx < sz; idx++) {
+        tree.put(words[idx], idx);
+        // the temporary is destroyed right after put
+        owning.put(std::string(words[idx]), idx);
+    }
+
+    for (auto &s: words)
+        for (int i = 0; i < s.size(); i++)
+            for (int j = 1; j <= s.size() - i && j <= 6; j++)
+                assert(owning.search(s.substr(i, j)) == tree.search(s.substr(i, j)));
+
+    // the shards own the keys too, whether put one by one or in a batch
+    ShardedSuffixTree<std::string, int> sharded(4), sharded_batch(4);
+    std::vector<std::pair<std::string, int>> entries;
+    for (int idx = 0; idx < sz; idx++) {
+        sharded.put(std::string(words[idx]), idx);
+        entries.emplace_back(words[idx], idx);
+    }
+    sharded_batch.put_batch(std::move(entries));
+    entries.clear();
+    entries.shrink_to_fit();
+
+    for (auto &s: words)
+        for (int i = 0; i < s.size(); i++) {
+            auto expected = tree.search(s.substr(i, 3));
+            assert(sharded.search(s.substr(i, 3)) == expected);
+            assert(sharded_batch.search(s.substr(i, 3)) == expected);
+        }
+}
+
+void test_deep_tree() {
+    int len = 300000;
+    std::cout << "Configuration: one string of " << len << " equal chars, a tree as deep as the string.\n";
+
+    // every suffix of a^n ends on its own node, one below the other
+    std::string deep(len, 'a');
+    std::string other = std::string(1000, 'a') + "b";
+    SuffixTree<std::string, int> tree;
+    tree.put(deep, 0);
+    tree.put(other, 1);
+
+    // collecting the values walks the whole depth of the tree
+    assert(tree.search("a") == std::set<int>({0, 1}));
+    assert(tree.search("aab") == std::set<int>({1}));
+}
+
+void test_parallel_collection() {
+    srand(time(nullptr));
+    int sz = 500;
+    int max_len = 40;
+    std::cout << "Configuration: " << sz << " strings, " << max_len
+              << " chars max. 3 lowercase letters, parallel collection compared with a single thread.\n";
+
+    std::vector<std::string> words;
+    for (int idx = 0; idx < sz; idx++) {
+        words.emplace_back();
+        for (int len = rand() % max_len + 1; len > 0; len--)
+            words.back() += (char) (rand() % 3 + 'a');
+    }
+
+    SuffixTree<std::string, int> tree, parallel;
+    for (int idx = 0; idx < sz; idx++) {
+        tree.put(words[idx], idx);
+        parallel.put(words[idx], idx);
+    }
+    // a low threshold, so that most searches reach the workers
+    parallel.enable_parallel_collection(3, 8);
+
+    for (auto &s: words)
+        for (int i = 0; i < s.size(); i += 3)
+            for (int j = 1; j <= s.size() - i && j <= 4; j++)
+                assert(parallel.search(s.substr(i, j)) == tree.search(s.substr(i, j)));
+}
+
+void test_result_cache() {
+    std::cout << "Configuration: result cache of 2 entries, invalidated by put.\n";
+    std::string words[] = {"banana", "bandana", "cabana"};
+
+    SuffixTree<std::string, int> tree;
+    tree.enable_result_cache(2);
+    tree.put(words[0], 0);
+    tree.put(words[1], 1);
+
+    assert(tree.search("ana") == std::set<int>({0, 1}));
+    assert(tree.search("ana") == std::set<int>({0, 1}));
+    assert(tree.search("ana", 1).size() == 1);
+    auto stats = tree.result_cache_stats();
+    assert(stats.hits == 1 && stats.misses == 2 && stats.size == 2);
+
+    // evicts "ana" without count, the least recently used
+    assert(tree.search("nd") == std::set<int>({1}));
+    assert(tree.search("ana", 1).size() == 1);
+    stats = tree.result_cache_stats();
+    assert(stats.hits == 2 && stats.evictions == 1);
+
+    // a put makes every cached result stale
+    tree.put(words[2], 2);
+    assert(tree.search("ana") == std::set<int>({0, 1, 2}));
+    assert(tree.search("cab") == std::set<int>({2}));
+    stats = tree.result_cache_stats();
+    assert(stats.hits == 2 && stats.misses == 5 && stats.invalidations == 1);
+    assert(stats.hit_rate() > 0.28 && stats.hit_rate() < 0.29);
+
+    tree.disable_result_cache();
+    assert(tree.result_cache_stats().misses == 0);
+    assert(tree.search("ana") == std::set<int>({0, 1, 2}));
+}
+
+void test_alphabet() {
+    srand(time(nullptr));
+    int sz = 200;
+    int max_len = 50;
+    std::cout << "Configuration: " << sz << " vectors of objects, " << max_len
+              << " objects max. 20 distinct objects, alphabet tree compared with a plain one.\n";
+
+    struct Obj {
+        int x, y;
+
+        bool operator<(const Obj &other) const { return x != other.x ? x < other.x : y < other.y; }
+    };
+
+    std::vector<std::vector<Obj>> words;
+    SuffixTree<std::vector<Obj>, int> tree;
+    AlphabetSuffixTree<std::vector<Obj>, int> encoded;
+    for (int idx = 0; idx < sz; idx++) {
+        words.emplace_back();
+        for (int len = rand() % max_len + 1; len > 0; len--)
+            words.back().push_back({rand() % 4, rand() % 5});
+        tree.put(words.back(), idx);
+        encoded.put(words.back(), idx);
+    }
+    assert(encoded.alphabet().size() <= 20);
+    assert(encoded.tree().node_count() == tree.node_count());
+
+    for (auto &s: words)
+        for (int i = 0; i < s.size(); i += 5)
+            for (int j = 1; j <= s.size() - i && j <= 8; j++) {
+                std::vector<Obj> word(s.begin() + i, s.begin() + i + j);
+                auto all = tree.search(word);
+                assert(encoded.search(word) == all);
+
+                // codes don't sort like the objects, so a count may pick other values
+                auto some = encoded.search(word, 2);
+                assert(some.size() == std::min<size_t>(all.size(), 2));
+                assert(std::includes(all.begin(), all.end(), some.begin(), some.end()));
+            }
+
+    // an object that is in no key
+    std::vector<Obj> unknown{words[0][0], {9, 9}};
+    assert(encoded.search(unknown).empty());
+    Symbol code;
+    assert(encoded.alphabet().find(words[0][0], code));
+    assert(!(encoded.alphabet().decode(code) < words[0][0]) && !(words[0][0] < encoded.alphabet().decode(code)));
+}
+
+void test_reuse() {
+    srand(time(nullptr));
+    int sz = 150;
+    int max_len = 40;
+    int rounds = 4;
+    std::cout << "Configuration: " << rounds << " rebuilds of " << sz << " strings, " << max_len
+              << " chars max, in one reserved tree cleared in between.\n";
+
+    SuffixTree<std::string, int> tree;
+    tree.reserve(sz * max_len);
+    const auto capacity = tree.node_capacity();
+    assert(capacity >= 2 * sz * max_len);
+
+    for (int round = 0; round < rounds; round++) {
+        std::vector<std::string> words;
+        // the tree keeps iterators into the keys, they must not move
+        words.reserve(sz);
+        size_t elements = 0;
+        for (int idx = 0; idx < sz; idx++) {
+            std::string s;
+            for (int len = rand() % max_len + 1; len > 0; len--)
+                s += (char) (rand() % (round + 2) + 'a');
+            words.push_back(s);
+            elements += s.size();
+            // half of the keys owned by the tree, dropped by clear
+            if (idx % 2)
+                tree.put(std::string(s), idx);
+            else
+                tree.put(words.back(), idx);
+        }
+        // storage of previous rounds is reused, never grown
+        assert(tree.node_capacity() == capacity);
+        assert(tree.node_count() <= 2 * elements);
+
+        for (int k = 0; k < 50; k++) {
+            auto &w = words[rand() % sz];
+            int i = rand() % w.size();
+            auto query = w.substr(i, rand() % (w.size() - i) + 1);
+            std::set<int> expected;
+            for (int idx = 0; idx < sz; idx++)
+                if (words[idx].find(query) != std::string::npos)
+                    expected.insert(idx);
+            assert(tree.search(query) == expected);
+        }
+
+        // words of this round are freed before the next one, the tree must not refer to them anymore
+        tree.clear();
+        assert(tree.node_count() == 1);
+        assert(tree.edge_count() == 0);
+        assert(tree.search("a").empty());
+    }
+}
+
+void test_boolean_queries() {
+    srand(time(nullptr));
+    int sz = 300;
+    int max_len = 30;
+    std::cout << "Configuration: " << sz << " strings, " << max_len
+              << " chars max. 4 lowercase letters, queries of several words compared with a naive scan.\n";
+
+    std::vector<std::string> words;
+    for (int idx = 0; idx < sz; idx++) {
+        std::string s;
+        for (int len = rand() % max_len + 1; len > 0; len--)
+            s += (char) (rand() % 4 + 'a');
+        words.push_back(s);
+    }
+
+    SuffixTree<std::string, int> tree;
+    ShardedSuffixTree<std::string, int> sharded(3);
+    for (int idx = 0; idx < sz; idx++) {
+        tree.put(words[idx], idx);
+        sharded.put(words[idx], idx);
+    }
+
+    auto random_word = [&words]() {
+        auto &w = words[rand() % words.size()];
+        int i = rand() % w.size();
+        auto word = w.substr(i, rand() % std::min<size_t>(w.size() - i, 5) + 1);
+        if (rand() % 8 == 0)
+            // most likely in no key
+            word += "dddddd";
+        return word;
+    };
+    auto contains = [&words](int idx, const std::vector<std::string> &query) {
+        std::vector<bool> found;
+        for (auto &q: query) found.push_back(words[idx].find(q) != std::string::npos);
+        return found;
+    };
+
+    for (int mode = 0; mode < 3; mode++) {
+        if (mode == 1)
+            tree.build_document_listing();
+        if (mode == 2)
+            tree.optimize_layout();
+
+        for (int k = 0; k < 300; k++) {
+            std::vector<std::string> included, excluded;
+            for (int n = rand() % 3 + 1; n > 0; n--) included.push_back(random_word());
+            for (int n = rand() % 3; n > 0; n--) excluded.push_back(random_word());
+
+            std::set<int> all, any;
+            for (int idx = 0; idx < sz; idx++) {
+                auto in = contains(idx, included);
+                auto out = contains(idx, excluded);
+                if (std::find(out.begin(), out.end(), true) != out.end())
+                    continue;
+                if (std::find(in.begin(), in.end(), false) == in.end())
+                    all.insert(idx);
+                if (std::find(in.begin(), in.end(), true) != in.end())
+                    any.insert(idx);
+            }
+
+            assert(tree.search_all(included, excluded) == all);
+            assert(tree.search_any(included, excluded) == any);
+            if (mode == 0) {
+                assert(sharded.search_all(included, excluded) == all);
+                assert(sharded.search_any(included, excluded) == any);
+            }
+        }
+    }
+
+    assert(tree.search_all({}).empty());
+    assert(tree.search_any({}).empty());
+    assert(tree.search_all({"a", "b"}) == tree.search_all({"b", "a"}));
+}
+
+void test_repeats() {
+    srand(time(nullptr));
+    int sz = 60;
+    int max_len = 25;
+    std::cout << "Configuration: " << sz << " strings, " << max_len
+              << " chars max. 3 lowercase letters, repeats compared with a naive count.\n";
+
+    std::vector<std::string> words;
+    for (int idx = 0; idx < sz; idx++) {
+        words.emplace_back();
+        for (int len = rand() % max_len + 1; len > 0; len--)
+            words.back() += (char) (rand() % 3 + 'a');
+    }
+
+    SuffixTree<std::string, int> tree, parallel;
+    for (int idx = 0; idx < sz; idx++) {
+        tree.put(words[idx], idx);
+        parallel.put(words[idx], idx);
+    }
+    parallel.enable_parallel_collection(3);
+
+    // occurrences and keys of every substring
+    std::map<std::string, int> occurrences, frequency;
+    for (auto &w: words) {
+        std::set<std::string> seen;
+        for (int i = 0; i < w.size(); i++)
+            for (int j = 1; j <= w.size() - i; j++) {
+                occurrences[w.substr(i, j)]++;
+                seen.insert(w.substr(i, j));
+            }
+        for (auto &sub: seen) frequency[sub]++;
+    }
+    auto count = [&occurrences](const std::string &s) {
+        auto it = occurrences.find(s);
+        return it == occurrences.end() ? 0 : it->second;
+    };
+    const std::string letters = "abc";
+
+    std::set<std::string> maximal, supermaximal;
+    for (auto &p: occurrences) {
+        if (p.second < 2) continue;
+        bool left = true, right = true, super = true;
+        for (auto c: letters) {
+            auto before = count(c + p.first), after = count(p.first + c);
+            left = left && before < p.second;
+            right = right && after < p.second;
+            super = super && before < 2 && after < 2;
+        }
+        if (left && right) maximal.insert(p.first);
+        if (super) supermaximal.insert(p.first);
+    }
+
+    for (auto *t: {&tree, &parallel}) {
+        std::set<std::string> found;
+        for (auto &r: t->maximal_repeats()) {
+            assert(r.length == r.text.size());
+            assert(r.occurrences == count(r.text));
+            assert(r.frequency == frequency[r.text]);
+            found.insert(r.text);
+        }
+        assert(found == maximal);
+
+        found.clear();
+        for (auto &r: t->supermaximal_repeats()) found.insert(r.text);
+        assert(found == supermaximal);
+
+        found.clear();
+        for (auto &r: t->maximal_repeats(3, 4)) {
+            assert(r.length >= 3 && r.occurrences >= 4);
+            found.insert(r.text);
+        }
+        for (auto &m: maximal)
+            assert(found.count(m) == (m.size() >= 3 && count(m) >= 4));
+
+        // the most frequent substrings of at least 2 chars, the longest of each edge
+        int k = 10;
+        auto top = t->frequent_repeats(k, 2);
+        assert(top.size() == k);
+        std::vector<int> counts;
+        for (auto &p: frequency)
+            if (p.first.size() >= 2) counts.push_back(p.second);
+        std::sort(counts.rbegin(), counts.rend());
+        for (int i = 0; i < k; i++) {
+            assert(top[i].length >= 2);
+            assert(top[i].frequency == frequency[top[i].text]);
+            assert(i == 0 || top[i].frequency <= top[i - 1].frequency);
+        }
+        assert(top[0].frequency == counts[0]);
+    }
+}
+
+void test_overlaps() {
+    srand(time(nullptr));
+    int sz = 80;
+    int max_len = 20;
+    int min_len = 3;
+    std::cout << "Configuration: " << sz << " strings, " << max_len
+              << " chars max. 2 lowercase letters, overlaps of at least " << min_len << " chars compared with a naive scan.\n";
+
+    std::vector<std::string> words;
+    for (int idx = 0; idx < sz; idx++) {
+        words.emplace_back();
+        for (int len = rand() % max_len + 1; len > 0; len--)
+            words.back() += (char) (rand() % 2 + 'a');
+    }
+
+    SuffixTree<std::string, int> tree;
+    for (int idx = 0; idx < sz; idx++)
+        tree.put(words[idx], idx);
+
+    std::map<std::pair<int, int>, size_t> expected, found;
+    for (int from = 0; from < sz; from++)
+        for (int to = 0; to < sz; to++) {
+            if (from == to) continue;
+            auto &a = words[from], &b = words[to];
+            for (auto length = std::min(a.size(), b.size()); length >= min_len; length--)
+                if (a.compare(a.size() - length, length, b, 0, length) == 0) {
+                    expected[std::make_pair(from, to)] = length;
+                    break;
+                }
+        }
+
+    tree.overlaps(min_len, [&found](int from, int to, size_t length) {
+        // every pair once
+        assert(found.insert(std::make_pair(std::make_pair(from, to), length)).second);
+    });
+    assert(found == expected);
+
+    size_t count = 0;
+    tree.overlaps(max_len + 1, [&count](int, int, size_t) { count++; });
+    assert(count == 0);
+}
+
+void test_window() {
+    srand(time(nullptr));
+    int sz = 600;
+    int window = 100;
+    int max_len = 20;
+    std::cout << "Configuration: " << sz << " strings, " << max_len << " chars max, a window of the last " << window
+              << " in generations of 16, compared with a naive scan.\n";
+
+    std::vector<std::string> words;
+    // the tree keeps iterators into the keys, they must not move
+    words.reserve(sz);
+    WindowedSuffixTree<std::string, int> tree(16);
+
+    for (int idx = 0; idx < sz; idx++) {
+        words.emplace_back();
+        for (int len = rand() % max_len + 1; len > 0; len--)
+            words.back() += (char) (rand() % 3 + 'a');
+        if (idx % 2)
+            tree.put(words.back(), idx);
+        else
+            tree.put(std::string(words.back()), idx);
+
+        if (idx % 7 == 0 && idx >= window)
+            tree.expire_before(idx - window);
+        if (idx % 25)
+            continue;
+
+        // generations of expired keys only are dropped
+        assert(tree.generation_count() <= window / 16 + 3);
+        // as of the last expiry
+        const int oldest = std::max(idx / 7 * 7 - window, 0);
+
+        for (int k = 0; k < 30; k++) {
+            auto &w = words[oldest + rand() % (idx + 1 - oldest)];
+            int i = rand() % w.size();
+            auto query = w.substr(i, rand() % (w.size() - i) + 1);
+            std::set<int> expected;
+            for (int v = oldest; v <= idx; v++)
+                if (words[v].find(query) != std::string::npos)
+                    expected.insert(v);
+            assert(tree.search(query) == expected);
+
+            auto some = tree.search(query, 3);
+            assert(some.size() == std::min<size_t>(3, expected.size()));
+            for (auto v: some) assert(expected.count(v));
+        }
+    }
+
+    tree.expire_before(sz);
+    assert(tree.generation_count() == 0);
+    assert(tree.search("a").empty());
+}
+
+void test_short_queries() {
+    srand(time(nullptr));
+    int sz = 300;
+    int max_len = 30;
+    std::cout << "Configuration: " << sz << " strings, " << max_len
+              << " chars max. 4 lowercase letters, q-gram tables compared with a plain tree.\n";
+
+    std::vector<std::string> words;
+    for (int idx = 0; idx < sz; idx++) {
+        words.emplace_back();
+        for (int len = rand() % max_len + 1; len > 0; len--)
+            words.back() += (char) (rand() % 4 + 'a');
+    }
+
+    // filled by put from the start, filled from the tree, and kept up by streamed puts and merges
+    SuffixTree<std::string, int> tree, incremental, late, streamed, merged, half, both, half_table;
+    incremental.enable_short_queries(3);
+    streamed.enable_short_queries(2);
+    merged.enable_short_queries(3);
+    // the table of a merged tree is added to the other's as it is
+    both.enable_short_queries(3);
+    half_table.enable_short_queries(3);
+    for (int idx = 0; idx < sz; idx++) {
+        tree.put(words[idx], idx);
+        incremental.put(words[idx], idx);
+        late.put(words[idx], idx);
+
+        auto &w = words[idx];
+        streamed.begin_put(idx);
+        streamed.append(w.begin(), w.begin() + w.size() / 2);
+        streamed.append(w.begin() + w.size() / 2, w.end());
+        streamed.end_put();
+
+        if (idx % 2)
+            merged.put(words[idx], idx);
+        else
+            half.put(words[idx], idx);
+        (idx % 3 ? both : half_table).put(words[idx], idx);
+    }
+    late.enable_short_queries(3);
+    merged.merge(std::move(half));
+    both.merge(std::move(half_table));
+
+    std::set<std::string> queries{"", "e", "ae", "aae", "abcd", "dcba"};
+    for (auto &w: words)
+        for (int i = 0; i < w.size(); i++)
+            for (int j = 1; j <= 4 && j <= w.size() - i; j++)
+                queries.insert(w.substr(i, j));
+
+    for (auto &query: queries) {
+        auto expected = tree.search(query);
+        assert(incremental.search(query) == expected);
+        assert(late.search(query) == expected);
+        assert(streamed.search(query) == expected);
+        assert(merged.search(query) == expected);
+        assert(both.search(query) == expected);
+        assert(half_table.search(query).empty());
+
+        auto some = late.search(query, 2);
+        assert(some.size() == std::min<size_t>(2, expected.size()));
+        for (auto v: some) assert(expected.count(v));
+    }
+
+    late.clear();
+    assert(late.search("a").empty());
+    late.put(words[0], 0);
+    assert(late.search(words[0].substr(0, 1)) == std::set<int>{0});
+}
+
+void test_search_batch() {
+    srand(time(nullptr));
+    int sz = 300;
+    int max_len = 30;
+    std::cout << "Configuration: " << sz << " strings, " << max_len
+              << " chars max. 4 lowercase letters, batched searches compared with single ones.\n";
+
+    std::vector<std::string> words;
+    for (int idx = 0; idx < sz; idx++) {
+        words.emplace_back();
+        for (int len = rand() % max_len + 1; len > 0; len--)
+            words.back() += (char) (rand() % 4 + 'a');
+    }
+
+    SuffixTree<std::string, int> tree;
+    for (int idx = 0; idx < sz; idx++)
+        tree.put(words[idx], idx);
+    std::list<int> first(words[0].begin(), words[0].end());
+    SuffixTree<std::list<int>, int> list_tree;
+    list_tree.put(first, 0);
+
+    std::vector<std::string> queries{"", "e", "abcdabcdabcd"};
+    for (int k = 0; k < 500; k++) {
+        auto &w = words[rand() % sz];
+        int i = rand() % w.size();
+        auto query = w.substr(i, rand() % (w.size() - i) + 1);
+        if (rand() % 5 == 0)
+            query += "ab";
+        queries.push_back(query);
+    }
+
+    for (int mode = 0; mode < 3; mode++) {
+        if (mode == 1)
+            tree.build_document_listing();
+        if (mode == 2)
+            tree.enable_short_queries(2);
+
+        for (size_t width: {1, 3, 16, 1000}) {
+            auto results = tree.search_batch(queries, -1, width);
+            assert(results.size() == queries.size());
+            for (size_t i = 0; i < queries.size(); i++)
+                assert(results[i] == tree.search(queries[i]));
+
+            auto some = tree.search_batch(queries, 2, width);
+            for (size_t i = 0; i < queries.size(); i++) {
+                assert(some[i].size() == std::min<size_t>(2, results[i].size()));
+                for (auto v: some[i]) assert(results[i].count(v));
+            }
+        }
+    }
+
+    // with the result cache, the misses are interleaved then cached, and the hits answered from the cache
+    SuffixTree<std::string, int> cached;
+    for (int idx = 0; idx < sz; idx++)
+        cached.put(words[idx], idx);
+    cached.enable_result_cache(1000);
+    for (int round = 0; round < 3; round++) {
+        if (round == 2) {
+            tree.put("abcdabcdabcd", sz);
+            cached.put("abcdabcdabcd", sz);
+        }
+        auto results = cached.search_batch(queries, -1, 16);
+        for (size_t i = 0; i < queries.size(); i++)
+            assert(results[i] == tree.search(queries[i]));
+        if (round == 0)
+            assert(cached.result_cache_stats().hits == 0);
+        if (round == 1)
+            assert(cached.result_cache_stats().hits >= queries.size());
+    }
+    assert(cached.search_batch(queries, -1, 16)[2].count(sz));
+
+    std::vector<std::list<int>> list_queries;
+    for (int i = 0; i < words[0].size(); i++)
+        list_queries.emplace_back(std::next(first.begin(), i), first.end());
+    for (auto &result: list_tree.search_batch(list_queries))
+        assert(result == std::set<int>{0});
+}
+
 int main() {
-    //test_speed();
     test_correctness();
     test_correctness_vec();
     test_correctness_vec_custom_obj();
     test_correctness_list();
+    test_exact_results();
+    test_contained_keys();
+    test_sharded();
+    test_merge();
+    test_fm_index();
+    test_document_listing();
+    test_optimized_layout();
+    test_streaming_put();
+    test_value_set_policies();
+    test_owned_keys();
+    test_deep_tree();
+    test_parallel_collection();
+    test_result_cache();
+    test_alphabet();
+    test_reuse();
+    test_boolean_queries();
+    test_repeats();
+    test_overlaps();
+    test_window();
+    test_short_queries();
+    test_search_batch();
 
     SuffixTree<std::string, int> tree;
     std::string words[] = {"qwe", "rtyr", "uio", "pas", "dfg", "hjk", "lzx", "cvb", "bnm"};
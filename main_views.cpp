@@ -0,0 +1,94 @@
+/**
+ * Tests of the keys that need a later standard than the tree itself: std::string_view (C++17) and std::span (C++20).
+ * Built as its own executable with the latest standard the compiler has, see CMakeLists.txt.
+ */
+
+#include <iostream>
+#include <cstdlib>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include "SuffixTree.h"
+
+#if __cplusplus < 201703L
+#error "main_views.cpp needs C++17 or later"
+#endif
+
+void test_string_view_keys() {
+    srand(time(nullptr));
+    int sz = 200;
+    int max_len = 30;
+    std::cout << "Configuration: " << sz << " strings, " << max_len
+              << " chars max. 3 lowercase letters, string_view keys compared with string keys.\n";
+
+    std::vector<std::string> words;
+    for (int idx = 0; idx < sz; idx++) {
+        words.emplace_back();
+        for (int len = rand() % max_len + 1; len > 0; len--)
+            words.back() += (char) (rand() % 3 + 'a');
+    }
+
+    SuffixTree<std::string, int> tree;
+    // views are keys too, stored as they are even when given as temporaries: the viewed strings must outlive the tree
+    SuffixTree<std::string_view, int> views, merged, half;
+    ShardedSuffixTree<std::string_view, int> sharded(4);
+    for (int idx = 0; idx < sz; idx++) {
+        tree.put(words[idx], idx);
+        views.put(std::string_view(words[idx]), idx);
+        (idx % 2 ? merged : half).put(std::string_view(words[idx]), idx);
+        sharded.put(std::string_view(words[idx]), idx);
+    }
+    merged.merge(std::move(half));
+
+    for (auto &s: words)
+        for (int i = 0; i < s.size(); i++)
+            for (int j = 1; j <= s.size() - i && j <= 4; j++) {
+                auto word = std::string_view(s).substr(i, j);
+                auto expected = tree.search(s.substr(i, j));
+                assert(views.search(word) == expected);
+                assert(merged.search(word) == expected);
+                assert(sharded.search(word) == expected);
+            }
+}
+
+#if defined(__cpp_lib_span)
+
+void test_span_keys() {
+    srand(time(nullptr));
+    int sz = 200;
+    int max_len = 30;
+    std::cout << "Configuration: " << sz << " lists, " << max_len
+              << " ints max. 5 values, span keys compared with vector keys.\n";
+
+    std::vector<std::vector<int>> lists;
+    for (int idx = 0; idx < sz; idx++) {
+        lists.emplace_back();
+        for (int len = rand() % max_len + 1; len > 0; len--)
+            lists.back().push_back(rand() % 5);
+    }
+
+    SuffixTree<std::vector<int>, int> tree;
+    SuffixTree<std::span<const int>, int> spans;
+    for (int idx = 0; idx < sz; idx++) {
+        tree.put(lists[idx], idx);
+        spans.put(std::span<const int>(lists[idx]), idx);
+    }
+
+    for (auto &l: lists)
+        for (int i = 0; i < l.size(); i++)
+            for (int j = 1; j <= l.size() - i && j <= 4; j++)
+                assert(spans.search(std::span<const int>(l).subspan(i, j)) ==
+                       tree.search(std::vector<int>(l.begin() + i, l.begin() + i + j)));
+}
+
+#endif
+
+int main() {
+    test_string_view_keys();
+#if defined(__cpp_lib_span)
+    test_span_keys();
+#else
+    std::cout << "No std::span before C++20, span keys not tested.\n";
+#endif
+}